@@ -7,18 +7,53 @@
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "gpuresource.h"
+#include "instancing.h"
+#include "frustum.h"
+#include "renderscheduler.h"
+#include "framebuffer.h"
+#include "occlusion.h"
+#include "glfeatures.h"
+#include "gpuculling.h"
+#include "pipelinestats.h"
+#include "glbackend.h"
+#include "glstate.h"
+#include "jobsystem.h"
+#include "softwarerenderer.h"
+#include "texturecache.h"
+#include "texturestreamer.h"
+#include "pagefile.h"
+#include "virtualtexture.h"
+#include "chunkfile.h"
+#include "pointfile.h"
 #include <assimp/Importer.hpp>
-#include <stb_image/stb_image_write.h>;
 #include <tinyfiledialogs.h>
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <thread>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
+void mouse_button_callback(GLFWwindow* window, int button, int action,
+                           int mods);
 void shortcut_callback(GLFWwindow* window, int key, int scancode, int action,
                        int mods);
 void drop_callback(GLFWwindow* window, int count, const char** paths);
+void refresh_callback(GLFWwindow* window);
 void processMovement(GLFWwindow * window);
+bool movementKeyHeld(GLFWwindow* window);
+void renderScene(Shader &shader);
 void exportImage(const std::string &name);
+void replaceModel(const std::string &path);
+void layoutInstances();
+glm::mat4 projectionMatrix();
+void pickCenter();
+RenderView orbitView(unsigned int frame, unsigned int frames);
+void runBatch(RenderBackend &backend, SoftwareRenderer* software);
 
 unsigned int WIDTH = 1000;
 unsigned int HEIGHT = 700;
@@ -32,19 +67,254 @@ float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
 bool wireframeMode = false;
+float lodPixelError = 1.0f;
+
+// only renders when something changed, keeps the last frame for exposes
+RenderScheduler scheduler;
+SceneFramebuffer sceneFramebuffer;
 
 Model* mainModel;
+ImportOptions importOptions;
+
+// copies of the model for layout reviews, 0 draws the model once
+unsigned int instanceCount = 0;
+InstanceSet instances;
+// the copies are drawn, chunk and point files page in a single placement
+bool instanced = false;
+
+// hides meshes behind large occluders rasterized on the cpu
+bool occlusionCulling = false;
+OcclusionBuffer occlusionBuffer;
+
+// culls and draws the model with compute shaders on gl 4.3 contexts
+bool gpuCullingRequested = false;
+GpuCulling gpuCulling;
+
+// lays down the depth of the sorted meshes before shading them, toggled
+// with 'p' to compare the frames in the report
+bool depthPrepass = false;
+Shader* depthShader = nullptr;
+PipelineStatistics pipelineStatistics;
+
+// draws the meshes whose diffuse texture went into a texture array
+Shader* arrayShader = nullptr;
+
+// bytes of texture data handed to gl per frame, 0 loads the textures
+// with the model instead of streaming them
+size_t uploadBudget = 0;
+// streamed textures start with their small levels, the finer ones follow
+// the size on screen
+bool mipResidency = false;
+
+// diffuse textures with a page file next to them are drawn through a page
+// cache of this size, 0 turns virtual texturing off
+size_t pageCacheBytes = 0;
+Shader* virtualShader = nullptr;
+Shader* feedbackShader = nullptr;
+// image and page file of --build-pages
+std::string pageSource;
+std::string pagePath;
+// model and chunk file of --build-chunks
+std::string chunkSource;
+std::string chunkPath;
+// scan and point file of --build-points
+std::string pointSource;
+std::string pointPath;
+
+// encodes and decodes test images in every block format and exits
+bool checkCompression = false;
+
+// draws on the cpu without a window or any gl context
+bool softwareRendering = false;
+// frames timed on a camera orbit, then the viewer exits
+unsigned int benchmarkFrames = 0;
+// png of the first orbit frame written without opening the viewer
+std::string exportPath;
+
+// start of the process, the time to the first frame is printed from it
+std::chrono::steady_clock::time_point launchTime;
+
+int main(int argc, char** argv) {
+  launchTime = std::chrono::steady_clock::now();
+  // command line options
+  std::string modelPath = "res/nanosuit/nanosuit.obj";
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc)
+      GpuRegistry::get().setBudget(
+          (size_t)std::strtoul(argv[++i], nullptr, 10) << 20);
+    else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      if (!parseImportProfile(argv[++i], importOptions.profile))
+        std::cout << "unknown import profile: " << argv[i] << std::endl;
+    }
+    else if (std::strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+      instanceCount = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+    else if (std::strcmp(argv[i], "--lod") == 0 && i + 1 < argc) {
+      if (!parseLodMode(argv[++i], importOptions.lod))
+        std::cout << "unknown lod mode: " << argv[i] << std::endl;
+    }
+    else if (std::strcmp(argv[i], "--gpu-culling") == 0)
+      gpuCullingRequested = true;
+    else if (std::strcmp(argv[i], "--depth-prepass") == 0)
+      depthPrepass = true;
+    else if (std::strcmp(argv[i], "--texture-arrays") == 0)
+      importOptions.textureArrays = true;
+    else if (std::strcmp(argv[i], "--mips") == 0 && i + 1 < argc) {
+      importOptions.cpuMips = std::strcmp(argv[++i], "gpu") != 0;
+      if (importOptions.cpuMips &&
+          !parseMipFilter(argv[i], importOptions.mipFilter)) {
+        std::cout << "unknown mip filter: " << argv[i] << std::endl;
+        importOptions.cpuMips = false;
+      }
+    }
+    else if (std::strcmp(argv[i], "--stream-textures") == 0)
+      uploadBudget = std::max<size_t>(uploadBudget, 16 << 20);
+    else if (std::strcmp(argv[i], "--stream-mips") == 0) {
+      uploadBudget = std::max<size_t>(uploadBudget, 16 << 20);
+      mipResidency = true;
+    }
+    else if (std::strcmp(argv[i], "--upload-budget") == 0 && i + 1 < argc)
+      uploadBudget = std::max<size_t>(
+          std::strtoul(argv[++i], nullptr, 10) << 20, 1);
+    else if (std::strcmp(argv[i], "--virtual-textures") == 0)
+      pageCacheBytes = std::max<size_t>(pageCacheBytes, 64 << 20);
+    else if (std::strcmp(argv[i], "--page-cache") == 0 && i + 1 < argc)
+      pageCacheBytes = std::max<size_t>(
+          std::strtoul(argv[++i], nullptr, 10) << 20, 1);
+    else if (std::strcmp(argv[i], "--build-pages") == 0 && i + 2 < argc) {
+      pageSource = argv[++i];
+      pagePath = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--build-chunks") == 0 && i + 2 < argc) {
+      chunkSource = argv[++i];
+      chunkPath = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--chunk-budget") == 0 && i + 1 < argc)
+      importOptions.chunkBudget = std::max<size_t>(
+          std::strtoul(argv[++i], nullptr, 10) << 20, 1);
+    else if (std::strcmp(argv[i], "--chunk-memory") == 0 && i + 1 < argc)
+      importOptions.chunkMemory = std::max<size_t>(
+          std::strtoul(argv[++i], nullptr, 10) << 20, 1);
+    else if (std::strcmp(argv[i], "--build-points") == 0 && i + 2 < argc) {
+      pointSource = argv[++i];
+      pointPath = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--point-budget") == 0 && i + 1 < argc)
+      importOptions.pointBudget = std::max<size_t>(
+          (size_t)(std::strtod(argv[++i], nullptr) * 1e6), 1);
+    else if (std::strcmp(argv[i], "--assimp-meshes") == 0)
+      importOptions.nativeMeshes = false;
+    else if (std::strcmp(argv[i], "--crease-angle") == 0 && i + 1 < argc)
+      importOptions.creaseAngle = std::strtof(argv[++i], nullptr);
+    else if (std::strcmp(argv[i], "--compress-textures") == 0)
+      TextureCache::get().setDirectory("texture-cache");
+    else if (std::strcmp(argv[i], "--check-compression") == 0)
+      checkCompression = true;
+    else if (std::strcmp(argv[i], "--texture-cache") == 0 && i + 1 < argc)
+      TextureCache::get().setDirectory(argv[++i]);
+    else if (std::strcmp(argv[i], "--occlusion") == 0)
+      occlusionCulling = true;
+    else if (std::strcmp(argv[i], "--clusters") == 0)
+      importOptions.clusters = true;
+    else if (std::strcmp(argv[i], "--no-picking") == 0)
+      importOptions.picking = false;
+    else if (std::strcmp(argv[i], "--ao") == 0)
+      importOptions.ambientOcclusion = true;
+    else if (std::strcmp(argv[i], "--ao-samples") == 0 && i + 1 < argc)
+      importOptions.aoSamples =
+          (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+    else if (std::strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+      lodPixelError = std::strtof(argv[++i], nullptr);
+    else if (std::strcmp(argv[i], "--frame-cap") == 0 && i + 1 < argc)
+      scheduler.setFrameCap(std::strtod(argv[++i], nullptr));
+    else if (std::strcmp(argv[i], "--continuous") == 0)
+      scheduler.setContinuous(true);
+    else if (std::strcmp(argv[i], "--import-report") == 0)
+      importOptions.report = true;
+    else if (std::strcmp(argv[i], "--software") == 0)
+      softwareRendering = true;
+    else if (std::strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+      benchmarkFrames = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+    else if (std::strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+      exportPath = argv[++i];
+    else if (argv[i][0] != '-')
+      modelPath = argv[i];
+    else
+      std::cout << "unknown option: " << argv[i] << std::endl;
+  }
+
+  if (checkCompression)
+    return checkBlockCompression(std::cout) ? 0 : -1;
+  // cuts the image into a page file for --virtual-textures and exits
+  if (!pageSource.empty()) {
+    PageBuildStats stats;
+    std::string error;
+    if (!buildPageFile(pageSource, pagePath, stats, error)) {
+      std::cout << "Couldn't build page file: " << error << std::endl;
+      return -1;
+    }
+    stats.print(std::cout);
+    return 0;
+  }
+  // partitions the model into a chunk file for the pager and exits
+  if (!chunkSource.empty()) {
+    ChunkBuildStats stats;
+    std::string error;
+    if (!buildChunkFile(chunkSource, chunkPath, stats, error)) {
+      std::cout << "Couldn't build chunk file: " << error << std::endl;
+      return -1;
+    }
+    stats.print(std::cout);
+    return 0;
+  }
+  // sorts the scan into a point file for the pager and exits
+  if (!pointSource.empty()) {
+    PointBuildStats stats;
+    std::string error;
+    if (!buildPointFile(pointSource, pointPath, stats, error)) {
+      std::cout << "Couldn't build point file: " << error << std::endl;
+      return -1;
+    }
+    stats.print(std::cout);
+    return 0;
+  }
+
+  // the software renderer keeps no gpu copies and draws every triangle,
+  // so the levels of detail and clusters are left out
+  if (softwareRendering) {
+    importOptions.gpu = false;
+    importOptions.lod = LOD_OFF;
+    importOptions.clusters = false;
+    if (benchmarkFrames == 0 && exportPath.empty())
+      exportPath = "open-model-viewer.png";
+    mainModel = new Model(modelPath, importOptions);
+    SoftwareRenderer software;
+    runBatch(software, &software);
+    delete mainModel;
+    return 0;
+  }
+  // the compute shaders only know the 2d textures of the meshes
+  if (importOptions.textureArrays && gpuCullingRequested) {
+    std::cout << "--gpu-culling is off with --texture-arrays" << std::endl;
+    gpuCullingRequested = false;
+  }
+  bool batch = benchmarkFrames > 0 || !exportPath.empty();
 
-int main() {
   // initialization and configuration of glfw
   glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  // gpu culling needs compute shaders, 3.3 stays the fallback
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, gpuCullingRequested ? 4 : 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_VISIBLE, batch ? GLFW_FALSE : GLFW_TRUE);
 
   // Create window
   GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "open-model-viewer",
       NULL, NULL);
+  if (window == NULL && gpuCullingRequested) {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    window = glfwCreateWindow(WIDTH, HEIGHT, "open-model-viewer", NULL,
+                              NULL);
+  }
   if (window == NULL) {
     std::cout << "Failed to create window" << std::endl;
     glfwTerminate();
@@ -56,6 +326,7 @@ int main() {
   // set mouse callback
   glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
   glfwSetCursorPosCallback(window, mouse_callback);
+  glfwSetMouseButtonCallback(window, mouse_button_callback);
 
   // set key callback
   glfwSetKeyCallback(window, shortcut_callback);
@@ -63,64 +334,208 @@ int main() {
   // set drop callback
   glfwSetDropCallback(window, drop_callback);
 
+  // set refresh callback
+  glfwSetWindowRefreshCallback(window, refresh_callback);
+
   // load all OpenGL functions
   if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
     std::cout << "Failed to initialize glad" << std::endl;
     return -1;
   }
+  loadGlFeatures((GLADloadproc)glfwGetProcAddress);
+  if (uploadBudget > 0)
+    TextureStreamer::get().start(uploadBudget, mipResidency);
+  if (pageCacheBytes > 0)
+    VirtualTextureSystem::get().start(pageCacheBytes);
+  // meshes without baked ambient occlusion are fully lit
+  glVertexAttrib1f(OCCLUSION_ATTRIBUTE, 1.0f);
 
   //set first viewport
   glViewport(0, 0, WIDTH, HEIGHT);
 
   // Create Shader
   Shader myShader("vertexshader.vs", "fragmentshader.fs");
+  // only blended meshes change it while they are drawn
+  myShader.use();
+  myShader.setUniform("opacity", 1.0f);
+  Shader prepassShader("depthshader.vs", "depthshader.fs");
+  depthShader = &prepassShader;
+  Shader textureArrayShader("vertexshader.vs", "arrayshader.fs");
+  textureArrayShader.use();
+  textureArrayShader.setUniform("opacity", 1.0f);
+  arrayShader = &textureArrayShader;
+  Shader pageShader("vertexshader.vs", "virtualshader.fs");
+  pageShader.use();
+  pageShader.setUniform("opacity", 1.0f);
+  Shader pageFeedbackShader("vertexshader.vs", "feedbackshader.fs");
+  if (VirtualTextureSystem::get().isEnabled()) {
+    virtualShader = &pageShader;
+    feedbackShader = &pageFeedbackShader;
+  }
 
   // Create Model
-  mainModel = new Model("res/nanosuit/nanosuit.obj");
+  mainModel = new Model(modelPath, importOptions);
+  double loadedMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - launchTime).count();
+  bool firstFrame = true;
+  bool streamReport = importOptions.report && uploadBudget > 0;
+  layoutInstances();
+  if (gpuCullingRequested && gpuCulling.init())
+    gpuCulling.setModel(*mainModel);
 
   // Enable depth
   glEnable(GL_DEPTH_TEST);
 
+  // the same frames as the software renderer, on mesa llvmpipe with
+  // LIBGL_ALWAYS_SOFTWARE=1
+  if (batch) {
+    std::cout << "gl renderer: " << (const char*)glGetString(GL_RENDERER)
+              << std::endl;
+    GlBackend backend(myShader, sceneFramebuffer);
+    runBatch(backend, nullptr);
+    glfwSetWindowShouldClose(window, true);
+  }
+
   // render
   while (!glfwWindowShouldClose(window)) {
-    processMovement(window);
-
-    // time management
-    float currentTime = (float) glfwGetTime();
-    deltaTime = currentTime - lastFrame;
-    lastFrame = currentTime;
-
-    // Background
-    glClearColor(.1f, .1, .1f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    // Set projection matrix
-    myShader.use();
-    glm::mat4 projection = glm::mat4(1.0f);
-    projection = glm::perspective(glm::radians(45.0f),
-        (float)WIDTH / (float)HEIGHT, // aspect ratio
-        0.1f, 100.0f);
-    myShader.setUniform("projection", projection);
-
-    // create transformations
-    glm::mat4 model = glm::mat4(1.0f);
-    glm::mat4 view = cam.getView();
-    myShader.setUniform("model", model);
-    myShader.setUniform("view", view);
-    
-
-    mainModel->draw(myShader);
-
+    scheduler.waitEvents();
+    // results of background work only show up in a new frame
+    scheduler.setAnimating(movementKeyHeld(window) ||
+                           mainModel->hasPendingWork() ||
+                           TextureStreamer::get().isBusy() ||
+                           VirtualTextureSystem::get().isBusy());
+
+    FrameAction action = scheduler.nextFrame();
+    if (action == FRAME_NONE)
+      continue;
+
+    if (action == FRAME_REDRAW) {
+      // time management, an idle phase must not become one big step
+      float currentTime = (float) glfwGetTime();
+      deltaTime = std::min(currentTime - lastFrame, 0.1f);
+      lastFrame = currentTime;
+      processMovement(window);
+
+      sceneFramebuffer.resize(WIDTH, HEIGHT);
+      sceneFramebuffer.bind();
+      renderScene(myShader);
+    }
+    sceneFramebuffer.present();
     glfwSwapBuffers(window);
-    glfwPollEvents();
+    // textures and buffers are only resident once the gpu drew with them
+    if (firstFrame) {
+      glFinish();
+      std::cout << "first frame after " << std::fixed
+                << std::setprecision(1)
+                << std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - launchTime).count()
+                << " ms, the model was loaded after " << loadedMs << " ms"
+                << std::endl;
+      firstFrame = false;
+    }
+    // bandwidth and stalls of the streamed textures once all arrived
+    if (streamReport && !TextureStreamer::get().isBusy()) {
+      TextureStreamer::get().report(std::cout);
+      streamReport = false;
+    }
   }
 
+  // release all GL objects while the context is still alive
+  TextureStreamer::get().stop();
+  VirtualTextureSystem::get().stop();
+  delete mainModel;
+  instances = InstanceSet();
+  gpuCulling = GpuCulling();
+  pipelineStatistics = PipelineStatistics();
+  sceneFramebuffer = SceneFramebuffer();
+  GpuRegistry::get().clearTextures();
   glfwTerminate();
   return 0;
 }
 
+void renderScene(Shader &shader) {
+  mainModel->update();
+  TextureStreamer::get().update();
+  VirtualTextureSystem::get().update();
+
+  // the depth of the last frame is still there until the clear. chunk
+  // and point files are paged by their own selection on the cpu
+  bool drawOnGpu = gpuCulling.isReady() && !instanced &&
+                   !mainModel->isPaged();
+  // the pre-pass only covers the single model drawn on the cpu path
+  bool prepass = depthPrepass && !instanced && !drawOnGpu;
+  pipelineStatistics.begin(prepass ? "with depth pre-pass" :
+                                     "without depth pre-pass");
+  if (drawOnGpu)
+    gpuCulling.buildPyramid(sceneFramebuffer.getDepthTexture(),
+                            sceneFramebuffer.getWidth(),
+                            sceneFramebuffer.getHeight());
+
+  // Background
+  glClearColor(.1f, .1, .1f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  // Set projection matrix
+  shader.use();
+  glm::mat4 projection = projectionMatrix();
+  shader.setUniform("projection", projection);
+
+  // create transformations
+  glm::mat4 model = glm::mat4(1.0f);
+  glm::mat4 view = cam.getView();
+  shader.setUniform("model", model);
+  shader.setUniform("view", view);
+
+  // the closest copies of the model are the occluders of the frame
+  const OcclusionBuffer* occlusion = nullptr;
+  if (occlusionCulling) {
+    occlusionBuffer.begin(projection * view, (int)WIDTH, (int)HEIGHT);
+    if (instanced)
+      for (const glm::mat4 &instance :
+           instances.nearest(cam.getPosition(), 16))
+        mainModel->addOccluders(occlusionBuffer, model * instance);
+    else
+      mainModel->addOccluders(occlusionBuffer, model);
+    occlusionBuffer.rasterize();
+    occlusion = &occlusionBuffer;
+  }
+
+  RenderView renderView = { view, projection, cam.getPosition(),
+                            (int)WIDTH, (int)HEIGHT, lodPixelError,
+                            occlusion, prepass ? depthShader : nullptr,
+                            arrayShader, virtualShader, feedbackShader };
+  if (instanced) {
+    instances.update(Frustum::fromMatrix(projection * view * model),
+                     mainModel->getBoundsCenter(),
+                     mainModel->getBoundsRadius(), occlusion);
+    // the closest copy decides the mip levels of the textures
+    for (const glm::mat4 &instance :
+         instances.nearest(cam.getPosition(), 1))
+      mainModel->requestMips(renderView, model * instance);
+    // packed meshes switch to the array shader with the same matrices
+    if (importOptions.textureArrays) {
+      arrayShader->use();
+      arrayShader->setUniform("projection", projection);
+      arrayShader->setUniform("model", model);
+      arrayShader->setUniform("view", view);
+      shader.use();
+    }
+    mainModel->drawInstanced(shader, instances, arrayShader);
+  }
+  else if (drawOnGpu) {
+    mainModel->requestMips(renderView, model);
+    gpuCulling.draw(shader, projection * view * model);
+  }
+  else
+    mainModel->draw(shader, renderView);
+  pipelineStatistics.end();
+}
+
 void shortcut_callback(GLFWwindow* window, int key, int scancode, int action,
                        int mods) {
+  // every shortcut may change the picture
+  scheduler.requestRedraw();
+
   // exit application if escape is pressed
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
     glfwSetWindowShouldClose(window, true);
@@ -142,13 +557,44 @@ void shortcut_callback(GLFWwindow* window, int key, int scancode, int action,
     if (filename != nullptr) {
       std::string newfile = filename;
       std::replace(newfile.begin(), newfile.end(), '\\', '/');
-      delete mainModel;
-      mainModel = new Model(newfile);
+      replaceModel(newfile);
     }
     else
       std::cout << "Please enter a valid obj file!" << std::endl;
   }
 
+  // print the gpu memory report if 'r' is pressed
+  if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+    GpuRegistry::get().report(std::cout);
+    mainModel->reportLod(std::cout);
+    mainModel->reportClusters(std::cout);
+    mainModel->reportBatches(std::cout);
+    GlStateCache::get().report(std::cout);
+    TextureCache::get().report(std::cout);
+    TextureStreamer::get().report(std::cout);
+    VirtualTextureSystem::get().report(std::cout);
+    RenderView renderView = { cam.getView(), projectionMatrix(),
+                              cam.getPosition(), (int)WIDTH, (int)HEIGHT,
+                              lodPixelError, nullptr, nullptr, nullptr,
+                              nullptr, nullptr };
+    mainModel->reportBvh(std::cout, renderView);
+    mainModel->reportAo(std::cout);
+    if (occlusionCulling)
+      occlusionBuffer.report(std::cout);
+    gpuCulling.report(std::cout);
+    if (instanced)
+      instances.report(std::cout);
+    pipelineStatistics.report(std::cout);
+    scheduler.report(std::cout);
+  }
+
+  // toggle the depth pre-pass and front to back sorting if 'p' is pressed
+  if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+    depthPrepass = !depthPrepass;
+    std::cout << "depth pre-pass " << (depthPrepass ? "on" : "off")
+              << std::endl;
+  }
+
   // export current frame as png
   if (key == GLFW_KEY_E && action == GLFW_PRESS) {
     const char* filterPatterns[1] = { "*.png" };
@@ -161,6 +607,13 @@ void shortcut_callback(GLFWwindow* window, int key, int scancode, int action,
   }
 }
 
+bool movementKeyHeld(GLFWwindow* window) {
+  return glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS ||
+         glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS ||
+         glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS ||
+         glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
+}
+
 void processMovement(GLFWwindow *window) {
   if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
     cam.handleKeyboard(FOR, deltaTime);
@@ -176,6 +629,12 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
   glViewport(0, 0, width, height);
   WIDTH = width;
   HEIGHT = height;
+  scheduler.requestRedraw();
+}
+
+void refresh_callback(GLFWwindow* window) {
+  // the scene didn't change, the kept frame is shown again
+  scheduler.requestPresent();
 }
 
 void drop_callback(GLFWwindow* window, int count, const char** paths) {
@@ -183,11 +642,32 @@ void drop_callback(GLFWwindow* window, int count, const char** paths) {
   if (paths[count - 1] != nullptr) {
     std::string newfile = paths[count-1];
     std::replace(newfile.begin(), newfile.end(), '\\', '/');
-    delete mainModel;
-    mainModel = new Model(newfile);
+    replaceModel(newfile);
   }
 }
 
+void replaceModel(const std::string &path) {
+  // the old model goes first, so its textures can be reused or evicted
+  delete mainModel;
+  mainModel = new Model(path, importOptions);
+  GpuRegistry::get().collect();
+  layoutInstances();
+  if (gpuCulling.isReady())
+    gpuCulling.setModel(*mainModel);
+  scheduler.requestRedraw();
+}
+
+void layoutInstances() {
+  // the spacing follows the size of the model
+  instanced = instanceCount > 0 && !mainModel->isPaged();
+  if (instanceCount > 0 && !instanced)
+    std::cout << "Chunk and point files are drawn once, --instances is "
+              << "ignored" << std::endl;
+  if (instanced)
+    instances.setTransforms(layoutGrid(instanceCount,
+        glm::max(mainModel->getBoundsRadius() * 2.2f, 0.01f)));
+}
+
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
   // if mouse enters the window the first time
   if (firstMouse) {
@@ -204,16 +684,165 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
   lastY = ypos;
 
   cam.handleMouse(xoffset, yoffset);
+  scheduler.requestRedraw();
+}
+
+void mouse_button_callback(GLFWwindow* window, int button, int action,
+                           int mods) {
+  if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    pickCenter();
+}
+
+glm::mat4 projectionMatrix() {
+  return glm::perspective(glm::radians(45.0f),
+      (float)WIDTH / (float)HEIGHT, // aspect ratio
+      0.1f, 100.0f);
+}
+
+// prints the triangle in the middle of the window, the cursor is captured
+// by the camera so the center is what it points at
+void pickCenter() {
+  Ray ray = screenRay(cam.getView(), projectionMatrix(), WIDTH * 0.5f,
+                      HEIGHT * 0.5f, WIDTH, HEIGHT);
+  std::vector<glm::mat4> placements(1, glm::mat4(1.0f));
+  if (instanced)
+    placements = instances.nearest(cam.getPosition(), instances.size());
+
+  // the ray moves into the space of every copy, its direction keeps the
+  // scale so the distances stay comparable
+  RayHit closest;
+  closest.distance = 1e30f;
+  bool found = false;
+  for (unsigned int i = 0; i < placements.size(); i++) {
+    glm::mat4 inverse = glm::inverse(placements[i]);
+    Ray local = { glm::vec3(inverse * glm::vec4(ray.origin, 1.0f)),
+                  glm::vec3(inverse * glm::vec4(ray.direction, 0.0f)) };
+    RayHit hit;
+    if (mainModel->pick(local, hit, closest.distance)) {
+      closest = hit;
+      closest.position = glm::vec3(placements[i] *
+                                   glm::vec4(hit.position, 1.0f));
+      found = true;
+    }
+  }
+  if (!found) {
+    std::cout << "pick: nothing under the center" << std::endl;
+    return;
+  }
+  std::cout << "pick: mesh " << closest.mesh << ", triangle "
+            << closest.triangle << " of node " << closest.instance
+            << ", barycentrics (" << 1.0f - closest.u - closest.v << ", "
+            << closest.u << ", " << closest.v << "), position ("
+            << closest.position.x << ", " << closest.position.y << ", "
+            << closest.position.z << "), distance " << closest.distance
+            << std::endl;
 }
 
 void exportImage(const std::string &name) {
-  // Buffer object with frame informations
-  GLubyte* buffer = new GLubyte[3 * WIDTH * HEIGHT];
-  glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, buffer);
+  // read the kept frame, the back buffer is undefined after a swap
+  std::vector<unsigned char> pixels;
+  sceneFramebuffer.readPixels(pixels);
+  if (!writeImage(name, sceneFramebuffer.getWidth(),
+                  sceneFramebuffer.getHeight(), pixels))
+    std::cout << "Couldn't write image: " << name << std::endl;
+}
+
+// camera circling the model slightly from above, frame 0 looks from +z
+// like the start position of the viewer
+RenderView orbitView(unsigned int frame, unsigned int frames) {
+  glm::vec3 center = mainModel->getBoundsCenter();
+  float radius = glm::max(mainModel->getBoundsRadius(), 0.01f);
+  float angle = 6.2831853f * frame / glm::max(frames, 1u);
+  glm::vec3 eye = center + radius * 2.5f *
+                  glm::vec3(std::sin(angle), 0.25f, std::cos(angle));
+  RenderView view = { glm::lookAt(eye, center, glm::vec3(0.0f, 1.0f, 0.0f)),
+                      projectionMatrix(), eye, (int)WIDTH, (int)HEIGHT,
+                      lodPixelError, nullptr,
+                      depthPrepass ? depthShader : nullptr, arrayShader,
+                      virtualShader, feedbackShader };
+  return view;
+}
 
-  stbi_flip_vertically_on_write(1);
-  stbi_write_png(name.c_str(), WIDTH, HEIGHT, 3, buffer, WIDTH * 3);
+// renders the orbit without a window for --benchmark and --export, the
+// software renderer is timed for every doubling of its threads
+void runBatch(RenderBackend &backend, SoftwareRenderer* software) {
+  backend.resize(WIDTH, HEIGHT);
+  // the ambient occlusion bake and the streamed textures have to arrive
+  // before the timing, with mip residency the levels the first orbit frame
+  // asks for as well. the pages of virtual textures come a few levels per
+  // frame, the frame is drawn again until its feedback finds them all.
+  // chunk and point files refine a few levels per frame the same way
+  VirtualTextureSystem &pages = VirtualTextureSystem::get();
+  bool again = true;
+  for (int pass = 0; again && pass < 32; pass++) {
+    if (pass > 0) {
+      backend.render(*mainModel, orbitView(0, glm::max(benchmarkFrames, 1u)));
+      backend.finish();
+      TextureStreamer::get().update();
+      pages.update();
+    }
+    again = pass == 0 ? TextureStreamer::get().managesMips() ||
+                        pages.isEnabled() || mainModel->isPaged() :
+                        pages.isBusy() || mainModel->hasPendingWork();
+    while (mainModel->hasPendingWork() || TextureStreamer::get().isBusy() ||
+           pages.isBusy()) {
+      mainModel->update();
+      TextureStreamer::get().update();
+      pages.update();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  if (importOptions.report) {
+    TextureStreamer::get().report(std::cout);
+    pages.report(std::cout);
+    if (mainModel->isPaged())
+      mainModel->reportLod(std::cout);
+  }
 
-  // Delete the buffer data
-  delete[] buffer;
+  if (benchmarkFrames > 0) {
+    std::vector<unsigned int> threadCounts(1, 0);
+    if (software) {
+      unsigned int pool = JobSystem::get().getThreadCount();
+      threadCounts.clear();
+      for (unsigned int threads = 1; threads < pool; threads *= 2)
+        threadCounts.push_back(threads);
+      threadCounts.push_back(pool);
+    }
+    double firstFps = 0.0;
+    for (unsigned int threads : threadCounts) {
+      if (software)
+        software->setThreadLimit(threads);
+      // one frame first, so caches and lazy allocations are warm
+      backend.render(*mainModel, orbitView(0, benchmarkFrames));
+      backend.finish();
+      std::chrono::steady_clock::time_point start =
+          std::chrono::steady_clock::now();
+      for (unsigned int frame = 0; frame < benchmarkFrames; frame++)
+        backend.render(*mainModel, orbitView(frame, benchmarkFrames));
+      backend.finish();
+      double seconds = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - start).count();
+      double fps = benchmarkFrames / glm::max(seconds, 1e-9);
+      if (firstFps == 0.0)
+        firstFps = fps;
+      std::cout << "benchmark: " << backend.getName() << " " << WIDTH << "x"
+                << HEIGHT << ", " << benchmarkFrames << " frames, "
+                << std::fixed << std::setprecision(1) << fps << " fps";
+      if (software)
+        std::cout << " on " << threads << " threads, " << std::setprecision(2)
+                  << fps / firstFps << "x the first";
+      std::cout << std::endl;
+    }
+    if (software)
+      software->report(std::cout);
+  }
+
+  if (!exportPath.empty()) {
+    backend.render(*mainModel, orbitView(0, 1));
+    backend.finish();
+    std::vector<unsigned char> pixels;
+    backend.readPixels(pixels);
+    if (!writeImage(exportPath, WIDTH, HEIGHT, pixels))
+      std::cout << "Couldn't write image: " << exportPath << std::endl;
+  }
 }
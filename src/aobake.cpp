@@ -0,0 +1,196 @@
+#include "aobake.h"
+#include "contenthash.h"
+#include "jobsystem.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+
+namespace {
+
+const char CACHE_MAGIC[8] = { 'o', 'm', 'v', 'a', 'o', '0', '0', '1' };
+
+// every mesh occludes every other, so the whole scene is the key
+uint64_t hashScene(const std::vector<Mesh> &meshes,
+                   const AoSettings &settings) {
+  uint64_t hash = hashBytes(&settings.samples, sizeof(settings.samples));
+  hash = hashBytes(&settings.distance, sizeof(settings.distance), hash);
+  for (const Mesh &mesh : meshes) {
+    hash = hashBytes(mesh.vertices.data(),
+                     mesh.vertices.size() * sizeof(Vertex), hash);
+    hash = hashBytes(mesh.indices.data(),
+                     mesh.indices.size() * sizeof(unsigned int), hash);
+    hash = hashBytes(mesh.instances.data(),
+                     mesh.instances.size() * sizeof(glm::mat4), hash);
+  }
+  return hash;
+}
+
+bool readCache(const std::string &path, uint64_t hash,
+               const std::vector<Mesh> &meshes,
+               std::vector<std::vector<float>> &result) {
+  std::ifstream file(path, std::ios::binary);
+  char magic[8];
+  uint64_t fileHash = 0;
+  uint32_t meshCount = 0;
+  if (!file.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 ||
+      !file.read((char*)&fileHash, sizeof(fileHash)) || fileHash != hash ||
+      !file.read((char*)&meshCount, sizeof(meshCount)) ||
+      meshCount != meshes.size())
+    return false;
+  result.resize(meshes.size());
+  for (size_t i = 0; i < meshes.size(); i++) {
+    result[i].resize(meshes[i].vertices.size());
+    if (!file.read((char*)result[i].data(),
+                   result[i].size() * sizeof(float)))
+      return false;
+  }
+  return true;
+}
+
+bool writeCache(const std::string &path, uint64_t hash,
+                const std::vector<std::vector<float>> &result) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  uint32_t meshCount = (uint32_t)result.size();
+  file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  file.write((const char*)&hash, sizeof(hash));
+  file.write((const char*)&meshCount, sizeof(meshCount));
+  for (const std::vector<float> &visibility : result)
+    file.write((const char*)visibility.data(),
+               visibility.size() * sizeof(float));
+  return (bool)file;
+}
+
+float radicalInverse(unsigned int bits) {
+  bits = (bits << 16) | (bits >> 16);
+  bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+  bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+  bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+  bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+  return bits * 2.3283064365386963e-10f;
+}
+
+// cosine weighted hammersley points on the hemisphere around +z, the
+// fraction of blocked rays is then the occlusion seen by a diffuse surface
+std::vector<glm::vec3> hemisphereSamples(unsigned int count) {
+  std::vector<glm::vec3> samples(count);
+  for (unsigned int i = 0; i < count; i++) {
+    float u = (i + 0.5f) / count;
+    float angle = radicalInverse(i) * 6.2831853f;
+    float radius = std::sqrt(u);
+    samples[i] = glm::vec3(radius * std::cos(angle),
+                           radius * std::sin(angle), std::sqrt(1.0f - u));
+  }
+  return samples;
+}
+
+}
+
+AoBake bakeAmbientOcclusion(const Bvh &bvh, const std::vector<Mesh> &meshes,
+                            const AoSettings &requested,
+                            const std::string &cachePath) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  AoSettings settings = requested;
+  settings.samples = (glm::max(settings.samples, 1u) + 3) / 4 * 4;
+  AoBake bake;
+  bake.stats.cachePath = cachePath;
+  for (const Mesh &mesh : meshes)
+    bake.stats.vertices += mesh.vertices.size();
+
+  uint64_t hash = hashScene(meshes, settings);
+  if (readCache(cachePath, hash, meshes, bake.meshes)) {
+    bake.stats.cacheReused = true;
+    bake.stats.bakeMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    return bake;
+  }
+
+  // vertices of all meshes in one loop, found through the first vertex of
+  // every mesh
+  std::vector<size_t> firstVertex;
+  size_t total = 0;
+  bake.meshes.resize(meshes.size());
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    firstVertex.push_back(total);
+    bake.meshes[i].resize(meshes[i].vertices.size(), 1.0f);
+    total += meshes[i].vertices.size();
+  }
+  std::vector<glm::vec3> samples = hemisphereSamples(settings.samples);
+  // rays start slightly above the surface so they miss its own triangles
+  float bias = settings.distance * 1e-3f;
+
+  JobSystem::get().parallelFor(total, 64, [&](size_t begin, size_t end) {
+    size_t mesh = std::upper_bound(firstVertex.begin(), firstVertex.end(),
+                                   begin) - firstVertex.begin() - 1;
+    for (size_t global = begin; global < end; global++) {
+      while (mesh + 1 < firstVertex.size() &&
+             global >= firstVertex[mesh + 1])
+        mesh++;
+      if (meshes[mesh].instances.empty())
+        continue;
+      size_t index = global - firstVertex[mesh];
+      const Vertex &vertex = meshes[mesh].vertices[index];
+      const glm::mat4 &transform = meshes[mesh].instances[0];
+      glm::vec3 normal = glm::transpose(glm::inverse(glm::mat3(transform))) *
+                         vertex.normal;
+      if (glm::dot(normal, normal) == 0.0f)
+        continue;
+      normal = glm::normalize(normal);
+      glm::vec3 position = glm::vec3(transform *
+                                     glm::vec4(vertex.position, 1.0f)) +
+                           normal * bias;
+
+      // orthonormal frame around the normal, turned by a different angle
+      // for every vertex so neighbours don't share the sampling pattern
+      float sign = normal.z >= 0.0f ? 1.0f : -1.0f;
+      float a = -1.0f / (sign + normal.z);
+      float b = normal.x * normal.y * a;
+      glm::vec3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b,
+                        -sign * normal.x);
+      glm::vec3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+      float turn = (float)std::fmod(global * 0.6180339887, 1.0) * 6.2831853f;
+      glm::vec3 x = tangent * std::cos(turn) + bitangent * std::sin(turn);
+      glm::vec3 y = glm::cross(normal, x);
+
+      unsigned int blocked = 0;
+      Ray packet[4];
+      for (unsigned int s = 0; s < settings.samples; s += 4) {
+        for (unsigned int k = 0; k < 4; k++) {
+          const glm::vec3 &sample = samples[s + k];
+          packet[k].origin = position;
+          packet[k].direction = x * sample.x + y * sample.y +
+                                normal * sample.z;
+        }
+        unsigned int lanes = bvh.occludedPacket(packet, settings.distance);
+        for (; lanes != 0; lanes &= lanes - 1)
+          blocked++;
+      }
+      bake.meshes[mesh][index] = 1.0f - (float)blocked / settings.samples;
+    }
+  });
+  bake.stats.rays = total * settings.samples;
+  bake.stats.bakeMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  bake.stats.cacheWritten = writeCache(cachePath, hash, bake.meshes);
+  return bake;
+}
+
+void AoStats::report(std::ostream &out) const {
+  out << "ao: " << vertices << " vertices";
+  if (cacheReused) {
+    out << " read from the cache " << cachePath << " in " << std::fixed
+        << std::setprecision(1) << bakeMs << " ms" << std::endl;
+    return;
+  }
+  out << " baked in " << std::fixed << std::setprecision(1) << bakeMs
+      << " ms (" << std::setprecision(2)
+      << rays / glm::max(bakeMs, 1e-3) / 1e3
+      << " million rays per second on " << JobSystem::get().getThreadCount()
+      << " threads), cache " << cachePath
+      << (cacheWritten ? " written" : " not writable") << std::endl;
+}
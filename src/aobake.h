@@ -0,0 +1,43 @@
+#ifndef aobake_h
+#define aobake_h
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "bvh.h"
+#include "mesh.h"
+
+struct AoSettings {
+  // rays per vertex, rounded up to whole packets of four
+  unsigned int samples = 32;
+  // only hits closer than this darken a vertex
+  float distance = 1.0f;
+};
+
+struct AoStats {
+  size_t vertices = 0;
+  size_t rays = 0;
+  double bakeMs = 0.0;
+  // the cache matched the scene and settings, nothing was traced
+  bool cacheReused = false;
+  bool cacheWritten = false;
+  std::string cachePath;
+
+  void report(std::ostream &out) const;
+};
+
+struct AoBake {
+  // visibility of every vertex of every mesh, 1 where nothing is in the way
+  std::vector<std::vector<float>> meshes;
+  AoStats stats;
+};
+
+// traces a hemisphere of rays around the normal of every vertex against the
+// bvh, the meshes are placed by their first node like in the bvh. the
+// result is read from the cache file when it was baked for the same scene
+// and settings, otherwise it is written there
+AoBake bakeAmbientOcclusion(const Bvh &bvh, const std::vector<Mesh> &meshes,
+                            const AoSettings &settings,
+                            const std::string &cachePath);
+
+#endif
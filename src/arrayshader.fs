@@ -0,0 +1,17 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoord;
+in float Occlusion;
+flat in float Layer;
+
+// diffuse textures of one size, the layer picks the material
+uniform sampler2DArray texture_diffuse1;
+// below 1 for blended materials
+uniform float opacity;
+
+void main()
+{
+  vec4 color = texture(texture_diffuse1, vec3(TexCoord, Layer));
+  FragColor = vec4(color.rgb * Occlusion, color.a * opacity);
+}
@@ -0,0 +1,619 @@
+#include "bvh.h"
+#include "jobsystem.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BVH_SSE
+#endif
+
+namespace {
+
+const unsigned int BIN_COUNT = 16;
+// larger leaves are split even if the heuristic prefers to keep them
+const unsigned int MAX_LEAF_SIZE = 8;
+// cost of visiting a node relative to testing one triangle
+const float TRAVERSAL_COST = 1.0f;
+// from this depth on the sah is skipped and nodes are halved, so the tree
+// fits the traversal stack
+const unsigned int MAX_SAH_DEPTH = 32;
+const unsigned int STACK_SIZE = 64;
+
+struct Bounds {
+  glm::vec3 minimum = glm::vec3(FLT_MAX);
+  glm::vec3 maximum = glm::vec3(-FLT_MAX);
+
+  void grow(const glm::vec3 &point) {
+    minimum = glm::min(minimum, point);
+    maximum = glm::max(maximum, point);
+  }
+  void grow(const Bounds &other) {
+    minimum = glm::min(minimum, other.minimum);
+    maximum = glm::max(maximum, other.maximum);
+  }
+  // half of the surface, only compared with each other
+  float area() const {
+    glm::vec3 extent = maximum - minimum;
+    if (extent.x < 0.0f)
+      return 0.0f;
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+  }
+};
+
+// entry distance of the ray into the box, FLT_MAX on a miss or when the
+// box starts behind the closest hit
+inline float intersectBox(const glm::vec3 &minimum, const glm::vec3 &maximum,
+                          const glm::vec3 &origin, const glm::vec3 &inverse,
+                          float distance) {
+  glm::vec3 t0 = (minimum - origin) * inverse;
+  glm::vec3 t1 = (maximum - origin) * inverse;
+  glm::vec3 nearest = glm::min(t0, t1);
+  glm::vec3 farthest = glm::max(t0, t1);
+  float enter = glm::max(glm::max(nearest.x, nearest.y), nearest.z);
+  float leave = glm::min(glm::min(farthest.x, farthest.y), farthest.z);
+  if (leave >= enter && leave > 0.0f && enter < distance)
+    return enter;
+  return FLT_MAX;
+}
+
+// moeller trumbore, both sides of the triangle count
+inline bool intersectTriangle(const glm::vec3 &origin,
+                              const glm::vec3 &direction,
+                              const glm::vec3 &v0, const glm::vec3 &e1,
+                              const glm::vec3 &e2, float &t, float &u,
+                              float &v) {
+  glm::vec3 p = glm::cross(direction, e2);
+  float det = glm::dot(e1, p);
+  if (det == 0.0f)
+    return false;
+  float inverse = 1.0f / det;
+  glm::vec3 s = origin - v0;
+  u = glm::dot(s, p) * inverse;
+  if (u < 0.0f || u > 1.0f)
+    return false;
+  glm::vec3 q = glm::cross(s, e1);
+  v = glm::dot(direction, q) * inverse;
+  if (v < 0.0f || u + v > 1.0f)
+    return false;
+  t = glm::dot(e2, q) * inverse;
+  return t > 0.0f;
+}
+
+
+// triangles are partitioned by value, the splits read them in order
+struct BuildTriangle {
+  Bounds bounds;
+  glm::vec3 centroid;
+  unsigned int index;
+};
+
+}
+
+struct Bvh::BuildState {
+  // in leaf order once the build is done
+  std::vector<BuildTriangle> triangles;
+  std::atomic<unsigned int> nextNode;
+  // subtrees this small are built by one worker each
+  unsigned int taskSize;
+  struct Task {
+    unsigned int node;
+    unsigned int first;
+    unsigned int count;
+    unsigned int depth;
+  };
+  std::vector<Task> tasks;
+};
+
+void Bvh::build(const std::vector<BvhMesh> &meshes) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  nodes.clear();
+  nodeCount = 0;
+
+  // every placed copy of a mesh is a range of triangles
+  std::vector<size_t> rangeStarts;
+  std::vector<unsigned int> rangeMeshes;
+  std::vector<unsigned int> rangeInstances;
+  size_t total = 0;
+  for (unsigned int i = 0; i < meshes.size(); i++)
+    for (unsigned int j = 0; j < meshes[i].transforms.size(); j++) {
+      rangeStarts.push_back(total);
+      rangeMeshes.push_back(i);
+      rangeInstances.push_back(j);
+      total += meshes[i].indices->size() / 3;
+    }
+  triangleCount = total;
+
+  // world space corners, bounds and centroids of all triangles
+  BuildState state;
+  std::vector<glm::vec3> corners(total * 3);
+  std::vector<unsigned int> ranges(total);
+  state.triangles.resize(total);
+  JobSystem &jobs = JobSystem::get();
+  jobs.parallelFor(total, 4096, [&](size_t begin, size_t end) {
+    size_t range = std::upper_bound(rangeStarts.begin(), rangeStarts.end(),
+                                    begin) - rangeStarts.begin() - 1;
+    for (size_t t = begin; t < end; t++) {
+      while (range + 1 < rangeStarts.size() && t >= rangeStarts[range + 1])
+        range++;
+      const BvhMesh &mesh = meshes[rangeMeshes[range]];
+      const glm::mat4 &transform = mesh.transforms[rangeInstances[range]];
+      size_t triangle = t - rangeStarts[range];
+      Bounds bounds;
+      for (unsigned int k = 0; k < 3; k++) {
+        const Vertex &vertex =
+            (*mesh.vertices)[(*mesh.indices)[triangle * 3 + k]];
+        glm::vec3 corner = glm::vec3(transform *
+                                     glm::vec4(vertex.position, 1.0f));
+        corners[t * 3 + k] = corner;
+        bounds.grow(corner);
+      }
+      ranges[t] = (unsigned int)range;
+      state.triangles[t].bounds = bounds;
+      state.triangles[t].centroid = (bounds.minimum + bounds.maximum) * 0.5f;
+      state.triangles[t].index = (unsigned int)t;
+    }
+  });
+
+  if (total > 0) {
+    // a binary tree over n leaves has at most 2n - 1 nodes
+    nodes.resize(total * 2 - 1);
+    state.nextNode = 1;
+
+    // the top of the tree is split here until there is a subtree for every
+    // worker a few times over, the subtrees are built in parallel
+    unsigned int threads = jobs.getThreadCount();
+    state.taskSize = (unsigned int)std::max<size_t>(
+        total / (threads * 4), 4096);
+    subdivide(state, 0, 0, (unsigned int)total, 0, threads > 1);
+    // the largest subtrees go first so no worker finishes last with one
+    std::sort(state.tasks.begin(), state.tasks.end(),
+              [](const BuildState::Task &a, const BuildState::Task &b) {
+      return a.count > b.count;
+    });
+    jobs.parallelFor(state.tasks.size(), 1, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        const BuildState::Task &task = state.tasks[i];
+        subdivide(state, task.node, task.first, task.count, task.depth,
+                  false);
+      }
+    });
+    nodeCount = state.nextNode;
+    nodes.resize(nodeCount);
+    nodes.shrink_to_fit();
+  }
+
+  // the leaves reference the triangles in order
+  std::vector<float>* arrays[] = { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z,
+                                   &e2x, &e2y, &e2z };
+  for (std::vector<float>* array : arrays) {
+    array->resize(total);
+    array->shrink_to_fit();
+  }
+  meshIds.resize(total);
+  instanceIds.resize(total);
+  triangleIds.resize(total);
+  jobs.parallelFor(total, 4096, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      unsigned int t = state.triangles[i].index;
+      glm::vec3 v0 = corners[t * 3];
+      glm::vec3 e1 = corners[t * 3 + 1] - v0;
+      glm::vec3 e2 = corners[t * 3 + 2] - v0;
+      v0x[i] = v0.x; v0y[i] = v0.y; v0z[i] = v0.z;
+      e1x[i] = e1.x; e1y[i] = e1.y; e1z[i] = e1.z;
+      e2x[i] = e2.x; e2y[i] = e2.y; e2z[i] = e2.z;
+      unsigned int range = ranges[t];
+      meshIds[i] = rangeMeshes[range];
+      instanceIds[i] = rangeInstances[range];
+      triangleIds[i] = (unsigned int)(t - rangeStarts[range]);
+    }
+  });
+  buildMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+void Bvh::subdivide(BuildState &state, unsigned int index, unsigned int first,
+                    unsigned int count, unsigned int depth, bool defer) {
+  if (defer && count <= state.taskSize) {
+    state.tasks.push_back({ index, first, count, depth });
+    return;
+  }
+  Bounds bounds;
+  Bounds centroidBounds;
+  BuildTriangle* triangles = &state.triangles[first];
+  for (unsigned int i = 0; i < count; i++) {
+    bounds.grow(triangles[i].bounds);
+    centroidBounds.grow(triangles[i].centroid);
+  }
+  Node &node = nodes[index];
+  node.minimum = bounds.minimum;
+  node.maximum = bounds.maximum;
+  node.first = first;
+  node.count = count;
+  if (count <= 2)
+    return;
+
+  // cheapest split between bins of the centroids on any axis, all three
+  // axes are binned in one pass over the triangles
+  float bestCost = FLT_MAX;
+  int bestAxis = -1;
+  unsigned int bestSplit = 0;
+  glm::vec3 lowest = centroidBounds.minimum;
+  glm::vec3 extent = centroidBounds.maximum - lowest;
+  glm::vec3 scale;
+  // small nodes have few useful split positions
+  unsigned int binCount = std::min(BIN_COUNT, count);
+  for (int axis = 0; axis < 3; axis++)
+    scale[axis] = extent[axis] > 0.0f ? binCount / extent[axis] : 0.0f;
+  Bounds bins[3][BIN_COUNT];
+  unsigned int binCounts[3][BIN_COUNT] = {};
+  if (depth < MAX_SAH_DEPTH)
+    for (unsigned int i = 0; i < count; i++) {
+      glm::vec3 position = (triangles[i].centroid - lowest) * scale;
+      for (int axis = 0; axis < 3; axis++) {
+        unsigned int bin = std::min(binCount - 1,
+                                    (unsigned int)position[axis]);
+        bins[axis][bin].grow(triangles[i].bounds);
+        binCounts[axis][bin]++;
+      }
+    }
+  for (int axis = 0; axis < 3 && depth < MAX_SAH_DEPTH; axis++) {
+    if (scale[axis] == 0.0f)
+      continue;
+    // areas and counts left of every split from one sweep each way
+    float leftCosts[BIN_COUNT - 1];
+    unsigned int leftCounts[BIN_COUNT - 1];
+    Bounds left;
+    unsigned int leftCount = 0;
+    for (unsigned int i = 0; i < binCount - 1; i++) {
+      left.grow(bins[axis][i]);
+      leftCount += binCounts[axis][i];
+      leftCosts[i] = left.area() * leftCount;
+      leftCounts[i] = leftCount;
+    }
+    Bounds right;
+    unsigned int rightCount = 0;
+    for (unsigned int i = binCount - 1; i > 0; i--) {
+      right.grow(bins[axis][i]);
+      rightCount += binCounts[axis][i];
+      if (leftCounts[i - 1] == 0 || rightCount == 0)
+        continue;
+      float cost = leftCosts[i - 1] + right.area() * rightCount;
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = i;
+      }
+    }
+  }
+
+  unsigned int middle;
+  float area = bounds.area();
+  if (bestAxis < 0) {
+    // identical centroids or too deep, only halving is left
+    if (count <= MAX_LEAF_SIZE)
+      return;
+    middle = first + count / 2;
+    if (depth >= MAX_SAH_DEPTH) {
+      int axis = 0;
+      if (extent.y > extent[axis])
+        axis = 1;
+      if (extent.z > extent[axis])
+        axis = 2;
+      std::nth_element(triangles, triangles + count / 2, triangles + count,
+                       [&](const BuildTriangle &a, const BuildTriangle &b) {
+        return a.centroid[axis] < b.centroid[axis];
+      });
+    }
+  }
+  else {
+    if (count <= MAX_LEAF_SIZE &&
+        area * count <= area * TRAVERSAL_COST + bestCost)
+      return;
+    middle = first + (unsigned int)(std::partition(
+        triangles, triangles + count, [&](const BuildTriangle &triangle) {
+      unsigned int bin = std::min(binCount - 1, (unsigned int)(
+          (triangle.centroid[bestAxis] - lowest[bestAxis]) *
+          scale[bestAxis]));
+      return bin < bestSplit;
+    }) - triangles);
+  }
+
+  unsigned int children = state.nextNode.fetch_add(2);
+  node.first = children;
+  node.count = 0;
+  subdivide(state, children, first, middle - first, depth + 1, defer);
+  subdivide(state, children + 1, middle, first + count - middle, depth + 1,
+            defer);
+}
+
+bool Bvh::intersect(const Ray &ray, RayHit &hit, float maxDistance) const {
+  float distance = maxDistance;
+  unsigned int index = 0;
+  float u = 0.0f;
+  float v = 0.0f;
+  if (!traverse<false>(ray, distance, index, u, v))
+    return false;
+  hit.distance = distance;
+  hit.mesh = meshIds[index];
+  hit.instance = instanceIds[index];
+  hit.triangle = triangleIds[index];
+  hit.u = u;
+  hit.v = v;
+  hit.position = ray.origin + ray.direction * distance;
+  return true;
+}
+
+bool Bvh::occluded(const Ray &ray, float maxDistance) const {
+  float distance = maxDistance;
+  unsigned int index = 0;
+  float u = 0.0f;
+  float v = 0.0f;
+  return traverse<true>(ray, distance, index, u, v);
+}
+
+unsigned int Bvh::occludedPacket(const Ray* rays, float maxDistance) const {
+  if (nodes.empty())
+    return 0;
+#ifdef BVH_SSE
+  // one ray per lane
+  const __m128 ox = _mm_setr_ps(rays[0].origin.x, rays[1].origin.x,
+                                rays[2].origin.x, rays[3].origin.x);
+  const __m128 oy = _mm_setr_ps(rays[0].origin.y, rays[1].origin.y,
+                                rays[2].origin.y, rays[3].origin.y);
+  const __m128 oz = _mm_setr_ps(rays[0].origin.z, rays[1].origin.z,
+                                rays[2].origin.z, rays[3].origin.z);
+  const __m128 dx = _mm_setr_ps(rays[0].direction.x, rays[1].direction.x,
+                                rays[2].direction.x, rays[3].direction.x);
+  const __m128 dy = _mm_setr_ps(rays[0].direction.y, rays[1].direction.y,
+                                rays[2].direction.y, rays[3].direction.y);
+  const __m128 dz = _mm_setr_ps(rays[0].direction.z, rays[1].direction.z,
+                                rays[2].direction.z, rays[3].direction.z);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 ix = _mm_div_ps(one, dx);
+  const __m128 iy = _mm_div_ps(one, dy);
+  const __m128 iz = _mm_div_ps(one, dz);
+  const __m128 limit = _mm_set1_ps(maxDistance);
+
+  unsigned int blocked = 0;
+  unsigned int stack[STACK_SIZE];
+  unsigned int depth = 0;
+  unsigned int current = 0;
+  while (true) {
+    const Node &node = nodes[current];
+    // the node is entered when any ray that is still open hits its box
+    __m128 ax = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minimum.x), ox), ix);
+    __m128 bx = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maximum.x), ox), ix);
+    __m128 ay = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minimum.y), oy), iy);
+    __m128 by = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maximum.y), oy), iy);
+    __m128 az = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minimum.z), oz), iz);
+    __m128 bz = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maximum.z), oz), iz);
+    __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(ax, bx),
+                                         _mm_min_ps(ay, by)),
+                              _mm_max_ps(_mm_min_ps(az, bz), zero));
+    __m128 leave = _mm_min_ps(_mm_min_ps(_mm_max_ps(ax, bx),
+                                         _mm_max_ps(ay, by)),
+                              _mm_min_ps(_mm_max_ps(az, bz), limit));
+    unsigned int lanes = _mm_movemask_ps(_mm_cmple_ps(enter, leave)) &
+                         ~blocked;
+    if (lanes != 0 && node.count == 0) {
+      stack[depth++] = node.first + 1;
+      current = node.first;
+      continue;
+    }
+    if (lanes != 0) {
+      // every triangle of the leaf against all four rays
+      for (unsigned int i = node.first; i < node.first + node.count; i++) {
+        __m128 e1x4 = _mm_set1_ps(e1x[i]);
+        __m128 e1y4 = _mm_set1_ps(e1y[i]);
+        __m128 e1z4 = _mm_set1_ps(e1z[i]);
+        __m128 e2x4 = _mm_set1_ps(e2x[i]);
+        __m128 e2y4 = _mm_set1_ps(e2y[i]);
+        __m128 e2z4 = _mm_set1_ps(e2z[i]);
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z4), _mm_mul_ps(dz, e2y4));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x4), _mm_mul_ps(dx, e2z4));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y4), _mm_mul_ps(dy, e2x4));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x4, px),
+                                           _mm_mul_ps(e1y4, py)),
+                                _mm_mul_ps(e1z4, pz));
+        __m128 inverse = _mm_div_ps(one, det);
+        __m128 sx = _mm_sub_ps(ox, _mm_set1_ps(v0x[i]));
+        __m128 sy = _mm_sub_ps(oy, _mm_set1_ps(v0y[i]));
+        __m128 sz = _mm_sub_ps(oz, _mm_set1_ps(v0z[i]));
+        __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px),
+                                                     _mm_mul_ps(sy, py)),
+                                          _mm_mul_ps(sz, pz)), inverse);
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z4), _mm_mul_ps(sz, e1y4));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x4), _mm_mul_ps(sx, e1z4));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y4), _mm_mul_ps(sy, e1x4));
+        __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx),
+                                                     _mm_mul_ps(dy, qy)),
+                                          _mm_mul_ps(dz, qz)), inverse);
+        __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x4, qx),
+                                                     _mm_mul_ps(e2y4, qy)),
+                                          _mm_mul_ps(e2z4, qz)), inverse);
+        __m128 mask = _mm_and_ps(_mm_cmpge_ps(uu, zero),
+                                 _mm_cmpge_ps(vv, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(uu, vv), one));
+        mask = _mm_and_ps(mask, _mm_cmpgt_ps(tt, zero));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(tt, limit));
+        mask = _mm_and_ps(mask, _mm_cmpneq_ps(det, zero));
+        blocked |= _mm_movemask_ps(mask);
+        if (blocked == 15)
+          return blocked;
+      }
+    }
+    if (depth == 0)
+      return blocked;
+    current = stack[--depth];
+  }
+#else
+  unsigned int blocked = 0;
+  for (unsigned int i = 0; i < 4; i++)
+    if (occluded(rays[i], maxDistance))
+      blocked |= 1 << i;
+  return blocked;
+#endif
+}
+
+template<bool AnyHit>
+bool Bvh::traverse(const Ray &ray, float &distance, unsigned int &index,
+                   float &u, float &v) const {
+  if (nodes.empty())
+    return false;
+  glm::vec3 inverse = 1.0f / ray.direction;
+  if (intersectBox(nodes[0].minimum, nodes[0].maximum, ray.origin, inverse,
+                   distance) == FLT_MAX)
+    return false;
+
+  // the farther child waits on the stack with its entry distance, it is
+  // dropped when a closer hit was found in the meantime
+  unsigned int stack[STACK_SIZE];
+  float entries[STACK_SIZE];
+  unsigned int depth = 0;
+  unsigned int current = 0;
+  bool hit = false;
+  while (true) {
+    const Node &node = nodes[current];
+    if (node.count > 0) {
+      if (intersectLeaf(node, ray, distance, index, u, v)) {
+        hit = true;
+        if (AnyHit)
+          return true;
+      }
+    }
+    else {
+      unsigned int nearChild = node.first;
+      unsigned int farChild = node.first + 1;
+      float nearEntry = intersectBox(nodes[nearChild].minimum,
+                                     nodes[nearChild].maximum, ray.origin,
+                                     inverse, distance);
+      float farEntry = intersectBox(nodes[farChild].minimum,
+                                    nodes[farChild].maximum, ray.origin,
+                                    inverse, distance);
+      if (farEntry < nearEntry) {
+        std::swap(nearChild, farChild);
+        std::swap(nearEntry, farEntry);
+      }
+      if (nearEntry != FLT_MAX) {
+        if (farEntry != FLT_MAX) {
+          stack[depth] = farChild;
+          entries[depth++] = farEntry;
+        }
+        current = nearChild;
+        continue;
+      }
+    }
+    // next waiting node that can still hold a closer hit
+    do {
+      if (depth == 0)
+        return hit;
+      depth--;
+    } while (entries[depth] >= distance);
+    current = stack[depth];
+  }
+}
+
+bool Bvh::intersectLeaf(const Node &node, const Ray &ray, float &distance,
+                        unsigned int &index, float &u, float &v) const {
+  bool hit = false;
+  unsigned int i = node.first;
+  unsigned int end = node.first + node.count;
+#ifdef BVH_SSE
+  // four triangles at a time
+  const __m128 ox = _mm_set1_ps(ray.origin.x);
+  const __m128 oy = _mm_set1_ps(ray.origin.y);
+  const __m128 oz = _mm_set1_ps(ray.origin.z);
+  const __m128 dx = _mm_set1_ps(ray.direction.x);
+  const __m128 dy = _mm_set1_ps(ray.direction.y);
+  const __m128 dz = _mm_set1_ps(ray.direction.z);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  for (; i + 4 <= end; i += 4) {
+    __m128 ax = _mm_loadu_ps(&e1x[i]);
+    __m128 ay = _mm_loadu_ps(&e1y[i]);
+    __m128 az = _mm_loadu_ps(&e1z[i]);
+    __m128 bx = _mm_loadu_ps(&e2x[i]);
+    __m128 by = _mm_loadu_ps(&e2y[i]);
+    __m128 bz = _mm_loadu_ps(&e2z[i]);
+    // p = direction x e2
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, bz), _mm_mul_ps(dz, by));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, bx), _mm_mul_ps(dx, bz));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, by), _mm_mul_ps(dy, bx));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, px),
+                                       _mm_mul_ps(ay, py)),
+                            _mm_mul_ps(az, pz));
+    __m128 inverse = _mm_div_ps(one, det);
+    // s = origin - v0
+    __m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(&v0x[i]));
+    __m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(&v0y[i]));
+    __m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(&v0z[i]));
+    __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px),
+                                                 _mm_mul_ps(sy, py)),
+                                      _mm_mul_ps(sz, pz)), inverse);
+    // q = s x e1
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, az), _mm_mul_ps(sz, ay));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, ax), _mm_mul_ps(sx, az));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, ay), _mm_mul_ps(sy, ax));
+    __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx),
+                                                 _mm_mul_ps(dy, qy)),
+                                      _mm_mul_ps(dz, qz)), inverse);
+    __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(bx, qx),
+                                                 _mm_mul_ps(by, qy)),
+                                      _mm_mul_ps(bz, qz)), inverse);
+    // comparisons with nan from a zero determinant are false
+    __m128 mask = _mm_and_ps(_mm_cmpge_ps(uu, zero), _mm_cmpge_ps(vv, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(uu, vv), one));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(tt, zero));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(tt, _mm_set1_ps(distance)));
+    mask = _mm_and_ps(mask, _mm_cmpneq_ps(det, zero));
+    int lanes = _mm_movemask_ps(mask);
+    if (lanes == 0)
+      continue;
+    float ts[4], us[4], vs[4];
+    _mm_storeu_ps(ts, tt);
+    _mm_storeu_ps(us, uu);
+    _mm_storeu_ps(vs, vv);
+    for (unsigned int lane = 0; lane < 4; lane++)
+      if ((lanes & (1 << lane)) && ts[lane] < distance) {
+        distance = ts[lane];
+        index = i + lane;
+        u = us[lane];
+        v = vs[lane];
+        hit = true;
+      }
+  }
+#endif
+  for (; i < end; i++) {
+    float t, hitU, hitV;
+    if (intersectTriangle(ray.origin, ray.direction,
+                          glm::vec3(v0x[i], v0y[i], v0z[i]),
+                          glm::vec3(e1x[i], e1y[i], e1z[i]),
+                          glm::vec3(e2x[i], e2y[i], e2z[i]), t, hitU, hitV) &&
+        t < distance) {
+      distance = t;
+      index = i;
+      u = hitU;
+      v = hitV;
+      hit = true;
+    }
+  }
+  return hit;
+}
+
+Ray screenRay(const glm::mat4 &view, const glm::mat4 &projection, float x,
+              float y, int width, int height) {
+  glm::vec2 ndc(x / width * 2.0f - 1.0f, 1.0f - y / height * 2.0f);
+  glm::mat4 inverse = glm::inverse(projection * view);
+  glm::vec4 nearPoint = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+  glm::vec4 farPoint = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+  Ray ray;
+  ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+  ray.direction = glm::normalize(glm::vec3(farPoint) / farPoint.w -
+                                 ray.origin);
+  return ray;
+}
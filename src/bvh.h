@@ -0,0 +1,94 @@
+#ifndef bvh_h
+#define bvh_h
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "mesh.h"
+
+struct Ray {
+  glm::vec3 origin;
+  // doesn't need to be normalized, distances are in its length
+  glm::vec3 direction;
+};
+
+struct RayHit {
+  float distance;
+  unsigned int mesh;
+  // node using the mesh, the same triangle exists once per node
+  unsigned int instance;
+  unsigned int triangle;
+  // weights of the second and third corner, the first gets 1 - u - v
+  float u;
+  float v;
+  glm::vec3 position;
+};
+
+// triangles of one mesh placed by the transforms of its nodes
+struct BvhMesh {
+  const std::vector<Vertex>* vertices;
+  const std::vector<unsigned int>* indices;
+  std::vector<glm::mat4> transforms;
+};
+
+// bounding volume hierarchy over world space triangles
+class Bvh {
+public:
+  // binned surface area heuristic, subtrees are built in parallel
+  void build(const std::vector<BvhMesh> &meshes);
+  bool empty() const { return nodes.empty(); }
+  size_t getTriangleCount() const { return triangleCount; }
+  size_t getNodeCount() const { return nodeCount; }
+  double getBuildMs() const { return buildMs; }
+
+  // closest hit closer than maxDistance
+  bool intersect(const Ray &ray, RayHit &hit,
+                 float maxDistance = 1e30f) const;
+  // true as soon as any triangle closer than maxDistance is hit
+  bool occluded(const Ray &ray, float maxDistance = 1e30f) const;
+  // any hit test of four rays at once, bit i is set when ray i is blocked.
+  // the rays traverse the tree together, so they should start close to
+  // each other
+  unsigned int occludedPacket(const Ray* rays,
+                              float maxDistance = 1e30f) const;
+private:
+  // 32 bytes, interior nodes have count 0 and their children next to
+  // each other at first
+  struct Node {
+    glm::vec3 minimum;
+    unsigned int first;
+    glm::vec3 maximum;
+    unsigned int count;
+  };
+
+  std::vector<Node> nodes;
+  size_t nodeCount = 0;
+  size_t triangleCount = 0;
+  double buildMs = 0.0;
+
+  // triangles in leaf order as structure of arrays, corner 0 and the
+  // edges to corners 1 and 2
+  std::vector<float> v0x, v0y, v0z;
+  std::vector<float> e1x, e1y, e1z;
+  std::vector<float> e2x, e2y, e2z;
+  std::vector<unsigned int> meshIds;
+  std::vector<unsigned int> instanceIds;
+  std::vector<unsigned int> triangleIds;
+
+  struct BuildState;
+  // splits the triangles of a node until the leaves are small, with defer
+  // set the nodes below the task size are queued for the workers instead
+  void subdivide(BuildState &state, unsigned int node, unsigned int first,
+                 unsigned int count, unsigned int depth, bool defer);
+
+  template<bool AnyHit>
+  bool traverse(const Ray &ray, float &distance, unsigned int &index,
+                float &u, float &v) const;
+  bool intersectLeaf(const Node &node, const Ray &ray, float &distance,
+                     unsigned int &index, float &u, float &v) const;
+};
+
+// ray through the pixel of a window with the origin at the top left
+Ray screenRay(const glm::mat4 &view, const glm::mat4 &projection, float x,
+              float y, int width, int height);
+
+#endif
@@ -20,6 +20,7 @@ public:
   void handleKeyboard(Movement direction, float deltaTime);
   void handleMouse(float xoffset, float yoffset);
   glm::mat4 getView();
+  glm::vec3 getPosition() const { return position; }
 private:
   glm::vec3 position;
   glm::vec3 front;
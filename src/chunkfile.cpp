@@ -0,0 +1,644 @@
+#include "chunkfile.h"
+#include "importprofile.h"
+#include "jobsystem.h"
+#include "lod.h"
+#include "spatialkey.h"
+#include "stlfile.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+struct ChunkFileHeader {
+  char magic[4];
+  uint32_t nodeCount;
+  uint64_t tableOffset;
+  uint64_t triangles;
+};
+
+const char CHUNK_MAGIC[4] = { 'M', 'C', 'K', '1' };
+// cells of the finest octree level on each axis, as bits
+const int GRID_BITS = 10;
+// triangles of the source read and sorted at once
+const size_t BATCH_TRIANGLES = 1 << 18;
+const size_t TRIANGLE_BYTES = 3 * sizeof(Vertex);
+
+// binary stl, read straight from the mapped file
+struct StlSource {
+  StlFile stl;
+
+  size_t count() const { return stl.triangles; }
+  // the normals are computed later
+  void get(size_t index, Vertex* corners) const {
+    for (unsigned int c = 0; c < 3; c++) {
+      corners[c].position = stl.corner(index, c);
+      corners[c].normal = glm::vec3(0.0f);
+      corners[c].texturecoord = glm::vec2(0.0f);
+    }
+  }
+  void release(size_t begin, size_t end) const {
+    stl.release(begin, end);
+  }
+};
+
+// every triangle of an imported scene, placed by its node
+struct SceneSource {
+  struct Face {
+    unsigned int mesh;
+    unsigned int face;
+    unsigned int transform;
+  };
+  const aiScene* scene;
+  std::vector<Face> faces;
+  std::vector<glm::mat4> transforms;
+
+  void addNode(const aiNode* node, const glm::mat4 &parent) {
+    aiMatrix4x4 m = node->mTransformation;
+    glm::mat4 transform = parent * glm::transpose(glm::make_mat4(&m.a1));
+    transforms.push_back(transform);
+    for (unsigned int i = 0; i < node->mNumMeshes; i++) {
+      const aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+      for (unsigned int f = 0; f < mesh->mNumFaces; f++)
+        if (mesh->mFaces[f].mNumIndices == 3)
+          faces.push_back({ node->mMeshes[i], f,
+                            (unsigned int)transforms.size() - 1 });
+    }
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+      addNode(node->mChildren[i], transform);
+  }
+  size_t count() const { return faces.size(); }
+  void get(size_t index, Vertex* corners) const {
+    const Face &face = faces[index];
+    const aiMesh* mesh = scene->mMeshes[face.mesh];
+    const glm::mat4 &transform = transforms[face.transform];
+    for (int c = 0; c < 3; c++) {
+      unsigned int v = mesh->mFaces[face.face].mIndices[c];
+      const aiVector3D &p = mesh->mVertices[v];
+      corners[c].position = glm::vec3(transform * glm::vec4(p.x, p.y, p.z,
+                                                            1.0f));
+      corners[c].normal = glm::vec3(0.0f);
+      if (mesh->mNormals) {
+        const aiVector3D &n = mesh->mNormals[v];
+        corners[c].normal = glm::vec3(transform * glm::vec4(n.x, n.y, n.z,
+                                                            0.0f));
+      }
+      corners[c].texturecoord = glm::vec2(0.0f);
+      if (mesh->mTextureCoords[0])
+        corners[c].texturecoord = glm::vec2(mesh->mTextureCoords[0][v].x,
+                                            mesh->mTextureCoords[0][v].y);
+    }
+  }
+  void release(size_t, size_t) const {}
+};
+
+struct Cell {
+  uint32_t code;
+  uint64_t triangles;
+};
+
+// a node while the file is built, the table is written once all are done
+struct BuildNode {
+  size_t firstCell;
+  size_t lastCell;
+  uint64_t triangles;
+  unsigned int depth;
+  // distance to the deepest leaf below, leaves are 0
+  unsigned int height;
+  std::vector<size_t> children;
+  glm::vec3 boundsMin;
+  glm::vec3 boundsMax;
+  float error;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint64_t offset;
+};
+
+// corners with the same position and texture coordinate become one
+// vertex, their normals are averaged. corners without normals get the
+// area weighted normal of their triangles
+struct WeldKey {
+  float values[5];
+  bool operator==(const WeldKey &other) const {
+    return std::memcmp(values, other.values, sizeof(values)) == 0;
+  }
+};
+
+struct WeldHash {
+  size_t operator()(const WeldKey &key) const {
+    return (size_t)hashFloats(key.values, 5);
+  }
+};
+
+void weld(const Vertex* corners, size_t count, std::vector<Vertex> &vertices,
+          std::vector<unsigned int> &indices) {
+  std::unordered_map<WeldKey, unsigned int, WeldHash> welded;
+  std::vector<glm::vec3> computed;
+  vertices.clear();
+  indices.clear();
+  for (size_t t = 0; t + 2 < count; t += 3) {
+    unsigned int triangle[3];
+    for (int c = 0; c < 3; c++) {
+      const Vertex &corner = corners[t + c];
+      WeldKey key = { { corner.position.x, corner.position.y,
+                        corner.position.z, corner.texturecoord.x,
+                        corner.texturecoord.y } };
+      auto inserted = welded.insert({ key, (unsigned int)vertices.size() });
+      if (inserted.second) {
+        vertices.push_back(corner);
+        computed.push_back(glm::vec3(0.0f));
+      }
+      else
+        vertices[inserted.first->second].normal += corner.normal;
+      triangle[c] = inserted.first->second;
+    }
+    // triangles that lost an edge to the welding are dropped
+    if (triangle[0] != triangle[1] && triangle[1] != triangle[2] &&
+        triangle[0] != triangle[2])
+      indices.insert(indices.end(), triangle, triangle + 3);
+  }
+  for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+    const glm::vec3 &a = vertices[indices[t]].position;
+    const glm::vec3 &b = vertices[indices[t + 1]].position;
+    const glm::vec3 &c = vertices[indices[t + 2]].position;
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    for (int k = 0; k < 3; k++)
+      computed[indices[t + k]] += normal;
+  }
+  for (size_t v = 0; v < vertices.size(); v++) {
+    glm::vec3 normal = vertices[v].normal;
+    if (glm::dot(normal, normal) < 1e-12f)
+      normal = computed[v];
+    float length = glm::length(normal);
+    vertices[v].normal = length > 0.0f ? normal / length :
+                                         glm::vec3(0.0f, 1.0f, 0.0f);
+  }
+}
+
+// drops the vertices the simplified indices don't use any more
+void compact(std::vector<Vertex> &vertices,
+             std::vector<unsigned int> &indices) {
+  std::vector<unsigned int> remap(vertices.size(), 0xffffffffu);
+  std::vector<Vertex> used;
+  for (unsigned int &index : indices) {
+    if (remap[index] == 0xffffffffu) {
+      remap[index] = (unsigned int)used.size();
+      used.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices.swap(used);
+}
+
+struct NodeMesh {
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  float error = 0.0f;
+};
+
+void writeMesh(std::ofstream &out, const NodeMesh &mesh, BuildNode &node,
+               size_t &offset) {
+  node.vertexCount = (uint32_t)mesh.vertices.size();
+  node.indexCount = (uint32_t)mesh.indices.size();
+  node.offset = offset;
+  out.write((const char*)mesh.vertices.data(),
+            mesh.vertices.size() * sizeof(Vertex));
+  out.write((const char*)mesh.indices.data(),
+            mesh.indices.size() * sizeof(unsigned int));
+  offset += mesh.vertices.size() * sizeof(Vertex) +
+            mesh.indices.size() * sizeof(unsigned int);
+  node.boundsMin = glm::vec3(1e30f);
+  node.boundsMax = glm::vec3(-1e30f);
+  for (const Vertex &vertex : mesh.vertices) {
+    node.boundsMin = glm::min(node.boundsMin, vertex.position);
+    node.boundsMax = glm::max(node.boundsMax, vertex.position);
+  }
+}
+
+// nodes over the sorted cells, a node with few triangles or at the finest
+// level is a leaf. nodes with a single child are skipped
+size_t buildTree(const std::vector<Cell> &cells, size_t first, size_t last,
+                 unsigned int depth, std::vector<BuildNode> &nodes) {
+  uint64_t triangles = 0;
+  for (size_t i = first; i < last; i++)
+    triangles += cells[i].triangles;
+  size_t index = nodes.size();
+  nodes.push_back(BuildNode());
+  nodes[index].firstCell = first;
+  nodes[index].lastCell = last;
+  nodes[index].triangles = triangles;
+  nodes[index].depth = depth;
+  nodes[index].height = 0;
+  nodes[index].error = 0.0f;
+  for (unsigned int level = depth; level < GRID_BITS; level++) {
+    if (triangles <= CHUNK_TRIANGLES)
+      break;
+    int shift = 3 * (GRID_BITS - level - 1);
+    std::vector<size_t> starts;
+    for (size_t i = first; i < last; i++)
+      if (i == first || (cells[i].code >> shift & 7) !=
+                        (cells[i - 1].code >> shift & 7))
+        starts.push_back(i);
+    if (starts.size() == 1)
+      continue;
+    starts.push_back(last);
+    unsigned int height = 0;
+    for (size_t k = 0; k + 1 < starts.size(); k++) {
+      size_t child = buildTree(cells, starts[k], starts[k + 1], level + 1,
+                               nodes);
+      nodes[index].children.push_back(child);
+      height = std::max(height, nodes[child].height + 1);
+    }
+    nodes[index].height = height;
+    break;
+  }
+  return index;
+}
+
+template <typename Source>
+bool buildChunks(const Source &source, const std::string &path,
+                 ChunkBuildStats &stats, std::string &error) {
+  JobSystem &jobs = JobSystem::get();
+  size_t count = source.count();
+  if (count == 0) {
+    error = "the model has no triangles";
+    return false;
+  }
+  stats.triangles = count;
+
+  // bounds of the whole model, the grid is a cube around them
+  glm::vec3 boundsMin = glm::vec3(1e30f);
+  glm::vec3 boundsMax = glm::vec3(-1e30f);
+  std::mutex mutex;
+  for (size_t batch = 0; batch < count; batch += BATCH_TRIANGLES) {
+    size_t end = std::min(batch + BATCH_TRIANGLES, count);
+    jobs.parallelFor(end - batch, 4096, [&](size_t begin, size_t stop) {
+      glm::vec3 low = glm::vec3(1e30f);
+      glm::vec3 high = glm::vec3(-1e30f);
+      Vertex corners[3];
+      for (size_t i = batch + begin; i < batch + stop; i++) {
+        source.get(i, corners);
+        for (const Vertex &corner : corners) {
+          low = glm::min(low, corner.position);
+          high = glm::max(high, corner.position);
+        }
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      boundsMin = glm::min(boundsMin, low);
+      boundsMax = glm::max(boundsMax, high);
+    });
+    source.release(batch, end);
+  }
+  glm::vec3 extent = boundsMax - boundsMin;
+  float size = std::max(std::max(extent.x, extent.y),
+                        std::max(extent.z, 1e-6f));
+  // the octree cells at the finest level
+  MortonGrid grid = { boundsMin, (1 << GRID_BITS) / (size * 1.0001f),
+                      GRID_BITS };
+
+  // triangles of every occupied cell, by the centre of the triangle
+  std::vector<uint32_t> codes(BATCH_TRIANGLES);
+  auto cellCodes = [&](size_t batch, size_t end) {
+    jobs.parallelFor(end - batch, 4096, [&](size_t begin, size_t stop) {
+      Vertex corners[3];
+      for (size_t i = begin; i < stop; i++) {
+        source.get(batch + i, corners);
+        codes[i] = grid.code((corners[0].position + corners[1].position +
+                              corners[2].position) / 3.0f);
+      }
+    });
+  };
+  std::unordered_map<uint32_t, uint64_t> occupied;
+  for (size_t batch = 0; batch < count; batch += BATCH_TRIANGLES) {
+    size_t end = std::min(batch + BATCH_TRIANGLES, count);
+    cellCodes(batch, end);
+    for (size_t i = 0; i < end - batch; i++)
+      occupied[codes[i]]++;
+    source.release(batch, end);
+  }
+  std::vector<Cell> cells;
+  cells.reserve(occupied.size());
+  for (const auto &cell : occupied)
+    cells.push_back({ cell.first, cell.second });
+  occupied.clear();
+  std::sort(cells.begin(), cells.end(), [](const Cell &a, const Cell &b) {
+    return a.code < b.code;
+  });
+
+  std::vector<BuildNode> nodes;
+  buildTree(cells, 0, cells.size(), 0, nodes);
+  // the leaves in code order, each owns a run of the temporary file
+  std::vector<size_t> leaves;
+  for (size_t i = 0; i < nodes.size(); i++)
+    if (nodes[i].children.empty())
+      leaves.push_back(i);
+  std::vector<uint32_t> leafCodes;
+  std::vector<uint64_t> cursors;
+  uint64_t leafOffset = 0;
+  for (size_t leaf : leaves) {
+    leafCodes.push_back(cells[nodes[leaf].firstCell].code);
+    cursors.push_back(leafOffset);
+    leafOffset += nodes[leaf].triangles * TRIANGLE_BYTES;
+  }
+  stats.leaves = leaves.size();
+  stats.nodes = nodes.size();
+  stats.height = nodes[0].height;
+
+  // sorts the triangles into the runs of their leaves a batch at a time
+  std::string scratchPath = path + ".tmp";
+  {
+    std::ofstream scratch(scratchPath, std::ios::binary | std::ios::trunc);
+    if (!scratch) {
+      error = "can't write " + scratchPath;
+      return false;
+    }
+    std::vector<std::pair<uint32_t, uint32_t>> order(BATCH_TRIANGLES);
+    std::vector<Vertex> corners(BATCH_TRIANGLES * 3);
+    for (size_t batch = 0; batch < count; batch += BATCH_TRIANGLES) {
+      size_t end = std::min(batch + BATCH_TRIANGLES, count);
+      size_t size = end - batch;
+      cellCodes(batch, end);
+      for (size_t i = 0; i < size; i++)
+        order[i] = { (uint32_t)(std::upper_bound(leafCodes.begin(),
+                                                 leafCodes.end(), codes[i]) -
+                                leafCodes.begin() - 1), (uint32_t)i };
+      std::sort(order.begin(), order.begin() + size);
+      jobs.parallelFor(size, 4096, [&](size_t begin, size_t stop) {
+        for (size_t i = begin; i < stop; i++)
+          source.get(batch + order[i].second, &corners[i * 3]);
+      });
+      for (size_t i = 0; i < size;) {
+        size_t run = i;
+        while (run < size && order[run].first == order[i].first)
+          run++;
+        uint64_t &cursor = cursors[order[i].first];
+        scratch.seekp(cursor);
+        scratch.write((const char*)&corners[i * 3], (run - i) *
+                                                     TRIANGLE_BYTES);
+        cursor += (run - i) * TRIANGLE_BYTES;
+        i = run;
+      }
+      source.release(batch, end);
+    }
+    scratch.close();
+    if (!scratch) {
+      std::remove(scratchPath.c_str());
+      error = "can't write " + scratchPath;
+      return false;
+    }
+  }
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    std::remove(scratchPath.c_str());
+    error = "can't write " + path;
+    return false;
+  }
+  ChunkFileHeader header = {};
+  out.write((const char*)&header, sizeof(header));
+  size_t offset = sizeof(header);
+  // a few nodes per thread are in memory at once
+  size_t group = jobs.getThreadCount() * 2;
+
+  // the leaves are welded from their run of corners
+  {
+    MappedFile scratch(scratchPath, ACCESS_SEQUENTIAL);
+    if (!scratch.isOpen()) {
+      std::remove(scratchPath.c_str());
+      error = "can't read back " + scratchPath;
+      return false;
+    }
+    uint64_t run = 0;
+    for (size_t first = 0; first < leaves.size(); first += group) {
+      size_t last = std::min(first + group, leaves.size());
+      std::vector<uint64_t> starts(last - first);
+      for (size_t k = first; k < last; k++) {
+        starts[k - first] = run;
+        run += nodes[leaves[k]].triangles * TRIANGLE_BYTES;
+      }
+      std::vector<NodeMesh> meshes(last - first);
+      jobs.parallelFor(last - first, 1, [&](size_t begin, size_t stop) {
+        for (size_t k = begin; k < stop; k++)
+          weld((const Vertex*)(scratch.data() + starts[k]),
+               nodes[leaves[first + k]].triangles * 3, meshes[k].vertices,
+               meshes[k].indices);
+      });
+      for (size_t k = first; k < last; k++)
+        writeMesh(out, meshes[k - first], nodes[leaves[k]], offset);
+      scratch.release(starts[0], run - starts[0]);
+    }
+  }
+  std::remove(scratchPath.c_str());
+
+  // inner nodes from their children read back from the file, a height at
+  // a time so the children are always written
+  for (unsigned int height = 1; height <= nodes[0].height; height++) {
+    std::vector<size_t> inner;
+    for (size_t i = 0; i < nodes.size(); i++)
+      if (nodes[i].height == height)
+        inner.push_back(i);
+    out.flush();
+    MappedFile written(path, ACCESS_RANDOM);
+    if (!written.isOpen()) {
+      error = "can't read back " + path;
+      return false;
+    }
+    for (size_t first = 0; first < inner.size(); first += group) {
+      size_t last = std::min(first + group, inner.size());
+      std::vector<NodeMesh> meshes(last - first);
+      jobs.parallelFor(last - first, 1, [&](size_t begin, size_t stop) {
+        for (size_t k = begin; k < stop; k++) {
+          BuildNode &node = nodes[inner[first + k]];
+          std::vector<Vertex> corners;
+          float childError = 0.0f;
+          for (size_t child : node.children) {
+            const BuildNode &part = nodes[child];
+            const Vertex* vertices =
+                (const Vertex*)(written.data() + part.offset);
+            const unsigned int* indices =
+                (const unsigned int*)(vertices + part.vertexCount);
+            for (uint32_t i = 0; i < part.indexCount; i++)
+              corners.push_back(vertices[indices[i]]);
+            childError = std::max(childError, part.error);
+          }
+          NodeMesh &mesh = meshes[k];
+          weld(corners.data(), corners.size(), mesh.vertices, mesh.indices);
+          std::vector<Vertex>().swap(corners);
+          float simplified = 0.0f;
+          mesh.indices = simplifyMesh(mesh.vertices, mesh.indices,
+                                      CHUNK_TRIANGLES * 3, simplified);
+          compact(mesh.vertices, mesh.indices);
+          mesh.error = childError + simplified;
+        }
+      });
+      for (size_t k = first; k < last; k++) {
+        BuildNode &node = nodes[inner[k]];
+        writeMesh(out, meshes[k - first], node, offset);
+        node.error = meshes[k - first].error;
+        // the parent covers its children even where it lost triangles
+        for (size_t child : node.children) {
+          node.boundsMin = glm::min(node.boundsMin, nodes[child].boundsMin);
+          node.boundsMax = glm::max(node.boundsMax, nodes[child].boundsMax);
+          written.release(nodes[child].offset,
+                          nodes[child].vertexCount * sizeof(Vertex) +
+                          nodes[child].indexCount * sizeof(unsigned int));
+        }
+      }
+    }
+  }
+
+  // breadth first, so the children of a node are next to each other
+  std::vector<size_t> order(1, 0);
+  std::vector<uint32_t> slots(nodes.size(), 0);
+  for (size_t i = 0; i < order.size(); i++)
+    for (size_t child : nodes[order[i]].children) {
+      slots[child] = (uint32_t)order.size();
+      order.push_back(child);
+    }
+  std::vector<ChunkNode> table(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    const BuildNode &node = nodes[order[i]];
+    ChunkNode &entry = table[i];
+    glm::vec3 center = (node.boundsMin + node.boundsMax) * 0.5f;
+    entry.center[0] = center.x;
+    entry.center[1] = center.y;
+    entry.center[2] = center.z;
+    entry.radius = glm::length(node.boundsMax - center);
+    entry.error = node.error;
+    entry.firstChild = node.children.empty() ? 0 : slots[node.children[0]];
+    entry.childCount = (uint32_t)node.children.size();
+    entry.vertexCount = node.vertexCount;
+    entry.indexCount = node.indexCount;
+    entry.depth = node.depth;
+    entry.offset = node.offset;
+  }
+  out.write((const char*)table.data(), table.size() * sizeof(ChunkNode));
+  std::memcpy(header.magic, CHUNK_MAGIC, sizeof(CHUNK_MAGIC));
+  header.nodeCount = (uint32_t)table.size();
+  header.tableOffset = offset;
+  header.triangles = count;
+  out.seekp(0);
+  out.write((const char*)&header, sizeof(header));
+  out.close();
+  if (!out) {
+    error = "can't write " + path;
+    return false;
+  }
+  stats.bytes = offset + table.size() * sizeof(ChunkNode);
+  return true;
+}
+
+}
+
+bool ChunkFile::open(const std::string &path, std::string &error) {
+  file = MappedFile(path, ACCESS_RANDOM);
+  nodes.clear();
+  if (!file.isOpen()) {
+    error = "can't open the file";
+    return false;
+  }
+  ChunkFileHeader header;
+  if (file.size() < sizeof(header)) {
+    error = "not a chunk file";
+    return false;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, CHUNK_MAGIC, sizeof(CHUNK_MAGIC)) != 0 ||
+      header.nodeCount == 0) {
+    error = "not a chunk file";
+    return false;
+  }
+  if (header.tableOffset > file.size() ||
+      (uint64_t)header.nodeCount * sizeof(ChunkNode) >
+      file.size() - header.tableOffset) {
+    error = "chunk file is truncated";
+    return false;
+  }
+  nodes.resize(header.nodeCount);
+  std::memcpy(nodes.data(), file.data() + header.tableOffset,
+              nodes.size() * sizeof(ChunkNode));
+  // the children follow their parent, so the selection can't loop, and
+  // the triangles of every node lie before the table
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const ChunkNode &node = nodes[i];
+    bool children = node.childCount == 0 ||
+                    (node.childCount <= 8 && node.firstChild > i &&
+                     (uint64_t)node.firstChild + node.childCount <=
+                     nodes.size());
+    if (!children || node.indexCount % 3 != 0 ||
+        node.offset > header.tableOffset ||
+        getNodeBytes(node) > header.tableOffset - node.offset) {
+      nodes.clear();
+      error = "chunk file is broken";
+      return false;
+    }
+  }
+  triangles = header.triangles;
+  return true;
+}
+
+void ChunkFile::read(const ChunkNode &node, std::vector<Vertex> &vertices,
+                     std::vector<unsigned int> &indices) const {
+  const unsigned char* data = file.data() + node.offset;
+  vertices.resize(node.vertexCount);
+  indices.resize(node.indexCount);
+  std::memcpy(vertices.data(), data, node.vertexCount * sizeof(Vertex));
+  std::memcpy(indices.data(), data + node.vertexCount * sizeof(Vertex),
+              node.indexCount * sizeof(unsigned int));
+  // an index past the vertices would read outside the buffer, such a node
+  // is drawn empty
+  for (unsigned int index : indices)
+    if (index >= node.vertexCount) {
+      vertices.clear();
+      indices.clear();
+      return;
+    }
+}
+
+void ChunkFile::release(const ChunkNode &node) const {
+  file.release(node.offset, getNodeBytes(node));
+}
+
+void ChunkBuildStats::print(std::ostream &out) const {
+  const double mb = 1024.0 * 1024.0;
+  out << "chunk file: " << triangles << " triangles into " << leaves
+      << " leaves and " << nodes - leaves << " simplified nodes, "
+      << height + 1 << " levels, " << std::fixed << std::setprecision(1)
+      << bytes / mb << " MB in " << ms << " ms on "
+      << JobSystem::get().getThreadCount() << " threads, peak memory "
+      << peakResidentBytes() / mb << " MB" << std::endl;
+}
+
+bool buildChunkFile(const std::string &model, const std::string &path,
+                    ChunkBuildStats &stats, std::string &error) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  bool built;
+  MappedFile file(model, ACCESS_SEQUENTIAL);
+  StlSource stl;
+  if (openStlFile(file, stl.stl))
+    built = buildChunks(stl, path, stats, error);
+  else {
+    file = MappedFile();
+    Assimp::Importer importer;
+    ImportOptions options;
+    options.profile = PROFILE_FAST;
+    SceneSource source;
+    source.scene = importScene(importer, model, options);
+    if (!source.scene || !source.scene->mRootNode) {
+      error = "can't import " + model + ": " + importer.GetErrorString();
+      return false;
+    }
+    source.addNode(source.scene->mRootNode, glm::mat4(1.0f));
+    built = buildChunks(source, path, stats, error);
+  }
+  stats.ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  return built;
+}
@@ -0,0 +1,78 @@
+#ifndef chunkfile_h
+#define chunkfile_h
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "mappedfile.h"
+#include "mesh.h"
+
+// leaves hold about this many triangles of the original, inner nodes are
+// simplified down to it from their children
+const unsigned int CHUNK_TRIANGLES = 32768;
+
+// a node of the chunk octree. the children of a node follow each other in
+// the table, the root is the first node
+struct ChunkNode {
+  float center[3];
+  float radius;
+  // distance the simplified surface may be away from the original in model
+  // units, 0 for the leaves
+  float error;
+  uint32_t firstChild;
+  uint32_t childCount;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t depth;
+  // the vertices followed by the indices of the node
+  uint64_t offset;
+};
+
+// a model partitioned into an octree of chunks with simplified inner
+// nodes, read from the mapped file one node at a time
+class ChunkFile {
+public:
+  // false with the reason in error
+  bool open(const std::string &path, std::string &error);
+  bool isOpen() const { return file.isOpen() && !nodes.empty(); }
+  const std::vector<ChunkNode> &getNodes() const { return nodes; }
+  // triangles of the model the file was built from
+  uint64_t getTriangleCount() const { return triangles; }
+  size_t getNodeBytes(const ChunkNode &node) const {
+    return node.vertexCount * sizeof(Vertex) +
+           node.indexCount * sizeof(unsigned int);
+  }
+  // copies the vertices and indices of a node out of the mapping, both
+  // empty when an index is out of range
+  void read(const ChunkNode &node, std::vector<Vertex> &vertices,
+            std::vector<unsigned int> &indices) const;
+  // the memory of a node that was copied can be dropped
+  void release(const ChunkNode &node) const;
+private:
+  MappedFile file;
+  std::vector<ChunkNode> nodes;
+  uint64_t triangles = 0;
+};
+
+struct ChunkBuildStats {
+  uint64_t triangles = 0;
+  size_t leaves = 0;
+  size_t nodes = 0;
+  unsigned int height = 0;
+  size_t bytes = 0;
+  double ms = 0.0;
+
+  void print(std::ostream &out) const;
+};
+
+// partitions the triangles of a model into octree leaves on all cores and
+// simplifies every inner node from its children. binary stl is streamed
+// from the mapped file and the triangles are sorted into the leaves
+// through a temporary file next to the output, so the model may be larger
+// than memory. other formats are imported with assimp as a whole
+bool buildChunkFile(const std::string &model, const std::string &path,
+                    ChunkBuildStats &stats, std::string &error);
+
+#endif
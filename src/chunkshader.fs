@@ -0,0 +1,11 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 Normal;
+
+void main()
+{
+  // chunk files carry no materials, both sides face the light
+  float light = abs(normalize(Normal).z);
+  FragColor = vec4(vec3(0.2 + 0.7 * light), 1.0);
+}
@@ -0,0 +1,15 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+
+out vec3 Normal;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+  // the normal in view space, lit from the camera
+  Normal = mat3(view) * aNormal;
+  gl_Position = projection * view * vec4(aPos, 1.0);
+}
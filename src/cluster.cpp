@@ -0,0 +1,162 @@
+#include "cluster.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace {
+
+// bounding sphere and normal cone of the triangles of one cluster
+void computeClusterBounds(Cluster &cluster, const std::vector<Vertex> &vertices,
+                          const std::vector<unsigned int> &indices) {
+  unsigned int begin = cluster.indexOffset;
+  unsigned int end = begin + cluster.indexCount;
+  glm::vec3 minimum = vertices[indices[begin]].position;
+  glm::vec3 maximum = minimum;
+  glm::vec3 normalSum(0.0f);
+  std::vector<glm::vec3> normals;
+  for (unsigned int i = begin; i < end; i += 3) {
+    glm::vec3 p0 = vertices[indices[i]].position;
+    glm::vec3 p1 = vertices[indices[i + 1]].position;
+    glm::vec3 p2 = vertices[indices[i + 2]].position;
+    minimum = glm::min(minimum, glm::min(p0, glm::min(p1, p2)));
+    maximum = glm::max(maximum, glm::max(p0, glm::max(p1, p2)));
+    glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+    float length = glm::length(normal);
+    // degenerate triangles can face every direction, they don't count
+    if (length > 0.0f) {
+      normals.push_back(normal / length);
+      normalSum += normals.back();
+    }
+  }
+
+  cluster.center = (minimum + maximum) * 0.5f;
+  cluster.radius = 0.0f;
+  for (unsigned int i = begin; i < end; i++)
+    cluster.radius = std::max(cluster.radius, glm::length(
+        vertices[indices[i]].position - cluster.center));
+
+  cluster.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+  cluster.coneCutoff = 2.0f;
+  float axisLength = glm::length(normalSum);
+  if (axisLength <= 0.0f)
+    return;
+  cluster.coneAxis = normalSum / axisLength;
+  float minimumDot = 1.0f;
+  for (const glm::vec3 &normal : normals)
+    minimumDot = std::min(minimumDot, glm::dot(normal, cluster.coneAxis));
+  // cones wider than about 85 degrees are never fully backfacing
+  if (minimumDot > 0.1f)
+    cluster.coneCutoff = std::sqrt(1.0f - minimumDot * minimumDot);
+}
+
+}
+
+std::vector<Cluster> buildClusters(const std::vector<Vertex> &vertices,
+                                   std::vector<unsigned int> &indices,
+                                   unsigned int maxTriangles,
+                                   unsigned int maxVertices) {
+  unsigned int triangleCount = indices.size() / 3;
+
+  // triangles around every vertex in one flat array
+  std::vector<unsigned int> offsets(vertices.size() + 1, 0);
+  for (unsigned int index : indices)
+    offsets[index + 1]++;
+  for (size_t i = 1; i < offsets.size(); i++)
+    offsets[i] += offsets[i - 1];
+  std::vector<unsigned int> adjacency(indices.size());
+  std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+  for (unsigned int i = 0; i < indices.size(); i++)
+    adjacency[fill[indices[i]]++] = i / 3;
+
+  std::vector<bool> assigned(triangleCount, false);
+  std::vector<unsigned int> vertexCluster(vertices.size(), UINT_MAX);
+  std::vector<unsigned int> candidateCluster(triangleCount, UINT_MAX);
+  std::vector<unsigned int> candidates;
+  std::vector<unsigned int> reordered;
+  reordered.reserve(indices.size());
+  std::vector<Cluster> clusters;
+
+  unsigned int seed = 0;
+  while (true) {
+    while (seed < triangleCount && assigned[seed])
+      seed++;
+    if (seed == triangleCount)
+      break;
+
+    unsigned int id = clusters.size();
+    Cluster cluster;
+    cluster.indexOffset = reordered.size();
+    unsigned int clusterVertices = 0;
+    unsigned int clusterTriangles = 0;
+    candidates.clear();
+
+    unsigned int next = seed;
+    while (true) {
+      // take the triangle and queue its unassigned neighbours
+      assigned[next] = true;
+      clusterTriangles++;
+      for (int c = 0; c < 3; c++) {
+        unsigned int vertex = indices[next * 3 + c];
+        reordered.push_back(vertex);
+        if (vertexCluster[vertex] == id)
+          continue;
+        vertexCluster[vertex] = id;
+        clusterVertices++;
+        for (unsigned int a = offsets[vertex]; a < offsets[vertex + 1]; a++) {
+          unsigned int neighbour = adjacency[a];
+          if (!assigned[neighbour] && candidateCluster[neighbour] != id) {
+            candidateCluster[neighbour] = id;
+            candidates.push_back(neighbour);
+          }
+        }
+      }
+      if (clusterTriangles == maxTriangles)
+        break;
+
+      // prefer the candidate adding the fewest new vertices, candidates
+      // that can't fit anymore never will, so they are dropped
+      int best = -1;
+      unsigned int bestNew = 4;
+      size_t kept = 0;
+      for (size_t i = 0; i < candidates.size(); i++) {
+        unsigned int triangle = candidates[i];
+        if (assigned[triangle])
+          continue;
+        unsigned int added = 0;
+        for (int c = 0; c < 3; c++)
+          added += vertexCluster[indices[triangle * 3 + c]] != id;
+        if (clusterVertices + added > maxVertices)
+          continue;
+        candidates[kept] = triangle;
+        if (added < bestNew) {
+          bestNew = added;
+          best = (int)kept;
+        }
+        kept++;
+      }
+      candidates.resize(kept);
+      if (best < 0)
+        break;
+      next = candidates[best];
+    }
+
+    cluster.indexCount = reordered.size() - cluster.indexOffset;
+    computeClusterBounds(cluster, vertices, reordered);
+    clusters.push_back(cluster);
+  }
+
+  indices.swap(reordered);
+  return clusters;
+}
+
+ClusterVisibility testCluster(const Cluster &cluster, const Frustum &frustum,
+                              const glm::vec3 &camera) {
+  if (!frustum.containsSphere(cluster.center, cluster.radius))
+    return CLUSTER_OUTSIDE;
+  // the camera sees the back of every triangle in the cone
+  glm::vec3 toCluster = cluster.center - camera;
+  if (glm::dot(toCluster, cluster.coneAxis) >=
+      cluster.coneCutoff * glm::length(toCluster) + cluster.radius)
+    return CLUSTER_BACKFACING;
+  return CLUSTER_VISIBLE;
+}
@@ -0,0 +1,46 @@
+#ifndef cluster_h
+#define cluster_h
+
+#include <vector>
+#include "frustum.h"
+#include "mesh.h"
+
+// a small, spatially close group of triangles with its bounds
+struct Cluster {
+  unsigned int indexOffset;
+  unsigned int indexCount;
+  glm::vec3 center;
+  float radius;
+  // normals of all triangles lie in the cone around the axis, a cutoff
+  // above 1 disables the backface test
+  glm::vec3 coneAxis;
+  float coneCutoff;
+};
+
+struct ClusterStats {
+  size_t clusters = 0;
+  size_t frustumCulled = 0;
+  size_t backfaceCulled = 0;
+  size_t occlusionCulled = 0;
+  size_t drawRanges = 0;
+  double cullMs = 0.0;
+};
+
+enum ClusterVisibility {
+  CLUSTER_VISIBLE,
+  CLUSTER_OUTSIDE,
+  CLUSTER_BACKFACING,
+  CLUSTER_OCCLUDED
+};
+
+// reorders the triangles so every cluster is contiguous in the indices
+std::vector<Cluster> buildClusters(const std::vector<Vertex> &vertices,
+                                   std::vector<unsigned int> &indices,
+                                   unsigned int maxTriangles = 124,
+                                   unsigned int maxVertices = 64);
+
+// frustum and camera have to be in the space of the mesh
+ClusterVisibility testCluster(const Cluster &cluster, const Frustum &frustum,
+                              const glm::vec3 &camera);
+
+#endif
@@ -0,0 +1,16 @@
+#include "contenthash.h"
+#include <cstring>
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, 8);
+    hash = (hash ^ word) * 0x100000001b3ull;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; i++)
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  return hash;
+}
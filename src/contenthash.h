@@ -0,0 +1,13 @@
+#ifndef contenthash_h
+#define contenthash_h
+
+#include <cstddef>
+#include <cstdint>
+
+const uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+
+// word wise fnv style hash of the bytes, chained through the seed. only
+// compared with itself, so it may change with the cache formats using it
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = HASH_SEED);
+
+#endif
@@ -0,0 +1,16 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 3) in mat4 aInstance;
+
+uniform mat4 model;
+uniform mat4 node;
+uniform mat4 view;
+uniform mat4 projection;
+
+// the colour pass computes the same expression, so its depth matches
+invariant gl_Position;
+
+void main()
+{
+  gl_Position = projection * view * model * aInstance * node * vec4(aPos, 1.0);
+}
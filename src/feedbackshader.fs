@@ -0,0 +1,26 @@
+#version 330 core
+out uvec4 FragColor;
+
+in vec2 TexCoord;
+
+// the page of the finest level the pixel needs, read back on the cpu
+uniform vec2 virtualSize;
+uniform int levelCount;
+// the target is smaller than the view, this makes up for it
+uniform float lodBias;
+uniform int textureId;
+
+const float PAGE_CONTENT = 120.0;
+
+void main()
+{
+  vec2 texel = TexCoord * virtualSize;
+  vec2 dx = dFdx(texel);
+  vec2 dy = dFdy(texel);
+  float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + lodBias;
+  int level = clamp(int(floor(lod)), 0, levelCount - 1);
+  vec2 size = max(floor(virtualSize / exp2(float(level))), vec2(1.0));
+  vec2 pages = ceil(size / PAGE_CONTENT);
+  vec2 page = min(floor(fract(TexCoord) * size / PAGE_CONTENT), pages - 1.0);
+  FragColor = uvec4(uvec2(page), uint(level), uint(textureId));
+}
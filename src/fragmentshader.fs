@@ -2,10 +2,14 @@
 out vec4 FragColor;
 
 in vec2 TexCoord;
+in float Occlusion;
 
 uniform sampler2D texture_diffuse1;
+// below 1 for blended materials
+uniform float opacity;
 
 void main()
 {
-  FragColor = texture(texture_diffuse1, TexCoord);
+  vec4 color = texture(texture_diffuse1, TexCoord);
+  FragColor = vec4(color.rgb * Occlusion, color.a * opacity);
 }
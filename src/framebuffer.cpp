@@ -0,0 +1,57 @@
+#include "framebuffer.h"
+#include <iostream>
+
+void SceneFramebuffer::resize(int width, int height) {
+  if (framebuffer && width == this->width && height == this->height)
+    return;
+  this->width = width;
+  this->height = height;
+  framebuffer = GpuFramebuffer("scene framebuffer");
+  color = GpuRenderbuffer("scene color");
+  depth = GpuTexture("scene depth");
+
+  glBindRenderbuffer(GL_RENDERBUFFER, color.id());
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  color.setSize((size_t)width * height * 4);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, depth.id());
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0,
+               GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  depth.setSize((size_t)width * height * 4);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.id());
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, color.id());
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                         GL_TEXTURE_2D, depth.id(), 0);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    std::cout << "scene framebuffer is incomplete" << std::endl;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void SceneFramebuffer::bind() {
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.id());
+}
+
+void SceneFramebuffer::present() {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer.id());
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                    GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void SceneFramebuffer::bindForReading() {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer.id());
+}
+
+void SceneFramebuffer::readPixels(std::vector<unsigned char> &pixels) {
+  pixels.resize((size_t)width * height * 3);
+  bindForReading();
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
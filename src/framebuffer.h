@@ -0,0 +1,32 @@
+#ifndef framebuffer_h
+#define framebuffer_h
+
+#include <vector>
+#include "gpuresource.h"
+
+// offscreen target keeping the last rendered frame
+class SceneFramebuffer {
+public:
+  // recreates the attachments if the size changed
+  void resize(int width, int height);
+  // directs the following draws into the framebuffer
+  void bind();
+  // copies the kept frame into the back buffer of the window
+  void present();
+  // makes the kept frame the source of glReadPixels
+  void bindForReading();
+  // rgb of the kept frame, the bottom row first
+  void readPixels(std::vector<unsigned char> &pixels);
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  // depth of the kept frame, a texture so culling can read it back
+  unsigned int getDepthTexture() const { return depth.id(); }
+private:
+  GpuFramebuffer framebuffer;
+  GpuRenderbuffer color;
+  GpuTexture depth;
+  int width = 0;
+  int height = 0;
+};
+
+#endif
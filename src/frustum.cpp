@@ -0,0 +1,29 @@
+#include "frustum.h"
+
+Frustum Frustum::fromMatrix(const glm::mat4 &matrix) {
+  // rows of the matrix, glm stores columns
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; i++)
+    rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i],
+                        matrix[3][i]);
+
+  Frustum frustum;
+  frustum.planes[0] = rows[3] + rows[0]; // left
+  frustum.planes[1] = rows[3] - rows[0]; // right
+  frustum.planes[2] = rows[3] + rows[1]; // bottom
+  frustum.planes[3] = rows[3] - rows[1]; // top
+  frustum.planes[4] = rows[3] + rows[2]; // near
+  frustum.planes[5] = rows[3] - rows[2]; // far
+
+  // normalized planes give real distances for the sphere test
+  for (glm::vec4 &plane : frustum.planes)
+    plane /= glm::length(glm::vec3(plane));
+  return frustum;
+}
+
+bool Frustum::containsSphere(const glm::vec3 &center, float radius) const {
+  for (const glm::vec4 &plane : planes)
+    if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+      return false;
+  return true;
+}
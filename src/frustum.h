@@ -0,0 +1,15 @@
+#ifndef frustum_h
+#define frustum_h
+
+#include <glm/glm.hpp>
+
+// view frustum as six inward facing planes, xyz is the normal
+struct Frustum {
+  glm::vec4 planes[6];
+
+  // extracts the planes of a projection * view (* model) matrix
+  static Frustum fromMatrix(const glm::mat4 &matrix);
+  bool containsSphere(const glm::vec3 &center, float radius) const;
+};
+
+#endif
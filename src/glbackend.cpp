@@ -0,0 +1,31 @@
+#include "glbackend.h"
+
+void GlBackend::resize(int width, int height) {
+  framebuffer.resize(width, height);
+}
+
+void GlBackend::render(Model &model, const RenderView &view) {
+  model.update();
+  framebuffer.bind();
+  glViewport(0, 0, framebuffer.getWidth(), framebuffer.getHeight());
+  glClearColor(.1f, .1f, .1f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  // the uniform setters take references
+  glm::mat4 projection = view.projection;
+  glm::mat4 viewMatrix = view.view;
+  glm::mat4 modelMatrix = glm::mat4(1.0f);
+  shader.use();
+  shader.setUniform("projection", projection);
+  shader.setUniform("view", viewMatrix);
+  shader.setUniform("model", modelMatrix);
+  model.draw(shader, view);
+}
+
+void GlBackend::finish() {
+  glFinish();
+}
+
+void GlBackend::readPixels(std::vector<unsigned char> &pixels) {
+  framebuffer.readPixels(pixels);
+}
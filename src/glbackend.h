@@ -0,0 +1,24 @@
+#ifndef glbackend_h
+#define glbackend_h
+
+#include "framebuffer.h"
+#include "renderbackend.h"
+#include "shader.h"
+
+// the plain opengl path of the viewer, the model drawn into the scene
+// framebuffer
+class GlBackend : public RenderBackend {
+public:
+  GlBackend(Shader &shader, SceneFramebuffer &framebuffer)
+      : shader(shader), framebuffer(framebuffer) {}
+  const char* getName() const override { return "opengl"; }
+  void resize(int width, int height) override;
+  void render(Model &model, const RenderView &view) override;
+  void finish() override;
+  void readPixels(std::vector<unsigned char> &pixels) override;
+private:
+  Shader &shader;
+  SceneFramebuffer &framebuffer;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "glfeatures.h"
+#include <cstring>
+
+PFNGLDISPATCHCOMPUTEPROC glad_glDispatchCompute = nullptr;
+PFNGLMEMORYBARRIERPROC glad_glMemoryBarrier = nullptr;
+PFNGLBINDIMAGETEXTUREPROC glad_glBindImageTexture = nullptr;
+PFNGLMULTIDRAWELEMENTSINDIRECTPROC glad_glMultiDrawElementsIndirect = nullptr;
+PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC
+    glad_glMultiDrawElementsIndirectCountARB = nullptr;
+PFNGLBUFFERSTORAGEPROC glad_glBufferStorage = nullptr;
+
+GlFeatures glFeatures;
+
+namespace {
+
+bool hasExtension(const char* name) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+    if (extension && std::strcmp(extension, name) == 0)
+      return true;
+  }
+  return false;
+}
+
+}
+
+void loadGlFeatures(GLADloadproc load) {
+  glFeatures = GlFeatures();
+  if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3)) {
+    glad_glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)
+        load("glDispatchCompute");
+    glad_glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)load("glMemoryBarrier");
+    glad_glBindImageTexture = (PFNGLBINDIMAGETEXTUREPROC)
+        load("glBindImageTexture");
+    glad_glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)
+        load("glMultiDrawElementsIndirect");
+    glFeatures.compute = glDispatchCompute && glMemoryBarrier &&
+                         glBindImageTexture && glMultiDrawElementsIndirect;
+  }
+  if (glFeatures.compute && hasExtension("GL_ARB_indirect_parameters")) {
+    glad_glMultiDrawElementsIndirectCountARB =
+        (PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC)
+        load("glMultiDrawElementsIndirectCountARB");
+    glFeatures.indirectParameters =
+        glMultiDrawElementsIndirectCountARB != nullptr;
+  }
+  glFeatures.pipelineStatistics =
+      hasExtension("GL_ARB_pipeline_statistics_query");
+  glFeatures.s3tc = hasExtension("GL_EXT_texture_compression_s3tc");
+  glFeatures.bptc = GLVersion.major > 4 ||
+                    (GLVersion.major == 4 && GLVersion.minor >= 2) ||
+                    hasExtension("GL_ARB_texture_compression_bptc");
+  if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4) ||
+      hasExtension("GL_ARB_buffer_storage")) {
+    glad_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+    glFeatures.bufferStorage = glBufferStorage != nullptr;
+  }
+}
+
+bool supportsTextureFormat(GLenum internalFormat) {
+  switch (internalFormat) {
+  case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+  case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    return glFeatures.s3tc;
+  case GL_COMPRESSED_RGBA_BPTC_UNORM_ARB:
+    return glFeatures.bptc;
+  }
+  return true;
+}
@@ -0,0 +1,77 @@
+#ifndef glfeatures_h
+#define glfeatures_h
+
+#include <glad/glad.h>
+
+// enums and entry points above the gl 3.3 loader, the pointers stay null
+// when the context doesn't provide them
+#define GL_COMPUTE_SHADER 0x91B9
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#define GL_PARAMETER_BUFFER_ARB 0x80EE
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#define GL_COMPRESSED_RGBA_BPTC_UNORM_ARB 0x8E8C
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint groupsX,
+                                                  GLuint groupsY,
+                                                  GLuint groupsZ);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+typedef void (APIENTRYP PFNGLBINDIMAGETEXTUREPROC)(GLuint unit,
+    GLuint texture, GLint level, GLboolean layered, GLint layer,
+    GLenum access, GLenum format);
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode,
+    GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride);
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC)(
+    GLenum mode, GLenum type, const void* indirect, GLintptr drawCount,
+    GLsizei maxDrawCount, GLsizei stride);
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target,
+    GLsizeiptr size, const void* data, GLbitfield flags);
+
+extern PFNGLDISPATCHCOMPUTEPROC glad_glDispatchCompute;
+extern PFNGLMEMORYBARRIERPROC glad_glMemoryBarrier;
+extern PFNGLBINDIMAGETEXTUREPROC glad_glBindImageTexture;
+extern PFNGLMULTIDRAWELEMENTSINDIRECTPROC glad_glMultiDrawElementsIndirect;
+extern PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC
+    glad_glMultiDrawElementsIndirectCountARB;
+extern PFNGLBUFFERSTORAGEPROC glad_glBufferStorage;
+#define glDispatchCompute glad_glDispatchCompute
+#define glMemoryBarrier glad_glMemoryBarrier
+#define glBindImageTexture glad_glBindImageTexture
+#define glMultiDrawElementsIndirect glad_glMultiDrawElementsIndirect
+#define glMultiDrawElementsIndirectCountARB \
+    glad_glMultiDrawElementsIndirectCountARB
+#define glBufferStorage glad_glBufferStorage
+
+struct GlFeatures {
+  // compute shaders, storage buffers and indirect multi draws
+  bool compute = false;
+  // the draw count of indirect multi draws can come from a buffer
+  bool indirectParameters = false;
+  // queries counting the invocations of the shader stages
+  bool pipelineStatistics = false;
+  // bc1 to bc3 textures, bc4 and bc5 are core since gl 3.0
+  bool s3tc = false;
+  // bc7 textures, core since gl 4.2
+  bool bptc = false;
+  // immutable buffers that stay mapped while gl reads from them
+  bool bufferStorage = false;
+};
+
+extern GlFeatures glFeatures;
+
+// call after gladLoadGLLoader with the same loader
+void loadGlFeatures(GLADloadproc load);
+// false for texture formats the extensions of the context don't cover
+bool supportsTextureFormat(GLenum internalFormat);
+
+#endif
@@ -0,0 +1,97 @@
+#include "glstate.h"
+#include <algorithm>
+
+// std::fill takes the marker by reference
+const unsigned int GlStateCache::UNKNOWN;
+
+GlStateCache &GlStateCache::get() {
+  static GlStateCache state;
+  return state;
+}
+
+void GlStateCache::begin() {
+  batching = true;
+  program = UNKNOWN;
+  vertexArray = UNKNOWN;
+  activeUnit = UNKNOWN;
+  std::fill(textures, textures + TEXTURE_UNITS, UNKNOWN);
+  std::fill(issued, issued + STATE_KINDS, 0u);
+  std::fill(avoided, avoided + STATE_KINDS, 0u);
+}
+
+void GlStateCache::end() {
+  bindVertexArray(0);
+  setActiveUnit(0);
+  batching = false;
+  std::copy(issued, issued + STATE_KINDS, lastIssued);
+  std::copy(avoided, avoided + STATE_KINDS, lastAvoided);
+}
+
+void GlStateCache::useProgram(unsigned int program) {
+  if (batching && this->program == program) {
+    avoided[STATE_PROGRAM]++;
+    return;
+  }
+  glUseProgram(program);
+  this->program = program;
+  issued[STATE_PROGRAM]++;
+}
+
+void GlStateCache::bindVertexArray(unsigned int vertexArray) {
+  if (batching && this->vertexArray == vertexArray) {
+    avoided[STATE_VERTEX_ARRAY]++;
+    return;
+  }
+  glBindVertexArray(vertexArray);
+  this->vertexArray = vertexArray;
+  issued[STATE_VERTEX_ARRAY]++;
+}
+
+void GlStateCache::setActiveUnit(unsigned int unit) {
+  if (batching && activeUnit == unit) {
+    avoided[STATE_TEXTURE_UNIT]++;
+    return;
+  }
+  glActiveTexture(GL_TEXTURE0 + unit);
+  activeUnit = unit;
+  issued[STATE_TEXTURE_UNIT]++;
+}
+
+void GlStateCache::bindTexture(unsigned int unit, unsigned int texture,
+                               GLenum target) {
+  // units beyond the tracked ones are always bound
+  bool tracked = unit < TEXTURE_UNITS;
+  if (batching && tracked && textures[unit] == texture &&
+      targets[unit] == target) {
+    avoided[STATE_TEXTURE]++;
+    return;
+  }
+  setActiveUnit(unit);
+  glBindTexture(target, texture);
+  if (tracked) {
+    textures[unit] = texture;
+    targets[unit] = target;
+  }
+  issued[STATE_TEXTURE]++;
+}
+
+void GlStateCache::releaseVertexArray() {
+  if (!batching)
+    bindVertexArray(0);
+}
+
+void GlStateCache::releaseTextureUnit() {
+  if (!batching)
+    setActiveUnit(0);
+}
+
+void GlStateCache::report(std::ostream &out) const {
+  const char* names[STATE_KINDS] = { "program", "vertex array",
+                                     "texture unit", "texture" };
+  out << "state changes of the last frame:";
+  for (int kind = 0; kind < STATE_KINDS; kind++)
+    out << (kind ? "," : "") << " " << names[kind] << " "
+        << lastIssued[kind] << " issued " << lastAvoided[kind]
+        << " avoided";
+  out << std::endl;
+}
@@ -0,0 +1,61 @@
+#ifndef glstate_h
+#define glstate_h
+
+#include <glad/glad.h>
+#include <ostream>
+
+enum GlStateKind {
+  STATE_PROGRAM,
+  STATE_VERTEX_ARRAY,
+  STATE_TEXTURE_UNIT,
+  STATE_TEXTURE,
+  STATE_KINDS
+};
+
+// remembers the bound program, vertex array and textures while a render
+// queue is submitted and drops the calls that wouldn't change anything.
+// outside of begin and end every call goes to gl like before, since other
+// code binds objects without telling the cache
+class GlStateCache {
+public:
+  static GlStateCache &get();
+
+  // forgets the state, the first bind of each kind is always issued
+  void begin();
+  // leaves vertex array 0 and texture unit 0 like the uncached calls
+  void end();
+
+  void useProgram(unsigned int program);
+  void bindVertexArray(unsigned int vertexArray);
+  // binds a texture to the unit, switching the active unit if needed. one
+  // target per unit is remembered, binding another target reissues it
+  void bindTexture(unsigned int unit, unsigned int texture,
+                   GLenum target = GL_TEXTURE_2D);
+  // called after a draw, unbinds right away outside a batch and at end
+  // inside of one
+  void releaseVertexArray();
+  void releaseTextureUnit();
+
+  // calls issued and dropped in the last batch
+  void report(std::ostream &out) const;
+private:
+  GlStateCache() {}
+
+  static const unsigned int TEXTURE_UNITS = 32;
+  static const unsigned int UNKNOWN = 0xffffffffu;
+
+  bool batching = false;
+  unsigned int program = UNKNOWN;
+  unsigned int vertexArray = UNKNOWN;
+  unsigned int activeUnit = UNKNOWN;
+  unsigned int textures[TEXTURE_UNITS] = {};
+  GLenum targets[TEXTURE_UNITS] = {};
+  unsigned int issued[STATE_KINDS] = {};
+  unsigned int avoided[STATE_KINDS] = {};
+  unsigned int lastIssued[STATE_KINDS] = {};
+  unsigned int lastAvoided[STATE_KINDS] = {};
+
+  void setActiveUnit(unsigned int unit);
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include "gpuculling.h"
+#include "frustum.h"
+#include "glfeatures.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+
+namespace {
+
+// matches the DrawInfo of the culling shader
+struct DrawInfo {
+  glm::vec4 sphere;
+  unsigned int indexCount;
+  unsigned int firstIndex;
+  int baseVertex;
+  unsigned int batch;
+};
+
+// layout the indirect draws read
+struct DrawCommand {
+  unsigned int count;
+  unsigned int instanceCount;
+  unsigned int firstIndex;
+  int baseVertex;
+  unsigned int baseInstance;
+};
+
+float maxScale(const glm::mat4 &transform) {
+  return glm::max(glm::length(glm::vec3(transform[0])),
+                  glm::max(glm::length(glm::vec3(transform[1])),
+                           glm::length(glm::vec3(transform[2]))));
+}
+
+void uploadBuffer(GpuBuffer &buffer, const char* label, GLenum target,
+                  size_t bytes, const void* data, GLenum usage) {
+  buffer = GpuBuffer(label);
+  glBindBuffer(target, buffer.id());
+  glBufferData(target, bytes, data, usage);
+  buffer.setSize(bytes);
+}
+
+}
+
+bool GpuCulling::init() {
+  if (!glFeatures.compute) {
+    std::cout << "gpu culling needs OpenGL 4.3, culling on the cpu"
+              << std::endl;
+    return false;
+  }
+  cullShader.reset(new Shader("cullshader.comp"));
+  pyramidShader.reset(new Shader("depthpyramid.comp"));
+  GLint cullLinked = 0;
+  GLint pyramidLinked = 0;
+  glGetProgramiv(cullShader->progID, GL_LINK_STATUS, &cullLinked);
+  glGetProgramiv(pyramidShader->progID, GL_LINK_STATUS, &pyramidLinked);
+  ready = cullLinked && pyramidLinked;
+  if (!ready)
+    std::cout << "gpu culling shaders failed, culling on the cpu"
+              << std::endl;
+  return ready;
+}
+
+void GpuCulling::setModel(const Model &model) {
+  const std::vector<Mesh> &meshes = model.getMeshes();
+  std::vector<Vertex> mergedVertices;
+  std::vector<unsigned int> mergedIndices;
+  std::vector<int> baseVertices;
+  std::vector<unsigned int> firstIndices;
+  // meshes with the same textures end up in the same multi draw
+  std::map<std::vector<unsigned int>, std::vector<unsigned int>> groups;
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    baseVertices.push_back((int)mergedVertices.size());
+    firstIndices.push_back(mergedIndices.size());
+    mergedVertices.insert(mergedVertices.end(), meshes[i].vertices.begin(),
+                          meshes[i].vertices.end());
+    mergedIndices.insert(mergedIndices.end(), meshes[i].indices.begin(),
+                         meshes[i].indices.end());
+    std::vector<unsigned int> key;
+    for (const Texture &texture : meshes[i].textures)
+      key.push_back(texture.texture->id());
+    groups[key].push_back(i);
+  }
+
+  // one draw per node using a mesh, its transform is the instance
+  // attribute picked by the base instance
+  std::vector<DrawInfo> drawInfos;
+  std::vector<glm::mat4> nodeTransforms;
+  std::vector<unsigned int> offsets;
+  batches.clear();
+  for (const auto &group : groups) {
+    Batch batch = { &meshes[group.second[0]],
+                    (unsigned int)drawInfos.size(), 0 };
+    for (unsigned int index : group.second) {
+      const Mesh &mesh = meshes[index];
+      for (const glm::mat4 &node : mesh.instances) {
+        glm::vec3 center = glm::vec3(node * glm::vec4(mesh.boundsCenter,
+                                                      1.0f));
+        DrawInfo info = { glm::vec4(center,
+                                    mesh.boundsRadius * maxScale(node)),
+                          (unsigned int)mesh.indices.size(),
+                          firstIndices[index], baseVertices[index],
+                          (unsigned int)batches.size() };
+        drawInfos.push_back(info);
+        nodeTransforms.push_back(node);
+        batch.count++;
+      }
+    }
+    offsets.push_back(batch.offset);
+    batches.push_back(batch);
+  }
+  drawCount = drawInfos.size();
+
+  vertexArray = GpuVertexArray("gpu culling vao");
+  glBindVertexArray(vertexArray.id());
+  uploadBuffer(vertices, "gpu culling vertices", GL_ARRAY_BUFFER,
+               mergedVertices.size() * sizeof(Vertex), mergedVertices.data(),
+               GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        (void*)offsetof(Vertex, normal));
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        (void*)offsetof(Vertex, texturecoord));
+  uploadBuffer(transforms, "gpu culling transforms", GL_ARRAY_BUFFER,
+               nodeTransforms.size() * sizeof(glm::mat4),
+               nodeTransforms.data(), GL_STATIC_DRAW);
+  for (unsigned int i = 0; i < 4; i++) {
+    glEnableVertexAttribArray(3 + i);
+    glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                          (void*)(i * sizeof(glm::vec4)));
+    glVertexAttribDivisor(3 + i, 1);
+  }
+  uploadBuffer(indices, "gpu culling indices", GL_ELEMENT_ARRAY_BUFFER,
+               mergedIndices.size() * sizeof(unsigned int),
+               mergedIndices.data(), GL_STATIC_DRAW);
+  glBindVertexArray(0);
+
+  uploadBuffer(draws, "gpu culling draws", GL_SHADER_STORAGE_BUFFER,
+               drawInfos.size() * sizeof(DrawInfo), drawInfos.data(),
+               GL_STATIC_DRAW);
+  uploadBuffer(commands, "gpu culling commands", GL_SHADER_STORAGE_BUFFER,
+               drawCount * sizeof(DrawCommand), NULL, GL_DYNAMIC_DRAW);
+  uploadBuffer(counts, "gpu culling counts", GL_SHADER_STORAGE_BUFFER,
+               batches.size() * sizeof(unsigned int), NULL, GL_DYNAMIC_DRAW);
+  uploadBuffer(batchOffsets, "gpu culling batches", GL_SHADER_STORAGE_BUFFER,
+               offsets.size() * sizeof(unsigned int), offsets.data(),
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  lastFrameDrawn = false;
+  pyramidValid = false;
+}
+
+void GpuCulling::buildPyramid(unsigned int depthTexture, int width,
+                              int height) {
+  pyramidValid = false;
+  if (!ready || width <= 0 || height <= 0)
+    return;
+  if (pyramidSize != glm::ivec2(width, height)) {
+    // a resized framebuffer has no depth worth reading yet
+    pyramidSize = glm::ivec2(width, height);
+    pyramidLevels = 1 + (int)std::floor(std::log2((float)std::max(width,
+                                                                  height)));
+    pyramid = GpuTexture("depth pyramid");
+    glBindTexture(GL_TEXTURE_2D, pyramid.id());
+    size_t bytes = 0;
+    for (int level = 0; level < pyramidLevels; level++) {
+      int levelWidth = std::max(width >> level, 1);
+      int levelHeight = std::max(height >> level, 1);
+      glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, levelWidth, levelHeight, 0,
+                   GL_RED, GL_FLOAT, NULL);
+      bytes += (size_t)levelWidth * levelHeight * 4;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pyramidLevels - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    pyramid.setSize(bytes);
+    lastFrameDrawn = false;
+    return;
+  }
+  if (!lastFrameDrawn)
+    return;
+
+  pyramidShader->use();
+  pyramidShader->setUniform("source", 0);
+  glActiveTexture(GL_TEXTURE0);
+  for (int level = 0; level < pyramidLevels; level++) {
+    int levelWidth = std::max(width >> level, 1);
+    int levelHeight = std::max(height >> level, 1);
+    // level 0 copies the depth buffer, the others reduce the level above
+    glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : pyramid.id());
+    pyramidShader->setUniform("reduce", level > 0);
+    pyramidShader->setUniform("sourceLevel", std::max(level - 1, 0));
+    glBindImageTexture(0, pyramid.id(), level, GL_FALSE, 0, GL_WRITE_ONLY,
+                       GL_R32F);
+    glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT |
+                    GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  pyramidValid = true;
+}
+
+void GpuCulling::draw(Shader &shader, const glm::mat4 &viewProjection) {
+  if (!ready || drawCount == 0)
+    return;
+
+  std::vector<unsigned int> zeros(batches.size(), 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, counts.id());
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                  zeros.size() * sizeof(unsigned int), zeros.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  Frustum frustum = Frustum::fromMatrix(viewProjection);
+  cullShader->use();
+  cullShader->setUniform("drawCount", (int)drawCount);
+  glUniform4fv(glGetUniformLocation(cullShader->progID, "planes"), 6,
+               &frustum.planes[0][0]);
+  cullShader->setUniform("useDepthPyramid", pyramidValid);
+  cullShader->setUniform("previousViewProjection", previousViewProjection);
+  cullShader->setUniform("depthPyramid", 0);
+  cullShader->setUniform("pyramidLevels", pyramidLevels);
+  // without indirect parameters every draw keeps its slot and culled ones
+  // are drawn zero times
+  cullShader->setUniform("compact", glFeatures.indirectParameters);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, pyramidValid ? pyramid.id() : 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, draws.id());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commands.id());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, counts.id());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, batchOffsets.id());
+  glDispatchCompute((drawCount + 63) / 64, 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  shader.use();
+  glm::mat4 node = glm::mat4(1.0f);
+  shader.setUniform("node", node);
+  glBindVertexArray(vertexArray.id());
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.id());
+  if (glFeatures.indirectParameters)
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, counts.id());
+  for (unsigned int i = 0; i < batches.size(); i++) {
+    const Batch &batch = batches[i];
+    batch.mesh->bindTextures(shader);
+    const void* offset = (const void*)(batch.offset * sizeof(DrawCommand));
+    if (glFeatures.indirectParameters)
+      glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                          offset, i * sizeof(unsigned int),
+                                          batch.count, 0);
+    else
+      glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, offset,
+                                  batch.count, 0);
+  }
+  if (glFeatures.indirectParameters)
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindVertexArray(0);
+
+  previousViewProjection = viewProjection;
+  lastFrameDrawn = true;
+}
+
+void GpuCulling::report(std::ostream &out) {
+  if (!ready)
+    return;
+  std::vector<unsigned int> visible(batches.size(), 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, counts.id());
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     visible.size() * sizeof(unsigned int), visible.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  unsigned int total = 0;
+  for (unsigned int count : visible)
+    total += count;
+  out << "gpu culling: " << total << " of " << drawCount
+      << " draws visible in " << batches.size() << " indirect draws, "
+      << (glFeatures.indirectParameters ? "draw count from the gpu"
+                                        : "culled draws kept as empty")
+      << ", depth pyramid " << (pyramidValid ? "used" : "not ready")
+      << std::endl;
+}
@@ -0,0 +1,60 @@
+#ifndef gpuculling_h
+#define gpuculling_h
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include "gpuresource.h"
+#include "model.h"
+#include "shader.h"
+
+// culls every node instance of every mesh in a compute shader against the
+// frustum and the depth of the last frame, the surviving draws are issued
+// with one indirect multi draw per set of textures, needs gl 4.3
+class GpuCulling {
+public:
+  // false when the context lacks the features or the shaders failed
+  bool init();
+  bool isReady() const { return ready; }
+  // merges the geometry of the model and uploads the bounds of the draws
+  void setModel(const Model &model);
+  // reduces the depth of the last frame, call before it is cleared
+  void buildPyramid(unsigned int depthTexture, int width, int height);
+  void draw(Shader &shader, const glm::mat4 &viewProjection);
+  // reads the visible counts back, stalls until the frame is done
+  void report(std::ostream &out);
+private:
+  // draws sharing the textures of one mesh
+  struct Batch {
+    const Mesh* mesh;
+    unsigned int offset;
+    unsigned int count;
+  };
+
+  bool ready = false;
+  std::unique_ptr<Shader> cullShader;
+  std::unique_ptr<Shader> pyramidShader;
+  std::vector<Batch> batches;
+  unsigned int drawCount = 0;
+
+  GpuVertexArray vertexArray;
+  GpuBuffer vertices;
+  GpuBuffer indices;
+  GpuBuffer transforms;
+  GpuBuffer draws;
+  GpuBuffer commands;
+  GpuBuffer counts;
+  GpuBuffer batchOffsets;
+
+  GpuTexture pyramid;
+  glm::ivec2 pyramidSize = glm::ivec2(0);
+  int pyramidLevels = 0;
+  // the depth buffer only holds usable depth if the last frame was drawn
+  // here with the same model
+  bool lastFrameDrawn = false;
+  bool pyramidValid = false;
+  glm::mat4 previousViewProjection = glm::mat4(1.0f);
+};
+
+#endif
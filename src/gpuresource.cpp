@@ -0,0 +1,158 @@
+#include "gpuresource.h"
+#include <iomanip>
+
+unsigned int gpuCreate(GpuResourceKind kind, const std::string &label) {
+  unsigned int id = 0;
+  switch (kind) {
+  case GPU_BUFFER:
+    glGenBuffers(1, &id); break;
+  case GPU_VERTEX_ARRAY:
+    glGenVertexArrays(1, &id); break;
+  case GPU_TEXTURE:
+    glGenTextures(1, &id); break;
+  case GPU_FRAMEBUFFER:
+    glGenFramebuffers(1, &id); break;
+  case GPU_RENDERBUFFER:
+    glGenRenderbuffers(1, &id); break;
+  case GPU_QUERY:
+    glGenQueries(1, &id); break;
+  default:
+    break;
+  }
+  GpuRegistry::get().add(kind, id, label);
+  return id;
+}
+
+void gpuDestroy(GpuResourceKind kind, unsigned int id) {
+  switch (kind) {
+  case GPU_BUFFER:
+    glDeleteBuffers(1, &id); break;
+  case GPU_VERTEX_ARRAY:
+    glDeleteVertexArrays(1, &id); break;
+  case GPU_TEXTURE:
+    glDeleteTextures(1, &id); break;
+  case GPU_FRAMEBUFFER:
+    glDeleteFramebuffers(1, &id); break;
+  case GPU_RENDERBUFFER:
+    glDeleteRenderbuffers(1, &id); break;
+  case GPU_QUERY:
+    glDeleteQueries(1, &id); break;
+  default:
+    break;
+  }
+  GpuRegistry::get().remove(kind, id);
+}
+
+void gpuResize(GpuResourceKind kind, unsigned int id, size_t bytes) {
+  GpuRegistry::get().resize(kind, id, bytes);
+}
+
+GpuRegistry &GpuRegistry::get() {
+  static GpuRegistry registry;
+  return registry;
+}
+
+void GpuRegistry::setBudget(size_t bytes) {
+  budget = bytes;
+  collect();
+}
+
+std::shared_ptr<GpuTexture> GpuRegistry::findTexture(const std::string &file) {
+  auto found = textureLookup.find(file);
+  if (found == textureLookup.end())
+    return nullptr;
+  // move the texture to the front of the lru list
+  textureLru.splice(textureLru.begin(), textureLru, found->second);
+  return found->second->texture;
+}
+
+void GpuRegistry::storeTexture(const std::string &file,
+                               const std::shared_ptr<GpuTexture> &texture) {
+  auto found = textureLookup.find(file);
+  if (found != textureLookup.end()) {
+    textureLru.erase(found->second);
+    textureLookup.erase(found);
+  }
+  textureLru.push_front({ file, texture });
+  textureLookup[file] = textureLru.begin();
+  collect();
+}
+
+void GpuRegistry::collect() {
+  // walk from the least recently used end, skip textures still in use
+  auto it = textureLru.end();
+  while (totalBytes() > budget && it != textureLru.begin()) {
+    --it;
+    if (it->texture.use_count() > 1)
+      continue;
+    textureLookup.erase(it->file);
+    it = textureLru.erase(it);
+    evictions++;
+  }
+}
+
+void GpuRegistry::clearTextures() {
+  textureLookup.clear();
+  textureLru.clear();
+}
+
+size_t GpuRegistry::totalBytes() const {
+  size_t total = 0;
+  for (const auto &kind : objects)
+    for (const auto &object : kind)
+      total += object.second.bytes;
+  return total;
+}
+
+size_t GpuRegistry::bytesOf(GpuResourceKind kind, unsigned int id) const {
+  auto found = objects[kind].find(id);
+  return found == objects[kind].end() ? 0 : found->second.bytes;
+}
+
+void GpuRegistry::report(std::ostream &out) const {
+  const char* names[GPU_RESOURCE_KINDS] = { "buffers", "vertex arrays",
+                                            "textures", "framebuffers",
+                                            "renderbuffers", "queries" };
+  const double mb = 1024.0 * 1024.0;
+  out << "gpu resources:" << std::endl;
+  for (int kind = 0; kind < GPU_RESOURCE_KINDS; kind++) {
+    size_t bytes = 0;
+    for (const auto &object : objects[kind])
+      bytes += object.second.bytes;
+    out << "  " << std::setw(14) << std::left << names[kind]
+        << std::setw(6) << std::right << objects[kind].size() << " objects "
+        << std::fixed << std::setprecision(2) << bytes / mb << " MB"
+        << std::endl;
+  }
+
+  size_t unused = 0;
+  size_t unusedBytes = 0;
+  for (const auto &cached : textureLru)
+    if (cached.texture.use_count() == 1) {
+      unused++;
+      unusedBytes += bytesOf(GPU_TEXTURE, cached.texture->id());
+    }
+  out << "  texture cache " << textureLru.size() << " entries, " << unused
+      << " unused (" << unusedBytes / mb << " MB), " << evictions
+      << " evicted" << std::endl;
+  out << "  total " << totalBytes() / mb << " MB of " << budget / mb
+      << " MB budget";
+  if (totalBytes() > budget)
+    out << " (over budget, everything left is in use)";
+  out << std::endl;
+}
+
+void GpuRegistry::add(GpuResourceKind kind, unsigned int id,
+                      const std::string &label) {
+  objects[kind][id] = { label, 0 };
+}
+
+void GpuRegistry::remove(GpuResourceKind kind, unsigned int id) {
+  objects[kind].erase(id);
+}
+
+void GpuRegistry::resize(GpuResourceKind kind, unsigned int id, size_t bytes) {
+  auto found = objects[kind].find(id);
+  if (found != objects[kind].end())
+    found->second.bytes = bytes;
+}
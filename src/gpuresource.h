@@ -0,0 +1,118 @@
+#ifndef gpuresource_h
+#define gpuresource_h
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+enum GpuResourceKind {
+  GPU_BUFFER,
+  GPU_VERTEX_ARRAY,
+  GPU_TEXTURE,
+  GPU_FRAMEBUFFER,
+  GPU_RENDERBUFFER,
+  GPU_QUERY,
+  GPU_RESOURCE_KINDS
+};
+
+// raw object management, every handle below goes through these
+unsigned int gpuCreate(GpuResourceKind kind, const std::string &label);
+void gpuDestroy(GpuResourceKind kind, unsigned int id);
+void gpuResize(GpuResourceKind kind, unsigned int id, size_t bytes);
+
+// move-only owner of one OpenGL object
+template <GpuResourceKind Kind>
+class GpuHandle {
+public:
+  GpuHandle() : handle(0) {}
+  explicit GpuHandle(const std::string &label)
+      : handle(gpuCreate(Kind, label)) {}
+  ~GpuHandle() { reset(); }
+
+  GpuHandle(const GpuHandle &) = delete;
+  GpuHandle &operator=(const GpuHandle &) = delete;
+  GpuHandle(GpuHandle &&other) noexcept : handle(other.handle) {
+    other.handle = 0;
+  }
+  GpuHandle &operator=(GpuHandle &&other) noexcept {
+    if (this != &other) {
+      reset();
+      handle = other.handle;
+      other.handle = 0;
+    }
+    return *this;
+  }
+
+  unsigned int id() const { return handle; }
+  explicit operator bool() const { return handle != 0; }
+  // tell the registry how much memory the object holds
+  void setSize(size_t bytes) { if (handle) gpuResize(Kind, handle, bytes); }
+  void reset() {
+    if (handle)
+      gpuDestroy(Kind, handle);
+    handle = 0;
+  }
+private:
+  unsigned int handle;
+};
+
+typedef GpuHandle<GPU_BUFFER> GpuBuffer;
+typedef GpuHandle<GPU_VERTEX_ARRAY> GpuVertexArray;
+typedef GpuHandle<GPU_TEXTURE> GpuTexture;
+typedef GpuHandle<GPU_FRAMEBUFFER> GpuFramebuffer;
+typedef GpuHandle<GPU_RENDERBUFFER> GpuRenderbuffer;
+typedef GpuHandle<GPU_QUERY> GpuQuery;
+
+// bookkeeping of every live GL object and a LRU cache for textures
+class GpuRegistry {
+public:
+  static GpuRegistry &get();
+
+  // memory budget in bytes, unused textures are evicted above it
+  void setBudget(size_t bytes);
+  size_t getBudget() const { return budget; }
+
+  // returns the cached texture of the file or nullptr
+  std::shared_ptr<GpuTexture> findTexture(const std::string &file);
+  void storeTexture(const std::string &file,
+                    const std::shared_ptr<GpuTexture> &texture);
+  // evicts least recently used textures nobody references anymore
+  void collect();
+  // drops the whole texture cache, needed before the context dies
+  void clearTextures();
+
+  size_t totalBytes() const;
+  void report(std::ostream &out) const;
+
+  // used by gpuCreate/gpuDestroy/gpuResize
+  void add(GpuResourceKind kind, unsigned int id, const std::string &label);
+  void remove(GpuResourceKind kind, unsigned int id);
+  void resize(GpuResourceKind kind, unsigned int id, size_t bytes);
+private:
+  struct Entry {
+    std::string label;
+    size_t bytes;
+  };
+  struct CachedTexture {
+    std::string file;
+    std::shared_ptr<GpuTexture> texture;
+  };
+
+  GpuRegistry() : budget(512u << 20), evictions(0) {}
+
+  std::unordered_map<unsigned int, Entry> objects[GPU_RESOURCE_KINDS];
+  // front is the most recently used texture
+  std::list<CachedTexture> textureLru;
+  std::unordered_map<std::string,
+                     std::list<CachedTexture>::iterator> textureLookup;
+  size_t budget;
+  size_t evictions;
+
+  size_t bytesOf(GpuResourceKind kind, unsigned int id) const;
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include "importprofile.h"
+#include <assimp/DefaultLogger.hpp>
+#include <assimp/LogStream.hpp>
+#include <assimp/ProgressHandler.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/config.h>
+#include <cctype>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// one post-processing step assimp ran and its time
+struct StepTiming {
+  std::string name;
+  double ms;
+};
+
+// times the post-processing steps of a single ReadFile. assimp calls
+// UpdatePostProcess before every step it knows, active or not, and once
+// more after the last one. the steps that ran are named by their debug
+// message, the others take no measurable time
+class StepTimer : public Assimp::ProgressHandler {
+public:
+  std::vector<StepTiming> steps;
+  double readMs = 0.0;
+  // steps that ran without naming themselves
+  double otherMs = 0.0;
+
+  bool Update(float percentage) override {
+    return true;
+  }
+  void UpdatePostProcess(int currentStep, int numberOfSteps) override {
+    Clock::time_point now = Clock::now();
+    double ms = std::chrono::duration<double, std::milli>(now - last)
+        .count();
+    if (currentStep == 0)
+      readMs = ms;
+    else if (!running.empty())
+      steps.push_back({ running, ms });
+    else
+      otherMs += ms;
+    running.clear();
+    last = now;
+  }
+
+  void begin() {
+    last = Clock::now();
+  }
+  void name(const std::string &step) {
+    running = step;
+  }
+private:
+  Clock::time_point last;
+  std::string running;
+};
+
+// every step logs "<name> begin" as a debug message when it starts
+class StepNames : public Assimp::LogStream {
+public:
+  StepNames(StepTimer &timer) : timer(timer) {}
+
+  void write(const char* message) override {
+    std::string text(message);
+    while (!text.empty() && std::isspace((unsigned char)text.back()))
+      text.pop_back();
+    const std::string suffix = " begin";
+    if (text.size() <= suffix.size() ||
+        text.compare(text.size() - suffix.size(), suffix.size(),
+                     suffix) != 0)
+      return;
+    text.erase(text.size() - suffix.size());
+    timer.name(text.substr(text.find_last_of(" :") + 1));
+  }
+private:
+  StepTimer &timer;
+};
+
+struct SceneSize {
+  unsigned int meshes = 0;
+  unsigned int vertices = 0;
+  unsigned int faces = 0;
+};
+
+SceneSize measureScene(const aiScene* scene) {
+  SceneSize size;
+  if (!scene)
+    return size;
+  size.meshes = scene->mNumMeshes;
+  for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+    size.vertices += scene->mMeshes[i]->mNumVertices;
+    size.faces += scene->mMeshes[i]->mNumFaces;
+  }
+  return size;
+}
+
+void printRow(const std::string &name, double ms, double total) {
+  std::cout << "  " << std::setw(30) << std::left << name
+            << std::setw(10) << std::right << std::fixed
+            << std::setprecision(2) << ms << " ms "
+            << std::setw(5) << std::setprecision(1)
+            << (total > 0.0 ? 100.0 * ms / total : 0.0) << " %" << std::endl;
+}
+
+}
+
+bool parseImportProfile(const std::string &name, ImportProfile &profile) {
+  if (name == "fast")
+    profile = PROFILE_FAST;
+  else if (name == "balanced")
+    profile = PROFILE_BALANCED;
+  else if (name == "render")
+    profile = PROFILE_RENDER;
+  else
+    return false;
+  return true;
+}
+
+const char* importProfileName(ImportProfile profile) {
+  switch (profile) {
+  case PROFILE_FAST:
+    return "fast";
+  case PROFILE_BALANCED:
+    return "balanced";
+  default:
+    return "render";
+  }
+}
+
+bool parseLodMode(const std::string &name, LodMode &mode) {
+  if (name == "off")
+    mode = LOD_OFF;
+  else if (name == "import")
+    mode = LOD_IMPORT;
+  else if (name == "background")
+    mode = LOD_BACKGROUND;
+  else
+    return false;
+  return true;
+}
+
+unsigned int importFlags(ImportProfile profile) {
+  // the minimum the viewer needs: triangles with normals and gl uvs
+  unsigned int flags = aiProcess_Triangulate | aiProcess_FlipUVs |
+                       aiProcess_SortByPType;
+  if (profile == PROFILE_FAST)
+    return flags | aiProcess_GenNormals;
+
+  // duplicated meshes become references, which are drawn instanced
+  flags |= aiProcess_GenSmoothNormals | aiProcess_JoinIdenticalVertices |
+           aiProcess_RemoveRedundantMaterials | aiProcess_FindInstances;
+  if (profile == PROFILE_BALANCED)
+    return flags;
+
+  return flags | aiProcess_OptimizeMeshes | aiProcess_OptimizeGraph |
+         aiProcess_ImproveCacheLocality | aiProcess_FindDegenerates |
+         aiProcess_FindInvalidData;
+}
+
+const aiScene* importScene(Assimp::Importer &importer, const std::string &path,
+                           const ImportOptions &options) {
+  unsigned int flags = importFlags(options.profile);
+  // points and lines can't be drawn by the viewer
+  importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE,
+                              aiPrimitiveType_POINT | aiPrimitiveType_LINE);
+  if (!options.report)
+    return importer.ReadFile(path, flags);
+
+  // the handler stays ours, it is taken off the importer before it goes
+  StepTimer timer;
+  StepNames names(timer);
+  const unsigned int severity = Assimp::Logger::Debugging;
+  bool ownLogger = Assimp::DefaultLogger::isNullLogger();
+  if (ownLogger)
+    Assimp::DefaultLogger::create(nullptr, Assimp::Logger::DEBUGGING, 0);
+  Assimp::DefaultLogger::get()->attachStream(&names, severity);
+  importer.SetProgressHandler(&timer);
+  timer.begin();
+  const aiScene* scene = importer.ReadFile(path, flags);
+  importer.SetProgressHandler(nullptr);
+  Assimp::DefaultLogger::get()->detachStream(&names, severity);
+  if (ownLogger)
+    Assimp::DefaultLogger::kill();
+
+  double total = timer.readMs + timer.otherMs;
+  for (const StepTiming &step : timer.steps)
+    total += step.ms;
+  SceneSize size = measureScene(scene);
+  std::cout << "import report for " << path << " (profile "
+            << importProfileName(options.profile) << ")" << std::endl;
+  printRow("read file", timer.readMs, total);
+  for (const StepTiming &step : timer.steps)
+    printRow(step.name, step.ms, total);
+  if (timer.otherMs > 0.0)
+    printRow("other steps", timer.otherMs, total);
+  std::cout << "  total " << std::fixed << std::setprecision(2) << total
+            << " ms, " << size.meshes << " meshes, " << size.vertices
+            << " vertices, " << size.faces << " faces" << std::endl;
+  return scene;
+}
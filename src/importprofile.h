@@ -0,0 +1,70 @@
+#ifndef importprofile_h
+#define importprofile_h
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <cstddef>
+#include <string>
+#include "textureimage.h"
+
+enum ImportProfile {
+  PROFILE_FAST,
+  PROFILE_BALANCED,
+  PROFILE_RENDER
+};
+
+enum LodMode {
+  LOD_OFF,
+  // simplify while loading, the first frame already has all levels
+  LOD_IMPORT,
+  // simplify on a worker thread, the levels appear when they are done
+  LOD_BACKGROUND
+};
+
+struct ImportOptions {
+  ImportProfile profile = PROFILE_BALANCED;
+  LodMode lod = LOD_BACKGROUND;
+  unsigned int lodLevels = 4;
+  // split the meshes into clusters culled against the view every frame
+  bool clusters = false;
+  // build a bvh over the triangles for picking and ray queries
+  bool picking = true;
+  // bake ambient occlusion per vertex in the background, needs the bvh
+  bool ambientOcclusion = false;
+  unsigned int aoSamples = 32;
+  // time the post-processing steps of the import and print their cost
+  bool report = false;
+  // upload meshes and textures to the current context, the software
+  // renderer loads without one and keeps the textures in memory
+  bool gpu = true;
+  // pack the diffuse textures into texture arrays and merge the draws of
+  // meshes sharing an array
+  bool textureArrays = false;
+  // build the mip chains on the worker threads instead of glGenerateMipmap,
+  // compressed and decoded textures always use the filter
+  bool cpuMips = false;
+  MipFilter mipFilter = MIP_BOX;
+  // chunk files keep at most this many bytes of nodes on the gpu and read
+  // at most this many ahead of the uploads
+  size_t chunkBudget = 256 << 20;
+  size_t chunkMemory = 64 << 20;
+  // point files draw at most this many points per frame
+  size_t pointBudget = 5000000;
+  // binary stl and ply files skip assimp, their faces meeting at less
+  // than the crease angle in degrees share smooth normals
+  bool nativeMeshes = true;
+  float creaseAngle = 60.0f;
+};
+
+// accepts "fast", "balanced" and "render"
+bool parseImportProfile(const std::string &name, ImportProfile &profile);
+const char* importProfileName(ImportProfile profile);
+// accepts "off", "import" and "background"
+bool parseLodMode(const std::string &name, LodMode &mode);
+unsigned int importFlags(ImportProfile profile);
+
+// reads the file with the post-processing steps of the profile
+const aiScene* importScene(Assimp::Importer &importer, const std::string &path,
+                           const ImportOptions &options);
+
+#endif
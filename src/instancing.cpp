@@ -0,0 +1,274 @@
+#include "instancing.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <random>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define INSTANCING_SSE
+#endif
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct InstanceArrays {
+  const float* px;
+  const float* py;
+  const float* pz;
+  const float* qx;
+  const float* qy;
+  const float* qz;
+  const float* qw;
+  const float* s;
+};
+
+// translation * rotation * uniform scale of one instance
+glm::mat4 buildMatrix(const InstanceArrays &in, unsigned int i) {
+  float x = in.qx[i], y = in.qy[i], z = in.qz[i], w = in.qw[i];
+  float s = in.s[i];
+  glm::mat4 m;
+  m[0] = glm::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + z * w),
+                   2.0f * (x * z - y * w), 0.0f) * s;
+  m[1] = glm::vec4(2.0f * (x * y - z * w), 1.0f - 2.0f * (x * x + z * z),
+                   2.0f * (y * z + x * w), 0.0f) * s;
+  m[2] = glm::vec4(2.0f * (x * z + y * w), 2.0f * (y * z - x * w),
+                   1.0f - 2.0f * (x * x + y * y), 0.0f) * s;
+  m[3] = glm::vec4(in.px[i], in.py[i], in.pz[i], 1.0f);
+  return m;
+}
+
+unsigned int cullScalar(const InstanceArrays &in, unsigned int begin,
+                        unsigned int end, const Frustum &frustum,
+                        const glm::vec3 &center, float radius,
+                        glm::mat4* out) {
+  unsigned int written = 0;
+  for (unsigned int i = begin; i < end; i++) {
+    glm::mat4 m = buildMatrix(in, i);
+    glm::vec3 worldCenter = glm::vec3(m * glm::vec4(center, 1.0f));
+    if (frustum.containsSphere(worldCenter, radius * std::fabs(in.s[i])))
+      out[written++] = m;
+  }
+  return written;
+}
+
+#ifdef INSTANCING_SSE
+// four instances per iteration, visible matrices are written back to back
+unsigned int cullSse(const InstanceArrays &in, unsigned int begin,
+                     unsigned int end, const Frustum &frustum,
+                     const glm::vec3 &center, float radius,
+                     glm::mat4* out) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+  const __m128 cx = _mm_set1_ps(center.x);
+  const __m128 cy = _mm_set1_ps(center.y);
+  const __m128 cz = _mm_set1_ps(center.z);
+  const __m128 r = _mm_set1_ps(radius);
+
+  unsigned int written = 0;
+  for (unsigned int i = begin; i < end; i += 4) {
+    __m128 x = _mm_loadu_ps(in.qx + i);
+    __m128 y = _mm_loadu_ps(in.qy + i);
+    __m128 z = _mm_loadu_ps(in.qz + i);
+    __m128 w = _mm_loadu_ps(in.qw + i);
+    __m128 s = _mm_loadu_ps(in.s + i);
+
+    __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y);
+    __m128 zz = _mm_mul_ps(z, z), xy = _mm_mul_ps(x, y);
+    __m128 xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+    __m128 xw = _mm_mul_ps(x, w), yw = _mm_mul_ps(y, w);
+    __m128 zw = _mm_mul_ps(z, w);
+
+    // scaled rotation matrix, mRC is row R of column C
+    __m128 m00 = _mm_mul_ps(s, _mm_sub_ps(one,
+        _mm_mul_ps(two, _mm_add_ps(yy, zz))));
+    __m128 m10 = _mm_mul_ps(s, _mm_mul_ps(two, _mm_add_ps(xy, zw)));
+    __m128 m20 = _mm_mul_ps(s, _mm_mul_ps(two, _mm_sub_ps(xz, yw)));
+    __m128 m01 = _mm_mul_ps(s, _mm_mul_ps(two, _mm_sub_ps(xy, zw)));
+    __m128 m11 = _mm_mul_ps(s, _mm_sub_ps(one,
+        _mm_mul_ps(two, _mm_add_ps(xx, zz))));
+    __m128 m21 = _mm_mul_ps(s, _mm_mul_ps(two, _mm_add_ps(yz, xw)));
+    __m128 m02 = _mm_mul_ps(s, _mm_mul_ps(two, _mm_add_ps(xz, yw)));
+    __m128 m12 = _mm_mul_ps(s, _mm_mul_ps(two, _mm_sub_ps(yz, xw)));
+    __m128 m22 = _mm_mul_ps(s, _mm_sub_ps(one,
+        _mm_mul_ps(two, _mm_add_ps(xx, yy))));
+    __m128 px = _mm_loadu_ps(in.px + i);
+    __m128 py = _mm_loadu_ps(in.py + i);
+    __m128 pz = _mm_loadu_ps(in.pz + i);
+
+    // bounding sphere in world space
+    __m128 wx = _mm_add_ps(px, _mm_add_ps(_mm_mul_ps(m00, cx),
+        _mm_add_ps(_mm_mul_ps(m01, cy), _mm_mul_ps(m02, cz))));
+    __m128 wy = _mm_add_ps(py, _mm_add_ps(_mm_mul_ps(m10, cx),
+        _mm_add_ps(_mm_mul_ps(m11, cy), _mm_mul_ps(m12, cz))));
+    __m128 wz = _mm_add_ps(pz, _mm_add_ps(_mm_mul_ps(m20, cx),
+        _mm_add_ps(_mm_mul_ps(m21, cy), _mm_mul_ps(m22, cz))));
+    __m128 negRadius = _mm_or_ps(_mm_mul_ps(r, _mm_andnot_ps(signMask, s)),
+                                 signMask);
+
+    __m128 inside = _mm_cmpeq_ps(zero, zero);
+    for (const glm::vec4 &plane : frustum.planes) {
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), wx),
+                     _mm_mul_ps(_mm_set1_ps(plane.y), wy)),
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), wz),
+                     _mm_set1_ps(plane.w)));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+    }
+    int mask = _mm_movemask_ps(inside);
+    if (!mask)
+      continue;
+
+    // transpose to one column per instance
+    __m128 column0[4] = { m00, m10, m20, zero };
+    __m128 column1[4] = { m01, m11, m21, zero };
+    __m128 column2[4] = { m02, m12, m22, zero };
+    __m128 column3[4] = { px, py, pz, one };
+    _MM_TRANSPOSE4_PS(column0[0], column0[1], column0[2], column0[3]);
+    _MM_TRANSPOSE4_PS(column1[0], column1[1], column1[2], column1[3]);
+    _MM_TRANSPOSE4_PS(column2[0], column2[1], column2[2], column2[3]);
+    _MM_TRANSPOSE4_PS(column3[0], column3[1], column3[2], column3[3]);
+    for (int lane = 0; lane < 4; lane++) {
+      if (!(mask & (1 << lane)))
+        continue;
+      float* target = &out[written++][0][0];
+      _mm_storeu_ps(target, column0[lane]);
+      _mm_storeu_ps(target + 4, column1[lane]);
+      _mm_storeu_ps(target + 8, column2[lane]);
+      _mm_storeu_ps(target + 12, column3[lane]);
+    }
+  }
+  return written;
+}
+#endif
+
+}
+
+void InstanceSet::setTransforms(
+    const std::vector<InstanceTransform> &transforms) {
+  std::vector<float>* arrays[8] = { &positionX, &positionY, &positionZ,
+                                    &rotationX, &rotationY, &rotationZ,
+                                    &rotationW, &scale };
+  for (std::vector<float>* array : arrays)
+    array->resize(transforms.size());
+  for (unsigned int i = 0; i < transforms.size(); i++)
+    setTransform(i, transforms[i]);
+  visible.resize(transforms.size());
+  visibleCount = 0;
+}
+
+void InstanceSet::setTransform(unsigned int index,
+                               const InstanceTransform &transform) {
+  glm::quat rotation = glm::normalize(transform.rotation);
+  positionX[index] = transform.position.x;
+  positionY[index] = transform.position.y;
+  positionZ[index] = transform.position.z;
+  rotationX[index] = rotation.x;
+  rotationY[index] = rotation.y;
+  rotationZ[index] = rotation.z;
+  rotationW[index] = rotation.w;
+  scale[index] = transform.scale;
+}
+
+unsigned int InstanceSet::update(const Frustum &frustum,
+                                 const glm::vec3 &boundsCenter,
+                                 float boundsRadius,
+                                 const OcclusionBuffer* occlusion) {
+  Clock::time_point start = Clock::now();
+  InstanceArrays arrays = { positionX.data(), positionY.data(),
+                            positionZ.data(), rotationX.data(),
+                            rotationY.data(), rotationZ.data(),
+                            rotationW.data(), scale.data() };
+  unsigned int count = size();
+  unsigned int simdEnd = 0;
+  visibleCount = 0;
+#ifdef INSTANCING_SSE
+  simdEnd = count & ~3u;
+  visibleCount = cullSse(arrays, 0, simdEnd, frustum, boundsCenter,
+                         boundsRadius, visible.data());
+#endif
+  visibleCount += cullScalar(arrays, simdEnd, count, frustum, boundsCenter,
+                             boundsRadius, visible.data() + visibleCount);
+  // instances hidden behind the occluders are compacted away as well
+  occludedCount = 0;
+  if (occlusion) {
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < visibleCount; i++) {
+      const glm::mat4 &m = visible[i];
+      if (occlusion->isOccluded(glm::vec3(m * glm::vec4(boundsCenter, 1.0f)),
+                                boundsRadius * glm::length(glm::vec3(m[0]))))
+        occludedCount++;
+      else
+        visible[kept++] = m;
+    }
+    visibleCount = kept;
+  }
+  Clock::time_point culled = Clock::now();
+
+  // orphan the old storage, the gpu may still read last frame's data
+  if (!buffer)
+    buffer = GpuBuffer("instance set");
+  glBindBuffer(GL_ARRAY_BUFFER, buffer.id());
+  if (bufferCapacity < count) {
+    bufferCapacity = count;
+    buffer.setSize(bufferCapacity * sizeof(glm::mat4));
+  }
+  glBufferData(GL_ARRAY_BUFFER, bufferCapacity * sizeof(glm::mat4), NULL,
+               GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, visibleCount * sizeof(glm::mat4),
+                  visible.data());
+
+  cullMs = std::chrono::duration<double, std::milli>(culled - start).count();
+  uploadMs = std::chrono::duration<double, std::milli>(
+      Clock::now() - culled).count();
+  return visibleCount;
+}
+
+std::vector<glm::mat4> InstanceSet::nearest(const glm::vec3 &point,
+                                            unsigned int count) const {
+  std::vector<std::pair<float, unsigned int>> distances(size());
+  for (unsigned int i = 0; i < size(); i++) {
+    glm::vec3 position(positionX[i], positionY[i], positionZ[i]);
+    glm::vec3 offset = position - point;
+    distances[i] = std::make_pair(glm::dot(offset, offset), i);
+  }
+  count = std::min(count, size());
+  std::partial_sort(distances.begin(), distances.begin() + count,
+                    distances.end());
+
+  InstanceArrays arrays = { positionX.data(), positionY.data(),
+                            positionZ.data(), rotationX.data(),
+                            rotationY.data(), rotationZ.data(),
+                            rotationW.data(), scale.data() };
+  std::vector<glm::mat4> matrices;
+  for (unsigned int i = 0; i < count; i++)
+    matrices.push_back(buildMatrix(arrays, distances[i].second));
+  return matrices;
+}
+
+void InstanceSet::report(std::ostream &out) const {
+  out << "instances: " << visibleCount << " of " << size() << " visible, "
+      << occludedCount << " occluded, "
+      << std::fixed << std::setprecision(3) << cullMs << " ms culling, "
+      << uploadMs << " ms upload" << std::endl;
+}
+
+std::vector<InstanceTransform> layoutGrid(unsigned int count, float spacing) {
+  std::vector<InstanceTransform> transforms(count);
+  unsigned int side = (unsigned int)std::ceil(std::sqrt((double)count));
+  float offset = (side - 1) * spacing * 0.5f;
+  // fixed seed, the same count always gives the same layout
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+  for (unsigned int i = 0; i < count; i++) {
+    transforms[i].position = glm::vec3((i % side) * spacing - offset, 0.0f,
+                                       (i / side) * spacing - offset);
+    transforms[i].rotation = glm::angleAxis(angle(random),
+                                            glm::vec3(0.0f, 1.0f, 0.0f));
+    transforms[i].scale = 1.0f;
+  }
+  return transforms;
+}
@@ -0,0 +1,56 @@
+#ifndef instancing_h
+#define instancing_h
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <ostream>
+#include <vector>
+#include "frustum.h"
+#include "gpuresource.h"
+#include "occlusion.h"
+
+// placement of one copy of a model
+struct InstanceTransform {
+  glm::vec3 position;
+  glm::quat rotation;
+  float scale;
+};
+
+// many copies of one model, culled and compacted every frame
+class InstanceSet {
+public:
+  void setTransforms(const std::vector<InstanceTransform> &transforms);
+  void setTransform(unsigned int index, const InstanceTransform &transform);
+  unsigned int size() const { return (unsigned int)positionX.size(); }
+
+  // builds the matrices of the instances whose bounding sphere is visible
+  // and not occluded and uploads them, returns the number of visible
+  // instances
+  unsigned int update(const Frustum &frustum, const glm::vec3 &boundsCenter,
+                      float boundsRadius,
+                      const OcclusionBuffer* occlusion = nullptr);
+  // matrices of the instances closest to the point, the best occluders
+  std::vector<glm::mat4> nearest(const glm::vec3 &point,
+                                 unsigned int count) const;
+  unsigned int getBuffer() const { return buffer.id(); }
+  unsigned int getVisibleCount() const { return visibleCount; }
+  void report(std::ostream &out) const;
+private:
+  // structure of arrays, the kernel loads four instances per register
+  std::vector<float> positionX, positionY, positionZ;
+  std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+  std::vector<float> scale;
+
+  std::vector<glm::mat4> visible;
+  unsigned int visibleCount = 0;
+  unsigned int occludedCount = 0;
+  GpuBuffer buffer;
+  size_t bufferCapacity = 0;
+  double cullMs = 0.0;
+  double uploadMs = 0.0;
+};
+
+// square grid around the origin, turned randomly to look less uniform
+std::vector<InstanceTransform> layoutGrid(unsigned int count, float spacing);
+
+#endif
@@ -0,0 +1,101 @@
+#include "jobsystem.h"
+#include <algorithm>
+
+JobSystem &JobSystem::get() {
+  static JobSystem jobs;
+  return jobs;
+}
+
+JobSystem::JobSystem() : stopping(false), generation(0) {
+  unsigned int threads = std::max(std::thread::hardware_concurrency(), 1u);
+  for (unsigned int i = 1; i < threads; i++)
+    workers.emplace_back(&JobSystem::workerLoop, this);
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+void JobSystem::parallelFor(size_t count, size_t grain,
+                            const std::function<void(size_t, size_t)> &task) {
+  if (count == 0)
+    return;
+  grain = std::max<size_t>(grain, 1);
+  // small loops aren't worth waking anybody
+  if (workers.empty() || count <= grain) {
+    task(0, count);
+    return;
+  }
+
+  Loop loop;
+  loop.task = &task;
+  loop.count = count;
+  loop.grain = grain;
+  loop.next = 0;
+  loop.done = 0;
+  loop.helpers = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  loops.push_back(&loop);
+  generation++;
+  lock.unlock();
+  wake.notify_all();
+  runChunks(loop, nullptr);
+
+  lock.lock();
+  finished.wait(lock, [&] {
+    return loop.done.load() >= count && loop.helpers == 0;
+  });
+  loops.erase(std::find(loops.begin(), loops.end(), &loop));
+}
+
+void JobSystem::workerLoop() {
+  while (true) {
+    Loop* loop = nullptr;
+    unsigned int seen;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] {
+        return stopping || (loop = pendingLoop()) != nullptr;
+      });
+      if (stopping)
+        return;
+      loop->helpers++;
+      seen = generation;
+    }
+    runChunks(*loop, &seen);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--loop->helpers == 0)
+      finished.notify_all();
+  }
+}
+
+// the newest loop is usually the one a frame waits for, older ones are
+// long running background work
+JobSystem::Loop* JobSystem::pendingLoop() const {
+  for (size_t i = loops.size(); i > 0; i--)
+    if (loops[i - 1]->next.load() < loops[i - 1]->count)
+      return loops[i - 1];
+  return nullptr;
+}
+
+// grabs chunks until the loop is exhausted, workers return early when a
+// newer loop was started so it gets help first
+void JobSystem::runChunks(Loop &loop, const unsigned int* seenGeneration) {
+  while (!seenGeneration || generation.load() == *seenGeneration) {
+    size_t begin = loop.next.fetch_add(loop.grain);
+    if (begin >= loop.count)
+      return;
+    size_t end = std::min(begin + loop.grain, loop.count);
+    (*loop.task)(begin, end);
+    if (loop.done.fetch_add(end - begin) + (end - begin) >= loop.count) {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished.notify_all();
+    }
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef jobsystem_h
+#define jobsystem_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// persistent worker threads for data parallel loops
+class JobSystem {
+public:
+  static JobSystem &get();
+  ~JobSystem();
+
+  // calls task(begin, end) for chunks of at most grain items, the calling
+  // thread helps and the call returns when every chunk is done. loops may
+  // be started from several threads and from inside other loops, idle
+  // workers take chunks from the newest loop that has some left
+  void parallelFor(size_t count, size_t grain,
+                   const std::function<void(size_t, size_t)> &task);
+  unsigned int getThreadCount() const { return workers.size() + 1; }
+private:
+  JobSystem();
+
+  struct Loop {
+    const std::function<void(size_t, size_t)>* task;
+    size_t count;
+    size_t grain;
+    std::atomic<size_t> next;
+    std::atomic<size_t> done;
+    // workers inside runChunks, the loop is only removed once they left
+    unsigned int helpers;
+  };
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+  bool stopping;
+  // running loops, the newest last
+  std::vector<Loop*> loops;
+  // counts started loops, workers leave a loop when a newer one arrives
+  std::atomic<unsigned int> generation;
+
+  void workerLoop();
+  Loop* pendingLoop() const;
+  // seenGeneration is null for the thread that started the loop
+  void runChunks(Loop &loop, const unsigned int* seenGeneration);
+};
+
+#endif
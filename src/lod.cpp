@@ -0,0 +1,287 @@
+#include "lod.h"
+#include "spatialkey.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+
+namespace {
+
+// plane distance quadric, stores the upper triangle of the 4x4 matrix
+struct Quadric {
+  double xx = 0, xy = 0, xz = 0, xw = 0;
+  double yy = 0, yz = 0, yw = 0;
+  double zz = 0, zw = 0;
+  double ww = 0;
+  double weight = 0;
+
+  void addPlane(const glm::dvec3 &n, double d, double w) {
+    xx += w * n.x * n.x; xy += w * n.x * n.y; xz += w * n.x * n.z;
+    xw += w * n.x * d; yy += w * n.y * n.y; yz += w * n.y * n.z;
+    yw += w * n.y * d; zz += w * n.z * n.z; zw += w * n.z * d;
+    ww += w * d * d;
+    weight += w;
+  }
+  Quadric &operator+=(const Quadric &q) {
+    xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw; yy += q.yy;
+    yz += q.yz; yw += q.yw; zz += q.zz; zw += q.zw; ww += q.ww;
+    weight += q.weight;
+    return *this;
+  }
+  // mean squared distance of the point to the accumulated planes
+  double error(const glm::vec3 &p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double e = xx * x * x + 2 * xy * x * y + 2 * xz * x * z + 2 * xw * x +
+               yy * y * y + 2 * yz * y * z + 2 * yw * y +
+               zz * z * z + 2 * zw * z + ww;
+    return weight > 0 ? std::fabs(e) / weight : 0.0;
+  }
+};
+
+struct Collapse {
+  double cost;
+  unsigned int from;
+  unsigned int to;
+  unsigned int fromVersion;
+  unsigned int toVersion;
+
+  bool operator>(const Collapse &other) const { return cost > other.cost; }
+};
+
+// half-edge collapse simplifier, keeps its state between runs so the
+// levels of a mesh are produced one after another
+class Simplifier {
+public:
+  Simplifier(const std::vector<Vertex> &vertices,
+             const std::vector<unsigned int> &indices);
+  void run(size_t targetIndices);
+  std::vector<unsigned int> extract() const;
+  size_t liveIndices() const { return live * 3; }
+  float error() const { return (float)std::sqrt(maxCost); }
+private:
+  const std::vector<Vertex> &vertices;
+  std::vector<unsigned int> triangles;
+  std::vector<bool> alive;
+  size_t live;
+
+  std::vector<unsigned int> position;
+  std::vector<Quadric> quadrics;
+  std::vector<bool> locked;
+  std::vector<bool> removed;
+  std::vector<unsigned int> version;
+  std::vector<std::vector<unsigned int>> vertexTriangles;
+  std::priority_queue<Collapse, std::vector<Collapse>,
+                      std::greater<Collapse>> queue;
+  double maxCost;
+
+  void push(unsigned int from, unsigned int to);
+  bool keepsOrientation(unsigned int from, unsigned int to) const;
+  void collapse(const Collapse &edge);
+};
+
+struct PositionKey {
+  float x, y, z;
+  bool operator==(const PositionKey &other) const {
+    return std::memcmp(this, &other, sizeof(PositionKey)) == 0;
+  }
+};
+
+struct PositionHash {
+  size_t operator()(const PositionKey &key) const {
+    return (size_t)hashPosition(glm::vec3(key.x, key.y, key.z));
+  }
+};
+
+Simplifier::Simplifier(const std::vector<Vertex> &vertices,
+                       const std::vector<unsigned int> &indices)
+    : vertices(vertices), triangles(indices),
+      alive(indices.size() / 3, true), live(indices.size() / 3),
+      position(vertices.size()), locked(vertices.size(), false),
+      removed(vertices.size(), false), version(vertices.size(), 0),
+      vertexTriangles(vertices.size()), maxCost(0.0) {
+  // vertices with equal positions but other attributes form seams
+  std::unordered_map<PositionKey, unsigned int, PositionHash> positions;
+  std::vector<unsigned int> copies;
+  for (unsigned int i = 0; i < vertices.size(); i++) {
+    const glm::vec3 &p = vertices[i].position;
+    auto inserted = positions.insert({ { p.x, p.y, p.z },
+                                       (unsigned int)copies.size() });
+    if (inserted.second)
+      copies.push_back(0);
+    position[i] = inserted.first->second;
+    copies[position[i]]++;
+  }
+
+  // edges with one triangle are open borders, more are non-manifold
+  std::unordered_map<unsigned long long, unsigned int> edges;
+  for (size_t t = 0; t < triangles.size(); t += 3)
+    for (int e = 0; e < 3; e++) {
+      unsigned long long a = position[triangles[t + e]];
+      unsigned long long b = position[triangles[t + (e + 1) % 3]];
+      edges[a < b ? (a << 32) | b : (b << 32) | a]++;
+    }
+  std::vector<bool> lockedPosition(copies.size(), false);
+  for (unsigned int p = 0; p < copies.size(); p++)
+    lockedPosition[p] = copies[p] > 1;
+  for (const auto &edge : edges)
+    if (edge.second != 2) {
+      lockedPosition[edge.first >> 32] = true;
+      lockedPosition[edge.first & 0xffffffffu] = true;
+    }
+  for (unsigned int i = 0; i < vertices.size(); i++)
+    locked[i] = lockedPosition[position[i]];
+
+  // area weighted planes of the triangles around every position
+  quadrics.resize(copies.size());
+  for (size_t t = 0; t < triangles.size(); t += 3) {
+    glm::dvec3 p0 = vertices[triangles[t]].position;
+    glm::dvec3 p1 = vertices[triangles[t + 1]].position;
+    glm::dvec3 p2 = vertices[triangles[t + 2]].position;
+    glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+    double area = glm::length(normal);
+    if (area > 0.0)
+      normal /= area;
+    for (int c = 0; c < 3; c++) {
+      quadrics[position[triangles[t + c]]].addPlane(
+          normal, -glm::dot(normal, p0), area * 0.5);
+      vertexTriangles[triangles[t + c]].push_back(t / 3);
+    }
+  }
+
+  for (size_t t = 0; t < triangles.size(); t += 3)
+    for (int e = 0; e < 3; e++) {
+      push(triangles[t + e], triangles[t + (e + 1) % 3]);
+      push(triangles[t + (e + 1) % 3], triangles[t + e]);
+    }
+}
+
+void Simplifier::push(unsigned int from, unsigned int to) {
+  if (locked[from] || from == to)
+    return;
+  Quadric combined = quadrics[position[from]];
+  combined += quadrics[position[to]];
+  queue.push({ combined.error(vertices[to].position), from, to,
+               version[from], version[to] });
+}
+
+// rejects collapses that would turn a triangle of the fan around
+bool Simplifier::keepsOrientation(unsigned int from, unsigned int to) const {
+  const glm::vec3 &target = vertices[to].position;
+  for (unsigned int t : vertexTriangles[from]) {
+    if (!alive[t])
+      continue;
+    const unsigned int* tri = &triangles[t * 3];
+    if (tri[0] == to || tri[1] == to || tri[2] == to)
+      continue;
+    glm::vec3 before[3];
+    glm::vec3 after[3];
+    for (int c = 0; c < 3; c++) {
+      before[c] = vertices[tri[c]].position;
+      after[c] = tri[c] == from ? target : before[c];
+    }
+    glm::vec3 normalBefore = glm::cross(before[1] - before[0],
+                                        before[2] - before[0]);
+    glm::vec3 normalAfter = glm::cross(after[1] - after[0],
+                                       after[2] - after[0]);
+    if (glm::dot(normalBefore, normalAfter) <= 0.0f)
+      return false;
+  }
+  return true;
+}
+
+void Simplifier::collapse(const Collapse &edge) {
+  unsigned int from = edge.from;
+  unsigned int to = edge.to;
+  for (unsigned int t : vertexTriangles[from]) {
+    if (!alive[t])
+      continue;
+    unsigned int* tri = &triangles[t * 3];
+    if (tri[0] == to || tri[1] == to || tri[2] == to) {
+      alive[t] = false;
+      live--;
+      continue;
+    }
+    for (int c = 0; c < 3; c++)
+      if (tri[c] == from)
+        tri[c] = to;
+    vertexTriangles[to].push_back(t);
+  }
+  vertexTriangles[from].clear();
+  quadrics[position[to]] += quadrics[position[from]];
+  removed[from] = true;
+  version[to]++;
+  maxCost = std::max(maxCost, edge.cost);
+
+  // the costs around the surviving vertex changed
+  for (unsigned int t : vertexTriangles[to]) {
+    if (!alive[t])
+      continue;
+    for (int c = 0; c < 3; c++) {
+      unsigned int other = triangles[t * 3 + c];
+      if (other == to)
+        continue;
+      push(other, to);
+      push(to, other);
+    }
+  }
+}
+
+void Simplifier::run(size_t targetIndices) {
+  while (live * 3 > targetIndices && !queue.empty()) {
+    Collapse edge = queue.top();
+    queue.pop();
+    if (removed[edge.from] || removed[edge.to] ||
+        version[edge.from] != edge.fromVersion ||
+        version[edge.to] != edge.toVersion)
+      continue;
+    if (!keepsOrientation(edge.from, edge.to))
+      continue;
+    collapse(edge);
+  }
+}
+
+std::vector<unsigned int> Simplifier::extract() const {
+  std::vector<unsigned int> result;
+  result.reserve(live * 3);
+  for (size_t t = 0; t < alive.size(); t++)
+    if (alive[t])
+      result.insert(result.end(), &triangles[t * 3], &triangles[t * 3] + 3);
+  return result;
+}
+
+}
+
+std::vector<unsigned int> simplifyMesh(const std::vector<Vertex> &vertices,
+                                       const std::vector<unsigned int> &indices,
+                                       size_t targetIndices, float &error) {
+  Simplifier simplifier(vertices, indices);
+  simplifier.run(targetIndices);
+  error = simplifier.error();
+  return simplifier.extract();
+}
+
+std::vector<LodLevel> buildLods(const std::vector<Vertex> &vertices,
+                                const std::vector<unsigned int> &indices,
+                                unsigned int maxLevels) {
+  std::vector<LodLevel> levels;
+  levels.push_back({ indices, 0.0f });
+  // tiny meshes don't pay for the extra draw ranges
+  if (maxLevels < 2 || indices.size() < 3 * 64)
+    return levels;
+
+  Simplifier simplifier(vertices, indices);
+  size_t target = indices.size();
+  for (unsigned int level = 1; level < maxLevels; level++) {
+    target = target / 6 * 3;
+    simplifier.run(target);
+    // stop once locked seams and borders keep the count from falling
+    if (simplifier.liveIndices() > levels.back().indices.size() * 85 / 100)
+      break;
+    levels.push_back({ simplifier.extract(), simplifier.error() });
+    if (simplifier.liveIndices() < 3 * 64)
+      break;
+  }
+  return levels;
+}
@@ -0,0 +1,25 @@
+#ifndef lod_h
+#define lod_h
+
+#include <vector>
+#include "mesh.h"
+
+// one simplified index buffer over the unchanged vertices of a mesh
+struct LodLevel {
+  std::vector<unsigned int> indices;
+  // largest distance the surface moved, in model units
+  float error;
+};
+
+// collapses edges by quadric error until at most targetIndices remain,
+// vertices on uv/normal seams and open borders never move
+std::vector<unsigned int> simplifyMesh(const std::vector<Vertex> &vertices,
+                                       const std::vector<unsigned int> &indices,
+                                       size_t targetIndices, float &error);
+
+// level 0 is the original, every following level halves the triangles
+std::vector<LodLevel> buildLods(const std::vector<Vertex> &vertices,
+                                const std::vector<unsigned int> &indices,
+                                unsigned int maxLevels);
+
+#endif
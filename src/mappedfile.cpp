@@ -0,0 +1,193 @@
+#include "mappedfile.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sys/stat.h>
+#include <utility>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+void readFaults(long &minor, long &major) {
+#ifdef _WIN32
+  minor = 0;
+  major = 0;
+#else
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  minor = usage.ru_minflt;
+  major = usage.ru_majflt;
+#endif
+}
+
+}
+
+void IoStats::begin() {
+  readFaults(minorFaults, majorFaults);
+}
+
+void IoStats::end() {
+  long minor;
+  long major;
+  readFaults(minor, major);
+  minorFaults = minor - minorFaults;
+  majorFaults = major - majorFaults;
+}
+
+void IoStats::print(const std::string &name) const {
+  const double mb = 1024.0 * 1024.0;
+  std::cout << "i/o report for " << name << ": " << files << " files, "
+            << std::fixed << std::setprecision(2) << mappedBytes / mb
+            << " MB mapped, " << copiedBytes / mb << " MB copied, "
+            << ioMs << " ms in i/o, " << minorFaults << " minor / "
+            << majorFaults << " major page faults" << std::endl;
+}
+
+MappedFile::MappedFile(const std::string &path, FileAccess access) {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return;
+  LARGE_INTEGER fileSize;
+  GetFileSizeEx(file, &fileSize);
+  length = (size_t)fileSize.QuadPart;
+  opened = true;
+  if (length > 0) {
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping)
+      bytes = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ,
+                                                  0, 0, 0);
+    opened = bytes != nullptr;
+  }
+  CloseHandle(file);
+#else
+  int file = open(path.c_str(), O_RDONLY);
+  if (file < 0)
+    return;
+  struct stat info;
+  if (fstat(file, &info) == 0) {
+    length = (size_t)info.st_size;
+    opened = true;
+  }
+  // empty files can't be mapped, they stay open without data
+  if (opened && length > 0) {
+    void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+    if (view == MAP_FAILED)
+      opened = false;
+    else
+      bytes = (const unsigned char*)view;
+  }
+  // the mapping stays valid after the descriptor is closed
+  ::close(file);
+#endif
+  if (!opened)
+    length = 0;
+  else
+    advise(access);
+}
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept {
+  *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+  if (this != &other) {
+    close();
+    bytes = other.bytes;
+    length = other.length;
+    opened = other.opened;
+#ifdef _WIN32
+    mapping = other.mapping;
+    other.mapping = nullptr;
+#endif
+    other.bytes = nullptr;
+    other.length = 0;
+    other.opened = false;
+  }
+  return *this;
+}
+
+void MappedFile::advise(FileAccess access) const {
+#ifndef _WIN32
+  if (!bytes)
+    return;
+  int advice = MADV_NORMAL;
+  switch (access) {
+  case ACCESS_SEQUENTIAL:
+    advice = MADV_SEQUENTIAL; break;
+  case ACCESS_WILLNEED:
+    advice = MADV_WILLNEED; break;
+  case ACCESS_RANDOM:
+    advice = MADV_RANDOM; break;
+  }
+  madvise((void*)bytes, length, advice);
+#endif
+}
+
+void MappedFile::release(size_t offset, size_t size) const {
+#ifndef _WIN32
+  if (!bytes || offset >= length)
+    return;
+  // only the whole pages inside the range, the neighbours may be in use
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t begin = ((size_t)bytes + offset + page - 1) / page * page;
+  size_t end = ((size_t)bytes + std::min(offset + size, length)) / page *
+               page;
+  if (end > begin)
+    madvise((void*)begin, end - begin, MADV_DONTNEED);
+#endif
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+  if (bytes)
+    UnmapViewOfFile(bytes);
+  if (mapping)
+    CloseHandle(mapping);
+  mapping = nullptr;
+#else
+  if (bytes)
+    munmap((void*)bytes, length);
+#endif
+  bytes = nullptr;
+  length = 0;
+  opened = false;
+}
+
+bool fileExists(const std::string &path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0;
+}
+
+size_t peakResidentBytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                            sizeof(counters)))
+    return 0;
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return (size_t)usage.ru_maxrss;
+#else
+  // kilobytes on linux
+  return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
@@ -0,0 +1,62 @@
+#ifndef mappedfile_h
+#define mappedfile_h
+
+#include <cstddef>
+#include <string>
+
+enum FileAccess {
+  ACCESS_SEQUENTIAL,
+  ACCESS_WILLNEED,
+  ACCESS_RANDOM
+};
+
+// i/o statistics of one model load
+struct IoStats {
+  unsigned int files = 0;
+  size_t mappedBytes = 0;
+  size_t copiedBytes = 0;
+  double ioMs = 0.0;
+  long minorFaults = 0;
+  long majorFaults = 0;
+
+  // remembers the process fault counters, end() stores the difference
+  void begin();
+  void end();
+  void print(const std::string &name) const;
+};
+
+// read-only view of a whole file in memory
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const std::string &path, FileAccess access);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile(MappedFile &&other) noexcept;
+  MappedFile &operator=(MappedFile &&other) noexcept;
+
+  bool isOpen() const { return opened; }
+  const unsigned char* data() const { return bytes; }
+  size_t size() const { return length; }
+  // hint how the following reads will touch the file
+  void advise(FileAccess access) const;
+  // lets the os drop the memory of a range that won't be read again soon,
+  // a later read faults it in from the file
+  void release(size_t offset, size_t size) const;
+private:
+  const unsigned char* bytes = nullptr;
+  size_t length = 0;
+  bool opened = false;
+#ifdef _WIN32
+  void* mapping = nullptr;
+#endif
+
+  void close();
+};
+
+bool fileExists(const std::string &path);
+// largest resident memory of the process so far in bytes
+size_t peakResidentBytes();
+
+#endif
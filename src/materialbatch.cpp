@@ -0,0 +1,208 @@
+#include "materialbatch.h"
+#include "glstate.h"
+#include <algorithm>
+#include <cstddef>
+#include <iomanip>
+#include <map>
+#include <utility>
+
+void MaterialBatch::build(const std::vector<Mesh> &meshes) {
+  // the first diffuse image of every mesh, arrays need equal sizes
+  std::vector<const TextureImage*> diffuse(meshes.size(), nullptr);
+  std::map<std::pair<int, int>, std::vector<const TextureImage*>> groups;
+  for (size_t i = 0; i < meshes.size(); i++) {
+    for (const Texture &texture : meshes[i].textures)
+      if (texture.type == "texture_diffuse" && texture.image &&
+          !texture.image->levels.empty()) {
+        diffuse[i] = texture.image.get();
+        break;
+      }
+    if (!diffuse[i])
+      continue;
+    const TextureImage::Level &base = diffuse[i]->levels[0];
+    std::vector<const TextureImage*> &group =
+        groups[std::make_pair(base.width, base.height)];
+    if (std::find(group.begin(), group.end(), diffuse[i]) == group.end())
+      group.push_back(diffuse[i]);
+  }
+
+  GLint maxLayers = 256;
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+  std::map<const TextureImage*, Layer> placed;
+  for (const auto &group : groups)
+    for (size_t first = 0; first < group.second.size();
+         first += (size_t)maxLayers) {
+      size_t last = std::min(first + (size_t)maxLayers, group.second.size());
+      std::vector<const TextureImage*> images(group.second.begin() + first,
+                                              group.second.begin() + last);
+      arrays.push_back(Array());
+      uploadArray(arrays.back(), images);
+      for (size_t k = 0; k < images.size(); k++)
+        placed[images[k]] = { (unsigned int)arrays.size() - 1,
+                              (unsigned int)k };
+    }
+
+  layers.assign(meshes.size(), { NONE, 0 });
+  for (size_t i = 0; i < meshes.size(); i++)
+    if (diffuse[i])
+      layers[i] = placed[diffuse[i]];
+  refresh(meshes);
+}
+
+// every level of the images goes into the same level of the array
+void MaterialBatch::uploadArray(
+    Array &array, const std::vector<const TextureImage*> &images) {
+  const TextureImage &first = *images[0];
+  array.texture = GpuTexture("texture array");
+  array.width = first.levels[0].width;
+  array.height = first.levels[0].height;
+  array.layers = images.size();
+  size_t bytes = 0;
+  glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture.id());
+  for (size_t level = 0; level < first.levels.size(); level++) {
+    const TextureImage::Level &size = first.levels[level];
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, size.width,
+                 size.height, images.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 nullptr);
+    for (size_t k = 0; k < images.size(); k++)
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, k, size.width,
+                      size.height, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                      images[k]->levels[level].rgba.data());
+    bytes += size.rgba.size() * images.size();
+  }
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  array.texture.setSize(bytes);
+  textureBytes += bytes;
+}
+
+void MaterialBatch::refresh(const std::vector<Mesh> &meshes) {
+  merged.assign(meshes.size(), false);
+  baseVertices.assign(meshes.size(), 0);
+  baseIndices.assign(meshes.size(), 0);
+  mergedMeshes = 0;
+
+  // the shared buffer has no instance stream, so only meshes at the origin
+  // can be merged. blended meshes need their own opacity
+  std::vector<BatchVertex> batchVertices;
+  size_t indexCount = 0;
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    const Mesh &mesh = meshes[i];
+    if (!isPacked(i) || mesh.instances.size() != 1 ||
+        mesh.instances[0] != glm::mat4(1.0f) || mesh.opacity < 1.0f)
+      continue;
+    merged[i] = true;
+    mergedMeshes++;
+    baseVertices[i] = (GLint)batchVertices.size();
+    baseIndices[i] = (unsigned int)indexCount;
+    for (size_t v = 0; v < mesh.vertices.size(); v++)
+      batchVertices.push_back({ mesh.vertices[v],
+                                mesh.occlusion.empty() ? 1.0f :
+                                                         mesh.occlusion[v],
+                                getLayer(i) });
+    indexCount += mesh.getIndexCount();
+  }
+  if (mergedMeshes == 0) {
+    vertexArray = GpuVertexArray();
+    vertexBuffer = GpuBuffer();
+    indexBuffer = GpuBuffer();
+    return;
+  }
+
+  vertexArray = GpuVertexArray("batch vao");
+  vertexBuffer = GpuBuffer("batch vertices");
+  indexBuffer = GpuBuffer("batch indices");
+  glBindVertexArray(vertexArray.id());
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer.id());
+  glBufferData(GL_ARRAY_BUFFER, batchVertices.size() * sizeof(BatchVertex),
+               batchVertices.data(), GL_STATIC_DRAW);
+  vertexBuffer.setSize(batchVertices.size() * sizeof(BatchVertex));
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer.id());
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int),
+               nullptr, GL_STATIC_DRAW);
+  indexBuffer.setSize(indexCount * sizeof(unsigned int));
+  // the levels of detail only live in the element buffers of the meshes
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    if (!merged[i])
+      continue;
+    glBindBuffer(GL_COPY_READ_BUFFER, meshes[i].getIndexBuffer());
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ELEMENT_ARRAY_BUFFER, 0,
+                        baseIndices[i] * sizeof(unsigned int),
+                        meshes[i].getIndexCount() * sizeof(unsigned int));
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+  GLsizei stride = sizeof(BatchVertex);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+                        (void*)(offsetof(BatchVertex, vertex) +
+                                offsetof(Vertex, position)));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride,
+                        (void*)(offsetof(BatchVertex, vertex) +
+                                offsetof(Vertex, normal)));
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride,
+                        (void*)(offsetof(BatchVertex, vertex) +
+                                offsetof(Vertex, texturecoord)));
+  glEnableVertexAttribArray(OCCLUSION_ATTRIBUTE);
+  glVertexAttribPointer(OCCLUSION_ATTRIBUTE, 1, GL_FLOAT, GL_FALSE, stride,
+                        (void*)offsetof(BatchVertex, occlusion));
+  glEnableVertexAttribArray(LAYER_ATTRIBUTE);
+  glVertexAttribPointer(LAYER_ATTRIBUTE, 1, GL_FLOAT, GL_FALSE, stride,
+                        (void*)offsetof(BatchVertex, layer));
+  glBindVertexArray(0);
+}
+
+void MaterialBatch::addRanges(unsigned int mesh,
+                              const std::vector<GLsizei> &counts,
+                              const std::vector<unsigned int> &offsets) {
+  for (size_t i = 0; i < counts.size(); i++)
+    addRange(mesh, counts[i], offsets[i]);
+}
+
+void MaterialBatch::addRange(unsigned int mesh, GLsizei count,
+                             unsigned int offset) {
+  counts.push_back(count);
+  pointers.push_back((const void*)((baseIndices[mesh] + offset) *
+                                   sizeof(unsigned int)));
+  bases.push_back(baseVertices[mesh]);
+}
+
+void MaterialBatch::drawRanges(Shader &shader) {
+  if (counts.empty())
+    return;
+  glm::mat4 node = glm::mat4(1.0f);
+  shader.setUniform("node", node);
+  GlStateCache &state = GlStateCache::get();
+  state.bindVertexArray(vertexArray.id());
+  // the instance locations are disabled, their constant is the identity
+  for (unsigned int i = 0; i < 4; i++)
+    glVertexAttrib4f(3 + i, i == 0 ? 1.0f : 0.0f, i == 1 ? 1.0f : 0.0f,
+                     i == 2 ? 1.0f : 0.0f, i == 3 ? 1.0f : 0.0f);
+  glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT,
+                                pointers.data(), counts.size(),
+                                bases.data());
+  state.releaseVertexArray();
+  counts.clear();
+  pointers.clear();
+  bases.clear();
+}
+
+void MaterialBatch::report(std::ostream &out) const {
+  unsigned int layerCount = 0;
+  for (const Array &array : arrays)
+    layerCount += array.layers;
+  size_t packed = 0;
+  for (const Layer &layer : layers)
+    packed += layer.array != NONE ? 1 : 0;
+  out << "texture arrays: " << layerCount << " diffuse textures in "
+      << arrays.size() << " arrays (" << std::fixed << std::setprecision(2)
+      << textureBytes / (1024.0 * 1024.0) << " MB), " << packed << " of "
+      << layers.size() << " meshes packed, " << mergedMeshes
+      << " merged into one buffer" << std::endl;
+}
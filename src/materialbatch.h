@@ -0,0 +1,92 @@
+#ifndef materialbatch_h
+#define materialbatch_h
+
+#include <glad/glad.h>
+#include <ostream>
+#include <vector>
+#include "gpuresource.h"
+#include "mesh.h"
+
+// layer of the diffuse texture a packed mesh samples, read from the
+// location by the array shader
+const unsigned int LAYER_ATTRIBUTE = 8;
+
+// collapses the diffuse textures of a model into texture arrays, one per
+// size, so a material is only a layer index. meshes used by a single
+// untransformed node are also copied into one shared vertex and index
+// buffer, the meshes of one array then go out in one multi draw
+class MaterialBatch {
+public:
+  // packs the decoded diffuse images of the meshes, meshes without one
+  // keep drawing with their own textures
+  void build(const std::vector<Mesh> &meshes);
+  // copies the index buffers and the occlusion of the merged meshes again
+  // after their levels of detail or the ambient occlusion arrived
+  void refresh(const std::vector<Mesh> &meshes);
+  bool empty() const { return arrays.empty(); }
+  bool isPacked(unsigned int mesh) const {
+    return mesh < layers.size() && layers[mesh].array != NONE;
+  }
+  bool isMerged(unsigned int mesh) const {
+    return mesh < merged.size() && merged[mesh];
+  }
+  unsigned int getArray(unsigned int mesh) const {
+    return layers[mesh].array;
+  }
+  float getLayer(unsigned int mesh) const {
+    return (float)layers[mesh].layer;
+  }
+  unsigned int getArrayTexture(unsigned int array) const {
+    return arrays[array].texture.id();
+  }
+  // queues index ranges of a merged mesh, offsets are in indices of its
+  // own index buffer
+  void addRanges(unsigned int mesh, const std::vector<GLsizei> &counts,
+                 const std::vector<unsigned int> &offsets);
+  void addRange(unsigned int mesh, GLsizei count, unsigned int offset);
+  bool hasRanges() const { return !counts.empty(); }
+  // draws the queued ranges with one call and clears them
+  void drawRanges(Shader &shader);
+  void report(std::ostream &out) const;
+private:
+  static const unsigned int NONE = 0xffffffffu;
+
+  struct Array {
+    GpuTexture texture;
+    int width;
+    int height;
+    unsigned int layers;
+  };
+  struct Layer {
+    unsigned int array;
+    unsigned int layer;
+  };
+  // the vertex of the shared buffer carries what the meshes kept in
+  // separate buffers or generic attributes
+  struct BatchVertex {
+    Vertex vertex;
+    float occlusion;
+    float layer;
+  };
+
+  std::vector<Array> arrays;
+  std::vector<Layer> layers;
+  std::vector<bool> merged;
+  std::vector<GLint> baseVertices;
+  std::vector<unsigned int> baseIndices;
+  size_t mergedMeshes = 0;
+  size_t textureBytes = 0;
+
+  GpuVertexArray vertexArray;
+  GpuBuffer vertexBuffer;
+  GpuBuffer indexBuffer;
+
+  std::vector<GLsizei> counts;
+  std::vector<const void*> pointers;
+  std::vector<GLint> bases;
+
+  void uploadArray(Array &array,
+                   const std::vector<const TextureImage*> &images);
+};
+
+#endif
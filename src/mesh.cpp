@@ -1,19 +1,160 @@
 #include "mesh.h"
+#include "lod.h"
+#include "glstate.h"
+#include <cmath>
+#include <utility>
+
 Mesh::Mesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices,
-           std::vector<Texture> &texture)
-    : vertices(vertices), indices(indices), textures(texture) {
-  setupMesh();
+           std::vector<Texture> &texture, bool gpu)
+    : vertices(vertices), indices(indices), textures(texture), gpu(gpu),
+      currentLod(0) {
+  initialize();
+}
+
+Mesh::Mesh(std::vector<Vertex> &&vertices,
+           std::vector<unsigned int> &&indices,
+           std::vector<Texture> &&texture, bool gpu)
+    : vertices(std::move(vertices)), indices(std::move(indices)),
+      textures(std::move(texture)), gpu(gpu), currentLod(0) {
+  initialize();
+}
+
+void Mesh::initialize() {
+  computeBounds();
+  computeUvDensity();
+  if (gpu)
+    setupMesh();
+  else
+    lodRanges.push_back({ 0, (unsigned int)indices.size(), 0.0f });
+  setInstances(std::vector<glm::mat4>(1, glm::mat4(1.0f)));
 }
 
 // draws all the meshes of the model
 void Mesh::draw(Shader &shader) {
+  bindTextures(shader);
+  drawElements(shader, VAO.id());
+}
+
+void Mesh::drawRanges(Shader &shader, const std::vector<GLsizei> &counts,
+                      const std::vector<unsigned int> &offsets) {
+  if (counts.empty())
+    return;
+  bindTextures(shader);
+  drawElementRanges(shader, VAO.id(), counts, offsets);
+}
+
+void Mesh::drawDepth(Shader &shader) {
+  if (!depthVAO)
+    setupDepthStream();
+  drawElements(shader, depthVAO.id());
+}
+
+void Mesh::drawDepthRanges(Shader &shader, const std::vector<GLsizei> &counts,
+                           const std::vector<unsigned int> &offsets) {
+  if (counts.empty())
+    return;
+  if (!depthVAO)
+    setupDepthStream();
+  drawElementRanges(shader, depthVAO.id(), counts, offsets);
+}
+
+void Mesh::drawElements(Shader &shader, unsigned int vao) {
+  // the instance buffer already holds the node transforms
+  glm::mat4 node = glm::mat4(1.0f);
+  shader.setUniform("node", node);
+  const LodRange &range = lodRanges[currentLod];
+  GlStateCache &state = GlStateCache::get();
+  state.bindVertexArray(vao);
+  glDrawElementsInstanced(GL_TRIANGLES, range.count, GL_UNSIGNED_INT,
+                          (void*)(range.offset * sizeof(unsigned int)),
+                          instances.size());
+  state.releaseVertexArray();
+}
+
+void Mesh::drawElementRanges(Shader &shader, unsigned int vao,
+                             const std::vector<GLsizei> &counts,
+                             const std::vector<unsigned int> &offsets) {
+  glm::mat4 node = glm::mat4(1.0f);
+  shader.setUniform("node", node);
+  std::vector<const void*> pointers(offsets.size());
+  for (size_t i = 0; i < offsets.size(); i++)
+    pointers[i] = (const void*)(offsets[i] * sizeof(unsigned int));
+  GlStateCache &state = GlStateCache::get();
+  state.bindVertexArray(vao);
+  glMultiDrawElements(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT,
+                      pointers.data(), counts.size());
+  state.releaseVertexArray();
+}
+
+void Mesh::setLods(const std::vector<LodLevel> &levels) {
+  std::vector<unsigned int> combined;
+  lodRanges.clear();
+  for (const LodLevel &level : levels) {
+    lodRanges.push_back({ (unsigned int)combined.size(),
+                          (unsigned int)level.indices.size(), level.error });
+    combined.insert(combined.end(), level.indices.begin(),
+                    level.indices.end());
+  }
+  currentLod = 0;
+  if (!gpu)
+    return;
+
+  // the vao keeps the element buffer binding
+  glBindVertexArray(VAO.id());
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, combined.size() * sizeof(unsigned int),
+               combined.data(), GL_STATIC_DRAW);
+  EBO.setSize(combined.size() * sizeof(unsigned int));
+  glBindVertexArray(0);
+}
+
+void Mesh::selectLod(float pixelsPerUnit, float pixelError) {
+  const float hysteresis = 0.25f;
+  unsigned int desired = 0;
+  for (unsigned int i = 1; i < lodRanges.size(); i++)
+    if (lodRanges[i].error * pixelsPerUnit <= pixelError)
+      desired = i;
+
+  // the current level is kept while it is close to the threshold
+  float current = lodRanges[currentLod].error * pixelsPerUnit;
+  bool tooCoarse = current > pixelError * (1.0f + hysteresis);
+  bool tooFine = currentLod + 1 < lodRanges.size() &&
+      lodRanges[currentLod + 1].error * pixelsPerUnit <
+      pixelError * (1.0f - hysteresis);
+  if (tooCoarse || tooFine)
+    currentLod = desired;
+}
+
+unsigned int Mesh::getDrawnTriangles() const {
+  return lodRanges[currentLod].count / 3 * instances.size();
+}
+
+void Mesh::drawInstanced(Shader &shader, unsigned int buffer,
+                         unsigned int count) {
+  if (count == 0)
+    return;
+  bindTextures(shader);
+
+  // one call per node, the instance attributes read the foreign buffer
+  // and all copies use the full detail
+  glBindVertexArray(VAO.id());
+  setInstanceAttributes(buffer);
+  for (glm::mat4 &node : instances) {
+    shader.setUniform("node", node);
+    glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0,
+                            count);
+  }
+  setInstanceAttributes(instanceVBO.id());
+  glBindVertexArray(0);
+}
+
+void Mesh::bindTextures(Shader &shader) const {
   unsigned int diffuseNr = 1;
   unsigned int specularNr = 1;
   unsigned int normalNr = 1;
 
   // bind all textures
+  GlStateCache &state = GlStateCache::get();
   for (unsigned int i = 0; i < textures.size(); i++) {
-    glActiveTexture(GL_TEXTURE0 + i);
     std::string number;
     std::string name = textures[i].type;
     if (name == "texture_diffuse")
@@ -23,28 +164,62 @@ void Mesh::draw(Shader &shader) {
     else if (name == "texture_normal")
       number = std::to_string(normalNr++);
     shader.setUniform(("material." + name + number).c_str(), 1);
-    glBindTexture(GL_TEXTURE_2D, textures[i].id);
+    if (textures[i].texture)
+      state.bindTexture(i, textures[i].texture->id());
 
   }
 
-  // draw the mesh
-  glActiveTexture(GL_TEXTURE0);
-  glBindVertexArray(VAO);
-  glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+  state.releaseTextureUnit();
+}
+
+VirtualTexture* Mesh::getVirtualTexture() const {
+  for (const Texture &texture : textures)
+    if (texture.virtualTexture)
+      return texture.virtualTexture.get();
+  return nullptr;
+}
+
+void Mesh::setInstances(const std::vector<glm::mat4> &transforms) {
+  instances = transforms;
+  if (!gpu)
+    return;
+  glBindBuffer(GL_ARRAY_BUFFER, instanceVBO.id());
+  glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(glm::mat4),
+               transforms.data(), GL_STATIC_DRAW);
+  instanceVBO.setSize(transforms.size() * sizeof(glm::mat4));
+}
+
+void Mesh::setOcclusion(const std::vector<float> &occlusion) {
+  this->occlusion = occlusion;
+  if (!gpu)
+    return;
+  occlusionVBO = GpuBuffer("mesh occlusion");
+  glBindVertexArray(VAO.id());
+  glBindBuffer(GL_ARRAY_BUFFER, occlusionVBO.id());
+  glBufferData(GL_ARRAY_BUFFER, occlusion.size() * sizeof(float),
+               occlusion.data(), GL_STATIC_DRAW);
+  occlusionVBO.setSize(occlusion.size() * sizeof(float));
+  glEnableVertexAttribArray(OCCLUSION_ATTRIBUTE);
+  glVertexAttribPointer(OCCLUSION_ATTRIBUTE, 1, GL_FLOAT, GL_FALSE,
+                        sizeof(float), (void*)0);
   glBindVertexArray(0);
 }
 
 void Mesh::setupMesh() {
-  glGenVertexArrays(1, &VAO);
-  glGenBuffers(1, &VBO);
-  glGenBuffers(1, &EBO);
-  glBindVertexArray(VAO);
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
+  VAO = GpuVertexArray("mesh vao");
+  VBO = GpuBuffer("mesh vertices");
+  EBO = GpuBuffer("mesh indices");
+  instanceVBO = GpuBuffer("mesh instances");
+  glBindVertexArray(VAO.id());
+  glBindBuffer(GL_ARRAY_BUFFER, VBO.id());
   glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(Vertex),
                vertices.data(), GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+  VBO.setSize(vertices.size() * sizeof(Vertex));
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.id());
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
                indices.data(), GL_STATIC_DRAW);
+  EBO.setSize(indices.size() * sizeof(unsigned int));
+  lodRanges.push_back({ 0, (unsigned int)indices.size(), 0.0f });
 
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -54,4 +229,76 @@ void Mesh::setupMesh() {
   glEnableVertexAttribArray(2);
   glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
                         (void*)offsetof(Vertex, texturecoord));
+
+  setInstanceAttributes(instanceVBO.id());
+  glBindVertexArray(0);
+}
+
+// positions packed without the other attributes, a depth only pass reads
+// a third of the vertex data. the index and instance buffers are shared
+void Mesh::setupDepthStream() {
+  std::vector<glm::vec3> positions(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++)
+    positions[i] = vertices[i].position;
+  depthVAO = GpuVertexArray("mesh depth vao");
+  positionVBO = GpuBuffer("mesh positions");
+  glBindVertexArray(depthVAO.id());
+  glBindBuffer(GL_ARRAY_BUFFER, positionVBO.id());
+  glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3),
+               positions.data(), GL_STATIC_DRAW);
+  positionVBO.setSize(positions.size() * sizeof(glm::vec3));
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.id());
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3),
+                        (void*)0);
+  setInstanceAttributes(instanceVBO.id());
+  glBindVertexArray(0);
+}
+
+// the instance transform takes the locations 3 to 6, one per column
+void Mesh::setInstanceAttributes(unsigned int buffer) {
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  for (unsigned int i = 0; i < 4; i++) {
+    glEnableVertexAttribArray(3 + i);
+    glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                          (void*)(i * sizeof(glm::vec4)));
+    glVertexAttribDivisor(3 + i, 1);
+  }
+}
+
+void Mesh::computeBounds() {
+  if (vertices.empty()) {
+    boundsCenter = glm::vec3(0.0f);
+    boundsRadius = 0.0f;
+    return;
+  }
+  glm::vec3 minimum = vertices[0].position;
+  glm::vec3 maximum = vertices[0].position;
+  for (const Vertex &vertex : vertices) {
+    minimum = glm::min(minimum, vertex.position);
+    maximum = glm::max(maximum, vertex.position);
+  }
+  boundsCenter = (minimum + maximum) * 0.5f;
+  boundsRadius = 0.0f;
+  for (const Vertex &vertex : vertices)
+    boundsRadius = glm::max(boundsRadius,
+                            glm::length(vertex.position - boundsCenter));
+}
+
+void Mesh::computeUvDensity() {
+  // the square root of the texture area over the surface area, averaged
+  // over the whole mesh
+  double surface = 0.0;
+  double mapped = 0.0;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const Vertex &a = vertices[indices[i]];
+    const Vertex &b = vertices[indices[i + 1]];
+    const Vertex &c = vertices[indices[i + 2]];
+    surface += glm::length(glm::cross(b.position - a.position,
+                                      c.position - a.position));
+    glm::vec2 u = b.texturecoord - a.texturecoord;
+    glm::vec2 v = c.texturecoord - a.texturecoord;
+    mapped += glm::abs(u.x * v.y - u.y * v.x);
+  }
+  uvDensity = surface > 0.0 ? (float)std::sqrt(mapped / surface) : 0.0f;
 }
@@ -2,8 +2,11 @@
 #define mesh_h
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <memory>
 #include <vector>
+#include "gpuresource.h"
 #include "shader.h"
+#include "textureimage.h"
 
 struct Vertex {
   glm::vec3 position;
@@ -11,8 +14,27 @@ struct Vertex {
   glm::vec2 texturecoord;
 };
 
+struct LodLevel;
+struct VirtualTexture;
+
+// baked ambient occlusion, meshes without it read the constant 1 the
+// viewer sets for the location
+const unsigned int OCCLUSION_ATTRIBUTE = 7;
+
+// part of the index buffer holding one level of detail
+struct LodRange {
+  unsigned int offset;
+  unsigned int count;
+  float error;
+};
+
 struct Texture {
-  unsigned int id;
+  std::shared_ptr<GpuTexture> texture;
+  // decoded copy for the software renderer and the texture arrays, null on
+  // the gl path. packed diffuse textures have no texture of their own
+  std::shared_ptr<const TextureImage> image;
+  // diffuse page file drawn through the page cache instead of a texture
+  std::shared_ptr<VirtualTexture> virtualTexture;
   std::string type;
   std::string path;
 };
@@ -22,15 +44,90 @@ public:
   std::vector<Vertex> vertices;
   std::vector<unsigned int> indices;
   std::vector<Texture> textures;
+  // world transforms of the nodes using the mesh
+  std::vector<glm::mat4> instances;
+  // visibility of every vertex from the ambient occlusion bake, empty
+  // until it arrived
+  std::vector<float> occlusion;
+  // bounding sphere of the vertices
+  glm::vec3 boundsCenter;
+  float boundsRadius;
+  // texture coordinate units per unit of the surface, the mip a texture
+  // needs follows from it. 0 without texture coordinates
+  float uvDensity = 0.0f;
+  // index of the scene material, draws are grouped by it
+  unsigned int material = 0;
+  // below 1 the mesh is blended after the opaque ones
+  float opacity = 1.0f;
 
+  // without gpu nothing is uploaded and only the software renderer can
+  // draw the mesh
   Mesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices,
-       std::vector<Texture> &texture);
+       std::vector<Texture> &texture, bool gpu = true);
+  // takes the buffers of a loader over without copying them
+  Mesh(std::vector<Vertex> &&vertices, std::vector<unsigned int> &&indices,
+       std::vector<Texture> &&texture, bool gpu = true);
+  // meshes own their GL objects, so they can only be moved
+  Mesh(Mesh &&other) = default;
+  Mesh &operator=(Mesh &&other) = default;
   void draw(Shader &shader);
+  // draws parts of the full detail level with one call, offsets are in
+  // indices
+  void drawRanges(Shader &shader, const std::vector<GLsizei> &counts,
+                  const std::vector<unsigned int> &offsets);
+  // depth pre-pass draws, they read a stream holding only the positions
+  // that is created by the first of them
+  void drawDepth(Shader &shader);
+  void drawDepthRanges(Shader &shader, const std::vector<GLsizei> &counts,
+                       const std::vector<unsigned int> &offsets);
+  // uploads the levels behind each other, they share the vertex buffer
+  void setLods(const std::vector<LodLevel> &levels);
+  // picks the coarsest level below the pixel error, a level only changes
+  // when the error leaves the band around the threshold
+  void selectLod(float pixelsPerUnit, float pixelError);
+  unsigned int getLodCount() const { return lodRanges.size(); }
+  unsigned int getCurrentLod() const { return currentLod; }
+  unsigned int getDrawnTriangles() const;
+  const LodRange &getLodRange() const { return lodRanges[currentLod]; }
+  // element buffer holding every level behind each other
+  unsigned int getIndexBuffer() const { return EBO.id(); }
+  unsigned int getIndexCount() const {
+    return lodRanges.back().offset + lodRanges.back().count;
+  }
+  // draws every node of the mesh for each transform in the buffer
+  void drawInstanced(Shader &shader, unsigned int buffer, unsigned int count);
+  // every transform draws one copy of the mesh
+  void setInstances(const std::vector<glm::mat4> &transforms);
+  // uploads one visibility per vertex into its own buffer next to the
+  // vertices
+  void setOcclusion(const std::vector<float> &occlusion);
+  unsigned int getInstanceCount() const { return instances.size(); }
+  void bindTextures(Shader &shader) const;
+  // the diffuse page file, null for meshes with plain textures
+  VirtualTexture* getVirtualTexture() const;
 private:
-  unsigned int VAO;
-  unsigned int VBO;
-  unsigned int EBO;
+  GpuVertexArray VAO;
+  GpuBuffer VBO;
+  GpuBuffer EBO;
+  GpuBuffer instanceVBO;
+  GpuBuffer occlusionVBO;
+  GpuVertexArray depthVAO;
+  GpuBuffer positionVBO;
+  bool gpu;
+  std::vector<LodRange> lodRanges;
+  unsigned int currentLod;
+  // bounds, uv density and the upload of a new mesh
+  void initialize();
   void setupMesh();
+  void setupDepthStream();
+  // the draw calls shared by the colour and depth streams
+  void drawElements(Shader &shader, unsigned int vao);
+  void drawElementRanges(Shader &shader, unsigned int vao,
+                         const std::vector<GLsizei> &counts,
+                         const std::vector<unsigned int> &offsets);
+  void computeBounds();
+  void computeUvDensity();
+  void setInstanceAttributes(unsigned int buffer);
 };
 
 #endif
@@ -0,0 +1,556 @@
+#include "meshloader.h"
+#include "jobsystem.h"
+#include "mappedfile.h"
+#include "plyformat.h"
+#include "spatialkey.h"
+#include "stlfile.h"
+#include <assimp/config.h>
+#include <assimp/postprocess.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <utility>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// positions and faces handled per task of the parallel loops
+const size_t BLOCK = 1 << 16;
+// the weld splits the positions into this many hash tables, as bits
+const unsigned int WELD_BITS = 10;
+const uint32_t NO_INDEX = 0xffffffffu;
+
+// a position of the weld and where it is in the file
+struct WeldSlot {
+  glm::vec3 position;
+  uint32_t index;
+};
+
+double msSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// corners of a binary stl, read straight from the mapped file
+struct StlPositions {
+  StlFile stl;
+
+  size_t count() const { return stl.triangles * 3; }
+  glm::vec3 get(size_t index) const {
+    return stl.corner(index / 3, index % 3);
+  }
+};
+
+// vertices of a binary ply, read straight from the mapped file
+struct PlyPositions {
+  const unsigned char* data = nullptr;
+  size_t vertices = 0;
+  size_t stride = 0;
+  size_t offsets[3] = {};
+  PlyType types[3] = {};
+
+  size_t count() const { return vertices; }
+  glm::vec3 get(size_t index) const {
+    const unsigned char* record = data + index * stride;
+    return glm::vec3((float)readPlyValue(record + offsets[0], types[0]),
+                     (float)readPlyValue(record + offsets[1], types[1]),
+                     (float)readPlyValue(record + offsets[2], types[2]));
+  }
+};
+
+// welds equal positions on all cores. the positions are split by the high
+// bits of their hash into tables of their own, the first position of every
+// group keeps its place. remap gets the welded index of every position
+template <typename Source>
+std::vector<glm::vec3> weldPositions(const Source &source,
+                                     std::vector<uint32_t> &remap) {
+  JobSystem &jobs = JobSystem::get();
+  const size_t count = source.count();
+  const size_t parts = (size_t)1 << WELD_BITS;
+  const size_t blocks = (count + BLOCK - 1) / BLOCK;
+  std::vector<uint32_t> histogram(blocks * parts, 0);
+  jobs.parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+    for (size_t block = begin; block < end; block++) {
+      uint32_t* counts = &histogram[block * parts];
+      size_t last = std::min(count, (block + 1) * BLOCK);
+      for (size_t i = block * BLOCK; i < last; i++)
+        counts[hashPosition(source.get(i)) >> (64 - WELD_BITS)]++;
+    }
+  });
+  // partition major, every table sees its positions in file order
+  std::vector<size_t> starts(parts + 1, 0);
+  std::vector<size_t> offsets(blocks * parts);
+  size_t total = 0;
+  for (size_t part = 0; part < parts; part++) {
+    starts[part] = total;
+    for (size_t block = 0; block < blocks; block++) {
+      offsets[block * parts + part] = total;
+      total += histogram[block * parts + part];
+    }
+  }
+  starts[parts] = total;
+  // the positions are copied next to their index, the tables then read
+  // them in order instead of going back to the file
+  std::vector<WeldSlot> sorted(count);
+  jobs.parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+    for (size_t block = begin; block < end; block++) {
+      size_t* cursor = &offsets[block * parts];
+      size_t last = std::min(count, (block + 1) * BLOCK);
+      for (size_t i = block * BLOCK; i < last; i++) {
+        glm::vec3 position = source.get(i);
+        sorted[cursor[hashPosition(position) >> (64 - WELD_BITS)]++] =
+            WeldSlot{ position, (uint32_t)i };
+      }
+    }
+  });
+
+  remap.resize(count);
+  jobs.parallelFor(parts, 1, [&](size_t begin, size_t end) {
+    std::vector<WeldSlot> table;
+    for (size_t part = begin; part < end; part++) {
+      size_t size = starts[part + 1] - starts[part];
+      size_t capacity = 16;
+      while (capacity < size * 2)
+        capacity *= 2;
+      table.assign(capacity, WeldSlot{ glm::vec3(0.0f), NO_INDEX });
+      // the low bits of the hash are free of the partition bits
+      for (size_t k = starts[part]; k < starts[part + 1]; k++) {
+        const WeldSlot &item = sorted[k];
+        size_t slot = hashPosition(item.position) & (capacity - 1);
+        for (;;) {
+          WeldSlot &entry = table[slot];
+          if (entry.index == NO_INDEX) {
+            entry = item;
+            remap[item.index] = item.index;
+            break;
+          }
+          if (entry.position == item.position) {
+            remap[item.index] = entry.index;
+            break;
+          }
+          slot = (slot + 1) & (capacity - 1);
+        }
+      }
+    }
+  });
+  std::vector<WeldSlot>().swap(sorted);
+
+  // the kept positions are numbered in file order
+  std::vector<uint32_t> kept(blocks + 1, 0);
+  jobs.parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+    for (size_t block = begin; block < end; block++) {
+      size_t last = std::min(count, (block + 1) * BLOCK);
+      for (size_t i = block * BLOCK; i < last; i++)
+        if (remap[i] == i)
+          kept[block + 1]++;
+    }
+  });
+  for (size_t block = 0; block < blocks; block++)
+    kept[block + 1] += kept[block];
+  std::vector<glm::vec3> positions(kept[blocks]);
+  std::vector<uint32_t> numbers(count);
+  jobs.parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+    for (size_t block = begin; block < end; block++) {
+      uint32_t next = kept[block];
+      size_t last = std::min(count, (block + 1) * BLOCK);
+      for (size_t i = block * BLOCK; i < last; i++)
+        if (remap[i] == i) {
+          numbers[i] = next;
+          positions[next++] = source.get(i);
+        }
+    }
+  });
+  jobs.parallelFor(count, BLOCK, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+      remap[i] = numbers[remap[i]];
+  });
+  return positions;
+}
+
+// splits the welded positions into vertices: the faces around a position
+// that meet along an edge at less than the crease angle share a vertex
+// with their area weighted normal
+void smoothNormals(const std::vector<glm::vec3> &positions,
+                   const std::vector<uint32_t> &corners, float creaseAngle,
+                   std::vector<Vertex> &vertices,
+                   std::vector<unsigned int> &indices) {
+  JobSystem &jobs = JobSystem::get();
+  size_t triangles = corners.size() / 3;
+  std::vector<glm::vec3> faceNormals(triangles);
+  std::vector<float> faceLengths(triangles);
+  jobs.parallelFor(triangles, BLOCK, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      const glm::vec3 &a = positions[corners[i * 3]];
+      faceNormals[i] = glm::cross(positions[corners[i * 3 + 1]] - a,
+                                  positions[corners[i * 3 + 2]] - a);
+      faceLengths[i] = glm::length(faceNormals[i]);
+    }
+  });
+  // the corners around every position
+  std::vector<uint32_t> first(positions.size() + 1, 0);
+  for (uint32_t position : corners)
+    first[position + 1]++;
+  for (size_t i = 0; i < positions.size(); i++)
+    first[i + 1] += first[i];
+  std::vector<uint32_t> around(corners.size());
+  {
+    std::vector<uint32_t> cursor(first.begin(), first.end() - 1);
+    for (size_t i = 0; i < corners.size(); i++)
+      around[cursor[corners[i]]++] = (uint32_t)i;
+  }
+
+  // the corners around a position share a vertex when their faces meet
+  // along an edge at less than the crease angle, or through a chain of
+  // such faces. the fan is sorted by the far end of its edges once, so
+  // the faces on both sides of an edge are neighbours
+  float cosine = std::cos(glm::radians(creaseAngle));
+  std::vector<uint32_t> slots(corners.size());
+  std::vector<uint32_t> base(positions.size() + 1, 0);
+  jobs.parallelFor(positions.size(), BLOCK, [&](size_t begin, size_t end) {
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> group;
+    auto root = [&](uint32_t corner) {
+      while (parent[corner] != corner)
+        corner = parent[corner] = parent[parent[corner]];
+      return corner;
+    };
+    for (size_t i = begin; i < end; i++) {
+      uint32_t count = first[i + 1] - first[i];
+      edges.clear();
+      parent.resize(count);
+      for (uint32_t j = 0; j < count; j++) {
+        uint32_t corner = around[first[i] + j];
+        uint32_t face = corner / 3 * 3;
+        edges.push_back({ corners[face + (corner + 1) % 3], j });
+        edges.push_back({ corners[face + (corner + 2) % 3], j });
+        parent[j] = j;
+      }
+      std::sort(edges.begin(), edges.end());
+      for (size_t e = 1; e < edges.size(); e++) {
+        if (edges[e].first != edges[e - 1].first)
+          continue;
+        uint32_t a = around[first[i] + edges[e - 1].second] / 3;
+        uint32_t b = around[first[i] + edges[e].second] / 3;
+        // degenerate faces would join the faces on both sides of a crease
+        if (faceLengths[a] > 0.0f && faceLengths[b] > 0.0f &&
+            glm::dot(faceNormals[a], faceNormals[b]) >=
+                cosine * faceLengths[a] * faceLengths[b])
+          parent[root(edges[e - 1].second)] = root(edges[e].second);
+      }
+      group.assign(count, NO_INDEX);
+      uint32_t groups = 0;
+      for (uint32_t j = 0; j < count; j++) {
+        uint32_t &id = group[root(j)];
+        if (id == NO_INDEX)
+          id = groups++;
+        slots[first[i] + j] = id;
+      }
+      base[i + 1] = groups;
+    }
+  });
+  for (size_t i = 0; i < positions.size(); i++)
+    base[i + 1] += base[i];
+  vertices.resize(base[positions.size()]);
+  indices.resize(corners.size());
+  jobs.parallelFor(positions.size(), BLOCK, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      for (uint32_t v = base[i]; v < base[i + 1]; v++) {
+        vertices[v].position = positions[i];
+        vertices[v].normal = glm::vec3(0.0f);
+        vertices[v].texturecoord = glm::vec2(0.0f);
+      }
+      for (uint32_t k = first[i]; k < first[i + 1]; k++) {
+        indices[around[k]] = base[i] + slots[k];
+        vertices[base[i] + slots[k]].normal += faceNormals[around[k] / 3];
+      }
+      for (uint32_t v = base[i]; v < base[i + 1]; v++) {
+        float length = glm::length(vertices[v].normal);
+        vertices[v].normal = length > 0.0f ? vertices[v].normal / length :
+                                             glm::vec3(0.0f, 0.0f, 1.0f);
+      }
+    }
+  });
+}
+
+// the vertex positions and the triangles of a binary ply, polygons become
+// fans. faces made of triangles only are read on all cores
+bool readPly(const MappedFile &file, PlyPositions &positions,
+             std::vector<uint32_t> &corners, std::string &error) {
+  PlyHeader header;
+  if (!parsePlyHeader(file, header, error))
+    return false;
+  if (!header.binary) {
+    error = "only binary ply files are read natively";
+    return false;
+  }
+  const unsigned char* data = file.data();
+  size_t offset = header.headerBytes;
+  bool hasVertices = false;
+  bool hasFaces = false;
+  for (const PlyElement &element : header.elements) {
+    size_t stride = 0;
+    bool fixed = true;
+    for (const PlyProperty &property : element.properties) {
+      fixed = fixed && !property.list;
+      stride += property.list ? 0 : plyTypeSize(property.type);
+    }
+    if (element.name == "vertex") {
+      static const char* names[3] = { "x", "y", "z" };
+      size_t found = 0;
+      size_t field = 0;
+      for (const PlyProperty &property : element.properties) {
+        for (int i = 0; i < 3; i++)
+          if (property.name == names[i]) {
+            positions.offsets[i] = field;
+            positions.types[i] = property.type;
+            found |= (size_t)1 << i;
+          }
+        field += plyTypeSize(property.type);
+      }
+      if (!fixed || found != 7) {
+        error = "the ply vertices have no x, y and z";
+        return false;
+      }
+      positions.data = data + offset;
+      positions.vertices = element.count;
+      positions.stride = stride;
+      hasVertices = true;
+    }
+    if (fixed) {
+      offset += element.count * stride;
+      if (offset > file.size()) {
+        error = "the ply file is truncated";
+        return false;
+      }
+      continue;
+    }
+
+    int list = -1;
+    if (element.name == "face")
+      for (size_t i = 0; i < element.properties.size(); i++)
+        if (element.properties[i].list &&
+            (element.properties[i].name == "vertex_indices" ||
+             element.properties[i].name == "vertex_index"))
+          list = (int)i;
+    if (list >= 0 && element.properties.size() == 1) {
+      // triangles only take the same room, the first count that isn't 3
+      // sends the faces to the general walk below
+      const PlyProperty &indices = element.properties[0];
+      size_t countSize = plyTypeSize(indices.countType);
+      size_t indexSize = plyTypeSize(indices.type);
+      size_t record = countSize + 3 * indexSize;
+      if (offset + element.count * record <= file.size()) {
+        std::atomic<bool> triangles(true);
+        corners.resize(element.count * 3);
+        JobSystem::get().parallelFor(element.count, BLOCK,
+                                     [&](size_t begin, size_t end) {
+          for (size_t i = begin; i < end && triangles; i++) {
+            const unsigned char* face = data + offset + i * record;
+            if (readPlyValue(face, indices.countType) != 3.0) {
+              triangles = false;
+              break;
+            }
+            for (int c = 0; c < 3; c++) {
+              double index = readPlyValue(face + countSize + c * indexSize,
+                                          indices.type);
+              corners[i * 3 + c] = index < 0.0 || index >= 4294967295.0 ?
+                                   NO_INDEX : (uint32_t)index;
+            }
+          }
+        });
+        if (triangles) {
+          offset += element.count * record;
+          hasFaces = true;
+          continue;
+        }
+        corners.clear();
+      }
+    }
+    // one record after the other, lists have their own length
+    for (size_t i = 0; i < element.count; i++)
+      for (size_t p = 0; p < element.properties.size(); p++) {
+        const PlyProperty &property = element.properties[p];
+        size_t size = plyTypeSize(property.list ? property.countType :
+                                                  property.type);
+        if (offset + size > file.size()) {
+          error = "the ply file is truncated";
+          return false;
+        }
+        if (!property.list) {
+          offset += size;
+          continue;
+        }
+        size_t count = (size_t)readPlyValue(data + offset,
+                                            property.countType);
+        offset += size;
+        size_t indexSize = plyTypeSize(property.type);
+        if (offset + count * indexSize > file.size()) {
+          error = "the ply file is truncated";
+          return false;
+        }
+        for (size_t c = 2; (int)p == list && c < count; c++) {
+          size_t fan[3] = { 0, c - 1, c };
+          for (size_t corner : fan) {
+            double index = readPlyValue(data + offset + corner * indexSize,
+                                        property.type);
+            corners.push_back(index < 0.0 || index >= 4294967295.0 ?
+                              NO_INDEX : (uint32_t)index);
+          }
+        }
+        offset += count * indexSize;
+      }
+    hasFaces = hasFaces || list >= 0;
+  }
+  if (!hasVertices || !hasFaces) {
+    error = "the ply file has no vertices or faces";
+    return false;
+  }
+  for (uint32_t index : corners)
+    if (index >= positions.vertices) {
+      error = "a ply face uses a vertex that doesn't exist";
+      return false;
+    }
+  return true;
+}
+
+}
+
+void NativeMeshStats::print(std::ostream &out) const {
+  const double mb = 1024.0 * 1024.0;
+  out << "native " << format << " import: " << triangles
+      << " triangles, " << positions << " positions welded to " << welded
+      << " and split into " << vertices << " vertices at the creases, "
+      << std::fixed << std::setprecision(2) << parseMs << " ms parse, "
+      << weldMs << " ms weld, " << normalMs << " ms normals, " << ms
+      << " ms total on " << JobSystem::get().getThreadCount()
+      << " threads (" << std::setprecision(1)
+      << (ms > 0.0 ? triangles / ms / 1000.0 : 0.0)
+      << " million triangles/s, "
+      << (ms > 0.0 ? bytes / mb / (ms / 1000.0) : 0.0) << " MB/s)"
+      << std::endl;
+}
+
+bool isNativeMesh(const std::string &path) {
+  size_t dot = path.find_last_of('.');
+  if (dot == std::string::npos)
+    return false;
+  std::string extension = path.substr(dot + 1);
+  for (char &c : extension)
+    c = (char)std::tolower((unsigned char)c);
+  return extension == "stl" || extension == "ply";
+}
+
+bool loadNativeMesh(const std::string &path, float creaseAngle,
+                    std::vector<Vertex> &vertices,
+                    std::vector<unsigned int> &indices,
+                    NativeMeshStats &stats, std::string &error) {
+  Clock::time_point start = Clock::now();
+  MappedFile file(path, ACCESS_SEQUENTIAL);
+  if (!file.isOpen()) {
+    error = "can't open " + path;
+    return false;
+  }
+  stats.bytes = file.size();
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> corners;
+  Clock::time_point step = Clock::now();
+  if (isPlyFile(file)) {
+    PlyPositions source;
+    if (!readPly(file, source, corners, error))
+      return false;
+    if (source.count() >= NO_INDEX) {
+      error = "the ply file has too many vertices";
+      return false;
+    }
+    stats.format = "ply";
+    stats.parseMs = msSince(step);
+    step = Clock::now();
+    std::vector<uint32_t> remap;
+    positions = weldPositions(source, remap);
+    stats.positions = source.count();
+    for (uint32_t &corner : corners)
+      corner = remap[corner];
+  }
+  else {
+    StlPositions source;
+    if (!openStlFile(file, source.stl)) {
+      error = "only binary stl files are read natively";
+      return false;
+    }
+    if (source.count() >= NO_INDEX) {
+      error = "the stl file has too many triangles";
+      return false;
+    }
+    stats.format = "stl";
+    stats.parseMs = msSince(step);
+    step = Clock::now();
+    // every corner is a position of its own
+    positions = weldPositions(source, corners);
+    stats.positions = source.count();
+  }
+  stats.weldMs = msSince(step);
+  if (corners.empty()) {
+    error = "the model has no triangles";
+    return false;
+  }
+  stats.triangles = corners.size() / 3;
+  stats.welded = positions.size();
+
+  step = Clock::now();
+  smoothNormals(positions, corners, creaseAngle, vertices, indices);
+  stats.normalMs = msSince(step);
+  stats.vertices = vertices.size();
+  stats.ms = msSince(start);
+  return true;
+}
+
+void compareAssimpImport(const std::string &path,
+                         const ImportOptions &options,
+                         const NativeMeshStats &stats) {
+  Clock::time_point start = Clock::now();
+  Assimp::Importer importer;
+  // stl stores a normal per face, without forcing them assimp keeps those
+  // and never smooths. the same creases, so the vertex counts compare
+  unsigned int flags = importFlags(options.profile) |
+                       aiProcess_ForceGenNormals;
+  bool smooth = (flags & aiProcess_GenSmoothNormals) != 0;
+  importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE,
+                            options.creaseAngle);
+  importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE,
+                              aiPrimitiveType_POINT | aiPrimitiveType_LINE);
+  const aiScene* scene = importer.ReadFile(path, flags);
+  double ms = msSince(start);
+  if (!scene) {
+    std::cout << "assimp import for comparison failed: "
+              << importer.GetErrorString() << std::endl;
+    return;
+  }
+  size_t vertices = 0;
+  size_t triangles = 0;
+  for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+    vertices += scene->mMeshes[i]->mNumVertices;
+    triangles += scene->mMeshes[i]->mNumFaces;
+  }
+  std::cout << "assimp import (profile "
+            << importProfileName(options.profile) << "): " << triangles
+            << " triangles, " << vertices << " vertices, " << std::fixed
+            << std::setprecision(2) << ms << " ms before processMesh, "
+            << std::setprecision(1) << (stats.ms > 0.0 ? ms / stats.ms : 0.0)
+            << "x the native time";
+  // the profile without smooth normals keeps every face apart
+  if (smooth)
+    std::cout << " with "
+              << (vertices > 0 ? 100.0 * stats.vertices / vertices : 0.0)
+              << " % of the vertices";
+  else
+    std::cout << ", its flat normals don't compare";
+  std::cout << std::endl;
+}
@@ -0,0 +1,46 @@
+#ifndef meshloader_h
+#define meshloader_h
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "importprofile.h"
+#include "mesh.h"
+
+// cost and size of a model read without assimp
+struct NativeMeshStats {
+  const char* format = "";
+  size_t triangles = 0;
+  // positions in the file, stl stores three for every triangle
+  size_t positions = 0;
+  // positions left after welding
+  size_t welded = 0;
+  // welded positions split along the creases
+  size_t vertices = 0;
+  size_t bytes = 0;
+  double parseMs = 0.0;
+  double weldMs = 0.0;
+  double normalMs = 0.0;
+  double ms = 0.0;
+
+  void print(std::ostream &out) const;
+};
+
+// the extension is one the native loader reads
+bool isNativeMesh(const std::string &path);
+// reads the triangles of a binary stl or ply file from the mapped file,
+// welds equal positions on all cores and averages the normals of the
+// faces around a position that meet along an edge at less than the crease
+// angle in degrees. false with the reason in error for other files
+bool loadNativeMesh(const std::string &path, float creaseAngle,
+                    std::vector<Vertex> &vertices,
+                    std::vector<unsigned int> &indices,
+                    NativeMeshStats &stats, std::string &error);
+// imports the same file through assimp and prints its time and vertices
+// next to the ones of the native loader
+void compareAssimpImport(const std::string &path,
+                         const ImportOptions &options,
+                         const NativeMeshStats &stats);
+
+#endif
@@ -0,0 +1,384 @@
+#include "meshpager.h"
+#include "frustum.h"
+#include "glstate.h"
+#include "occlusion.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <utility>
+
+namespace {
+
+// bytes of nodes uploaded per frame, a frame never waits for more
+const size_t UPLOAD_BYTES = 16 << 20;
+// nodes requested and not uploaded yet
+const unsigned int MAX_IN_FLIGHT = 64;
+
+glm::vec3 nodeCenter(const ChunkNode &node) {
+  return glm::vec3(node.center[0], node.center[1], node.center[2]);
+}
+
+}
+
+bool MeshPager::open(const std::string &path, size_t gpuBudget,
+                     size_t memoryBudget, std::string &error) {
+  close();
+  if (!file.open(path, error))
+    return false;
+  const std::vector<ChunkNode> &table = file.getNodes();
+  this->gpuBudget = gpuBudget;
+  this->memoryBudget = memoryBudget;
+  nodes = std::vector<Resident>(table.size());
+  state.assign(table.size(), 0);
+  loading.assign(table.size(), false);
+  shader.reset(new Shader("chunkshader.vs", "chunkshader.fs"));
+  // the root is always there, everything else refines it
+  Loaded root;
+  root.node = 0;
+  file.read(table[0], root.vertices, root.indices);
+  file.release(table[0]);
+  upload(root);
+  stopping = false;
+  loader = std::thread(&MeshPager::loadLoop, this);
+  return true;
+}
+
+void MeshPager::close() {
+  if (loader.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      requests.clear();
+    }
+    wake.notify_all();
+    loader.join();
+  }
+  loaded.clear();
+  nodes.clear();
+  resident.clear();
+  residentBytes = 0;
+  state.clear();
+  touched.clear();
+  loading.clear();
+  inFlight = 0;
+  loadedBytes = 0;
+  peakLoadedBytes = 0;
+  loadedNodes = 0;
+  evictedNodes = 0;
+  droppedNodes = 0;
+  readBytes = 0;
+  loadMs = 0.0;
+  uploadMs = 0.0;
+  drawnNodes = 0;
+  drawnTriangles = 0;
+  shader.reset();
+  file = ChunkFile();
+}
+
+glm::vec3 MeshPager::getBoundsCenter() const {
+  return isOpen() ? nodeCenter(file.getNodes()[0]) : glm::vec3(0.0f);
+}
+
+float MeshPager::getBoundsRadius() const {
+  return isOpen() ? file.getNodes()[0].radius : 0.0f;
+}
+
+void MeshPager::loadLoop() {
+  const std::vector<ChunkNode> &table = file.getNodes();
+  for (;;) {
+    uint32_t node;
+    size_t bytes;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      // read ahead of the uploads only as far as the memory budget goes,
+      // a single node larger than it is still read
+      wake.wait(lock, [this, &table]() {
+        return stopping ||
+               (!requests.empty() &&
+                (loadedBytes == 0 ||
+                 loadedBytes + file.getNodeBytes(table[requests.front()]) <=
+                 memoryBudget));
+      });
+      if (stopping)
+        return;
+      node = requests.front();
+      requests.pop_front();
+      bytes = file.getNodeBytes(table[node]);
+      loadedBytes += bytes;
+      peakLoadedBytes = std::max(peakLoadedBytes, loadedBytes);
+    }
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    Loaded item;
+    item.node = node;
+    file.read(table[node], item.vertices, item.indices);
+    // the copy goes to the gpu, the mapped pages can go again
+    file.release(table[node]);
+    std::lock_guard<std::mutex> lock(mutex);
+    loadMs += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    readBytes += bytes;
+    loaded.push_back(std::move(item));
+  }
+}
+
+void MeshPager::update() {
+  if (!isOpen())
+    return;
+  const std::vector<ChunkNode> &table = file.getNodes();
+  std::vector<Loaded> batch;
+  size_t bytes = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!loaded.empty()) {
+      size_t size = file.getNodeBytes(table[loaded.front().node]);
+      if (!batch.empty() && bytes + size > UPLOAD_BYTES)
+        break;
+      bytes += size;
+      batch.push_back(std::move(loaded.front()));
+      loaded.pop_front();
+    }
+  }
+  if (batch.empty())
+    return;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  size_t uploaded = 0;
+  for (Loaded &item : batch) {
+    if (upload(item))
+      uploaded++;
+    loading[item.node] = false;
+    // the copy goes right away, only the budget is read ahead
+    std::vector<Vertex>().swap(item.vertices);
+    std::vector<unsigned int>().swap(item.indices);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    uploadMs += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    loadedNodes += uploaded;
+    droppedNodes += batch.size() - uploaded;
+    loadedBytes -= bytes;
+    inFlight -= (unsigned int)batch.size();
+  }
+  wake.notify_all();
+}
+
+bool MeshPager::upload(Loaded &item) {
+  const ChunkNode &chunk = file.getNodes()[item.node];
+  size_t bytes = file.getNodeBytes(chunk);
+  // room is made from the nodes the last frame didn't select, the
+  // selection itself always fits into the budget
+  while (item.node != 0 && residentBytes + bytes > gpuBudget) {
+    uint32_t oldest = 0;
+    for (uint32_t node : resident)
+      if (node != 0 && nodes[node].used + 1 < frame &&
+          (oldest == 0 || nodes[node].used < nodes[oldest].used))
+        oldest = node;
+    if (oldest == 0)
+      return false;
+    evict(oldest);
+  }
+  Resident &target = nodes[item.node];
+  target.vertexArray = GpuVertexArray("chunk vao");
+  target.vertices = GpuBuffer("chunk vertices");
+  target.indices = GpuBuffer("chunk indices");
+  glBindVertexArray(target.vertexArray.id());
+  glBindBuffer(GL_ARRAY_BUFFER, target.vertices.id());
+  glBufferData(GL_ARRAY_BUFFER, item.vertices.size() * sizeof(Vertex),
+               item.vertices.data(), GL_STATIC_DRAW);
+  target.vertices.setSize(item.vertices.size() * sizeof(Vertex));
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, target.indices.id());
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               item.indices.size() * sizeof(unsigned int),
+               item.indices.data(), GL_STATIC_DRAW);
+  target.indices.setSize(item.indices.size() * sizeof(unsigned int));
+  target.indexCount = (unsigned int)item.indices.size();
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        (void*)offsetof(Vertex, normal));
+  glBindVertexArray(0);
+  target.bytes = bytes;
+  // requested by the last frame, not evicted before the next one drew
+  target.used = frame - 1;
+  resident.push_back(item.node);
+  residentBytes += bytes;
+  return true;
+}
+
+void MeshPager::evict(uint32_t node) {
+  Resident &target = nodes[node];
+  target.vertexArray.reset();
+  target.vertices.reset();
+  target.indices.reset();
+  residentBytes -= target.bytes;
+  target.bytes = 0;
+  resident.erase(std::find(resident.begin(), resident.end(), node));
+  std::lock_guard<std::mutex> lock(mutex);
+  evictedNodes++;
+}
+
+bool MeshPager::ready(uint32_t node) const {
+  return nodes[node].vertexArray ||
+         ((state[node] & NODE_REFINED) && childrenReady(node));
+}
+
+bool MeshPager::childrenReady(uint32_t node) const {
+  const ChunkNode &chunk = file.getNodes()[node];
+  for (uint32_t i = 0; i < chunk.childCount; i++) {
+    uint32_t child = chunk.firstChild + i;
+    if ((state[child] & NODE_VISIBLE) && !ready(child))
+      return false;
+  }
+  return true;
+}
+
+void MeshPager::draw(const RenderView &view) {
+  drawnNodes = 0;
+  drawnTriangles = 0;
+  if (!isOpen())
+    return;
+  const std::vector<ChunkNode> &table = file.getNodes();
+  for (uint32_t node : touched)
+    state[node] = 0;
+  touched.clear();
+  Frustum frustum = Frustum::fromMatrix(view.projection * view.view);
+  auto visible = [&](const ChunkNode &node) {
+    glm::vec3 center = nodeCenter(node);
+    return frustum.containsSphere(center, node.radius) &&
+           !(view.occlusion &&
+             view.occlusion->isOccluded(center, node.radius));
+  };
+  // pixels the simplification of the node may be off by
+  auto screenError = [&](const ChunkNode &node) {
+    float distance = glm::length(nodeCenter(node) - view.cameraPosition) -
+                     node.radius;
+    return node.error * view.pixelsPerUnit(distance);
+  };
+
+  // refines the node with the largest error on screen first until the
+  // error is small enough or the nodes no longer fit into the budget
+  std::vector<uint32_t> wanted(1, 0);
+  nodes[0].used = frame;
+  touched.push_back(0);
+  if (visible(table[0])) {
+    state[0] = NODE_VISIBLE;
+    size_t bytes = file.getNodeBytes(table[0]);
+    std::priority_queue<std::pair<float, uint32_t>> queue;
+    queue.push(std::make_pair(screenError(table[0]), 0u));
+    std::vector<uint32_t> children;
+    while (!queue.empty()) {
+      std::pair<float, uint32_t> top = queue.top();
+      queue.pop();
+      const ChunkNode &chunk = table[top.second];
+      if (chunk.childCount == 0 || top.first <= view.lodPixelError)
+        continue;
+      children.clear();
+      size_t cost = 0;
+      for (uint32_t i = 0; i < chunk.childCount; i++)
+        if (visible(table[chunk.firstChild + i])) {
+          children.push_back(chunk.firstChild + i);
+          cost += file.getNodeBytes(table[chunk.firstChild + i]);
+        }
+      if (bytes + cost > gpuBudget)
+        continue;
+      bytes += cost;
+      state[top.second] |= NODE_REFINED;
+      for (uint32_t child : children) {
+        state[child] = NODE_VISIBLE;
+        touched.push_back(child);
+        wanted.push_back(child);
+        nodes[child].used = frame;
+        queue.push(std::make_pair(screenError(table[child]), child));
+      }
+    }
+  }
+
+  // the missing nodes coarse first, within a level the ones refined
+  // first. the queue of the last frame is stale by now
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t node : requests)
+      loading[node] = false;
+    inFlight -= (unsigned int)requests.size();
+    requests.clear();
+    std::vector<uint32_t> missing;
+    for (uint32_t node : wanted)
+      if (!nodes[node].vertexArray && !loading[node])
+        missing.push_back(node);
+    std::stable_sort(missing.begin(), missing.end(),
+                     [&table](uint32_t a, uint32_t b) {
+                       return table[a].depth < table[b].depth;
+                     });
+    for (uint32_t node : missing) {
+      if (inFlight >= MAX_IN_FLIGHT)
+        break;
+      loading[node] = true;
+      requests.push_back(node);
+      inFlight++;
+    }
+  }
+  wake.notify_all();
+
+  if (state[0] & NODE_VISIBLE) {
+    GlStateCache &cache = GlStateCache::get();
+    cache.begin();
+    cache.useProgram(shader->progID);
+    glm::mat4 projection = view.projection;
+    glm::mat4 viewMatrix = view.view;
+    shader->setUniform("projection", projection);
+    shader->setUniform("view", viewMatrix);
+    drawNode(0);
+    cache.end();
+  }
+  frame++;
+}
+
+void MeshPager::drawNode(uint32_t node) {
+  const ChunkNode &chunk = file.getNodes()[node];
+  if ((state[node] & NODE_REFINED) && childrenReady(node)) {
+    for (uint32_t i = 0; i < chunk.childCount; i++)
+      if (state[chunk.firstChild + i] & NODE_VISIBLE)
+        drawNode(chunk.firstChild + i);
+    return;
+  }
+  // the children are still loading, the node stands in for them
+  if (!nodes[node].vertexArray)
+    return;
+  GlStateCache &cache = GlStateCache::get();
+  cache.bindVertexArray(nodes[node].vertexArray.id());
+  glDrawElements(GL_TRIANGLES, nodes[node].indexCount, GL_UNSIGNED_INT, 0);
+  cache.releaseVertexArray();
+  drawnNodes++;
+  drawnTriangles += nodes[node].indexCount / 3;
+}
+
+bool MeshPager::isBusy() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return inFlight > 0;
+}
+
+void MeshPager::report(std::ostream &out) const {
+  if (!isOpen())
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  const double mb = 1024.0 * 1024.0;
+  out << "chunks: " << nodes.size() << " nodes of "
+      << file.getTriangleCount() << " triangles, " << resident.size()
+      << " resident in " << std::fixed << std::setprecision(1)
+      << residentBytes / mb << " of " << gpuBudget / mb << " MB, "
+      << drawnNodes << " drawn with " << drawnTriangles << " triangles, "
+      << loadedNodes << " loaded (" << readBytes / mb << " MB in " << loadMs
+      << " ms on the loader thread, "
+      << readBytes / mb / std::max(loadMs / 1000.0, 1e-9) << " MB/s), "
+      << uploadMs << " ms of uploads, " << evictedNodes << " evicted";
+  if (droppedNodes > 0)
+    out << ", " << droppedNodes << " dropped over the budget";
+  out << ". at most " << peakLoadedBytes / mb << " of " << memoryBudget / mb
+      << " MB read ahead, peak resident memory "
+      << peakResidentBytes() / mb << " MB" << std::endl;
+}
@@ -0,0 +1,120 @@
+#ifndef meshpager_h
+#define meshpager_h
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "chunkfile.h"
+#include "gpuresource.h"
+#include "renderview.h"
+#include "shader.h"
+
+// draws a chunk file of any size: every frame the view picks the nodes
+// whose simplification error is visible on screen, a thread copies the
+// missing ones out of the mapped file and they are uploaded under a gpu
+// budget while the least recently drawn nodes are evicted. a node stays on
+// screen until all of its visible children arrived
+class MeshPager {
+public:
+  MeshPager() {}
+  MeshPager(const MeshPager &) = delete;
+  MeshPager &operator=(const MeshPager &) = delete;
+  ~MeshPager() { close(); }
+
+  // render thread with a current context. at most gpuBudget bytes of
+  // nodes are resident and memoryBudget bytes read ahead of the upload,
+  // the root is uploaded right away
+  bool open(const std::string &path, size_t gpuBudget, size_t memoryBudget,
+            std::string &error);
+  // render thread before the context goes away
+  void close();
+  bool isOpen() const { return file.isOpen(); }
+  glm::vec3 getBoundsCenter() const;
+  float getBoundsRadius() const;
+
+  // render thread once per frame: uploads the nodes read since the last
+  // one, evicting the least recently drawn above the budget
+  void update();
+  // selects the nodes for the view, queues the missing ones and draws the
+  // finest resident cut
+  void draw(const RenderView &view);
+  // nodes requested and not uploaded yet
+  bool isBusy() const;
+  size_t getDrawnTriangles() const { return drawnTriangles; }
+  void report(std::ostream &out) const;
+private:
+  // a node on the gpu, the vertex array is 0 while it isn't
+  struct Resident {
+    GpuVertexArray vertexArray;
+    GpuBuffer vertices;
+    GpuBuffer indices;
+    // none when the indices of the node were broken
+    unsigned int indexCount = 0;
+    size_t bytes = 0;
+    unsigned long long used = 0;
+  };
+  // a node copied out of the file by the loader
+  struct Loaded {
+    uint32_t node;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+  };
+  // selection state of a node in the current frame
+  enum {
+    NODE_VISIBLE = 1,
+    NODE_REFINED = 2
+  };
+
+  ChunkFile file;
+  std::unique_ptr<Shader> shader;
+  size_t gpuBudget = 0;
+  size_t memoryBudget = 0;
+  std::vector<Resident> nodes;
+  // nodes with a vertex array, the eviction candidates
+  std::vector<uint32_t> resident;
+  size_t residentBytes = 0;
+  std::vector<uint8_t> state;
+  std::vector<uint32_t> touched;
+  unsigned long long frame = 1;
+
+  std::thread loader;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::deque<uint32_t> requests;
+  std::deque<Loaded> loaded;
+  std::vector<bool> loading;
+  // nodes queued, being read or waiting for the upload
+  unsigned int inFlight = 0;
+  // bytes read and not uploaded yet, the loader waits above memoryBudget
+  size_t loadedBytes = 0;
+  size_t peakLoadedBytes = 0;
+
+  size_t requestedNodes = 0;
+  size_t loadedNodes = 0;
+  size_t evictedNodes = 0;
+  size_t droppedNodes = 0;
+  size_t readBytes = 0;
+  double loadMs = 0.0;
+  double uploadMs = 0.0;
+  size_t drawnNodes = 0;
+  size_t drawnTriangles = 0;
+
+  void loadLoop();
+  bool upload(Loaded &node);
+  void evict(uint32_t node);
+  // below the node, whether every visible child can be drawn
+  bool childrenReady(uint32_t node) const;
+  bool ready(uint32_t node) const;
+  void drawNode(uint32_t node);
+};
+
+#endif
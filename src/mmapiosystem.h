@@ -0,0 +1,38 @@
+#ifndef mmapiosystem_h
+#define mmapiosystem_h
+
+#include "mappedfile.h"
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+// assimp stream reading straight out of a mapped file
+class MmapIOStream : public Assimp::IOStream {
+public:
+  MmapIOStream(MappedFile &&file, IoStats &stats);
+
+  size_t Read(void* buffer, size_t size, size_t count) override;
+  size_t Write(const void* buffer, size_t size, size_t count) override;
+  aiReturn Seek(size_t offset, aiOrigin origin) override;
+  size_t Tell() const override;
+  size_t FileSize() const override;
+  void Flush() override;
+private:
+  MappedFile file;
+  size_t position;
+  IoStats &stats;
+};
+
+// read-only file system for the importer, collects the i/o statistics
+class MmapIOSystem : public Assimp::IOSystem {
+public:
+  MmapIOSystem(IoStats &stats) : stats(stats) {}
+
+  bool Exists(const char* file) const override;
+  char getOsSeparator() const override;
+  Assimp::IOStream* Open(const char* file, const char* mode) override;
+  void Close(Assimp::IOStream* file) override;
+private:
+  IoStats &stats;
+};
+
+#endif
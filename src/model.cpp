@@ -1,46 +1,1037 @@
 #include "model.h"
+#include "mmapiosystem.h"
+#include "jobsystem.h"
+#include "glstate.h"
+#include "glfeatures.h"
+#include "texturecache.h"
+#include "texturecontainer.h"
+#include "texturestreamer.h"
+#include "virtualtexture.h"
+#include "meshloader.h"
 #include <assimp/Importer.hpp>
 #include <stb_image/stb_image.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
 
-unsigned int TextureFromFile(const char* path, const std::string &directory);
+std::shared_ptr<GpuTexture> TextureFromFile(const char* path,
+                                            const std::string &directory,
+                                            IoStats &stats,
+                                            const MipSettings &mips,
+                                            bool cpuMips, MipStats &mipStats);
+std::shared_ptr<const TextureImage> ImageFromFile(const char* path,
+                                                  const std::string &directory,
+                                                  IoStats &stats,
+                                                  const MipSettings &mips,
+                                                  MipStats &mipStats);
+
+namespace {
+
+// largest scale of the axes of a transform
+float maxScale(const glm::mat4 &transform) {
+  return glm::max(glm::length(glm::vec3(transform[0])),
+                  glm::max(glm::length(glm::vec3(transform[1])),
+                           glm::length(glm::vec3(transform[2]))));
+}
+
+bool readContainer(const unsigned char* data, size_t size, const char* path,
+                   TextureContainer &container) {
+  std::string error;
+  if (!readTextureContainer(data, size, container, error)) {
+    std::cout << "Couldn't load texture: " << path << " (" << error << ")"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// uploads the levels in one go, a chain that asks for it is completed
+// by glGenerateMipmap
+void uploadTexture(const TextureContainer &container, GpuTexture &texture,
+                   MipStats &mipStats) {
+  glBindTexture(GL_TEXTURE_2D, texture.id());
+  // rows of the small levels aren't padded to four bytes
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (size_t level = 0; level < container.levels.size(); level++) {
+    const TextureContainer::Level &image = container.levels[level];
+    if (container.compressed)
+      glCompressedTexImage2D(GL_TEXTURE_2D, level, container.internalFormat,
+                             image.width, image.height, 0, image.size,
+                             image.data);
+    else
+      glTexImage2D(GL_TEXTURE_2D, level, container.internalFormat,
+                   image.width, image.height, 0, container.format,
+                   container.type, image.data);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  if (container.generateMipmaps) {
+    // the upload is finished first so only the filtering is measured
+    if (mipStats.timed)
+      glFinish();
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    glGenerateMipmap(GL_TEXTURE_2D);
+    if (mipStats.timed)
+      glFinish();
+    mipStats.gpuMs += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    mipStats.gpuTextures++;
+    mipStats.gpuTexels += (size_t)container.levels[0].width *
+                          container.levels[0].height;
+    // the mip chain adds about a third to the base level
+    texture.setSize(container.size() * 4 / 3);
+  }
+  else {
+    // a chain that stops early is complete at its last stored level
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    (GLint)container.levels.size() - 1);
+    texture.setSize(container.size());
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// the software renderer and the texture arrays need rgba8, the base level
+// is decoded and the chain is built again
+std::shared_ptr<const TextureImage> imageFromContainer(
+    const unsigned char* data, size_t size, const char* path,
+    const MipSettings &mips) {
+  TextureContainer container;
+  if (!readContainer(data, size, path, container))
+    return nullptr;
+  const TextureContainer::Level &base = container.levels[0];
+  std::vector<unsigned char> rgba;
+  int channels = 4;
+  if (container.compressed) {
+    BlockFormat format;
+    if (container.internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+        container.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT)
+      format = BLOCK_BC1;
+    else if (container.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+      format = BLOCK_BC3;
+    else if (container.internalFormat == GL_COMPRESSED_RG_RGTC2)
+      format = BLOCK_BC5;
+    else {
+      std::cout << "Couldn't load texture: " << path
+                << " (format not decodable on the cpu)" << std::endl;
+      return nullptr;
+    }
+    CompressedImage::Level level;
+    level.width = base.width;
+    level.height = base.height;
+    level.blocks.assign(base.data, base.data + base.size);
+    rgba = decompressLevel(level, format);
+  }
+  else if (container.format == GL_BGRA || container.format == GL_BGR ||
+           container.format == GL_RG) {
+    // swizzled into rgba, two channels are red and green and not gray
+    size_t stride = container.format == GL_BGRA ? 4 :
+                    container.format == GL_BGR ? 3 : 2;
+    size_t texels = (size_t)base.width * base.height;
+    rgba.resize(texels * 4);
+    for (size_t i = 0; i < texels; i++) {
+      const unsigned char* source = base.data + i * stride;
+      unsigned char* target = &rgba[i * 4];
+      target[0] = stride == 2 ? source[0] : source[2];
+      target[1] = source[1];
+      target[2] = stride == 2 ? 0 : source[0];
+      target[3] = stride == 4 ? source[3] : 255;
+    }
+  }
+  else {
+    rgba.assign(base.data, base.data + base.size);
+    channels = container.format == GL_RED ? 1 :
+               container.format == GL_RGB ? 3 : 4;
+  }
+  return std::make_shared<TextureImage>(
+      buildTextureImage(rgba.data(), base.width, base.height, channels,
+                        mips));
+}
+
+// repacks a chain built on the cpu to the channels of the file, so the
+// texture keeps the format and size the glGenerateMipmap path gives it
+void packLevels(const TextureImage &image, int channels,
+                std::vector<unsigned char> &storage,
+                TextureContainer &container) {
+  // gray with alpha keeps the alpha in the second channel
+  const int sources[4][4] = { { 0 }, { 0, 3 }, { 0, 1, 2 }, { 0, 1, 2, 3 } };
+  size_t total = 0;
+  for (const TextureImage::Level &level : image.levels)
+    total += (size_t)level.width * level.height * channels;
+  storage.resize(total);
+  size_t offset = 0;
+  for (const TextureImage::Level &level : image.levels) {
+    size_t texels = (size_t)level.width * level.height;
+    unsigned char* target = &storage[offset];
+    for (size_t i = 0; i < texels; i++)
+      for (int c = 0; c < channels; c++)
+        target[i * channels + c] =
+            level.rgba[i * 4 + sources[channels - 1][c]];
+    container.levels.push_back({ level.width, level.height, target,
+                                 texels * channels });
+    offset += texels * channels;
+  }
+}
+
+// turns a texture file into levels for gl: dds and ktx2 as they are
+// stored, block compressed or filtered from the cache, filtered on the cpu
+// or only the base level for glGenerateMipmap. runs on the streaming
+// threads as well
+bool decodeTexture(const std::string &filename, const char* path,
+                   const MipSettings &mips, bool cpuMips, IoStats &stats,
+                   MipStats &mipStats, TextureData &data) {
+  // decode straight from the mapped file, the whole file is needed now
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  std::shared_ptr<MappedFile> file =
+      std::make_shared<MappedFile>(filename, ACCESS_WILLNEED);
+  stats.ioMs += std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  stats.files += file->isOpen() ? 1 : 0;
+  stats.mappedBytes += file->size();
+
+  // dds and ktx2 levels go to gl straight from the mapped file, without
+  // decoding or building mips
+  if (file->size() > 0 && isTextureContainer(file->data(), file->size())) {
+    if (!readContainer(file->data(), file->size(), path, data.levels))
+      return false;
+    if (!supportsTextureFormat(data.levels.internalFormat)) {
+      std::cout << "Couldn't load texture: " << path
+                << " (format not supported by the context)" << std::endl;
+      return false;
+    }
+    data.owner = file;
+    return true;
+  }
+  // block compressed mips from the cache, bc1 and bc3 need s3tc
+  std::shared_ptr<CompressedImage> compressed =
+      std::make_shared<CompressedImage>();
+  if (TextureCache::get().isEnabled() && file->size() > 0 &&
+      (mips.normalMap || glFeatures.s3tc) &&
+      TextureCache::get().load(file->data(), file->size(), mips,
+                               *compressed)) {
+    data.levels.compressed = true;
+    data.levels.internalFormat =
+        compressed->format == BLOCK_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT :
+        compressed->format == BLOCK_BC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT :
+                                          GL_COMPRESSED_RG_RGTC2;
+    for (const CompressedImage::Level &level : compressed->levels)
+      data.levels.levels.push_back({ level.width, level.height,
+                                     level.blocks.data(),
+                                     level.blocks.size() });
+    data.owner = compressed;
+    return true;
+  }
+
+  // filtered levels from the cache when the context lacks the blocks
+  int width;
+  int height;
+  int channels;
+  TextureImage image;
+  bool cachedLevels = cpuMips && TextureCache::get().isEnabled() &&
+                      file->size() > 0 &&
+                      TextureCache::get().readLevels(file->data(),
+                                                     file->size(), mips,
+                                                     image, channels);
+  unsigned char* pixels = nullptr;
+  if (!cachedLevels && file->size() > 0)
+    pixels = stbi_load_from_memory(file->data(), (int)file->size(), &width,
+                                   &height, &channels, 0);
+  if (!cachedLevels && !pixels) {
+    std::cout << "Couldn't load texture: " << path << std::endl;
+    return false;
+  }
+  const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+  data.levels.internalFormat = formats[channels - 1];
+  data.levels.format = formats[channels - 1];
+  data.levels.type = GL_UNSIGNED_BYTE;
+  if (cpuMips) {
+    if (!cachedLevels) {
+      start = std::chrono::steady_clock::now();
+      image = buildTextureImage(pixels, width, height, channels, mips);
+      mipStats.cpuMs += std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start).count();
+      mipStats.cpuTextures++;
+      mipStats.cpuTexels += (size_t)width * height;
+      stbi_image_free(pixels);
+      if (TextureCache::get().isEnabled())
+        TextureCache::get().storeLevels(file->data(), file->size(), mips,
+                                        image, channels);
+    }
+    std::shared_ptr<std::vector<unsigned char>> storage =
+        std::make_shared<std::vector<unsigned char>>();
+    packLevels(image, channels, *storage, data.levels);
+    data.owner = storage;
+  }
+  else {
+    data.levels.generateMipmaps = true;
+    data.levels.levels.push_back({ width, height, pixels,
+                                   (size_t)width * height * channels });
+    data.owner = std::shared_ptr<void>(pixels, stbi_image_free);
+  }
+  return true;
+}
+
+// the texture itself when it is a page file, otherwise a page file next to
+// it with the same name. empty when there is none
+std::string pageFilePath(const std::string &filename) {
+  size_t dot = filename.find_last_of('.');
+  size_t slash = filename.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    return "";
+  if (filename.compare(dot, std::string::npos, ".vtp") == 0)
+    return filename;
+  std::string path = filename.substr(0, dot) + ".vtp";
+  return fileExists(path) ? path : "";
+}
+
+}
 
 // initialize model
-Model::Model(const std::string &path) {
-  loadModel(path);
+Model::Model(const std::string &path, const ImportOptions &options) {
+  loadModel(path, options);
 }
 
-void Model::draw(Shader &shader) {
-  for (unsigned int i = 0; i < meshes.size(); i++)
-    meshes[i].draw(shader);
+void Model::update() {
+  pager.update();
+  points.update();
+  if (pendingLods.valid() && pendingLods.wait_for(std::chrono::seconds(0)) ==
+      std::future_status::ready)
+    applyLods(pendingLods.get());
+  if (pendingAo.valid() && pendingAo.wait_for(std::chrono::seconds(0)) ==
+      std::future_status::ready) {
+    AoBake bake = pendingAo.get();
+    for (unsigned int i = 0; i < meshes.size(); i++)
+      meshes[i].setOcclusion(bake.meshes[i]);
+    aoStats = bake.stats;
+    // the merged meshes carry a copy of the occlusion
+    if (!materialBatch.empty())
+      materialBatch.refresh(meshes);
+  }
 }
 
-void Model::loadModel(const std::string &path) {
-  Assimp::Importer importer;
-  // create scene
-  scene = importer.ReadFile(path,
-      aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-
-  // check for scene errors
-  if (!scene || scene->mFlags &&
-      AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-    std::cout << "assimp error: " << importer.GetErrorString() << std::endl;
+void Model::draw(Shader &shader, const RenderView &view) {
+  if (pager.isOpen()) {
+    pager.draw(view);
+    drawnTriangles = pager.getDrawnTriangles();
     return;
   }
-  directory = path.substr(0, path.find_last_of('/'));
-  // process the root node
-  processNode(scene->mRootNode);
+  if (points.isOpen()) {
+    points.draw(view);
+    drawnTriangles = 0;
+    return;
+  }
+  drawnTriangles = 0;
+  clusterStats = ClusterStats();
+  std::vector<DrawItem> queue;
+  renderQueue.clear();
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    Mesh &mesh = meshes[i];
+    // a mesh is skipped when every node using it is hidden
+    if (view.occlusion) {
+      bool hidden = true;
+      for (const glm::mat4 &transform : mesh.instances)
+        if (!view.occlusion->isOccluded(
+                glm::vec3(transform * glm::vec4(mesh.boundsCenter, 1.0f)),
+                mesh.boundsRadius * maxScale(transform))) {
+          hidden = false;
+          break;
+        }
+      if (hidden)
+        continue;
+    }
+    // the closest node decides the detail of all of them and the place
+    // in the front to back order
+    float pixelsPerUnit = 0.0f;
+    float nearest = 1e30f;
+    for (const glm::mat4 &transform : mesh.instances) {
+      glm::vec3 center = glm::vec3(
+          transform * glm::vec4(mesh.boundsCenter, 1.0f));
+      float scale = glm::length(glm::vec3(transform[0]));
+      float distance = glm::length(center - view.cameraPosition) -
+                       mesh.boundsRadius * scale;
+      pixelsPerUnit = glm::max(pixelsPerUnit,
+                               view.pixelsPerUnit(distance) * scale);
+      float depth = -(view.view * glm::vec4(center, 1.0f)).z -
+                    mesh.boundsRadius * scale;
+      nearest = glm::min(nearest, depth);
+    }
+    mesh.selectLod(pixelsPerUnit, view.lodPixelError);
+    requestMips(mesh, pixelsPerUnit);
+
+    DrawItem item;
+    item.mesh = i;
+    // clusters only cover the full detail of a mesh used by one node
+    item.clustered = !meshClusters.empty() && mesh.getInstanceCount() == 1 &&
+                     mesh.getCurrentLod() == 0;
+    if (item.clustered) {
+      selectClusters(view, i, item.counts, item.offsets);
+      if (item.counts.empty())
+        continue;
+    }
+    else
+      drawnTriangles += mesh.getDrawnTriangles();
+    bool translucent = mesh.opacity < 1.0f;
+    uint32_t index = (uint32_t)queue.size();
+    // translucent meshes hide nothing, so they skip the pre-pass
+    if (view.depthShader && !translucent)
+      renderQueue.push(renderKey(PASS_DEPTH, false,
+                                 view.depthShader->progID, 0, nearest),
+                       index);
+    // packed meshes are grouped by their array instead of the material
+    if (materialBatch.isPacked(i))
+      renderQueue.push(renderKey(PASS_COLOR, translucent,
+                                 view.arrayShader->progID,
+                                 materialBatch.getArray(i), nearest), index);
+    else if (view.virtualShader && mesh.getVirtualTexture())
+      renderQueue.push(renderKey(PASS_COLOR, translucent,
+                                 view.virtualShader->progID, mesh.material,
+                                 nearest), index);
+    else
+      renderQueue.push(renderKey(PASS_COLOR, translucent, shader.progID,
+                                 mesh.material, nearest), index);
+    queue.push_back(std::move(item));
+  }
+  renderQueue.sort();
+  drawFeedback(view, queue);
+  submitQueue(shader, view, queue);
+}
+
+void Model::drawFeedback(const RenderView &view,
+                         const std::vector<DrawItem> &queue) {
+  if (!view.virtualShader || !view.feedbackShader)
+    return;
+  VirtualTextureSystem &system = VirtualTextureSystem::get();
+  GlStateCache &state = GlStateCache::get();
+  Shader &program = *view.feedbackShader;
+  bool begun = false;
+  for (const DrawItem &item : queue) {
+    Mesh &mesh = meshes[item.mesh];
+    VirtualTexture* texture = mesh.getVirtualTexture();
+    if (!texture)
+      continue;
+    if (!begun) {
+      system.beginFeedback(view.width, view.height);
+      state.begin();
+      state.useProgram(program.progID);
+      glm::mat4 projection = view.projection;
+      glm::mat4 viewMatrix = view.view;
+      glm::mat4 modelMatrix = glm::mat4(1.0f);
+      program.setUniform("projection", projection);
+      program.setUniform("view", viewMatrix);
+      program.setUniform("model", modelMatrix);
+      begun = true;
+    }
+    system.bind(*texture, program);
+    if (item.clustered)
+      mesh.drawRanges(program, item.counts, item.offsets);
+    else
+      mesh.draw(program);
+  }
+  if (begun) {
+    state.end();
+    system.endFeedback();
+  }
+}
+
+void Model::submitQueue(Shader &shader, const RenderView &view,
+                        const std::vector<DrawItem> &queue) {
+  GlStateCache &state = GlStateCache::get();
+  state.begin();
+  bool depthPass = false;
+  bool colorPass = false;
+  bool blending = false;
+  bool arrayUniforms = false;
+  bool virtualUniforms = false;
+  // pass, translucency, program and array of the queued merged ranges
+  uint64_t mergedGroup = 0;
+  drawnMeshes = 0;
+  drawCalls = 0;
+  for (size_t i = 0; i < renderQueue.size(); i++) {
+    uint64_t key = renderQueue.getKey(i);
+    const DrawItem &item = queue[renderQueue.getItem(i)];
+    Mesh &mesh = meshes[item.mesh];
+
+    if (keyPass(key) == PASS_DEPTH) {
+      Shader &depthShader = *view.depthShader;
+      if (!depthPass) {
+        // the single model is drawn untransformed like the colour pass
+        glm::mat4 projection = view.projection;
+        glm::mat4 viewMatrix = view.view;
+        glm::mat4 modelMatrix = glm::mat4(1.0f);
+        state.useProgram(depthShader.progID);
+        depthShader.setUniform("projection", projection);
+        depthShader.setUniform("view", viewMatrix);
+        depthShader.setUniform("model", modelMatrix);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        depthPass = true;
+      }
+      if (item.clustered)
+        mesh.drawDepthRanges(depthShader, item.counts, item.offsets);
+      else
+        mesh.drawDepth(depthShader);
+      continue;
+    }
+
+    if (!colorPass) {
+      // every visible fragment is shaded once, the invariant positions
+      // let the colour pass hit the stored depth exactly
+      if (depthPass) {
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+      }
+      colorPass = true;
+    }
+    // the merged ranges of a group go out together once it is complete
+    if (materialBatch.hasRanges() && key >> 32 != mergedGroup) {
+      materialBatch.drawRanges(*view.arrayShader);
+      drawCalls++;
+    }
+    drawnMeshes++;
+    bool packed = materialBatch.isPacked(item.mesh);
+    VirtualTexture* virtualTexture =
+        view.virtualShader ? mesh.getVirtualTexture() : nullptr;
+    Shader &program = packed ? *view.arrayShader :
+                      virtualTexture ? *view.virtualShader : shader;
+    state.useProgram(program.progID);
+    if (virtualTexture) {
+      if (!virtualUniforms) {
+        glm::mat4 projection = view.projection;
+        glm::mat4 viewMatrix = view.view;
+        glm::mat4 modelMatrix = glm::mat4(1.0f);
+        program.setUniform("projection", projection);
+        program.setUniform("view", viewMatrix);
+        program.setUniform("model", modelMatrix);
+        virtualUniforms = true;
+      }
+      VirtualTextureSystem::get().bind(*virtualTexture, program);
+    }
+    if (packed) {
+      if (!arrayUniforms) {
+        glm::mat4 projection = view.projection;
+        glm::mat4 viewMatrix = view.view;
+        glm::mat4 modelMatrix = glm::mat4(1.0f);
+        program.setUniform("projection", projection);
+        program.setUniform("view", viewMatrix);
+        program.setUniform("model", modelMatrix);
+        arrayUniforms = true;
+      }
+      state.bindTexture(0, materialBatch.getArrayTexture(
+                               materialBatch.getArray(item.mesh)),
+                        GL_TEXTURE_2D_ARRAY);
+    }
+    if (keyTranslucent(key)) {
+      if (!blending) {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDepthMask(GL_FALSE);
+        blending = true;
+      }
+      program.setUniform("opacity", mesh.opacity);
+    }
+    if (materialBatch.isMerged(item.mesh)) {
+      mergedGroup = key >> 32;
+      if (item.clustered)
+        materialBatch.addRanges(item.mesh, item.counts, item.offsets);
+      else
+        materialBatch.addRange(item.mesh, mesh.getLodRange().count,
+                               mesh.getLodRange().offset);
+      continue;
+    }
+    if (packed)
+      glVertexAttrib1f(LAYER_ATTRIBUTE, materialBatch.getLayer(item.mesh));
+    if (item.clustered)
+      mesh.drawRanges(program, item.counts, item.offsets);
+    else
+      mesh.draw(program);
+    drawCalls++;
+  }
+  if (materialBatch.hasRanges()) {
+    materialBatch.drawRanges(*view.arrayShader);
+    drawCalls++;
+  }
+
+  if (blending) {
+    state.useProgram(shader.progID);
+    shader.setUniform("opacity", 1.0f);
+    if (arrayUniforms) {
+      state.useProgram(view.arrayShader->progID);
+      view.arrayShader->setUniform("opacity", 1.0f);
+    }
+    if (virtualUniforms) {
+      state.useProgram(view.virtualShader->progID);
+      view.virtualShader->setUniform("opacity", 1.0f);
+    }
+    glDisable(GL_BLEND);
+  }
+  if (depthPass) {
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthFunc(GL_LESS);
+  }
+  glDepthMask(GL_TRUE);
+  state.end();
+}
+
+void Model::selectClusters(const RenderView &view, unsigned int index,
+                           std::vector<GLsizei> &counts,
+                           std::vector<unsigned int> &offsets) {
+  Mesh &mesh = meshes[index];
+  const std::vector<Cluster> &clusters = meshClusters[index];
+  // the clusters are tested in the space of the mesh
+  const glm::mat4 &transform = mesh.instances[0];
+  Frustum frustum = Frustum::fromMatrix(view.projection * view.view *
+                                        transform);
+  glm::vec3 camera = glm::vec3(glm::inverse(transform) *
+                               glm::vec4(view.cameraPosition, 1.0f));
+  float scale = maxScale(transform);
+
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  std::vector<unsigned char> visibility(clusters.size());
+  JobSystem::get().parallelFor(clusters.size(), 256,
+                               [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      visibility[i] = testCluster(clusters[i], frustum, camera);
+      if (visibility[i] == CLUSTER_VISIBLE && view.occlusion &&
+          view.occlusion->isOccluded(
+              glm::vec3(transform * glm::vec4(clusters[i].center, 1.0f)),
+              clusters[i].radius * scale))
+        visibility[i] = CLUSTER_OCCLUDED;
+    }
+  });
+
+  // neighbouring visible clusters are merged into one range
+  for (size_t i = 0; i < clusters.size(); i++) {
+    if (visibility[i] == CLUSTER_OUTSIDE) {
+      clusterStats.frustumCulled++;
+      continue;
+    }
+    if (visibility[i] == CLUSTER_BACKFACING) {
+      clusterStats.backfaceCulled++;
+      continue;
+    }
+    if (visibility[i] == CLUSTER_OCCLUDED) {
+      clusterStats.occlusionCulled++;
+      continue;
+    }
+    const Cluster &cluster = clusters[i];
+    if (!counts.empty() && offsets.back() + counts.back() ==
+        cluster.indexOffset)
+      counts.back() += cluster.indexCount;
+    else {
+      counts.push_back(cluster.indexCount);
+      offsets.push_back(cluster.indexOffset);
+    }
+    drawnTriangles += cluster.indexCount / 3;
+  }
+  clusterStats.clusters += clusters.size();
+  clusterStats.drawRanges += counts.size();
+  clusterStats.cullMs += std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+void Model::requestMips(const RenderView &view, const glm::mat4 &transform) {
+  if (!TextureStreamer::get().managesMips())
+    return;
+  for (const Mesh &mesh : meshes) {
+    float pixelsPerUnit = 0.0f;
+    for (const glm::mat4 &instance : mesh.instances) {
+      glm::mat4 placement = transform * instance;
+      glm::vec3 center = glm::vec3(
+          placement * glm::vec4(mesh.boundsCenter, 1.0f));
+      float scale = glm::length(glm::vec3(placement[0]));
+      float distance = glm::length(center - view.cameraPosition) -
+                       mesh.boundsRadius * scale;
+      pixelsPerUnit = glm::max(pixelsPerUnit,
+                               view.pixelsPerUnit(distance) * scale);
+    }
+    requestMips(mesh, pixelsPerUnit);
+  }
 }
 
-void Model::processNode(aiNode* node) {
+void Model::requestMips(const Mesh &mesh, float pixelsPerUnit) {
+  TextureStreamer &streamer = TextureStreamer::get();
+  if (!streamer.managesMips() || mesh.uvDensity <= 0.0f)
+    return;
+  for (const Texture &texture : mesh.textures)
+    if (texture.texture)
+      streamer.requestDetail(*texture.texture,
+                             mesh.uvDensity / glm::max(pixelsPerUnit, 1e-6f));
+}
 
-  for (unsigned int i = 0; i < node->mNumMeshes; i++) {
-    aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-    meshes.push_back(processMesh(mesh));
+void Model::drawInstanced(Shader &shader, const InstanceSet &instances,
+                          Shader* arrayShader) {
+  GlStateCache &state = GlStateCache::get();
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    if (!materialBatch.isPacked(i) || !arrayShader) {
+      meshes[i].drawInstanced(shader, instances.getBuffer(),
+                              instances.getVisibleCount());
+      continue;
+    }
+    state.useProgram(arrayShader->progID);
+    state.bindTexture(0, materialBatch.getArrayTexture(
+                             materialBatch.getArray(i)),
+                      GL_TEXTURE_2D_ARRAY);
+    glVertexAttrib1f(LAYER_ATTRIBUTE, materialBatch.getLayer(i));
+    meshes[i].drawInstanced(*arrayShader, instances.getBuffer(),
+                            instances.getVisibleCount());
+    state.useProgram(shader.progID);
   }
+}
+
+void Model::loadModel(const std::string &path,
+                      const ImportOptions &options) {
+  // an octree of chunks built by --build-chunks, paged in by the view
+  if (path.size() > 7 && path.compare(path.size() - 7, 7, ".chunks") == 0) {
+    std::string error;
+    if (!options.gpu)
+      std::cout << "Chunk files need the OpenGL renderer: " << path
+                << std::endl;
+    else if (!pager.open(path, options.chunkBudget, options.chunkMemory,
+                         error))
+      std::cout << "Couldn't load chunk file: " << path << " (" << error
+                << ")" << std::endl;
+    boundsCenter = pager.getBoundsCenter();
+    boundsRadius = pager.getBoundsRadius();
+    return;
+  }
+  // a nested point octree built by --build-points
+  if (path.size() > 7 && path.compare(path.size() - 7, 7, ".points") == 0) {
+    std::string error;
+    if (!options.gpu)
+      std::cout << "Point files need the OpenGL renderer: " << path
+                << std::endl;
+    else if (!points.open(path, options.pointBudget, error))
+      std::cout << "Couldn't load point file: " << path << " (" << error
+                << ")" << std::endl;
+    boundsCenter = points.getBoundsCenter();
+    boundsRadius = points.getBoundsRadius();
+    return;
+  }
+  Assimp::Importer importer;
+  ioStats.begin();
+  // binary stl and ply are welded straight from the mapped file, other
+  // files and the ones it can't read go through assimp
+  std::vector<Vertex> nativeVertices;
+  std::vector<unsigned int> nativeIndices;
+  NativeMeshStats nativeStats;
+  std::string nativeError;
+  bool native = options.nativeMeshes && isNativeMesh(path) &&
+                loadNativeMesh(path, options.creaseAngle, nativeVertices,
+                               nativeIndices, nativeStats, nativeError);
+  if (!native && options.report && !nativeError.empty())
+    std::cout << "native import skipped: " << nativeError << std::endl;
+  scene = nullptr;
+  if (!native) {
+    // the importer takes ownership of the file system
+    importer.SetIOHandler(new MmapIOSystem(ioStats));
+    // create scene
+    scene = importScene(importer, path, options);
+
+    // check for scene errors
+    if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) ||
+        !scene->mRootNode) {
+      std::cout << "assimp error: " << importer.GetErrorString()
+                << std::endl;
+      ioStats.end();
+      return;
+    }
+  }
+  directory = path.substr(0, path.find_last_of('/'));
+  gpu = options.gpu;
+  clusterCulling = options.clusters;
+  textureArrays = options.gpu && options.textureArrays;
+  mipFilter = options.mipFilter;
+  cpuMips = options.cpuMips;
+  mipStats.timed = options.report;
+  if (native) {
+    // one untransformed mesh without material
+    nodeTransforms.push_back(glm::mat4(1.0f));
+    if (clusterCulling)
+      meshClusters.push_back(buildClusters(nativeVertices, nativeIndices));
+    meshes.push_back(Mesh(std::move(nativeVertices), std::move(nativeIndices),
+                          std::vector<Texture>(), gpu));
+  }
+  else {
+    // flatten the node hierarchy
+    meshReferences.resize(scene->mNumMeshes);
+    processNode(scene->mRootNode, glm::mat4(1.0f));
+
+    // upload every referenced mesh once, drawn for each node using it
+    for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+      if (meshReferences[i].empty())
+        continue;
+      meshes.push_back(processMesh(scene->mMeshes[i]));
+      std::vector<glm::mat4> transforms;
+      for (unsigned int node : meshReferences[i])
+        transforms.push_back(nodeTransforms[node]);
+      meshes.back().setInstances(transforms);
+    }
+  }
+  computeBounds();
+  if (options.picking)
+    buildBvh();
+  // the decoded images are only needed until they are in the arrays
+  if (textureArrays) {
+    materialBatch.build(meshes);
+    for (Mesh &mesh : meshes)
+      for (Texture &texture : mesh.textures)
+        texture.image.reset();
+    textures_loaded.clear();
+  }
+  ioStats.end();
+
+  // large meshes hide the most, small ones aren't worth rasterizing
+  for (const Mesh &mesh : meshes)
+    occluders.push_back(mesh.boundsRadius * maxScale(mesh.instances[0]) >=
+                        boundsRadius * 0.1f);
+  occluderProxies.resize(meshes.size());
+
+  // the simplifier only reads the vertices and indices of the meshes
+  if (options.lod == LOD_IMPORT)
+    applyLods(buildMeshLods(options.lodLevels));
+  else if (options.lod == LOD_BACKGROUND)
+    pendingLods = std::async(std::launch::async, &Model::buildMeshLods, this,
+                             options.lodLevels);
+  // the rays only count hits within a tenth of the model, the result is
+  // cached next to the model file
+  if (options.ambientOcclusion && bvh.empty())
+    std::cout << "ambient occlusion needs the bvh, drop --no-picking"
+              << std::endl;
+  else if (options.ambientOcclusion) {
+    AoSettings settings;
+    settings.samples = options.aoSamples;
+    settings.distance = boundsRadius * 0.1f;
+    pendingAo = std::async(std::launch::async, bakeAmbientOcclusion,
+                           std::cref(bvh), std::cref(meshes), settings,
+                           path + ".ao");
+  }
+  if (options.report) {
+    if (native) {
+      nativeStats.print(std::cout);
+      compareAssimpImport(path, options, nativeStats);
+    }
+    ioStats.print(path);
+    printInstancing();
+    mipStats.report(std::cout, mipFilter);
+    TextureCache::get().report(std::cout);
+  }
+}
+
+void Model::processNode(aiNode* node, const glm::mat4 &parentTransform) {
+  // assimp matrices are row major
+  const aiMatrix4x4 &local = node->mTransformation;
+  glm::mat4 transform = parentTransform * glm::transpose(glm::mat4(
+      local.a1, local.a2, local.a3, local.a4,
+      local.b1, local.b2, local.b3, local.b4,
+      local.c1, local.c2, local.c3, local.c4,
+      local.d1, local.d2, local.d3, local.d4));
+  unsigned int index = nodeTransforms.size();
+  nodeTransforms.push_back(transform);
+
+  for (unsigned int i = 0; i < node->mNumMeshes; i++)
+    meshReferences[node->mMeshes[i]].push_back(index);
 
   // recursive iteration over all nodes
   for (unsigned int i = 0; i < node->mNumChildren; i++)
-    processNode(node->mChildren[i]);
+    processNode(node->mChildren[i], transform);
+}
+
+std::vector<std::vector<LodLevel>> Model::buildMeshLods(unsigned int levels) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  std::vector<std::vector<LodLevel>> lods;
+  for (const Mesh &mesh : meshes)
+    lods.push_back(buildLods(mesh.vertices, mesh.indices, levels));
+  lodBuildMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  return lods;
+}
+
+void Model::applyLods(const std::vector<std::vector<LodLevel>> &levels) {
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    meshes[i].setLods(levels[i]);
+    // the coarsest level that stays close to the surface, a proxy that
+    // grew too much would hide what is really visible
+    if (!occluders[i])
+      continue;
+    for (unsigned int level = 1; level < levels[i].size(); level++)
+      if (levels[i][level].error <= meshes[i].boundsRadius * 0.01f)
+        occluderProxies[i] = levels[i][level].indices;
+  }
+  // the merged index buffer holds a copy of every level
+  if (!materialBatch.empty())
+    materialBatch.refresh(meshes);
+}
+
+void Model::addOccluders(OcclusionBuffer &buffer,
+                         const glm::mat4 &transform) const {
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    if (!occluders[i])
+      continue;
+    const std::vector<unsigned int> &indices = occluderProxies[i].empty() ?
+        meshes[i].indices : occluderProxies[i];
+    for (const glm::mat4 &node : meshes[i].instances) {
+      glm::mat4 world = transform * node;
+      if (buffer.inView(glm::vec3(world * glm::vec4(meshes[i].boundsCenter,
+                                                    1.0f)),
+                        meshes[i].boundsRadius * maxScale(world)))
+        buffer.addOccluder(meshes[i].vertices, indices, world);
+    }
+  }
+}
+
+void Model::reportLod(std::ostream &out) const {
+  if (pager.isOpen()) {
+    pager.report(out);
+    return;
+  }
+  if (points.isOpen()) {
+    points.report(out);
+    return;
+  }
+  size_t fullTriangles = 0;
+  size_t levels = 0;
+  for (const Mesh &mesh : meshes) {
+    fullTriangles += mesh.indices.size() / 3 * mesh.instances.size();
+    levels += mesh.getLodCount();
+  }
+  out << "lod: " << drawnTriangles << " of " << fullTriangles
+      << " triangles drawn, " << levels << " levels in " << meshes.size()
+      << " meshes";
+  // the build time belongs to the worker until its result was taken
+  if (!pendingLods.valid() && lodBuildMs > 0.0 && fullTriangles > 0)
+    out << ", built in " << std::fixed << std::setprecision(1) << lodBuildMs
+        << " ms (" << lodBuildMs * 1e6 / fullTriangles
+        << " ms per million triangles)";
+  out << std::endl;
+}
+
+void Model::reportBvh(std::ostream &out, const RenderView &view) const {
+  if (bvh.empty())
+    return;
+  // one ray through every fourth pixel, generated before the clock starts
+  int columns = glm::max(view.width / 4, 1);
+  int rows = glm::max(view.height / 4, 1);
+  std::vector<Ray> rays(columns * rows);
+  for (int y = 0; y < rows; y++)
+    for (int x = 0; x < columns; x++)
+      rays[y * columns + x] = screenRay(view.view, view.projection,
+                                        (x + 0.5f) * 4.0f, (y + 0.5f) * 4.0f,
+                                        view.width, view.height);
+  std::atomic<size_t> hits(0);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  JobSystem::get().parallelFor(rays.size(), 256,
+                               [&](size_t begin, size_t end) {
+    size_t chunkHits = 0;
+    RayHit hit;
+    for (size_t i = begin; i < end; i++)
+      if (bvh.intersect(rays[i], hit))
+        chunkHits++;
+    hits += chunkHits;
+  });
+  double traceMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+
+  out << "bvh: " << bvh.getNodeCount() << " nodes over "
+      << bvh.getTriangleCount() << " triangles, built in " << std::fixed
+      << std::setprecision(1) << bvh.getBuildMs() << " ms ("
+      << bvh.getBuildMs() * 1e6 / std::max<size_t>(bvh.getTriangleCount(), 1)
+      << " ms per million triangles), " << hits << " of " << rays.size()
+      << " view rays hit, " << std::setprecision(2)
+      << rays.size() / std::max(traceMs, 1e-3) / 1e3
+      << " million rays per second on " << JobSystem::get().getThreadCount()
+      << " threads" << std::endl;
+}
+
+void Model::reportAo(std::ostream &out) const {
+  if (pendingAo.valid())
+    out << "ao: baking in the background" << std::endl;
+  else if (aoStats.vertices > 0)
+    aoStats.report(out);
+}
+
+void Model::reportBatches(std::ostream &out) const {
+  out << "batches: " << drawnMeshes << " meshes in " << drawCalls
+      << " draw calls (" << std::fixed << std::setprecision(2)
+      << drawnMeshes / (double)std::max(drawCalls, 1u)
+      << " meshes per call)" << std::endl;
+  if (!materialBatch.empty())
+    materialBatch.report(out);
+}
+
+void Model::reportClusters(std::ostream &out) const {
+  if (meshClusters.empty())
+    return;
+  out << "clusters: " << clusterStats.clusters << " tested, "
+      << clusterStats.frustumCulled << " outside the view, "
+      << clusterStats.backfaceCulled << " backfacing, "
+      << clusterStats.occlusionCulled << " occluded, drawn in "
+      << clusterStats.drawRanges << " ranges, culled in " << std::fixed
+      << std::setprecision(3) << clusterStats.cullMs << " ms on "
+      << JobSystem::get().getThreadCount() << " threads" << std::endl;
+}
+
+// sphere around the bounding spheres of all mesh instances
+void Model::computeBounds() {
+  glm::vec3 minimum(0.0f);
+  glm::vec3 maximum(0.0f);
+  bool first = true;
+  for (const Mesh &mesh : meshes)
+    for (const glm::mat4 &transform : mesh.instances) {
+      glm::vec3 center = glm::vec3(
+          transform * glm::vec4(mesh.boundsCenter, 1.0f));
+      if (first)
+        minimum = maximum = center;
+      minimum = glm::min(minimum, center);
+      maximum = glm::max(maximum, center);
+      first = false;
+    }
+  boundsCenter = (minimum + maximum) * 0.5f;
+  boundsRadius = 0.0f;
+  for (const Mesh &mesh : meshes)
+    for (const glm::mat4 &transform : mesh.instances) {
+      glm::vec3 center = glm::vec3(
+          transform * glm::vec4(mesh.boundsCenter, 1.0f));
+      boundsRadius = glm::max(boundsRadius, glm::length(center - boundsCenter)
+                              + mesh.boundsRadius * maxScale(transform));
+    }
+}
+
+// the meshes keep their vertices and indices, the bvh copies the triangles
+// placed by every node
+void Model::buildBvh() {
+  std::vector<BvhMesh> bvhMeshes;
+  for (const Mesh &mesh : meshes)
+    bvhMeshes.push_back({ &mesh.vertices, &mesh.indices, mesh.instances });
+  bvh.build(bvhMeshes);
+}
+
+// compares the instanced meshes with one copy per reference
+void Model::printInstancing() const {
+  size_t references = 0;
+  size_t uploadedBytes = 0;
+  size_t duplicatedBytes = 0;
+  for (const Mesh &mesh : meshes) {
+    size_t bytes = mesh.vertices.size() * sizeof(Vertex) +
+                   mesh.indices.size() * sizeof(unsigned int);
+    references += mesh.getInstanceCount();
+    uploadedBytes += bytes + mesh.getInstanceCount() * sizeof(glm::mat4);
+    duplicatedBytes += bytes * mesh.getInstanceCount();
+  }
+  const double mb = 1024.0 * 1024.0;
+  std::cout << "instancing report: " << nodeTransforms.size() << " nodes, "
+            << references << " mesh references, " << meshes.size()
+            << " draw calls instead of " << references << ", "
+            << std::fixed << std::setprecision(2) << uploadedBytes / mb
+            << " MB uploaded instead of " << duplicatedBytes / mb << " MB"
+            << std::endl;
 }
 
 Mesh Model::processMesh(aiMesh* mesh) {
@@ -59,10 +1050,12 @@ Mesh Model::processMesh(aiMesh* mesh) {
     position.z = mesh->mVertices[i].z;
 
     // get normals
-    glm::vec3 normal;
-    normal.x = mesh->mNormals[i].x;
-    normal.y = mesh->mNormals[i].y;
-    normal.z = mesh->mNormals[i].z;
+    glm::vec3 normal(0.0f, 0.0f, 0.0f);
+    if (mesh->HasNormals()) {
+      normal.x = mesh->mNormals[i].x;
+      normal.y = mesh->mNormals[i].y;
+      normal.z = mesh->mNormals[i].z;
+    }
 
     // get texture coords
     glm::vec2 texturecoord;
@@ -86,6 +1079,9 @@ Mesh Model::processMesh(aiMesh* mesh) {
     for (unsigned int j = 0; j < face.mNumIndices; j++)
       indices.push_back(face.mIndices[j]);
   }
+  // the clusters reorder the triangles before the upload
+  if (clusterCulling)
+    meshClusters.push_back(buildClusters(vertices, indices));
 
   // handle textures
   aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
@@ -105,7 +1101,10 @@ Mesh Model::processMesh(aiMesh* mesh) {
   textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
   textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
 
-  return Mesh(vertices, indices, textures);
+  Mesh result(vertices, indices, textures, gpu);
+  result.material = mesh->mMaterialIndex;
+  material->Get(AI_MATKEY_OPACITY, result.opacity);
+  return result;
 }
 
 // load the textures
@@ -118,16 +1117,45 @@ std::vector<Texture> Model::loadMaterialTextures(aiMaterial* mat,
     aiString path;
     mat->GetTexture(type, i, &path);
     bool alreadyLoaded = false;
+    // packed diffuse textures are only decoded, the arrays upload them
+    bool decoded = !gpu || (textureArrays && typeName == "texture_diffuse");
+    // the diffuse colours are stored as srgb, the specular maps are plain
+    // factors
+    MipSettings mips;
+    mips.filter = mipFilter;
+    mips.srgb = typeName == "texture_diffuse";
+    mips.normalMap = typeName == "texture_normal";
     // check if any texture is already loaded
     for (unsigned int j = 0; j < textures_loaded.size(); j++)
-      if (std::strcmp(textures_loaded[j].path.data(), path.C_Str()) == 0) {
+      if (std::strcmp(textures_loaded[j].path.data(), path.C_Str()) == 0 &&
+          decoded == !textures_loaded[j].texture) {
         textures.push_back(textures_loaded[j]);
         alreadyLoaded = true;
         break;
       }
+    // diffuse page files go through the page cache and need no texture
+    std::string pages;
+    if (gpu && typeName == "texture_diffuse" &&
+        VirtualTextureSystem::get().isEnabled())
+      pages = pageFilePath(this->directory + '/' + path.C_Str());
+    if (!alreadyLoaded && !pages.empty()) {
+      Texture texture;
+      texture.virtualTexture = VirtualTextureSystem::get().open(pages);
+      if (texture.virtualTexture) {
+        texture.type = typeName;
+        texture.path = path.C_Str();
+        textures.push_back(texture);
+        continue;
+      }
+    }
     if (!alreadyLoaded) {
       Texture texture;
-      texture.id = TextureFromFile(path.C_Str(), this->directory);
+      if (!decoded)
+        texture.texture = TextureFromFile(path.C_Str(), this->directory,
+                                          ioStats, mips, cpuMips, mipStats);
+      else
+        texture.image = ImageFromFile(path.C_Str(), this->directory,
+                                      ioStats, mips, mipStats);
       texture.type = typeName;
       texture.path = path.C_Str();
       textures.push_back(texture);
@@ -137,46 +1165,79 @@ std::vector<Texture> Model::loadMaterialTextures(aiMaterial* mat,
   return textures;
 }
 
-// bind texture
-unsigned int TextureFromFile(const char* path, const std::string &directory) {
+// bind texture, textures of earlier models are reused from the cache
+std::shared_ptr<GpuTexture> TextureFromFile(const char* path,
+                                            const std::string &directory,
+                                            IoStats &stats,
+                                            const MipSettings &mips,
+                                            bool cpuMips, MipStats &mipStats) {
   std::string filename = std::string(path);
   filename = directory + '/' + filename;
-  
-  unsigned int textureID;
-  glGenTextures(1, &textureID);
-  
-  int width;
-  int height;
-  int formatComp;
-  unsigned char* data = stbi_load(filename.c_str(), &width,
-                                  &height, &formatComp, 0);
-  if (data) {
-    GLenum format;
-    switch (formatComp) {
-    case 1:
-      format = GL_RED; break;
-    case 3:
-      format = GL_RGB; break;
-    case 4:
-      format = GL_RGBA; break;
-    }
-
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-                 GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
 
-    // set texture parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                    GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  std::shared_ptr<GpuTexture> texture =
+      GpuRegistry::get().findTexture(filename);
+  if (texture)
+    return texture;
+  texture = std::make_shared<GpuTexture>(filename);
+
+  if (TextureStreamer::get().isEnabled()) {
+    // decoded on a streaming thread, the statistics of the model aren't
+    // reachable from there and the streamer reports the time instead
+    std::string name = path;
+    // a managed texture needs all its levels to stream the finer ones
+    if (TextureStreamer::get().managesMips())
+      cpuMips = true;
+    TextureStreamer::get().request(texture, name,
+        [filename, name, mips, cpuMips](TextureData &data) {
+      IoStats stats;
+      MipStats mipStats;
+      return decodeTexture(filename, name.c_str(), mips, cpuMips, stats,
+                           mipStats, data);
+    });
   }
-  else
-    std::cout << "Couldn't load texture: " << path << std::endl;
+  else {
+    TextureData data;
+    if (decodeTexture(filename, path, mips, cpuMips, stats, mipStats, data))
+      uploadTexture(data.levels, *texture, mipStats);
+  }
+  GpuRegistry::get().storeTexture(filename, texture);
+  return texture;
+}
+// decode texture into memory with its mip chain for the software renderer
+std::shared_ptr<const TextureImage> ImageFromFile(const char* path,
+                                                  const std::string &directory,
+                                                  IoStats &stats,
+                                                  const MipSettings &mips,
+                                                  MipStats &mipStats) {
+  std::string filename = directory + '/' + std::string(path);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  MappedFile file(filename, ACCESS_WILLNEED);
+  stats.ioMs += std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  stats.files += file.isOpen() ? 1 : 0;
+  stats.mappedBytes += file.size();
+  if (isTextureContainer(file.data(), file.size()))
+    return imageFromContainer(file.data(), file.size(), path, mips);
 
-  // release the data
+  int width;
+  int height;
+  int channels;
+  unsigned char* data = nullptr;
+  if (file.size() > 0)
+    data = stbi_load_from_memory(file.data(), (int)file.size(), &width,
+                                 &height, &channels, 0);
+  if (!data) {
+    std::cout << "Couldn't load texture: " << path << std::endl;
+    return nullptr;
+  }
+  start = std::chrono::steady_clock::now();
+  std::shared_ptr<TextureImage> image = std::make_shared<TextureImage>(
+      buildTextureImage(data, width, height, channels, mips));
+  mipStats.cpuMs += std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  mipStats.cpuTextures++;
+  mipStats.cpuTexels += (size_t)width * height;
   stbi_image_free(data);
-  return textureID;
-}
\ No newline at end of file
+  return image;
+}
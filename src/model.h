@@ -2,6 +2,20 @@
 #define model_h
 
 #include "mesh.h"
+#include "bvh.h"
+#include "aobake.h"
+#include "cluster.h"
+#include "occlusion.h"
+#include "importprofile.h"
+#include "mappedfile.h"
+#include "instancing.h"
+#include "lod.h"
+#include "renderview.h"
+#include "renderqueue.h"
+#include "materialbatch.h"
+#include "meshpager.h"
+#include "pointpager.h"
+#include <future>
 #include <iostream>
 #include <vector>
 #include <assimp/scene.h>
@@ -9,16 +23,124 @@
 
 class Model {
 public:
-  Model(const std::string &path);
-  void draw(Shader &shader);
+  Model(const std::string &path,
+        const ImportOptions &options = ImportOptions());
+  Model(const Model &) = delete;
+  Model &operator=(const Model &) = delete;
+  // selects the detail level of every mesh for the view and draws it
+  // through a render queue sorted by pass, program, material and depth.
+  // with a depth shader in the view the opaque meshes are laid down front
+  // to back in a depth only pass first
+  void draw(Shader &shader, const RenderView &view);
+  // asks the texture streamer for the mip levels the meshes need, seen
+  // from the view with the model placed by the transform. draw does this
+  // for the meshes it draws
+  void requestMips(const RenderView &view, const glm::mat4 &transform);
+  // takes over the levels of detail and ambient occlusion finished in the
+  // background, call before drawing a frame
+  void update();
+  // keeps the viewer drawing until the background work arrived
+  bool hasPendingWork() const {
+    return pendingLods.valid() || pendingAo.valid() || pager.isBusy() ||
+           points.isBusy();
+  }
+  // draws the model once for every visible instance of the set, packed
+  // meshes switch to the array shader that needs the same uniforms
+  void drawInstanced(Shader &shader, const InstanceSet &instances,
+                     Shader* arrayShader = nullptr);
+  // drawn from a chunk or point file by a pager
+  bool isPaged() const { return pager.isOpen() || points.isOpen(); }
+  // bounding sphere of the whole model
+  glm::vec3 getBoundsCenter() const { return boundsCenter; }
+  float getBoundsRadius() const { return boundsRadius; }
+  const std::vector<Mesh> &getMeshes() const { return meshes; }
+  void reportLod(std::ostream &out) const;
+  void reportClusters(std::ostream &out) const;
+  // closest triangle along a ray in model space, false without a bvh
+  bool pick(const Ray &ray, RayHit &hit, float maxDistance = 1e30f) const {
+    return bvh.intersect(ray, hit, maxDistance);
+  }
+  // build cost of the bvh and the speed of tracing rays through the view
+  void reportBvh(std::ostream &out, const RenderView &view) const;
+  void reportAo(std::ostream &out) const;
+  // meshes and draw calls of the last frame and the packed textures
+  void reportBatches(std::ostream &out) const;
+  // queues the large meshes as occluders, placed by the transform
+  void addOccluders(OcclusionBuffer &buffer,
+                    const glm::mat4 &transform) const;
 private:
   std::vector<Texture> textures_loaded;
   std::vector<Mesh> meshes;
   std::string directory;
+  bool gpu = true;
+  IoStats ioStats;
+  // world transform of every node in traversal order
+  std::vector<glm::mat4> nodeTransforms;
+  // nodes referencing each mesh of the scene
+  std::vector<std::vector<unsigned int>> meshReferences;
+  glm::vec3 boundsCenter = glm::vec3(0.0f);
+  float boundsRadius = 0.0f;
+  // detail levels built in the background, declared after the meshes so
+  // the destructor waits for the worker before the meshes go away
+  std::future<std::vector<std::vector<LodLevel>>> pendingLods;
+  double lodBuildMs = 0.0;
+  size_t drawnTriangles = 0;
+  // clusters of the full detail level of every mesh, empty when off
+  bool clusterCulling = false;
+  std::vector<std::vector<Cluster>> meshClusters;
+  ClusterStats clusterStats;
+  // one visible mesh of the frame, clustered meshes draw only the ranges
+  struct DrawItem {
+    unsigned int mesh;
+    bool clustered;
+    std::vector<GLsizei> counts;
+    std::vector<unsigned int> offsets;
+  };
+  RenderQueue renderQueue;
+  // diffuse textures packed into arrays, meshes sharing one are merged
+  bool textureArrays = false;
+  MaterialBatch materialBatch;
+  // mip chains built on the worker threads, glGenerateMipmap builds the
+  // uncompressed ones unless cpuMips is set
+  MipFilter mipFilter = MIP_BOX;
+  bool cpuMips = false;
+  MipStats mipStats;
+  unsigned int drawnMeshes = 0;
+  unsigned int drawCalls = 0;
+  // meshes big enough to hide others and the simplified indices they are
+  // rasterized with, empty proxies use the full detail
+  std::vector<bool> occluders;
+  std::vector<std::vector<unsigned int>> occluderProxies;
+  Bvh bvh;
+  // reads the meshes and the bvh, so it is declared after them
+  std::future<AoBake> pendingAo;
+  AoStats aoStats;
+
+  // chunk files are drawn by the pager alone, the meshes stay empty
+  MeshPager pager;
+  // point files the same way
+  PointPager points;
 
   const aiScene* scene;
-  void loadModel(const std::string &path);
-  void processNode(aiNode* node);
+  void loadModel(const std::string &path, const ImportOptions &options);
+  void processNode(aiNode* node, const glm::mat4 &parentTransform);
+  void printInstancing() const;
+  // draws the sorted queue, redundant binds are dropped by the state cache
+  void submitQueue(Shader &shader, const RenderView &view,
+                   const std::vector<DrawItem> &queue);
+  // the meshes with page files into the small feedback target first
+  void drawFeedback(const RenderView &view,
+                    const std::vector<DrawItem> &queue);
+  // merged index ranges of the clusters that survive culling
+  void selectClusters(const RenderView &view, unsigned int index,
+                      std::vector<GLsizei> &counts,
+                      std::vector<unsigned int> &offsets);
+  void computeBounds();
+  // pixelsPerUnit of the closest node using the mesh
+  void requestMips(const Mesh &mesh, float pixelsPerUnit);
+  void buildBvh();
+  std::vector<std::vector<LodLevel>> buildMeshLods(unsigned int levels);
+  void applyLods(const std::vector<std::vector<LodLevel>> &levels);
   Mesh processMesh(aiMesh* mesh);
   std::vector<Texture> loadMaterialTextures(aiMaterial* mat,
                                             aiTextureType type,
@@ -0,0 +1,293 @@
+#include "occlusion.h"
+#include "jobsystem.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+namespace {
+
+const int bufferWidth = 320;
+const int tileWidth = 32;
+const int tileHeight = 16;
+
+// a point is usable when it lies in front of the near plane
+bool toScreen(const glm::vec4 &clip, int width, int height,
+              glm::vec3 &screen) {
+  if (clip.w <= 1e-4f || clip.z < -clip.w)
+    return false;
+  float inverse = 1.0f / clip.w;
+  screen = glm::vec3((clip.x * inverse * 0.5f + 0.5f) * width,
+                     (clip.y * inverse * 0.5f + 0.5f) * height,
+                     clip.z * inverse * 0.5f + 0.5f);
+  return true;
+}
+
+// e(x, y) = a * x + b * y + c is positive inside of a counter clockwise
+// triangle
+struct Edge {
+  float a, b, c;
+  Edge(const glm::vec3 &from, const glm::vec3 &to) {
+    a = from.y - to.y;
+    b = to.x - from.x;
+    c = -(a * from.x + b * from.y);
+  }
+};
+
+}
+
+void OcclusionBuffer::begin(const glm::mat4 &viewProjection,
+                            int viewportWidth, int viewportHeight) {
+  this->viewProjection = viewProjection;
+  frustum = Frustum::fromMatrix(viewProjection);
+  width = bufferWidth;
+  int rows = (int)std::lround((double)bufferWidth * viewportHeight /
+                              std::max(viewportWidth, 1) / tileHeight);
+  height = std::max(rows, 1) * tileHeight;
+  tilesX = width / tileWidth;
+  tilesY = height / tileHeight;
+
+  triangles.clear();
+  bins.resize(tilesX * tilesY);
+  pyramid.resize(1);
+  pyramid[0].assign(width * height, 1.0f);
+  pyramidSizes.assign(1, glm::ivec2(width, height));
+  queuedTriangles = 0;
+  rasterMs = 0.0;
+  tested = 0;
+  occluded = 0;
+}
+
+void OcclusionBuffer::addOccluder(const std::vector<Vertex> &vertices,
+                                  const std::vector<unsigned int> &indices,
+                                  const glm::mat4 &model) {
+  glm::mat4 matrix = viewProjection * model;
+  projected.resize(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++) {
+    glm::vec3 screen;
+    bool valid = toScreen(matrix * glm::vec4(vertices[i].position, 1.0f),
+                          width, height, screen);
+    projected[i] = glm::vec4(screen, valid ? 1.0f : 0.0f);
+  }
+
+  queuedTriangles += indices.size() / 3;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const glm::vec4 &c0 = projected[indices[i]];
+    const glm::vec4 &c1 = projected[indices[i + 1]];
+    const glm::vec4 &c2 = projected[indices[i + 2]];
+    // triangles crossing the near plane are dropped, an occluder may only
+    // ever hide less than it really does
+    if (c0.w == 0.0f || c1.w == 0.0f || c2.w == 0.0f)
+      continue;
+    Triangle triangle = { { glm::vec3(c0), glm::vec3(c1), glm::vec3(c2) } };
+    const glm::vec3 &p0 = triangle.corners[0];
+    const glm::vec3 &p1 = triangle.corners[1];
+    const glm::vec3 &p2 = triangle.corners[2];
+    float area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+    if (area <= 0.0f)
+      continue;
+    float minX = std::min(p0.x, std::min(p1.x, p2.x));
+    float maxX = std::max(p0.x, std::max(p1.x, p2.x));
+    float minY = std::min(p0.y, std::min(p1.y, p2.y));
+    float maxY = std::max(p0.y, std::max(p1.y, p2.y));
+    if (maxX < 0.0f || maxY < 0.0f || minX > width || minY > height)
+      continue;
+    triangles.push_back(triangle);
+  }
+}
+
+void OcclusionBuffer::rasterize() {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (std::vector<unsigned int> &bin : bins)
+    bin.clear();
+  for (unsigned int i = 0; i < triangles.size(); i++) {
+    const glm::vec3* p = triangles[i].corners;
+    float minX = std::min(p[0].x, std::min(p[1].x, p[2].x));
+    float maxX = std::max(p[0].x, std::max(p[1].x, p[2].x));
+    float minY = std::min(p[0].y, std::min(p[1].y, p[2].y));
+    float maxY = std::max(p[0].y, std::max(p[1].y, p[2].y));
+    int x0 = std::max((int)minX, 0) / tileWidth;
+    int x1 = std::min((int)maxX, width - 1) / tileWidth;
+    int y0 = std::max((int)minY, 0) / tileHeight;
+    int y1 = std::min((int)maxY, height - 1) / tileHeight;
+    for (int y = y0; y <= y1; y++)
+      for (int x = x0; x <= x1; x++)
+        bins[y * tilesX + x].push_back(i);
+  }
+
+  // tiles don't share pixels, every worker owns the tiles it took
+  JobSystem::get().parallelFor(bins.size(), 1, [this](size_t begin,
+                                                       size_t end) {
+    for (size_t tile = begin; tile < end; tile++)
+      rasterizeTile((int)tile);
+  });
+  buildPyramid();
+  rasterMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+void OcclusionBuffer::rasterizeTile(int tile) {
+  int tileX = (tile % tilesX) * tileWidth;
+  int tileY = (tile / tilesX) * tileHeight;
+  float* depth = pyramid[0].data();
+
+  for (unsigned int index : bins[tile]) {
+    const glm::vec3* p = triangles[index].corners;
+    Edge e0(p[1], p[2]);
+    Edge e1(p[2], p[0]);
+    Edge e2(p[0], p[1]);
+    float area = e2.a * p[2].x + e2.b * p[2].y + e2.c;
+    // depth is a plane over the screen
+    float za = (e0.a * p[0].z + e1.a * p[1].z + e2.a * p[2].z) / area;
+    float zb = (e0.b * p[0].z + e1.b * p[1].z + e2.b * p[2].z) / area;
+    float zc = (e0.c * p[0].z + e1.c * p[1].z + e2.c * p[2].z) / area;
+
+    // pixel centers inside the bounds of the triangle and the tile
+    float minX = std::min(p[0].x, std::min(p[1].x, p[2].x));
+    float maxX = std::max(p[0].x, std::max(p[1].x, p[2].x));
+    float minY = std::min(p[0].y, std::min(p[1].y, p[2].y));
+    float maxY = std::max(p[0].y, std::max(p[1].y, p[2].y));
+    int x0 = std::max(tileX, (int)std::ceil(minX - 0.5f));
+    int x1 = std::min(tileX + tileWidth - 1, (int)std::floor(maxX - 0.5f));
+    int y0 = std::max(tileY, (int)std::ceil(minY - 0.5f));
+    int y1 = std::min(tileY + tileHeight - 1, (int)std::floor(maxY - 0.5f));
+    if (x0 > x1 || y0 > y1)
+      continue;
+
+#ifdef OCCLUSION_SSE
+    // four pixels per step, the tile is a multiple of four wide
+    x0 &= ~3;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 lanes = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    for (int y = y0; y <= y1; y++) {
+      float py = y + 0.5f;
+      __m128 px = _mm_add_ps(_mm_set1_ps((float)x0), lanes);
+      __m128 step = _mm_set1_ps(4.0f);
+      __m128 w0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e0.a), px),
+                             _mm_set1_ps(e0.b * py + e0.c));
+      __m128 w1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e1.a), px),
+                             _mm_set1_ps(e1.b * py + e1.c));
+      __m128 w2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e2.a), px),
+                             _mm_set1_ps(e2.b * py + e2.c));
+      __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px),
+                            _mm_set1_ps(zb * py + zc));
+      __m128 w0Step = _mm_mul_ps(_mm_set1_ps(e0.a), step);
+      __m128 w1Step = _mm_mul_ps(_mm_set1_ps(e1.a), step);
+      __m128 w2Step = _mm_mul_ps(_mm_set1_ps(e2.a), step);
+      __m128 zStep = _mm_mul_ps(_mm_set1_ps(za), step);
+      float* row = depth + y * width;
+      for (int x = x0; x <= x1; x += 4) {
+        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero),
+                                              _mm_cmpge_ps(w1, zero)),
+                                   _mm_cmpge_ps(w2, zero));
+        if (_mm_movemask_ps(inside)) {
+          __m128 old = _mm_loadu_ps(row + x);
+          __m128 nearer = _mm_min_ps(old, z);
+          _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer),
+                                           _mm_andnot_ps(inside, old)));
+        }
+        w0 = _mm_add_ps(w0, w0Step);
+        w1 = _mm_add_ps(w1, w1Step);
+        w2 = _mm_add_ps(w2, w2Step);
+        z = _mm_add_ps(z, zStep);
+      }
+    }
+#else
+    for (int y = y0; y <= y1; y++) {
+      float py = y + 0.5f;
+      float* row = depth + y * width;
+      for (int x = x0; x <= x1; x++) {
+        float px = x + 0.5f;
+        if (e0.a * px + e0.b * py + e0.c < 0.0f ||
+            e1.a * px + e1.b * py + e1.c < 0.0f ||
+            e2.a * px + e2.b * py + e2.c < 0.0f)
+          continue;
+        row[x] = std::min(row[x], za * px + zb * py + zc);
+      }
+    }
+#endif
+  }
+}
+
+void OcclusionBuffer::buildPyramid() {
+  while (pyramidSizes.back().x > 1 || pyramidSizes.back().y > 1) {
+    glm::ivec2 size = pyramidSizes.back();
+    glm::ivec2 next((size.x + 1) / 2, (size.y + 1) / 2);
+    const std::vector<float> &source = pyramid.back();
+    std::vector<float> level(next.x * next.y);
+    for (int y = 0; y < next.y; y++) {
+      int y0 = y * 2;
+      int y1 = std::min(y0 + 1, size.y - 1);
+      for (int x = 0; x < next.x; x++) {
+        int x0 = x * 2;
+        int x1 = std::min(x0 + 1, size.x - 1);
+        level[y * next.x + x] = std::max(
+            std::max(source[y0 * size.x + x0], source[y0 * size.x + x1]),
+            std::max(source[y1 * size.x + x0], source[y1 * size.x + x1]));
+      }
+    }
+    pyramid.push_back(std::move(level));
+    pyramidSizes.push_back(next);
+  }
+}
+
+bool OcclusionBuffer::isOccluded(const glm::vec3 &center,
+                                 float radius) const {
+  if (pyramid.size() < 2)
+    return false;
+  tested++;
+
+  // screen rectangle and nearest depth of the box around the sphere
+  glm::vec3 minimum(1e30f);
+  glm::vec3 maximum(-1e30f);
+  for (int i = 0; i < 8; i++) {
+    glm::vec3 corner = center + radius * glm::vec3(i & 1 ? 1.0f : -1.0f,
+                                                   i & 2 ? 1.0f : -1.0f,
+                                                   i & 4 ? 1.0f : -1.0f);
+    glm::vec3 screen;
+    if (!toScreen(viewProjection * glm::vec4(corner, 1.0f), width, height,
+                  screen))
+      return false;
+    minimum = glm::min(minimum, screen);
+    maximum = glm::max(maximum, screen);
+  }
+  if (maximum.x < 0.0f || maximum.y < 0.0f || minimum.x > width ||
+      minimum.y > height)
+    return false;
+  int x0 = glm::clamp((int)std::floor(minimum.x), 0, width - 1);
+  int x1 = glm::clamp((int)std::floor(maximum.x), 0, width - 1);
+  int y0 = glm::clamp((int)std::floor(minimum.y), 0, height - 1);
+  int y1 = glm::clamp((int)std::floor(maximum.y), 0, height - 1);
+
+  // the level where the rectangle covers at most four texels per side
+  unsigned int level = 0;
+  while (level + 1 < pyramid.size() &&
+         ((x1 - x0) >> level > 3 || (y1 - y0) >> level > 3))
+    level++;
+  const std::vector<float> &texels = pyramid[level];
+  int levelWidth = pyramidSizes[level].x;
+  for (int y = y0 >> level; y <= y1 >> level; y++)
+    for (int x = x0 >> level; x <= x1 >> level; x++)
+      if (texels[y * levelWidth + x] >= minimum.z)
+        return false;
+  occluded++;
+  return true;
+}
+
+void OcclusionBuffer::report(std::ostream &out) const {
+  size_t testCount = tested;
+  size_t occludedCount = occluded;
+  out << "occlusion: " << triangles.size() << " of " << queuedTriangles
+      << " occluder triangles rasterized at " << width << "x" << height
+      << " in " << std::fixed << std::setprecision(3) << rasterMs
+      << " ms on " << JobSystem::get().getThreadCount() << " threads, "
+      << occludedCount << " of " << testCount << " bounds occluded ("
+      << std::setprecision(1)
+      << (testCount ? 100.0 * occludedCount / testCount : 0.0) << "%)"
+      << std::endl;
+}
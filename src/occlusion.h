@@ -0,0 +1,65 @@
+#ifndef occlusion_h
+#define occlusion_h
+
+#include <glm/glm.hpp>
+#include <atomic>
+#include <ostream>
+#include <vector>
+#include "frustum.h"
+#include "mesh.h"
+
+// low resolution depth buffer rasterized on the cpu from a few large
+// occluders, bounds behind them don't need to be drawn
+class OcclusionBuffer {
+public:
+  // starts a frame, the buffer keeps the aspect ratio of the viewport
+  void begin(const glm::mat4 &viewProjection, int viewportWidth,
+             int viewportHeight);
+  // occluders outside the view aren't worth transforming
+  bool inView(const glm::vec3 &center, float radius) const {
+    return frustum.containsSphere(center, radius);
+  }
+  // queues the front facing triangles in front of the near plane
+  void addOccluder(const std::vector<Vertex> &vertices,
+                   const std::vector<unsigned int> &indices,
+                   const glm::mat4 &model);
+  // rasterizes the queued triangles tile by tile and builds the depth
+  // pyramid, tests are only valid afterwards
+  void rasterize();
+  // true if the sphere lies behind the occluders everywhere it covers,
+  // can be called from several threads
+  bool isOccluded(const glm::vec3 &center, float radius) const;
+  void report(std::ostream &out) const;
+private:
+  struct Triangle {
+    // screen position in pixels and depth of the corners
+    glm::vec3 corners[3];
+  };
+
+  glm::mat4 viewProjection;
+  Frustum frustum;
+  int width = 0;
+  int height = 0;
+  int tilesX = 0;
+  int tilesY = 0;
+  std::vector<Triangle> triangles;
+  // triangles overlapping every tile
+  std::vector<std::vector<unsigned int>> bins;
+  // screen position of every vertex of the occluder, w is 0 behind the
+  // near plane
+  std::vector<glm::vec4> projected;
+  // level 0 is the depth buffer, every following level keeps the
+  // farthest depth of four texels of the previous one
+  std::vector<std::vector<float>> pyramid;
+  std::vector<glm::ivec2> pyramidSizes;
+
+  size_t queuedTriangles = 0;
+  double rasterMs = 0.0;
+  mutable std::atomic<size_t> tested{0};
+  mutable std::atomic<size_t> occluded{0};
+
+  void rasterizeTile(int tile);
+  void buildPyramid();
+};
+
+#endif
@@ -0,0 +1,337 @@
+#include "pagefile.h"
+#include "jobsystem.h"
+#include <stb_image/stb_image.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+
+namespace {
+
+struct PageFileHeader {
+  char magic[4];
+  uint32_t width;
+  uint32_t height;
+  uint32_t pageSize;
+  uint32_t border;
+  uint32_t levels;
+};
+
+const char PAGE_MAGIC[4] = { 'V', 'T', 'P', '1' };
+// the pages start on a boundary of the os pages, so a page can be dropped
+// from memory on its own
+const size_t PAGE_DATA_OFFSET = 4096;
+// pages built and written at once, a strip of page rows
+const size_t BATCH_PAGES = 256;
+
+// texels of the source image, rows in file order
+struct ImageSource {
+  const unsigned char* pixels;
+  int width;
+  int height;
+  int channels;
+  size_t stride;
+
+  void fetch(int x, int y, unsigned char* rgba) const {
+    const unsigned char* texel = pixels + (size_t)y * stride +
+                                 (size_t)x * channels;
+    switch (channels) {
+    case 1:
+      rgba[0] = rgba[1] = rgba[2] = texel[0];
+      rgba[3] = 255;
+      break;
+    case 2:
+      rgba[0] = rgba[1] = rgba[2] = texel[0];
+      rgba[3] = texel[1];
+      break;
+    case 3:
+      std::memcpy(rgba, texel, 3);
+      rgba[3] = 255;
+      break;
+    default:
+      std::memcpy(rgba, texel, 4);
+    }
+  }
+};
+
+// texels of the next level, box filtered from a level already written
+struct LevelSource {
+  const unsigned char* pages;
+  PageLevel level;
+
+  const unsigned char* texel(int x, int y) const {
+    x = std::min(x, level.width - 1);
+    y = std::min(y, level.height - 1);
+    int pageX = x / PAGE_CONTENT;
+    int pageY = y / PAGE_CONTENT;
+    const unsigned char* page = pages + ((size_t)pageY * level.pagesX +
+                                         pageX) * PAGE_BYTES;
+    return page + ((size_t)(y - pageY * PAGE_CONTENT + PAGE_BORDER) *
+                   PAGE_SIZE + x - pageX * PAGE_CONTENT + PAGE_BORDER) * 4;
+  }
+  void fetch(int x, int y, unsigned char* rgba) const {
+    const unsigned char* a = texel(2 * x, 2 * y);
+    const unsigned char* b = texel(2 * x + 1, 2 * y);
+    const unsigned char* c = texel(2 * x, 2 * y + 1);
+    const unsigned char* d = texel(2 * x + 1, 2 * y + 1);
+    for (int i = 0; i < 4; i++)
+      rgba[i] = (unsigned char)((a[i] + b[i] + c[i] + d[i] + 2) / 4);
+  }
+};
+
+// the border texels outside the level repeat its edge
+template <typename Source>
+void fillPage(const Source &source, const PageLevel &level, int pageX,
+              int pageY, unsigned char* page) {
+  for (int y = 0; y < PAGE_SIZE; y++) {
+    int sourceY = std::min(std::max(pageY * PAGE_CONTENT + y - PAGE_BORDER,
+                                    0), level.height - 1);
+    for (int x = 0; x < PAGE_SIZE; x++) {
+      int sourceX = std::min(std::max(pageX * PAGE_CONTENT + x -
+                                      PAGE_BORDER, 0), level.width - 1);
+      source.fetch(sourceX, sourceY, page + ((size_t)y * PAGE_SIZE + x) * 4);
+    }
+  }
+}
+
+// binary ppm and pgm with 8 bit samples. false with an empty error for
+// other files
+bool readNetpbm(const unsigned char* data, size_t size, ImageSource &image,
+                size_t &offset, std::string &error) {
+  if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6'))
+    return false;
+  offset = 2;
+  // width, height and the largest sample, separated by whitespace and
+  // comments
+  unsigned long values[3];
+  for (unsigned long &value : values) {
+    while (offset < size && (std::isspace(data[offset]) ||
+                             data[offset] == '#'))
+      if (data[offset] == '#')
+        while (offset < size && data[offset] != '\n')
+          offset++;
+      else
+        offset++;
+    value = 0;
+    size_t start = offset;
+    while (offset < size && std::isdigit(data[offset]))
+      value = value * 10 + (data[offset++] - '0');
+    if (offset == start) {
+      error = "broken netpbm header";
+      return false;
+    }
+  }
+  // a single whitespace ends the header
+  offset++;
+  if (values[2] > 255) {
+    error = "only 8 bit netpbm samples are supported";
+    return false;
+  }
+  image.width = (int)values[0];
+  image.height = (int)values[1];
+  image.channels = data[1] == '6' ? 3 : 1;
+  image.stride = (size_t)image.width * image.channels;
+  if (image.width == 0 || image.height == 0 ||
+      offset + image.stride * image.height > size) {
+    error = "netpbm file is truncated";
+    return false;
+  }
+  image.pixels = data + offset;
+  return true;
+}
+
+}
+
+std::vector<PageLevel> pageLevels(int width, int height) {
+  std::vector<PageLevel> levels;
+  size_t first = 0;
+  for (;;) {
+    PageLevel level;
+    level.width = width;
+    level.height = height;
+    level.pagesX = (width + PAGE_CONTENT - 1) / PAGE_CONTENT;
+    level.pagesY = (height + PAGE_CONTENT - 1) / PAGE_CONTENT;
+    level.firstPage = first;
+    levels.push_back(level);
+    first += (size_t)level.pagesX * level.pagesY;
+    if (level.pagesX == 1 && level.pagesY == 1)
+      return levels;
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+  }
+}
+
+bool PageFile::open(const std::string &path, std::string &error) {
+  file = MappedFile(path, ACCESS_RANDOM);
+  levels.clear();
+  if (!file.isOpen()) {
+    error = "can't open the file";
+    return false;
+  }
+  PageFileHeader header;
+  if (file.size() < PAGE_DATA_OFFSET) {
+    error = "not a page file";
+    return false;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, PAGE_MAGIC, 4) != 0) {
+    error = "not a page file";
+    return false;
+  }
+  if (header.pageSize != PAGE_SIZE || header.border != PAGE_BORDER ||
+      header.width == 0 || header.height == 0) {
+    error = "page file of another page size";
+    return false;
+  }
+  levels = pageLevels((int)header.width, (int)header.height);
+  if (levels.size() != header.levels ||
+      file.size() < PAGE_DATA_OFFSET + getPageCount() * PAGE_BYTES) {
+    levels.clear();
+    error = "page file is truncated";
+    return false;
+  }
+  return true;
+}
+
+size_t PageFile::getPageCount() const {
+  const PageLevel &last = levels.back();
+  return last.firstPage + (size_t)last.pagesX * last.pagesY;
+}
+
+size_t PageFile::pageOffset(int level, int x, int y) const {
+  const PageLevel &pages = levels[level];
+  return PAGE_DATA_OFFSET +
+         (pages.firstPage + (size_t)y * pages.pagesX + x) * PAGE_BYTES;
+}
+
+const unsigned char* PageFile::page(int level, int x, int y) const {
+  return file.data() + pageOffset(level, x, y);
+}
+
+void PageFile::release(int level, int x, int y) const {
+  file.release(pageOffset(level, x, y), PAGE_BYTES);
+}
+
+void PageBuildStats::print(std::ostream &out) const {
+  const double mb = 1024.0 * 1024.0;
+  out << "page file: " << pages << " pages (" << std::fixed
+      << std::setprecision(1) << pages * PAGE_BYTES / mb << " MB) from "
+      << sourceBytes / mb << " MB of image in " << ms << " ms, "
+      << sourceBytes / mb / std::max(ms / 1e3, 1e-6) << " MB/s on "
+      << JobSystem::get().getThreadCount() << " threads" << std::endl;
+}
+
+bool buildPageFile(const std::string &image, const std::string &path,
+                   PageBuildStats &stats, std::string &error) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  MappedFile sourceFile(image, ACCESS_SEQUENTIAL);
+  if (!sourceFile.isOpen() || sourceFile.size() == 0) {
+    error = "can't open " + image;
+    return false;
+  }
+  stats.sourceBytes = sourceFile.size();
+  ImageSource source;
+  size_t sourceOffset = 0;
+  bool mapped = readNetpbm(sourceFile.data(), sourceFile.size(), source,
+                           sourceOffset, error);
+  if (!error.empty())
+    return false;
+  std::shared_ptr<unsigned char> decoded;
+  if (!mapped) {
+    int width;
+    int height;
+    int channels;
+    unsigned char* pixels = stbi_load_from_memory(
+        sourceFile.data(), (int)sourceFile.size(), &width, &height,
+        &channels, 0);
+    if (!pixels) {
+      error = "can't decode " + image;
+      return false;
+    }
+    decoded.reset(pixels, stbi_image_free);
+    source.pixels = pixels;
+    source.width = width;
+    source.height = height;
+    source.channels = channels;
+    source.stride = (size_t)width * channels;
+  }
+
+  std::vector<PageLevel> levels = pageLevels(source.width, source.height);
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    error = "can't write " + path;
+    return false;
+  }
+  std::vector<char> header(PAGE_DATA_OFFSET, 0);
+  PageFileHeader fields = { { PAGE_MAGIC[0], PAGE_MAGIC[1], PAGE_MAGIC[2],
+                              PAGE_MAGIC[3] },
+                            (uint32_t)source.width, (uint32_t)source.height,
+                            PAGE_SIZE, PAGE_BORDER,
+                            (uint32_t)levels.size() };
+  std::memcpy(header.data(), &fields, sizeof(fields));
+  out.write(header.data(), header.size());
+
+  std::vector<unsigned char> batch;
+  MappedFile previous;
+  for (size_t index = 0; index < levels.size(); index++) {
+    const PageLevel &level = levels[index];
+    // every level after the first is filtered from the one just written
+    LevelSource finer;
+    if (index > 0) {
+      out.flush();
+      previous = MappedFile(path, ACCESS_SEQUENTIAL);
+      if (!previous.isOpen()) {
+        error = "can't read back " + path;
+        return false;
+      }
+      finer.level = levels[index - 1];
+      finer.pages = previous.data() + PAGE_DATA_OFFSET +
+                    finer.level.firstPage * PAGE_BYTES;
+    }
+    int rows = (int)std::max<size_t>(1, BATCH_PAGES / level.pagesX);
+    for (int row = 0; row < level.pagesY; row += rows) {
+      int count = std::min(rows, level.pagesY - row);
+      size_t pages = (size_t)count * level.pagesX;
+      batch.resize(pages * PAGE_BYTES);
+      JobSystem::get().parallelFor(pages, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          int pageX = (int)(i % level.pagesX);
+          int pageY = row + (int)(i / level.pagesX);
+          if (index == 0)
+            fillPage(source, level, pageX, pageY, &batch[i * PAGE_BYTES]);
+          else
+            fillPage(finer, level, pageX, pageY, &batch[i * PAGE_BYTES]);
+        }
+      });
+      out.write((const char*)batch.data(), batch.size());
+      stats.pages += pages;
+
+      // the rows above the next strip aren't read again, only the mapped
+      // strip stays in memory however large the image is
+      int done = std::max((row + count) * PAGE_CONTENT - PAGE_BORDER, 0);
+      if (index == 0 && mapped)
+        sourceFile.release(sourceOffset,
+                           (size_t)std::min(done, source.height) *
+                           source.stride);
+      else if (index > 0)
+        previous.release(PAGE_DATA_OFFSET + finer.level.firstPage *
+                         PAGE_BYTES,
+                         (size_t)std::min(2 * done / PAGE_CONTENT,
+                                          finer.level.pagesY) *
+                         finer.level.pagesX * PAGE_BYTES);
+    }
+  }
+  out.close();
+  if (!out) {
+    error = "can't write " + path;
+    return false;
+  }
+  stats.ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  return true;
+}
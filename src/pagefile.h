@@ -0,0 +1,67 @@
+#ifndef pagefile_h
+#define pagefile_h
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "mappedfile.h"
+
+// a page is PAGE_SIZE texels square in rgba. the inner PAGE_CONTENT of
+// them belong to it and the border repeats the neighbours, so bilinear
+// filtering in the page cache doesn't reach into unrelated pages
+const int PAGE_SIZE = 128;
+const int PAGE_BORDER = 4;
+const int PAGE_CONTENT = PAGE_SIZE - 2 * PAGE_BORDER;
+const size_t PAGE_BYTES = (size_t)PAGE_SIZE * PAGE_SIZE * 4;
+
+// one mip level of a page file, its pages follow each other row by row
+struct PageLevel {
+  int width;
+  int height;
+  int pagesX;
+  int pagesY;
+  size_t firstPage;
+};
+
+// sizes of the levels of a texture, down to one page
+std::vector<PageLevel> pageLevels(int width, int height);
+
+// the tiled mip chain of a texture too large to decode at once, pages are
+// read from the mapped file when they are needed
+class PageFile {
+public:
+  // false with the reason in error
+  bool open(const std::string &path, std::string &error);
+  bool isOpen() const { return file.isOpen() && !levels.empty(); }
+  int getWidth() const { return levels[0].width; }
+  int getHeight() const { return levels[0].height; }
+  int getLevelCount() const { return (int)levels.size(); }
+  const PageLevel &getLevel(int level) const { return levels[level]; }
+  size_t getPageCount() const;
+  // texels of a page, rows from the top of the texture down
+  const unsigned char* page(int level, int x, int y) const;
+  // the memory of a page that went into the cache can be dropped
+  void release(int level, int x, int y) const;
+private:
+  MappedFile file;
+  std::vector<PageLevel> levels;
+
+  size_t pageOffset(int level, int x, int y) const;
+};
+
+struct PageBuildStats {
+  size_t pages = 0;
+  size_t sourceBytes = 0;
+  double ms = 0.0;
+
+  void print(std::ostream &out) const;
+};
+
+// cuts an image into the pages of every level on all cores. binary ppm and
+// pgm are read from the mapped file a strip at a time, so their size only
+// depends on the disk. anything else stb_image reads is decoded whole
+bool buildPageFile(const std::string &image, const std::string &path,
+                   PageBuildStats &stats, std::string &error);
+
+#endif
@@ -0,0 +1,71 @@
+#include "pipelinestats.h"
+#include "glfeatures.h"
+#include <chrono>
+#include <iomanip>
+
+namespace {
+
+double nowMs() {
+  return std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+void PipelineStatistics::begin(const std::string &configuration) {
+  Frame &frame = frames[current];
+  // the slot was last used LATENCY frames ago, its results are there
+  if (frame.pending)
+    collect(frame);
+  if (!frame.time)
+    frame.time = GpuQuery("frame time");
+  if (!frame.fragments && glFeatures.pipelineStatistics)
+    frame.fragments = GpuQuery("fragment invocations");
+  frame.configuration = configuration;
+  glBeginQuery(GL_TIME_ELAPSED, frame.time.id());
+  if (frame.fragments)
+    glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, frame.fragments.id());
+  cpuStart = nowMs();
+}
+
+void PipelineStatistics::end() {
+  Frame &frame = frames[current];
+  frame.cpuMs = nowMs() - cpuStart;
+  glEndQuery(GL_TIME_ELAPSED);
+  if (frame.fragments)
+    glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+  frame.pending = true;
+  current = (current + 1) % LATENCY;
+}
+
+void PipelineStatistics::collect(Frame &frame) {
+  Totals &total = totals[frame.configuration];
+  GLuint64 nanoseconds = 0;
+  glGetQueryObjectui64v(frame.time.id(), GL_QUERY_RESULT, &nanoseconds);
+  total.gpuMs += nanoseconds / 1e6;
+  if (frame.fragments) {
+    GLuint64 invocations = 0;
+    glGetQueryObjectui64v(frame.fragments.id(), GL_QUERY_RESULT,
+                          &invocations);
+    total.fragments += (double)invocations;
+  }
+  total.cpuMs += frame.cpuMs;
+  total.frames++;
+  frame.pending = false;
+}
+
+void PipelineStatistics::report(std::ostream &out) const {
+  for (const auto &entry : totals) {
+    const Totals &total = entry.second;
+    out << "frames " << entry.first << ": " << total.frames << " measured, "
+        << std::fixed << std::setprecision(3)
+        << total.gpuMs / total.frames << " ms gpu, "
+        << total.cpuMs / total.frames << " ms cpu";
+    if (glFeatures.pipelineStatistics)
+      out << ", " << std::setprecision(0) << total.fragments / total.frames
+          << " fragment shader invocations";
+    out << " per frame" << std::endl;
+  }
+  if (totals.empty())
+    out << "frames: none measured yet" << std::endl;
+}
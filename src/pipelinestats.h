@@ -0,0 +1,43 @@
+#ifndef pipelinestats_h
+#define pipelinestats_h
+
+#include <map>
+#include <ostream>
+#include <string>
+#include "gpuresource.h"
+
+// gpu time and fragment shader invocations of whole frames. the queries
+// are read a few frames later, so the cpu doesn't wait for the gpu.
+// frames are grouped by a configuration name to compare e.g. the depth
+// pre-pass on and off
+class PipelineStatistics {
+public:
+  void begin(const std::string &configuration);
+  void end();
+  void report(std::ostream &out) const;
+private:
+  static const unsigned int LATENCY = 4;
+  struct Frame {
+    GpuQuery time;
+    // stays empty without GL_ARB_pipeline_statistics_query
+    GpuQuery fragments;
+    std::string configuration;
+    double cpuMs = 0.0;
+    bool pending = false;
+  };
+  struct Totals {
+    unsigned int frames = 0;
+    double gpuMs = 0.0;
+    double cpuMs = 0.0;
+    double fragments = 0.0;
+  };
+
+  Frame frames[LATENCY];
+  unsigned int current = 0;
+  double cpuStart = 0.0;
+  std::map<std::string, Totals> totals;
+
+  void collect(Frame &frame);
+};
+
+#endif
@@ -0,0 +1,106 @@
+#include "plyformat.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+bool parsePlyType(const std::string &name, PlyType &type) {
+  static const char* names[] = { "char", "uchar", "short", "ushort", "int",
+                                 "uint", "float", "double" };
+  static const char* sizedNames[] = { "int8", "uint8", "int16", "uint16",
+                                      "int32", "uint32", "float32",
+                                      "float64" };
+  for (int i = 0; i <= PLY_FLOAT64; i++)
+    if (name == names[i] || name == sizedNames[i]) {
+      type = (PlyType)i;
+      return true;
+    }
+  return false;
+}
+
+}
+
+bool isPlyFile(const MappedFile &file) {
+  return file.size() >= 4 && std::memcmp(file.data(), "ply", 3) == 0 &&
+         (file.data()[3] == '\n' || file.data()[3] == '\r');
+}
+
+bool parsePlyHeader(const MappedFile &file, PlyHeader &header,
+                    std::string &error) {
+  const char* data = (const char*)file.data();
+  std::string text(data, data + std::min(file.size(), (size_t)65536));
+  size_t headerEnd = text.find("end_header");
+  if (headerEnd == std::string::npos) {
+    error = "the ply header has no end";
+    return false;
+  }
+  size_t lineEnd = text.find('\n', headerEnd);
+  header.headerBytes = lineEnd == std::string::npos ? text.size() :
+                       lineEnd + 1;
+  std::istringstream lines(text.substr(0, headerEnd));
+  std::string line;
+  while (std::getline(lines, line)) {
+    std::istringstream words(line);
+    std::string keyword;
+    words >> keyword;
+    if (keyword == "format") {
+      std::string format;
+      words >> format;
+      if (format == "binary_little_endian")
+        header.binary = true;
+      else if (format != "ascii") {
+        error = "ply files in " + format + " aren't supported";
+        return false;
+      }
+    }
+    else if (keyword == "element") {
+      PlyElement element;
+      element.count = 0;
+      words >> element.name >> element.count;
+      header.elements.push_back(element);
+    }
+    else if (keyword == "property") {
+      PlyProperty property;
+      std::string typeName;
+      words >> typeName;
+      property.list = typeName == "list";
+      property.countType = PLY_UINT8;
+      if (property.list) {
+        std::string countName;
+        words >> countName >> typeName;
+        if (!parsePlyType(countName, property.countType)) {
+          error = "unsupported ply property " + line;
+          return false;
+        }
+      }
+      words >> property.name;
+      if (header.elements.empty() ||
+          !parsePlyType(typeName, property.type)) {
+        error = "unsupported ply property " + line;
+        return false;
+      }
+      header.elements.back().properties.push_back(property);
+    }
+  }
+  return true;
+}
+
+size_t plyTypeSize(PlyType type) {
+  static const size_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+  return sizes[type];
+}
+
+double readPlyValue(const unsigned char* data, PlyType type) {
+  switch (type) {
+    case PLY_INT8: { int8_t v; std::memcpy(&v, data, 1); return v; }
+    case PLY_UINT8: return data[0];
+    case PLY_INT16: { int16_t v; std::memcpy(&v, data, 2); return v; }
+    case PLY_UINT16: { uint16_t v; std::memcpy(&v, data, 2); return v; }
+    case PLY_INT32: { int32_t v; std::memcpy(&v, data, 4); return v; }
+    case PLY_UINT32: { uint32_t v; std::memcpy(&v, data, 4); return v; }
+    case PLY_FLOAT32: { float v; std::memcpy(&v, data, 4); return v; }
+    default: { double v; std::memcpy(&v, data, 8); return v; }
+  }
+}
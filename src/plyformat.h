@@ -0,0 +1,49 @@
+#ifndef plyformat_h
+#define plyformat_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "mappedfile.h"
+
+enum PlyType {
+  PLY_INT8,
+  PLY_UINT8,
+  PLY_INT16,
+  PLY_UINT16,
+  PLY_INT32,
+  PLY_UINT32,
+  PLY_FLOAT32,
+  PLY_FLOAT64
+};
+
+struct PlyProperty {
+  std::string name;
+  PlyType type;
+  // lists store their length as countType before the values
+  bool list;
+  PlyType countType;
+};
+
+struct PlyElement {
+  std::string name;
+  size_t count;
+  std::vector<PlyProperty> properties;
+};
+
+// the elements of a ply file in the order of their data
+struct PlyHeader {
+  bool binary = false;
+  size_t headerBytes = 0;
+  std::vector<PlyElement> elements;
+};
+
+// the file starts with the ply signature
+bool isPlyFile(const MappedFile &file);
+// ascii and binary_little_endian, false with the reason in error
+bool parsePlyHeader(const MappedFile &file, PlyHeader &header,
+                    std::string &error);
+size_t plyTypeSize(PlyType type);
+double readPlyValue(const unsigned char* data, PlyType type);
+
+#endif
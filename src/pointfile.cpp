@@ -0,0 +1,843 @@
+#include "pointfile.h"
+#include "jobsystem.h"
+#include "plyformat.h"
+#include "spatialkey.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+
+namespace {
+
+struct PointFileHeader {
+  char magic[4];
+  uint32_t nodeCount;
+  uint64_t tableOffset;
+  uint64_t points;
+};
+
+const char POINT_MAGIC[4] = { 'M', 'P', 'T', '1' };
+// cells of the counting grid on each axis, as bits
+const int GRID_BITS = 7;
+// chunks are split until they have at most this many points, a cell of
+// the counting grid with more is cut into runs of them
+const uint64_t CHUNK_POINTS = 1 << 20;
+// points of the source read and sorted at once
+const size_t BATCH_POINTS = 1 << 20;
+// bytes of text parsed at once
+const size_t TEXT_BLOCK = 16 << 20;
+// many copies of the same point end in a leaf at this depth
+const unsigned int MAX_DEPTH = 24;
+
+// colours of float properties are 0 to 1, of 16 bit ones 0 to 65535
+uint8_t colorValue(double value, PlyType type) {
+  if (type == PLY_FLOAT32 || type == PLY_FLOAT64)
+    value *= 255.0;
+  else if (type == PLY_UINT16 || type == PLY_INT16)
+    value /= 257.0;
+  return (uint8_t)std::min(std::max(value + 0.5, 0.0), 255.0);
+}
+
+// where x, y, z, red, green and blue are in a vertex of a ply file
+struct PlyLayout {
+  bool binary = false;
+  size_t headerBytes = 0;
+  size_t vertexCount = 0;
+  size_t stride = 0;
+  // byte offset in binary files and column in ascii ones, -1 when missing
+  int fields[6] = { -1, -1, -1, -1, -1, -1 };
+  PlyType types[6] = {};
+};
+
+bool parsePlyLayout(const MappedFile &file, PlyLayout &layout,
+                    std::string &error) {
+  static const char* fieldNames[6] = { "x", "y", "z", "red", "green",
+                                       "blue" };
+  PlyHeader header;
+  if (!parsePlyHeader(file, header, error))
+    return false;
+  if (header.elements.empty() || header.elements[0].name != "vertex") {
+    error = "the vertices have to be the first element of the ply file";
+    return false;
+  }
+  const PlyElement &vertex = header.elements[0];
+  layout.binary = header.binary;
+  layout.headerBytes = header.headerBytes;
+  layout.vertexCount = vertex.count;
+  int column = 0;
+  for (const PlyProperty &property : vertex.properties) {
+    if (property.list) {
+      error = "unsupported vertex property " + property.name;
+      return false;
+    }
+    for (int i = 0; i < 6; i++)
+      if (property.name == fieldNames[i] ||
+          (i >= 3 && property.name == std::string(1, fieldNames[i][0]) &&
+           layout.fields[i] < 0)) {
+        layout.fields[i] = layout.binary ? (int)layout.stride : column;
+        layout.types[i] = property.type;
+      }
+    layout.stride += plyTypeSize(property.type);
+    column++;
+  }
+  if (layout.fields[0] < 0 || layout.fields[1] < 0 || layout.fields[2] < 0) {
+    error = "the ply vertices have no x, y and z";
+    return false;
+  }
+  if (layout.binary &&
+      layout.headerBytes + layout.vertexCount * layout.stride >
+      file.size()) {
+    error = "the ply file is truncated";
+    return false;
+  }
+  return true;
+}
+
+// vertices of a binary ply, read straight from the mapped file
+struct PlySource {
+  const MappedFile* file;
+  PlyLayout layout;
+
+  size_t count() const { return layout.vertexCount; }
+  void get(size_t index, CloudPoint &point) const {
+    const unsigned char* record = file->data() + layout.headerBytes +
+                                  index * layout.stride;
+    for (int i = 0; i < 3; i++)
+      point.position[i] = (float)readPlyValue(record + layout.fields[i],
+                                              layout.types[i]);
+    for (int i = 0; i < 3; i++)
+      point.color[i] = layout.fields[i + 3] < 0 ? 255 :
+          colorValue(readPlyValue(record + layout.fields[i + 3],
+                                  layout.types[i + 3]), layout.types[i + 3]);
+    point.color[3] = 255;
+  }
+  void release(size_t begin, size_t end) const {
+    file->release(layout.headerBytes + begin * layout.stride,
+                  (end - begin) * layout.stride);
+  }
+};
+
+// points parsed from text into a temporary file
+struct RawSource {
+  const MappedFile* file;
+
+  size_t count() const { return file->size() / sizeof(CloudPoint); }
+  void get(size_t index, CloudPoint &point) const {
+    std::memcpy(&point, file->data() + index * sizeof(CloudPoint),
+                sizeof(CloudPoint));
+  }
+  void release(size_t begin, size_t end) const {
+    file->release(begin * sizeof(CloudPoint),
+                  (end - begin) * sizeof(CloudPoint));
+  }
+};
+
+// columns of the values in a line of text, -1 when missing. xyz files
+// have the colour after the position, or after an intensity with seven
+// values and more
+struct TextColumns {
+  int fields[6];
+  PlyType colorType;
+  bool guessColor;
+};
+
+bool parseLine(const char* begin, const char* end,
+               const TextColumns &columns, CloudPoint &point) {
+  char line[512];
+  size_t length = std::min((size_t)(end - begin), sizeof(line) - 1);
+  std::memcpy(line, begin, length);
+  line[length] = 0;
+  float values[16];
+  int count = 0;
+  char* cursor = line;
+  while (count < 16) {
+    while (*cursor == ',' || *cursor == ';')
+      cursor++;
+    char* next;
+    float value = std::strtof(cursor, &next);
+    if (next == cursor)
+      break;
+    values[count++] = value;
+    cursor = next;
+  }
+  int fields[6];
+  std::memcpy(fields, columns.fields, sizeof(fields));
+  if (columns.guessColor)
+    for (int i = 0; i < 3; i++)
+      fields[i + 3] = count >= 7 ? 4 + i : count >= 6 ? 3 + i : -1;
+  for (int i = 0; i < 3; i++)
+    if (fields[i] >= count)
+      return false;
+  for (int i = 0; i < 3; i++) {
+    point.position[i] = values[fields[i]];
+    point.color[i] = fields[i + 3] < 0 || fields[i + 3] >= count ? 255 :
+                     colorValue(values[fields[i + 3]], columns.colorType);
+  }
+  point.color[3] = 255;
+  return true;
+}
+
+// parses the lines between begin and end on all cores into the file
+bool convertText(const MappedFile &file, size_t begin, size_t end,
+                 const TextColumns &columns, const std::string &path,
+                 std::string &error) {
+  JobSystem &jobs = JobSystem::get();
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    error = "can't write " + path;
+    return false;
+  }
+  const char* text = (const char*)file.data();
+  auto lineStart = [&](size_t position, size_t limit) {
+    const void* newline = std::memchr(text + position, '\n',
+                                      limit - position);
+    return newline ? (size_t)((const char*)newline - text) + 1 : limit;
+  };
+  size_t parts = jobs.getThreadCount() * 4;
+  std::vector<std::vector<CloudPoint>> parsed(parts);
+  for (size_t block = begin; block < end;) {
+    size_t blockEnd = block + TEXT_BLOCK >= end ? end :
+                      lineStart(block + TEXT_BLOCK, end);
+    // every part starts at a line
+    std::vector<size_t> starts(parts + 1, blockEnd);
+    starts[0] = block;
+    for (size_t k = 1; k < parts; k++)
+      starts[k] = std::max(starts[k - 1],
+          lineStart(std::max(block, block + (blockEnd - block) * k / parts) -
+                    1, blockEnd));
+    jobs.parallelFor(parts, 1, [&](size_t first, size_t last) {
+      for (size_t k = first; k < last; k++) {
+        parsed[k].clear();
+        CloudPoint point;
+        for (size_t line = starts[k]; line < starts[k + 1];) {
+          size_t next = lineStart(line, starts[k + 1]);
+          if (parseLine(text + line, text + next, columns, point))
+            parsed[k].push_back(point);
+          line = next;
+        }
+      }
+    });
+    for (const std::vector<CloudPoint> &points : parsed)
+      out.write((const char*)points.data(),
+                points.size() * sizeof(CloudPoint));
+    file.release(block, blockEnd - block);
+    block = blockEnd;
+  }
+  out.close();
+  if (!out) {
+    error = "can't write " + path;
+    return false;
+  }
+  return true;
+}
+
+glm::vec3 pointPosition(const CloudPoint &point) {
+  return glm::vec3(point.position[0], point.position[1], point.position[2]);
+}
+
+// octant k of a cube, x in the high bit like the grid codes
+glm::vec3 octantOrigin(const glm::vec3 &origin, float size, unsigned int k) {
+  float half = size * 0.5f;
+  return origin + glm::vec3((k >> 2) & 1, (k >> 1) & 1, k & 1) * half;
+}
+
+// a node while the file is built, the table is written once all are done
+struct BuildNode {
+  glm::vec3 origin;
+  float size;
+  unsigned int depth;
+  // octant in the parent cube
+  unsigned int octant;
+  std::vector<size_t> children;
+  // chunks are built in memory, the nodes above them from their points
+  bool chunk;
+  uint32_t firstCode;
+  uint64_t points;
+  // points of a chunk or upper node not written yet, the parent may take
+  // some of them
+  std::vector<CloudPoint> pending;
+  uint32_t pointCount;
+  uint64_t offset;
+};
+
+// cells of the octree above the chunks, a node with few points is a chunk.
+// below the finest level of the grid the points of a cell are cut into
+// runs in file order under nodes of the same cube, there may be many
+// copies of a point
+size_t buildChunkTree(const std::vector<uint64_t> &counts, uint32_t code,
+                      unsigned int level, uint64_t points,
+                      const glm::vec3 &origin, float size,
+                      std::vector<BuildNode> &nodes) {
+  size_t index = nodes.size();
+  nodes.push_back(BuildNode());
+  BuildNode &node = nodes[index];
+  node.origin = origin;
+  node.size = size;
+  node.depth = level;
+  node.octant = code & 7;
+  node.firstCode = level >= (unsigned int)GRID_BITS ? code :
+                   code << 3 * (GRID_BITS - level);
+  node.points = points;
+  node.chunk = points <= CHUNK_POINTS;
+  node.pointCount = 0;
+  node.offset = 0;
+  if (node.chunk)
+    return index;
+  if (level >= (unsigned int)GRID_BITS) {
+    // up to eight runs of whole chunks, the runs tell the octants apart
+    uint64_t share = ((points + CHUNK_POINTS - 1) / CHUNK_POINTS + 7) / 8 *
+                     CHUNK_POINTS;
+    uint64_t left = points;
+    for (uint32_t k = 0; left > 0; k++) {
+      uint64_t part = std::min(share, left);
+      left -= part;
+      size_t built = buildChunkTree(counts, code, level + 1, part, origin,
+                                    size, nodes);
+      nodes[built].octant = k;
+      nodes[index].children.push_back(built);
+    }
+    return index;
+  }
+  int shift = 3 * (GRID_BITS - level - 1);
+  for (uint32_t k = 0; k < 8; k++) {
+    uint32_t child = code << 3 | k;
+    uint64_t childPoints = 0;
+    for (uint32_t cell = child << shift; cell < (child + 1) << shift; cell++)
+      childPoints += counts[cell];
+    if (childPoints == 0)
+      continue;
+    size_t built = buildChunkTree(counts, child, level + 1, childPoints,
+                                  octantOrigin(origin, size, k), size * 0.5f,
+                                  nodes);
+    nodes[index].children.push_back(built);
+  }
+  return index;
+}
+
+// keeps the point closest to the centre of every occupied cell of the
+// node grid first, followed by the other points sorted by octant
+struct Sampler {
+  std::vector<int> best;
+  std::vector<float> distances;
+  std::vector<uint32_t> cells;
+  std::vector<uint32_t> touched;
+  std::vector<CloudPoint> sorted;
+
+  Sampler() : best(POINT_GRID * POINT_GRID * POINT_GRID, -1),
+              distances(best.size()) {}
+
+  // owners overrides the octant of every point
+  size_t sample(CloudPoint* points, size_t count, const glm::vec3 &origin,
+                float size, size_t octants[8],
+                const uint8_t* owners = nullptr) {
+    const float scale = POINT_GRID / size;
+    const float last = (float)(POINT_GRID - 1);
+    cells.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      glm::vec3 local = (pointPosition(points[i]) - origin) * scale;
+      glm::vec3 cell = glm::floor(glm::clamp(local, 0.0f, last));
+      glm::vec3 offset = local - cell - 0.5f;
+      float distance = glm::dot(offset, offset);
+      uint32_t c = ((uint32_t)cell.x * POINT_GRID + (uint32_t)cell.y) *
+                   POINT_GRID + (uint32_t)cell.z;
+      cells[i] = c;
+      if (best[c] < 0)
+        touched.push_back(c);
+      if (best[c] < 0 || distance < distances[c]) {
+        best[c] = (int)i;
+        distances[c] = distance;
+      }
+    }
+    size_t samples = touched.size();
+    size_t cursors[8];
+    for (int k = 0; k < 8; k++)
+      octants[k] = 0;
+    const uint32_t half = POINT_GRID / 2;
+    auto octant = [&](size_t i) {
+      if (owners)
+        return (uint32_t)owners[i];
+      uint32_t c = cells[i];
+      uint32_t x = c / (POINT_GRID * POINT_GRID);
+      uint32_t y = c / POINT_GRID % POINT_GRID;
+      uint32_t z = c % POINT_GRID;
+      return (uint32_t)(x >= half) << 2 | (uint32_t)(y >= half) << 1 |
+             (uint32_t)(z >= half);
+    };
+    for (size_t i = 0; i < count; i++)
+      if (best[cells[i]] != (int)i)
+        octants[octant(i)]++;
+    size_t sampleCursor = 0;
+    cursors[0] = samples;
+    for (int k = 1; k < 8; k++)
+      cursors[k] = cursors[k - 1] + octants[k - 1];
+    sorted.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      if (best[cells[i]] == (int)i)
+        sorted[sampleCursor++] = points[i];
+      else
+        sorted[cursors[octant(i)]++] = points[i];
+    }
+    std::copy(sorted.begin(), sorted.end(), points);
+    for (uint32_t c : touched)
+      best[c] = -1;
+    touched.clear();
+    return samples;
+  }
+};
+
+// a node inside of a chunk, its points are a range of the chunk
+struct LocalNode {
+  size_t first;
+  size_t count;
+  glm::vec3 origin;
+  float size;
+  unsigned int depth;
+  std::vector<size_t> children;
+};
+
+// the points of a node go to the front of its range, the rest to the
+// children by octant
+size_t buildLocal(std::vector<CloudPoint> &points, size_t first, size_t last,
+                  const glm::vec3 &origin, float size, unsigned int depth,
+                  std::vector<LocalNode> &nodes, Sampler &sampler) {
+  size_t index = nodes.size();
+  nodes.push_back({ first, last - first, origin, size, depth, {} });
+  if (last - first <= LEAF_POINTS || depth >= MAX_DEPTH)
+    return index;
+  size_t octants[8];
+  size_t samples = sampler.sample(&points[first], last - first, origin, size,
+                                  octants);
+  nodes[index].count = samples;
+  size_t begin = first + samples;
+  for (unsigned int k = 0; k < 8; k++) {
+    if (octants[k] == 0)
+      continue;
+    size_t child = buildLocal(points, begin, begin + octants[k],
+                              octantOrigin(origin, size, k), size * 0.5f,
+                              depth + 1, nodes, sampler);
+    nodes[index].children.push_back(child);
+    begin += octants[k];
+  }
+  return index;
+}
+
+struct Chunk {
+  std::vector<CloudPoint> points;
+  std::vector<LocalNode> nodes;
+};
+
+void writePoints(std::ofstream &out, const CloudPoint* points, size_t count,
+                 BuildNode &node, size_t &offset) {
+  node.pointCount = (uint32_t)count;
+  node.offset = offset;
+  out.write((const char*)points, count * sizeof(CloudPoint));
+  offset += count * sizeof(CloudPoint);
+}
+
+template <typename Source>
+bool buildPoints(const Source &source, const std::string &path,
+                 PointBuildStats &stats, std::string &error) {
+  JobSystem &jobs = JobSystem::get();
+  size_t count = source.count();
+  if (count == 0) {
+    error = "the scan has no points";
+    return false;
+  }
+  stats.points = count;
+
+  // bounds of the whole scan, the grid is a cube around them
+  glm::vec3 boundsMin = glm::vec3(1e30f);
+  glm::vec3 boundsMax = glm::vec3(-1e30f);
+  std::mutex mutex;
+  for (size_t batch = 0; batch < count; batch += BATCH_POINTS) {
+    size_t end = std::min(batch + BATCH_POINTS, count);
+    jobs.parallelFor(end - batch, 16384, [&](size_t begin, size_t stop) {
+      glm::vec3 low = glm::vec3(1e30f);
+      glm::vec3 high = glm::vec3(-1e30f);
+      CloudPoint point;
+      for (size_t i = batch + begin; i < batch + stop; i++) {
+        source.get(i, point);
+        low = glm::min(low, pointPosition(point));
+        high = glm::max(high, pointPosition(point));
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      boundsMin = glm::min(boundsMin, low);
+      boundsMax = glm::max(boundsMax, high);
+    });
+    source.release(batch, end);
+  }
+  glm::vec3 extent = boundsMax - boundsMin;
+  float size = std::max(std::max(extent.x, extent.y),
+                        std::max(extent.z, 1e-6f)) * 1.0001f;
+  // the counting grid, the cells of every chunk are contiguous
+  MortonGrid grid = { boundsMin, (1 << GRID_BITS) / size, GRID_BITS };
+
+  // points of every cell of the counting grid
+  std::vector<uint32_t> codes(BATCH_POINTS);
+  auto cellCodes = [&](size_t batch, size_t end) {
+    jobs.parallelFor(end - batch, 16384, [&](size_t begin, size_t stop) {
+      CloudPoint point;
+      for (size_t i = begin; i < stop; i++) {
+        source.get(batch + i, point);
+        codes[i] = grid.code(pointPosition(point));
+      }
+    });
+  };
+  std::vector<uint64_t> counts((size_t)1 << 3 * GRID_BITS, 0);
+  for (size_t batch = 0; batch < count; batch += BATCH_POINTS) {
+    size_t end = std::min(batch + BATCH_POINTS, count);
+    cellCodes(batch, end);
+    for (size_t i = 0; i < end - batch; i++)
+      counts[codes[i]]++;
+    source.release(batch, end);
+  }
+  std::vector<BuildNode> nodes;
+  buildChunkTree(counts, 0, 0, count, boundsMin, size, nodes);
+  size_t treeNodes = nodes.size();
+  std::vector<uint64_t>().swap(counts);
+  // the chunks in code order, each owns a run of the temporary file. the
+  // chunks cut from one cell share a code and fill their runs in turn
+  std::vector<size_t> chunks;
+  std::vector<uint32_t> chunkCodes;
+  std::vector<uint64_t> cursors;
+  uint64_t chunkOffset = 0;
+  for (size_t i = 0; i < nodes.size(); i++)
+    if (nodes[i].chunk) {
+      chunks.push_back(i);
+      if (chunkCodes.empty() || chunkCodes.back() != nodes[i].firstCode) {
+        chunkCodes.push_back(nodes[i].firstCode);
+        cursors.push_back(chunkOffset);
+      }
+      chunkOffset += nodes[i].points * sizeof(CloudPoint);
+    }
+  stats.chunks = chunks.size();
+
+  // sorts the points into the runs of their chunks a batch at a time
+  std::string scratchPath = path + ".tmp";
+  {
+    std::ofstream scratch(scratchPath, std::ios::binary | std::ios::trunc);
+    if (!scratch) {
+      error = "can't write " + scratchPath;
+      return false;
+    }
+    std::vector<std::pair<uint32_t, uint32_t>> order(BATCH_POINTS);
+    std::vector<CloudPoint> points(BATCH_POINTS);
+    for (size_t batch = 0; batch < count; batch += BATCH_POINTS) {
+      size_t end = std::min(batch + BATCH_POINTS, count);
+      size_t size = end - batch;
+      cellCodes(batch, end);
+      for (size_t i = 0; i < size; i++)
+        order[i] = { (uint32_t)(std::upper_bound(chunkCodes.begin(),
+                                                 chunkCodes.end(), codes[i]) -
+                                chunkCodes.begin() - 1), (uint32_t)i };
+      std::sort(order.begin(), order.begin() + size);
+      jobs.parallelFor(size, 16384, [&](size_t begin, size_t stop) {
+        for (size_t i = begin; i < stop; i++)
+          source.get(batch + order[i].second, points[i]);
+      });
+      for (size_t i = 0; i < size;) {
+        size_t run = i;
+        while (run < size && order[run].first == order[i].first)
+          run++;
+        uint64_t &cursor = cursors[order[i].first];
+        scratch.seekp(cursor);
+        scratch.write((const char*)&points[i],
+                      (run - i) * sizeof(CloudPoint));
+        cursor += (run - i) * sizeof(CloudPoint);
+        i = run;
+      }
+      source.release(batch, end);
+    }
+    scratch.close();
+    if (!scratch) {
+      std::remove(scratchPath.c_str());
+      error = "can't write " + scratchPath;
+      return false;
+    }
+  }
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    std::remove(scratchPath.c_str());
+    error = "can't write " + path;
+    return false;
+  }
+  PointFileHeader header = {};
+  out.write((const char*)&header, sizeof(header));
+  size_t offset = sizeof(header);
+
+  // the octree of every chunk in memory, a chunk per thread at once. the
+  // points of a chunk root wait for the levels above
+  {
+    MappedFile scratch(scratchPath, ACCESS_SEQUENTIAL);
+    if (!scratch.isOpen()) {
+      std::remove(scratchPath.c_str());
+      error = "can't read back " + scratchPath;
+      return false;
+    }
+    size_t group = jobs.getThreadCount();
+    uint64_t run = 0;
+    for (size_t first = 0; first < chunks.size(); first += group) {
+      size_t last = std::min(first + group, chunks.size());
+      std::vector<uint64_t> starts(last - first);
+      for (size_t k = first; k < last; k++) {
+        starts[k - first] = run;
+        run += nodes[chunks[k]].points * sizeof(CloudPoint);
+      }
+      std::vector<Chunk> built(last - first);
+      jobs.parallelFor(last - first, 1, [&](size_t begin, size_t stop) {
+        Sampler sampler;
+        for (size_t k = begin; k < stop; k++) {
+          const BuildNode &node = nodes[chunks[first + k]];
+          const CloudPoint* points =
+              (const CloudPoint*)(scratch.data() + starts[k]);
+          Chunk &chunk = built[k];
+          chunk.points.assign(points, points + node.points);
+          buildLocal(chunk.points, 0, chunk.points.size(), node.origin,
+                     node.size, node.depth, chunk.nodes, sampler);
+        }
+      });
+      for (size_t k = first; k < last; k++) {
+        Chunk &chunk = built[k - first];
+        // local nodes become build nodes, parents before their children
+        std::vector<size_t> global(chunk.nodes.size());
+        global[0] = chunks[k];
+        for (size_t i = 1; i < chunk.nodes.size(); i++) {
+          const LocalNode &local = chunk.nodes[i];
+          global[i] = nodes.size();
+          nodes.push_back(BuildNode());
+          BuildNode &node = nodes.back();
+          node.origin = local.origin;
+          node.size = local.size;
+          node.depth = local.depth;
+          node.octant = 0;
+          node.chunk = false;
+          node.points = local.count;
+          writePoints(out, &chunk.points[local.first], local.count, node,
+                      offset);
+        }
+        for (size_t i = 0; i < chunk.nodes.size(); i++)
+          for (size_t child : chunk.nodes[i].children)
+            nodes[global[i]].children.push_back(global[child]);
+        const LocalNode &root = chunk.nodes[0];
+        nodes[chunks[k]].pending.assign(
+            chunk.points.begin() + root.first,
+            chunk.points.begin() + root.first + root.count);
+      }
+      scratch.release(starts[0], run - starts[0]);
+    }
+  }
+  std::remove(scratchPath.c_str());
+
+  // the nodes above the chunks take a point per cell from the waiting
+  // points of their children, deepest first so the children are done
+  std::vector<size_t> upper;
+  for (size_t i = 0; i < treeNodes; i++)
+    if (!nodes[i].chunk)
+      upper.push_back(i);
+  std::stable_sort(upper.begin(), upper.end(), [&nodes](size_t a, size_t b) {
+    return nodes[a].depth > nodes[b].depth;
+  });
+  Sampler sampler;
+  for (size_t index : upper) {
+    BuildNode &node = nodes[index];
+    std::vector<CloudPoint> points;
+    // a point goes back to the child it came from if it isn't taken
+    std::vector<uint8_t> owners;
+    for (size_t child : node.children) {
+      const std::vector<CloudPoint> &pending = nodes[child].pending;
+      points.insert(points.end(), pending.begin(), pending.end());
+      owners.insert(owners.end(), pending.size(), nodes[child].octant);
+    }
+    size_t octants[8];
+    size_t samples = sampler.sample(points.data(), points.size(), node.origin,
+                                    node.size, octants, owners.data());
+    // the children are sorted by octant like the points
+    size_t begin = samples;
+    for (size_t child : node.children) {
+      BuildNode &part = nodes[child];
+      writePoints(out, points.data() + begin, octants[part.octant], part,
+                  offset);
+      begin += octants[part.octant];
+      std::vector<CloudPoint>().swap(part.pending);
+    }
+    node.pending.assign(points.begin(), points.begin() + samples);
+  }
+  writePoints(out, nodes[0].pending.data(), nodes[0].pending.size(), nodes[0],
+              offset);
+  std::vector<CloudPoint>().swap(nodes[0].pending);
+
+  // breadth first, so the children of a node are next to each other
+  std::vector<size_t> order(1, 0);
+  std::vector<uint32_t> slots(nodes.size(), 0);
+  for (size_t i = 0; i < order.size(); i++)
+    for (size_t child : nodes[order[i]].children) {
+      slots[child] = (uint32_t)order.size();
+      order.push_back(child);
+    }
+  std::vector<PointNode> table(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    const BuildNode &node = nodes[order[i]];
+    PointNode &entry = table[i];
+    float half = node.size * 0.5f;
+    entry.center[0] = node.origin.x + half;
+    entry.center[1] = node.origin.y + half;
+    entry.center[2] = node.origin.z + half;
+    entry.halfSize = half;
+    entry.spacing = node.size / POINT_GRID;
+    // leaves keep all of their points, a dense surface is finer than the
+    // grid
+    if (node.children.empty() && node.pointCount > 0)
+      entry.spacing = std::min(entry.spacing,
+                               node.size / std::sqrt((float)node.pointCount));
+    entry.firstChild = node.children.empty() ? 0 : slots[node.children[0]];
+    entry.childCount = (uint32_t)node.children.size();
+    entry.pointCount = node.pointCount;
+    entry.depth = node.depth;
+    entry.offset = node.offset;
+    stats.levels = std::max(stats.levels, node.depth + 1);
+  }
+  stats.nodes = table.size();
+  out.write((const char*)table.data(), table.size() * sizeof(PointNode));
+  std::memcpy(header.magic, POINT_MAGIC, sizeof(POINT_MAGIC));
+  header.nodeCount = (uint32_t)table.size();
+  header.tableOffset = offset;
+  header.points = count;
+  out.seekp(0);
+  out.write((const char*)&header, sizeof(header));
+  out.close();
+  if (!out) {
+    error = "can't write " + path;
+    return false;
+  }
+  stats.bytes = offset + table.size() * sizeof(PointNode);
+  return true;
+}
+
+}
+
+bool PointFile::open(const std::string &path, std::string &error) {
+  file = MappedFile(path, ACCESS_RANDOM);
+  nodes.clear();
+  if (!file.isOpen()) {
+    error = "can't open the file";
+    return false;
+  }
+  PointFileHeader header;
+  if (file.size() < sizeof(header)) {
+    error = "not a point file";
+    return false;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, POINT_MAGIC, sizeof(POINT_MAGIC)) != 0 ||
+      header.nodeCount == 0) {
+    error = "not a point file";
+    return false;
+  }
+  if (header.tableOffset + (uint64_t)header.nodeCount * sizeof(PointNode) >
+      file.size()) {
+    error = "point file is truncated";
+    return false;
+  }
+  nodes.resize(header.nodeCount);
+  std::memcpy(nodes.data(), file.data() + header.tableOffset,
+              nodes.size() * sizeof(PointNode));
+  for (const PointNode &node : nodes)
+    if (node.offset + getNodeBytes(node) > header.tableOffset ||
+        (uint64_t)node.firstChild + node.childCount > nodes.size()) {
+      nodes.clear();
+      error = "point file is broken";
+      return false;
+    }
+  points = header.points;
+  return true;
+}
+
+void PointFile::read(const PointNode &node,
+                     std::vector<CloudPoint> &points) const {
+  points.resize(node.pointCount);
+  // a node whose points all went to its parent is empty
+  if (node.pointCount > 0)
+    std::memcpy(points.data(), file.data() + node.offset,
+                node.pointCount * sizeof(CloudPoint));
+}
+
+void PointFile::release(const PointNode &node) const {
+  file.release(node.offset, getNodeBytes(node));
+}
+
+void PointBuildStats::print(std::ostream &out) const {
+  const double mb = 1024.0 * 1024.0;
+  out << "point file: " << points << " points in " << chunks
+      << " chunks and " << nodes << " nodes, " << levels << " levels, "
+      << std::fixed << std::setprecision(1) << bytes / mb << " MB in " << ms
+      << " ms on " << JobSystem::get().getThreadCount() << " threads ("
+      << points / std::max(ms / 1000.0, 1e-9) / 1e6
+      << " million points/s), peak memory " << peakResidentBytes() / mb
+      << " MB" << std::endl;
+}
+
+bool buildPointFile(const std::string &scan, const std::string &path,
+                    PointBuildStats &stats, std::string &error) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  MappedFile file(scan, ACCESS_SEQUENTIAL);
+  if (!file.isOpen()) {
+    error = "can't open " + scan;
+    return false;
+  }
+  bool built;
+  PlyLayout layout;
+  bool ply = isPlyFile(file);
+  if (ply && !parsePlyLayout(file, layout, error))
+    return false;
+  if (ply && layout.binary) {
+    PlySource source = { &file, layout };
+    built = buildPoints(source, path, stats, error);
+  }
+  else {
+    TextColumns columns = { { 0, 1, 2, -1, -1, -1 }, PLY_UINT8, !ply };
+    size_t end = file.size();
+    if (ply) {
+      std::copy(layout.fields, layout.fields + 6, columns.fields);
+      columns.colorType = layout.types[3];
+      // faces may follow the vertices
+      const char* text = (const char*)file.data();
+      end = layout.headerBytes;
+      for (size_t line = 0; line < layout.vertexCount && end < file.size();
+           line++) {
+        const void* newline = std::memchr(text + end, '\n',
+                                          file.size() - end);
+        end = newline ? (size_t)((const char*)newline - text) + 1 :
+                        file.size();
+      }
+    }
+    std::string parsedPath = path + ".points.tmp";
+    if (!convertText(file, ply ? layout.headerBytes : 0, end, columns,
+                     parsedPath, error)) {
+      std::remove(parsedPath.c_str());
+      return false;
+    }
+    file = MappedFile();
+    MappedFile parsed(parsedPath, ACCESS_SEQUENTIAL);
+    RawSource source = { &parsed };
+    // an empty file can't be mapped
+    if (!parsed.isOpen()) {
+      std::remove(parsedPath.c_str());
+      error = "the scan has no points";
+      return false;
+    }
+    built = buildPoints(source, path, stats, error);
+    parsed = MappedFile();
+    std::remove(parsedPath.c_str());
+  }
+  stats.ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  return built;
+}
@@ -0,0 +1,81 @@
+#ifndef pointfile_h
+#define pointfile_h
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "mappedfile.h"
+
+// a point of a scan with its rgba8 colour
+struct CloudPoint {
+  float position[3];
+  uint8_t color[4];
+};
+
+// a node keeps one point per cell of a grid with this many cells on each
+// axis over its cube, the other points go down to the children
+const unsigned int POINT_GRID = 64;
+// nodes with at most this many points keep them all
+const unsigned int LEAF_POINTS = 16384;
+
+// a node of the nested point octree. the points of a node add to the ones
+// of its parent, the children of a node follow each other in the table and
+// the root is the first node
+struct PointNode {
+  float center[3];
+  float halfSize;
+  // distance between the points of the node, the cube size over POINT_GRID
+  // or less for dense leaves
+  float spacing;
+  uint32_t firstChild;
+  uint32_t childCount;
+  uint32_t pointCount;
+  uint32_t depth;
+  uint32_t reserved;
+  uint64_t offset;
+};
+
+// a point cloud partitioned into a nested octree, read from the mapped
+// file one node at a time
+class PointFile {
+public:
+  // false with the reason in error
+  bool open(const std::string &path, std::string &error);
+  bool isOpen() const { return file.isOpen() && !nodes.empty(); }
+  const std::vector<PointNode> &getNodes() const { return nodes; }
+  uint64_t getPointCount() const { return points; }
+  size_t getNodeBytes(const PointNode &node) const {
+    return node.pointCount * sizeof(CloudPoint);
+  }
+  // copies the points of a node out of the mapping
+  void read(const PointNode &node, std::vector<CloudPoint> &points) const;
+  // the memory of a node that was copied can be dropped
+  void release(const PointNode &node) const;
+private:
+  MappedFile file;
+  std::vector<PointNode> nodes;
+  uint64_t points = 0;
+};
+
+struct PointBuildStats {
+  uint64_t points = 0;
+  size_t chunks = 0;
+  size_t nodes = 0;
+  unsigned int levels = 0;
+  size_t bytes = 0;
+  double ms = 0.0;
+
+  void print(std::ostream &out) const;
+};
+
+// sorts the points of a scan into chunks that fit into memory and builds
+// the octree of every chunk on all cores, the levels above the chunks take
+// their points from the chunks. binary ply is read from the mapped file,
+// ascii ply and xyz text are parsed on all cores into a temporary file
+// first, so the scan may be larger than memory
+bool buildPointFile(const std::string &scan, const std::string &path,
+                    PointBuildStats &stats, std::string &error);
+
+#endif
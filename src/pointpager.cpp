@@ -0,0 +1,410 @@
+#include "pointpager.h"
+#include "frustum.h"
+#include "glstate.h"
+#include "occlusion.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <utility>
+
+namespace {
+
+// bytes of nodes uploaded per frame, a frame never waits for more
+const size_t UPLOAD_BYTES = 16 << 20;
+// bytes read ahead of the uploads
+const size_t READ_AHEAD_BYTES = 32 << 20;
+// nodes requested and not uploaded yet
+const unsigned int MAX_IN_FLIGHT = 64;
+// larger points would smear whole nodes over the screen
+const float MAX_POINT_SIZE = 32.0f;
+// frames further apart were interrupted by the viewer sleeping
+const double TIMED_GAP_SECONDS = 0.5;
+
+glm::vec3 nodeCenter(const PointNode &node) {
+  return glm::vec3(node.center[0], node.center[1], node.center[2]);
+}
+
+float nodeRadius(const PointNode &node) {
+  return node.halfSize * 1.7320508f;
+}
+
+}
+
+bool PointPager::open(const std::string &path, size_t pointBudget,
+                      std::string &error) {
+  close();
+  if (!file.open(path, error))
+    return false;
+  const std::vector<PointNode> &table = file.getNodes();
+  this->pointBudget = pointBudget;
+  // nodes stay resident a while after they went out of view
+  residentBudget = pointBudget * 2;
+  nodes = std::vector<Resident>(table.size());
+  for (size_t i = 0; i < table.size(); i++)
+    nodes[i].loaded = table[i].pointCount == 0;
+  state.assign(table.size(), 0);
+  loading.assign(table.size(), false);
+  shader.reset(new Shader("pointshader.vs", "pointshader.fs"));
+  // the root is always there, everything else adds to it
+  if (!nodes[0].loaded) {
+    Loaded root;
+    root.node = 0;
+    file.read(table[0], root.points);
+    file.release(table[0]);
+    upload(root);
+  }
+  stopping = false;
+  loader = std::thread(&PointPager::loadLoop, this);
+  return true;
+}
+
+void PointPager::close() {
+  if (loader.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      requests.clear();
+    }
+    wake.notify_all();
+    loader.join();
+  }
+  loaded.clear();
+  nodes.clear();
+  resident.clear();
+  residentPoints = 0;
+  state.clear();
+  touched.clear();
+  loading.clear();
+  inFlight = 0;
+  loadedBytes = 0;
+  loadedNodes = 0;
+  evictedNodes = 0;
+  droppedNodes = 0;
+  readBytes = 0;
+  loadMs = 0.0;
+  uploadMs = 0.0;
+  drawnNodes = 0;
+  drawnPoints = 0;
+  timedFrames = 0;
+  timedSeconds = 0.0;
+  timedPoints = 0;
+  lastDraw = std::chrono::steady_clock::time_point();
+  shader.reset();
+  file = PointFile();
+}
+
+glm::vec3 PointPager::getBoundsCenter() const {
+  return isOpen() ? nodeCenter(file.getNodes()[0]) : glm::vec3(0.0f);
+}
+
+float PointPager::getBoundsRadius() const {
+  return isOpen() ? nodeRadius(file.getNodes()[0]) : 0.0f;
+}
+
+void PointPager::loadLoop() {
+  const std::vector<PointNode> &table = file.getNodes();
+  for (;;) {
+    uint32_t node;
+    size_t bytes;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this, &table]() {
+        return stopping ||
+               (!requests.empty() &&
+                (loadedBytes == 0 ||
+                 loadedBytes + file.getNodeBytes(table[requests.front()]) <=
+                 READ_AHEAD_BYTES));
+      });
+      if (stopping)
+        return;
+      node = requests.front();
+      requests.pop_front();
+      bytes = file.getNodeBytes(table[node]);
+      loadedBytes += bytes;
+    }
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    Loaded item;
+    item.node = node;
+    file.read(table[node], item.points);
+    // the copy goes to the gpu, the mapped pages can go again
+    file.release(table[node]);
+    std::lock_guard<std::mutex> lock(mutex);
+    loadMs += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    readBytes += bytes;
+    loaded.push_back(std::move(item));
+  }
+}
+
+void PointPager::update() {
+  if (!isOpen())
+    return;
+  const std::vector<PointNode> &table = file.getNodes();
+  std::vector<Loaded> batch;
+  size_t bytes = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!loaded.empty()) {
+      size_t size = file.getNodeBytes(table[loaded.front().node]);
+      if (!batch.empty() && bytes + size > UPLOAD_BYTES)
+        break;
+      bytes += size;
+      batch.push_back(std::move(loaded.front()));
+      loaded.pop_front();
+    }
+  }
+  if (batch.empty())
+    return;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  size_t uploaded = 0;
+  for (Loaded &item : batch) {
+    if (upload(item))
+      uploaded++;
+    loading[item.node] = false;
+    std::vector<CloudPoint>().swap(item.points);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    uploadMs += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    loadedNodes += uploaded;
+    droppedNodes += batch.size() - uploaded;
+    loadedBytes -= bytes;
+    inFlight -= (unsigned int)batch.size();
+  }
+  wake.notify_all();
+}
+
+bool PointPager::upload(Loaded &item) {
+  const PointNode &node = file.getNodes()[item.node];
+  // room is made from the nodes the last frame didn't select, the
+  // selection itself always fits
+  while (item.node != 0 &&
+         residentPoints + node.pointCount > residentBudget) {
+    uint32_t oldest = 0;
+    for (uint32_t candidate : resident)
+      if (candidate != 0 && nodes[candidate].used + 1 < frame &&
+          (oldest == 0 || nodes[candidate].used < nodes[oldest].used))
+        oldest = candidate;
+    if (oldest == 0)
+      return false;
+    evict(oldest);
+  }
+  Resident &target = nodes[item.node];
+  target.vertexArray = GpuVertexArray("point vao");
+  target.points = GpuBuffer("point vertices");
+  glBindVertexArray(target.vertexArray.id());
+  glBindBuffer(GL_ARRAY_BUFFER, target.points.id());
+  glBufferData(GL_ARRAY_BUFFER, item.points.size() * sizeof(CloudPoint),
+               item.points.data(), GL_STATIC_DRAW);
+  target.points.setSize(item.points.size() * sizeof(CloudPoint));
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(CloudPoint),
+                        (void*)0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CloudPoint),
+                        (void*)offsetof(CloudPoint, color));
+  glBindVertexArray(0);
+  target.loaded = true;
+  // requested by the last frame, not evicted before the next one drew
+  target.used = frame - 1;
+  resident.push_back(item.node);
+  residentPoints += node.pointCount;
+  return true;
+}
+
+void PointPager::evict(uint32_t node) {
+  Resident &target = nodes[node];
+  target.vertexArray.reset();
+  target.points.reset();
+  target.loaded = false;
+  residentPoints -= file.getNodes()[node].pointCount;
+  resident.erase(std::find(resident.begin(), resident.end(), node));
+  std::lock_guard<std::mutex> lock(mutex);
+  evictedNodes++;
+}
+
+unsigned int PointPager::completeLevels(uint32_t node) const {
+  const PointNode &entry = file.getNodes()[node];
+  unsigned int levels = 0;
+  bool any = false;
+  for (uint32_t i = 0; i < entry.childCount; i++) {
+    uint32_t child = entry.firstChild + i;
+    if (!(state[child] & NODE_VISIBLE))
+      continue;
+    if (!(state[child] & NODE_SELECTED) || !nodes[child].loaded)
+      return 0;
+    unsigned int below = completeLevels(child) + 1;
+    levels = any ? std::min(levels, below) : below;
+    any = true;
+  }
+  return levels;
+}
+
+void PointPager::draw(const RenderView &view) {
+  drawnNodes = 0;
+  drawnPoints = 0;
+  if (!isOpen())
+    return;
+  const std::vector<PointNode> &table = file.getNodes();
+  for (uint32_t node : touched)
+    state[node] = 0;
+  touched.clear();
+  Frustum frustum = Frustum::fromMatrix(view.projection * view.view);
+  auto visible = [&](const PointNode &node) {
+    glm::vec3 center = nodeCenter(node);
+    float radius = nodeRadius(node);
+    return frustum.containsSphere(center, radius) &&
+           !(view.occlusion && view.occlusion->isOccluded(center, radius));
+  };
+  // pixels between the points of the parent at the node, the widest gaps
+  // are filled first
+  auto gap = [&](const PointNode &node) {
+    float distance = glm::length(nodeCenter(node) - view.cameraPosition) -
+                     nodeRadius(node);
+    return node.spacing * 2.0f * view.pixelsPerUnit(distance);
+  };
+
+  // adds the nodes behind the widest gaps until the budget is spent or the
+  // gaps are below the allowed error
+  std::vector<uint32_t> selected;
+  nodes[0].used = frame;
+  touched.push_back(0);
+  if (visible(table[0])) {
+    state[0] = NODE_VISIBLE | NODE_SELECTED;
+    selected.push_back(0);
+    size_t points = table[0].pointCount;
+    std::priority_queue<std::pair<float, uint32_t>> queue;
+    auto addChildren = [&](uint32_t parent) {
+      const PointNode &node = table[parent];
+      for (uint32_t i = 0; i < node.childCount; i++) {
+        uint32_t child = node.firstChild + i;
+        touched.push_back(child);
+        if (visible(table[child])) {
+          state[child] = NODE_VISIBLE;
+          queue.push(std::make_pair(gap(table[child]), child));
+        }
+      }
+    };
+    addChildren(0);
+    while (!queue.empty()) {
+      std::pair<float, uint32_t> top = queue.top();
+      queue.pop();
+      if (top.first <= view.lodPixelError)
+        break;
+      if (points + table[top.second].pointCount > pointBudget)
+        break;
+      points += table[top.second].pointCount;
+      state[top.second] |= NODE_SELECTED;
+      nodes[top.second].used = frame;
+      selected.push_back(top.second);
+      addChildren(top.second);
+    }
+  }
+
+  // the missing nodes coarse first, within a level by their gap. the
+  // queue of the last frame is stale by now
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t node : requests)
+      loading[node] = false;
+    inFlight -= (unsigned int)requests.size();
+    requests.clear();
+    std::vector<uint32_t> missing;
+    for (uint32_t node : selected)
+      if (!nodes[node].loaded && !loading[node])
+        missing.push_back(node);
+    std::stable_sort(missing.begin(), missing.end(),
+                     [&table](uint32_t a, uint32_t b) {
+                       return table[a].depth < table[b].depth;
+                     });
+    for (uint32_t node : missing) {
+      if (inFlight >= MAX_IN_FLIGHT)
+        break;
+      loading[node] = true;
+      requests.push_back(node);
+      inFlight++;
+    }
+  }
+  wake.notify_all();
+
+  if (state[0] & NODE_VISIBLE) {
+    GlStateCache &cache = GlStateCache::get();
+    cache.begin();
+    cache.useProgram(shader->progID);
+    glm::mat4 projection = view.projection;
+    glm::mat4 viewMatrix = view.view;
+    shader->setUniform("projection", projection);
+    shader->setUniform("view", viewMatrix);
+    shader->setUniform("pixelsPerUnit", view.pixelsPerUnit(1.0f));
+    shader->setUniform("maxPointSize", MAX_POINT_SIZE);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    drawNode(0);
+    glDisable(GL_PROGRAM_POINT_SIZE);
+    cache.end();
+  }
+  frame++;
+
+  std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(now - lastDraw).count();
+  if (lastDraw != std::chrono::steady_clock::time_point() &&
+      seconds < TIMED_GAP_SECONDS) {
+    timedFrames++;
+    timedSeconds += seconds;
+    timedPoints += drawnPoints;
+  }
+  lastDraw = now;
+}
+
+void PointPager::drawNode(uint32_t node) {
+  const PointNode &entry = file.getNodes()[node];
+  // a node without its parent would leave holes around it
+  if (!nodes[node].loaded)
+    return;
+  if (entry.pointCount > 0) {
+    // the points cover for the levels below that aren't drawn
+    float spacing = entry.spacing / (float)(1u << completeLevels(node));
+    shader->setUniform("spacing", spacing);
+    GlStateCache &cache = GlStateCache::get();
+    cache.bindVertexArray(nodes[node].vertexArray.id());
+    glDrawArrays(GL_POINTS, 0, entry.pointCount);
+    cache.releaseVertexArray();
+    drawnNodes++;
+    drawnPoints += entry.pointCount;
+  }
+  for (uint32_t i = 0; i < entry.childCount; i++)
+    if (state[entry.firstChild + i] & NODE_SELECTED)
+      drawNode(entry.firstChild + i);
+}
+
+bool PointPager::isBusy() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return inFlight > 0;
+}
+
+void PointPager::report(std::ostream &out) const {
+  if (!isOpen())
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  const double mb = 1024.0 * 1024.0;
+  out << "points: " << nodes.size() << " nodes of "
+      << file.getPointCount() << " points, " << resident.size()
+      << " resident with " << residentPoints << " points, " << drawnNodes
+      << " drawn with " << drawnPoints << " of " << pointBudget
+      << " budget points, " << loadedNodes << " loaded (" << std::fixed
+      << std::setprecision(1) << readBytes / mb << " MB in " << loadMs
+      << " ms on the loader thread), " << uploadMs << " ms of uploads, "
+      << evictedNodes << " evicted";
+  if (droppedNodes > 0)
+    out << ", " << droppedNodes << " dropped over the budget";
+  if (timedSeconds > 0.0)
+    out << ". " << timedFrames / timedSeconds << " fps and "
+        << timedPoints / timedSeconds / 1e6
+        << " million points/s over " << timedFrames << " frames";
+  out << ", peak resident memory " << peakResidentBytes() / mb << " MB"
+      << std::endl;
+}
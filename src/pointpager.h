@@ -0,0 +1,117 @@
+#ifndef pointpager_h
+#define pointpager_h
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "gpuresource.h"
+#include "pointfile.h"
+#include "renderview.h"
+#include "shader.h"
+
+// draws a point file of any size as GL_POINTS: every frame the nodes whose
+// point spacing is widest on screen are added until the point budget is
+// spent, a thread copies the missing ones out of the mapped file and the
+// least recently drawn are evicted above twice the budget. the points grow
+// to close the gaps to the level drawn below them
+class PointPager {
+public:
+  PointPager() {}
+  PointPager(const PointPager &) = delete;
+  PointPager &operator=(const PointPager &) = delete;
+  ~PointPager() { close(); }
+
+  // render thread with a current context, at most pointBudget points are
+  // drawn per frame. the root is uploaded right away
+  bool open(const std::string &path, size_t pointBudget, std::string &error);
+  // render thread before the context goes away
+  void close();
+  bool isOpen() const { return file.isOpen(); }
+  glm::vec3 getBoundsCenter() const;
+  float getBoundsRadius() const;
+
+  // render thread once per frame: uploads the nodes read since the last
+  // one, evicting the least recently drawn above the budget
+  void update();
+  // selects the nodes for the view, queues the missing ones and draws the
+  // resident ones below the root
+  void draw(const RenderView &view);
+  // nodes requested and not uploaded yet
+  bool isBusy() const;
+  size_t getDrawnPoints() const { return drawnPoints; }
+  void report(std::ostream &out) const;
+private:
+  // a node on the gpu, nodes without points count as resident
+  struct Resident {
+    GpuVertexArray vertexArray;
+    GpuBuffer points;
+    bool loaded = false;
+    unsigned long long used = 0;
+  };
+  // a node copied out of the file by the loader
+  struct Loaded {
+    uint32_t node;
+    std::vector<CloudPoint> points;
+  };
+  // selection state of a node in the current frame
+  enum {
+    NODE_VISIBLE = 1,
+    NODE_SELECTED = 2
+  };
+
+  PointFile file;
+  std::unique_ptr<Shader> shader;
+  size_t pointBudget = 0;
+  size_t residentBudget = 0;
+  std::vector<Resident> nodes;
+  // nodes with points on the gpu, the eviction candidates
+  std::vector<uint32_t> resident;
+  size_t residentPoints = 0;
+  std::vector<uint8_t> state;
+  std::vector<uint32_t> touched;
+  unsigned long long frame = 1;
+
+  std::thread loader;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::deque<uint32_t> requests;
+  std::deque<Loaded> loaded;
+  std::vector<bool> loading;
+  // nodes queued, being read or waiting for the upload
+  unsigned int inFlight = 0;
+  // bytes read and not uploaded yet
+  size_t loadedBytes = 0;
+
+  size_t loadedNodes = 0;
+  size_t evictedNodes = 0;
+  size_t droppedNodes = 0;
+  size_t readBytes = 0;
+  double loadMs = 0.0;
+  double uploadMs = 0.0;
+  size_t drawnNodes = 0;
+  size_t drawnPoints = 0;
+  // frames drawn one after the other, pauses of the viewer left out
+  std::chrono::steady_clock::time_point lastDraw;
+  unsigned int timedFrames = 0;
+  double timedSeconds = 0.0;
+  uint64_t timedPoints = 0;
+
+  void loadLoop();
+  bool upload(Loaded &node);
+  void evict(uint32_t node);
+  // levels below the node that are drawn wherever it is visible
+  unsigned int completeLevels(uint32_t node) const;
+  void drawNode(uint32_t node);
+};
+
+#endif
@@ -0,0 +1,23 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec4 aColor;
+
+out vec3 Color;
+
+uniform mat4 view;
+uniform mat4 projection;
+// distance between the points where they are drawn from, and the pixels
+// a world unit covers at distance 1
+uniform float spacing;
+uniform float pixelsPerUnit;
+uniform float maxPointSize;
+
+void main()
+{
+  Color = aColor.rgb;
+  vec4 position = view * vec4(aPos, 1.0);
+  // large enough to close the gaps to the neighbours on screen
+  gl_PointSize = clamp(spacing * pixelsPerUnit / max(-position.z, 1e-4),
+                       1.0, maxPointSize);
+  gl_Position = projection * position;
+}
@@ -0,0 +1,78 @@
+#include "radixsort.h"
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// values is null when only the keys are sorted
+void sortPasses(std::vector<uint64_t> &keys, std::vector<uint32_t>* values,
+                std::vector<uint64_t> &keyScratch,
+                std::vector<uint32_t>* valueScratch) {
+  size_t size = keys.size();
+  if (size < 2)
+    return;
+  // all eight histograms in one pass over the keys
+  size_t counts[8][256];
+  std::memset(counts, 0, sizeof(counts));
+  for (uint64_t key : keys)
+    for (unsigned int pass = 0; pass < 8; pass++)
+      counts[pass][(key >> (pass * 8)) & 0xff]++;
+
+  keyScratch.resize(size);
+  uint64_t* source = keys.data();
+  uint64_t* target = keyScratch.data();
+  uint32_t* sourceValues = nullptr;
+  uint32_t* targetValues = nullptr;
+  if (values) {
+    valueScratch->resize(size);
+    sourceValues = values->data();
+    targetValues = valueScratch->data();
+  }
+  for (unsigned int pass = 0; pass < 8; pass++) {
+    size_t* histogram = counts[pass];
+    unsigned int shift = pass * 8;
+    if (histogram[(source[0] >> shift) & 0xff] == size)
+      continue;
+    size_t offset = 0;
+    for (unsigned int digit = 0; digit < 256; digit++) {
+      size_t count = histogram[digit];
+      histogram[digit] = offset;
+      offset += count;
+    }
+    if (values)
+      for (size_t i = 0; i < size; i++) {
+        size_t position = histogram[(source[i] >> shift) & 0xff]++;
+        target[position] = source[i];
+        targetValues[position] = sourceValues[i];
+      }
+    else
+      for (size_t i = 0; i < size; i++)
+        target[histogram[(source[i] >> shift) & 0xff]++] = source[i];
+    std::swap(source, target);
+    std::swap(sourceValues, targetValues);
+  }
+  if (source != keys.data()) {
+    std::memcpy(keys.data(), source, size * sizeof(uint64_t));
+    if (values)
+      std::memcpy(values->data(), sourceValues, size * sizeof(uint32_t));
+  }
+}
+
+}
+
+void radixSort(std::vector<uint64_t> &keys, std::vector<uint64_t> &scratch) {
+  sortPasses(keys, nullptr, scratch, nullptr);
+}
+
+void radixSort(std::vector<uint64_t> &keys, std::vector<uint32_t> &values,
+               std::vector<uint64_t> &keyScratch,
+               std::vector<uint32_t> &valueScratch) {
+  sortPasses(keys, &values, keyScratch, &valueScratch);
+}
+
+uint32_t sortableFloat(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  // negative floats sort reversed, flipping all their bits fixes that
+  return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
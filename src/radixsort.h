@@ -0,0 +1,19 @@
+#ifndef radixsort_h
+#define radixsort_h
+
+#include <cstdint>
+#include <vector>
+
+// stable ascending sort of packed keys, eight bits per pass. passes where
+// every key has the same byte are skipped, so keys with unused high bits
+// cost less. scratch is reused between calls
+void radixSort(std::vector<uint64_t> &keys, std::vector<uint64_t> &scratch);
+// the same with a value moved along with every key
+void radixSort(std::vector<uint64_t> &keys, std::vector<uint32_t> &values,
+               std::vector<uint64_t> &keyScratch,
+               std::vector<uint32_t> &valueScratch);
+
+// key bits of a float that sort like the float, negative values included
+uint32_t sortableFloat(float value);
+
+#endif
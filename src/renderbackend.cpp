@@ -0,0 +1,9 @@
+#include "renderbackend.h"
+#include <stb_image/stb_image_write.h>
+
+bool writeImage(const std::string &name, int width, int height,
+                const std::vector<unsigned char> &pixels) {
+  stbi_flip_vertically_on_write(1);
+  return stbi_write_png(name.c_str(), width, height, 3, pixels.data(),
+                        width * 3) != 0;
+}
@@ -0,0 +1,27 @@
+#ifndef renderbackend_h
+#define renderbackend_h
+
+#include <string>
+#include <vector>
+#include "model.h"
+#include "renderview.h"
+
+// draws a model into a framebuffer of its own, with opengl or on the cpu
+class RenderBackend {
+public:
+  virtual ~RenderBackend() {}
+  virtual const char* getName() const = 0;
+  // recreates the framebuffer if the size changed
+  virtual void resize(int width, int height) = 0;
+  virtual void render(Model &model, const RenderView &view) = 0;
+  // blocks until the last frame is complete
+  virtual void finish() = 0;
+  // rgb of the last frame, the bottom row first like glReadPixels
+  virtual void readPixels(std::vector<unsigned char> &pixels) = 0;
+};
+
+// writes the pixels of readPixels as png
+bool writeImage(const std::string &name, int width, int height,
+                const std::vector<unsigned char> &pixels);
+
+#endif
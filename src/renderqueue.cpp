@@ -0,0 +1,24 @@
+#include "renderqueue.h"
+#include "radixsort.h"
+
+uint64_t renderKey(RenderPass pass, bool translucent, unsigned int program,
+                   unsigned int material, float depth) {
+  uint32_t depthBits = sortableFloat(depth);
+  if (translucent)
+    depthBits = ~depthBits;
+  return (uint64_t)(pass & 0x3u) << 62 | (uint64_t)translucent << 61 |
+         (uint64_t)(program & 0xffu) << 53 |
+         (uint64_t)(material & 0x1fffffu) << 32 | depthBits;
+}
+
+RenderPass keyPass(uint64_t key) {
+  return (RenderPass)(key >> 62);
+}
+
+bool keyTranslucent(uint64_t key) {
+  return (key >> 61) & 1;
+}
+
+void RenderQueue::sort() {
+  radixSort(keys, items, keyScratch, itemScratch);
+}
@@ -0,0 +1,42 @@
+#ifndef renderqueue_h
+#define renderqueue_h
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum RenderPass {
+  PASS_DEPTH,
+  PASS_COLOR
+};
+
+// sort key of a draw, most significant first: pass 2 bits, translucency
+// 1, program 8, material 21 and the view depth 32. opaque draws of a pass
+// are grouped by program and material and go front to back inside a
+// group, translucent draws come last and go back to front
+uint64_t renderKey(RenderPass pass, bool translucent, unsigned int program,
+                   unsigned int material, float depth);
+RenderPass keyPass(uint64_t key);
+bool keyTranslucent(uint64_t key);
+
+// draws of one frame as key and caller defined item, sorted with a radix
+// sort. the storage is kept between frames
+class RenderQueue {
+public:
+  void clear() { keys.clear(); items.clear(); }
+  void push(uint64_t key, uint32_t item) {
+    keys.push_back(key);
+    items.push_back(item);
+  }
+  void sort();
+  size_t size() const { return keys.size(); }
+  uint64_t getKey(size_t i) const { return keys[i]; }
+  uint32_t getItem(size_t i) const { return items[i]; }
+private:
+  std::vector<uint64_t> keys;
+  std::vector<uint32_t> items;
+  std::vector<uint64_t> keyScratch;
+  std::vector<uint32_t> itemScratch;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "renderscheduler.h"
+#include <GLFW/glfw3.h>
+#include <iomanip>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+// user and system time the process consumed so far
+double processCpuSeconds() {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+  ULARGE_INTEGER k, u;
+  k.LowPart = kernel.dwLowDateTime;
+  k.HighPart = kernel.dwHighDateTime;
+  u.LowPart = user.dwLowDateTime;
+  u.HighPart = user.dwHighDateTime;
+  return (k.QuadPart + u.QuadPart) * 1e-7;
+#else
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+}
+
+RenderScheduler::RenderScheduler()
+    : frameCap(60.0), continuous(false), redraw(true), present(false),
+      animating(false), lastFrame(-1.0), redrawn(0), presented(0),
+      wakeups(0), reportWallStart(0.0), reportCpuStart(0.0) {}
+
+void RenderScheduler::waitEvents() {
+  wakeups++;
+  bool pending = continuous || redraw || animating || present;
+  if (!pending) {
+    // nothing to do until the next input, resize or expose event
+    glfwWaitEvents();
+    return;
+  }
+  double remaining = frameCap > 0.0 ?
+      lastFrame + 1.0 / frameCap - glfwGetTime() : 0.0;
+  if (remaining > 0.0 && !present)
+    glfwWaitEventsTimeout(remaining);
+  else
+    glfwPollEvents();
+}
+
+FrameAction RenderScheduler::nextFrame() {
+  double now = glfwGetTime();
+  bool dirty = continuous || redraw || animating;
+  bool due = frameCap <= 0.0 || now >= lastFrame + 1.0 / frameCap;
+  if (dirty && due) {
+    redraw = false;
+    present = false;
+    lastFrame = now;
+    redrawn++;
+    return FRAME_REDRAW;
+  }
+  if (present) {
+    present = false;
+    presented++;
+    return FRAME_PRESENT;
+  }
+  return FRAME_NONE;
+}
+
+void RenderScheduler::report(std::ostream &out) {
+  double wall = glfwGetTime() - reportWallStart;
+  double cpu = processCpuSeconds() - reportCpuStart;
+  if (wall <= 0.0)
+    return;
+  out << "scheduler: " << redrawn << " frames rendered, " << presented
+      << " presented again, " << wakeups << " wakeups in " << std::fixed
+      << std::setprecision(1) << wall << " s (" << redrawn / wall
+      << " fps), " << 100.0 * cpu / wall << " % cpu" << std::endl;
+  redrawn = 0;
+  presented = 0;
+  wakeups = 0;
+  reportWallStart += wall;
+  reportCpuStart += cpu;
+}
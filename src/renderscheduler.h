@@ -0,0 +1,51 @@
+#ifndef renderscheduler_h
+#define renderscheduler_h
+
+#include <ostream>
+
+enum FrameAction {
+  FRAME_NONE,
+  // the scene changed and has to be rendered again
+  FRAME_REDRAW,
+  // the window was exposed, showing the last frame again is enough
+  FRAME_PRESENT
+};
+
+// decides when a frame is needed and sleeps in between
+class RenderScheduler {
+public:
+  RenderScheduler();
+
+  // frames per second, 0 disables the cap
+  void setFrameCap(double fps) { frameCap = fps; }
+  // redraws every frame like a game loop, for comparisons
+  void setContinuous(bool enabled) { continuous = enabled; }
+
+  void requestRedraw() { redraw = true; }
+  void requestPresent() { present = true; }
+  // keeps redrawing while something moves, e.g. a held movement key
+  void setAnimating(bool enabled) { animating = enabled; }
+
+  // processes window events and blocks until there is work
+  void waitEvents();
+  // returns the work of this iteration and marks it as done
+  FrameAction nextFrame();
+
+  void report(std::ostream &out);
+private:
+  double frameCap;
+  bool continuous;
+  bool redraw;
+  bool present;
+  bool animating;
+  double lastFrame;
+
+  // counters since the last report, the first covers the whole run
+  unsigned int redrawn;
+  unsigned int presented;
+  unsigned int wakeups;
+  double reportWallStart;
+  double reportCpuStart;
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef renderview_h
+#define renderview_h
+
+#include <glm/glm.hpp>
+
+class OcclusionBuffer;
+class Shader;
+
+// everything the draw calls need to know about the current view
+struct RenderView {
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::vec3 cameraPosition;
+  int width;
+  int height;
+  // allowed screen space error of simplified meshes in pixels
+  float lodPixelError;
+  // rasterized occluders of the frame, null when occlusion culling is off
+  const OcclusionBuffer* occlusion;
+  // depth only program of the pre-pass, null draws in node order without
+  // it
+  Shader* depthShader;
+  // samples the layer of a texture array, drawn by meshes whose diffuse
+  // texture was packed
+  Shader* arrayShader;
+  // draw meshes with page files through the page cache and write the
+  // pages they need, null without virtual textures
+  Shader* virtualShader;
+  Shader* feedbackShader;
+
+  // pixels covered by one world unit at the given distance
+  float pixelsPerUnit(float distance) const {
+    return projection[1][1] * height * 0.5f / glm::max(distance, 1e-4f);
+  }
+};
+
+#endif
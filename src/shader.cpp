@@ -1,4 +1,5 @@
 #include "shader.h"
+#include "glfeatures.h"
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -63,6 +64,37 @@ Shader::Shader(std::string vertexFilePath, std::string fragmentFilePath) {
   glDeleteShader(fragment);
 }
 
+// create compute shader
+Shader::Shader(std::string computeFilePath) {
+  std::string computeCode;
+  std::ifstream computeShaderFile;
+  computeShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+
+  try {
+    computeShaderFile.open(computeFilePath);
+    std::stringstream computeShaderStream;
+    computeShaderStream << computeShaderFile.rdbuf();
+    computeShaderFile.close();
+    computeCode = computeShaderStream.str();
+  }
+  catch (const std::ifstream::failure &) {
+    std::cout << "shader file not found" << std::endl;
+  }
+
+  const char* computeShaderCode = computeCode.c_str();
+  unsigned int compute;
+  compute = glCreateShader(GL_COMPUTE_SHADER);
+  glShaderSource(compute, 1, &computeShaderCode, NULL);
+  glCompileShader(compute);
+  checkCompileErrors(compute, "COMPUTE");
+
+  progID = glCreateProgram();
+  glAttachShader(progID, compute);
+  glLinkProgram(progID);
+  checkCompileErrors(progID, "PROGRAM");
+  glDeleteShader(compute);
+}
+
 // activate the shader
 void Shader::use() {
   glUseProgram(progID);
@@ -10,6 +10,8 @@ public:
   unsigned int progID;
   
   Shader(std::string vertexFilePath, std::string fragmentFilePath);
+  // compute program, needs gl 4.3
+  explicit Shader(std::string computeFilePath);
   void use();
   void setUniform(const std::string &name, bool value);
   void setUniform(const std::string &name, int value);
@@ -0,0 +1,431 @@
+#include "softwarerenderer.h"
+#include "jobsystem.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RASTER_SSE
+#endif
+
+namespace {
+
+const int TILE_SIZE = 64;
+// triangles set up by one task, the tiles draw the chunks in order
+const size_t CHUNK_TRIANGLES = 2048;
+// the .1 gray the gl path clears to, alpha in the high byte
+const uint32_t CLEAR_COLOR = 0xff1a1a1au;
+
+float evaluate(const glm::vec3 &plane, float x, float y) {
+  return plane.x * x + plane.y * y + plane.z;
+}
+
+glm::vec3 sampleLevel(const TextureImage::Level &level, float u, float v) {
+  // repeat wrap like the gl textures
+  u -= std::floor(u);
+  v -= std::floor(v);
+  float s = u * level.width - 0.5f;
+  float t = v * level.height - 0.5f;
+  float sFloor = std::floor(s);
+  float tFloor = std::floor(t);
+  float sWeight = s - sFloor;
+  float tWeight = t - tFloor;
+  int x0 = ((int)sFloor + level.width) % level.width;
+  int y0 = ((int)tFloor + level.height) % level.height;
+  int x1 = (x0 + 1) % level.width;
+  int y1 = (y0 + 1) % level.height;
+  const unsigned char* texels = level.rgba.data();
+  const unsigned char* a = texels + ((size_t)y0 * level.width + x0) * 4;
+  const unsigned char* b = texels + ((size_t)y0 * level.width + x1) * 4;
+  const unsigned char* c = texels + ((size_t)y1 * level.width + x0) * 4;
+  const unsigned char* d = texels + ((size_t)y1 * level.width + x1) * 4;
+  glm::vec3 top = glm::mix(glm::vec3(a[0], a[1], a[2]),
+                           glm::vec3(b[0], b[1], b[2]), sWeight);
+  glm::vec3 bottom = glm::mix(glm::vec3(c[0], c[1], c[2]),
+                              glm::vec3(d[0], d[1], d[2]), sWeight);
+  return glm::mix(top, bottom, tWeight) * (1.0f / 255.0f);
+}
+
+}
+
+void SoftwareRenderer::resize(int width, int height) {
+  if (width == this->width && height == this->height)
+    return;
+  this->width = width;
+  this->height = height;
+  stride = (width + 3) & ~3;
+  tilesX = (stride + TILE_SIZE - 1) / TILE_SIZE;
+  tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+  color.assign((size_t)stride * height, CLEAR_COLOR);
+  depth.assign((size_t)stride * height, 1.0f);
+}
+
+void SoftwareRenderer::forEach(size_t count, size_t grain,
+    const std::function<void(size_t, size_t)> &task) {
+  JobSystem &jobs = JobSystem::get();
+  if (threadLimit == 0 || threadLimit >= jobs.getThreadCount()) {
+    jobs.parallelFor(count, grain, task);
+    return;
+  }
+  // one job per allowed thread, each takes chunks until none are left
+  std::atomic<size_t> next(0);
+  jobs.parallelFor(threadLimit, 1, [&](size_t, size_t) {
+    for (;;) {
+      size_t begin = next.fetch_add(grain);
+      if (begin >= count)
+        break;
+      task(begin, std::min(begin + grain, count));
+    }
+  });
+}
+
+void SoftwareRenderer::render(Model &model, const RenderView &view) {
+  model.update();
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+  draws.clear();
+  size_t vertexCount = 0;
+  triangleCount = 0;
+  for (const Mesh &mesh : model.getMeshes()) {
+    const TextureImage* texture = nullptr;
+    for (const Texture &candidate : mesh.textures)
+      if (candidate.type == "texture_diffuse" && candidate.image) {
+        texture = candidate.image.get();
+        break;
+      }
+    for (const glm::mat4 &transform : mesh.instances) {
+      draws.push_back({ &mesh, &transform, texture, vertexCount,
+                        triangleCount });
+      vertexCount += mesh.vertices.size();
+      triangleCount += mesh.indices.size() / 3;
+    }
+  }
+
+  glm::mat4 viewProjection = view.projection * view.view;
+  clipPositions.resize(vertexCount);
+  forEach(draws.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      glm::mat4 transform = viewProjection * *draws[i].transform;
+      const std::vector<Vertex> &vertices = draws[i].mesh->vertices;
+      glm::vec4* target = &clipPositions[draws[i].firstVertex];
+      for (size_t v = 0; v < vertices.size(); v++)
+        target[v] = transform * glm::vec4(vertices[v].position, 1.0f);
+    }
+  });
+
+  size_t chunkCount = (triangleCount + CHUNK_TRIANGLES - 1) / CHUNK_TRIANGLES;
+  size_t tileCount = (size_t)tilesX * tilesY;
+  chunkSetups.resize(chunkCount);
+  bins.resize(chunkCount * tileCount);
+  forEach(chunkCount, 1, [&](size_t begin, size_t end) {
+    for (size_t chunk = begin; chunk < end; chunk++)
+      setupChunk(chunk);
+  });
+  std::chrono::steady_clock::time_point setupDone =
+      std::chrono::steady_clock::now();
+
+  forEach(tileCount, 1, [&](size_t begin, size_t end) {
+    for (size_t tile = begin; tile < end; tile++)
+      rasterizeTile((unsigned int)tile);
+  });
+  std::chrono::steady_clock::time_point rasterDone =
+      std::chrono::steady_clock::now();
+
+  geometryMs = std::chrono::duration<double, std::milli>(
+      setupDone - start).count();
+  rasterMs = std::chrono::duration<double, std::milli>(
+      rasterDone - setupDone).count();
+  setupCount = 0;
+  binnedCount = 0;
+  for (size_t chunk = 0; chunk < chunkCount; chunk++)
+    setupCount += chunkSetups[chunk].size();
+  for (size_t bin = 0; bin < chunkCount * tileCount; bin++)
+    binnedCount += bins[bin].size();
+}
+
+void SoftwareRenderer::setupChunk(size_t chunk) {
+  size_t tileCount = (size_t)tilesX * tilesY;
+  chunkSetups[chunk].clear();
+  for (size_t tile = 0; tile < tileCount; tile++)
+    bins[chunk * tileCount + tile].clear();
+
+  size_t begin = chunk * CHUNK_TRIANGLES;
+  size_t end = std::min(begin + CHUNK_TRIANGLES, triangleCount);
+  size_t draw = std::upper_bound(draws.begin(), draws.end(), begin,
+      [](size_t triangle, const Draw &other) {
+        return triangle < other.firstTriangle;
+      }) - draws.begin() - 1;
+  for (size_t triangle = begin; triangle < end; triangle++) {
+    while (draw + 1 < draws.size() &&
+           triangle >= draws[draw + 1].firstTriangle)
+      draw++;
+    const Mesh &mesh = *draws[draw].mesh;
+    bool occluded = mesh.occlusion.size() == mesh.vertices.size();
+    size_t local = triangle - draws[draw].firstTriangle;
+    glm::vec4 clip[3];
+    glm::vec3 attributes[3];
+    for (int k = 0; k < 3; k++) {
+      unsigned int index = mesh.indices[local * 3 + k];
+      clip[k] = clipPositions[draws[draw].firstVertex + index];
+      attributes[k] = glm::vec3(mesh.vertices[index].texturecoord,
+                                occluded ? mesh.occlusion[index] : 1.0f);
+    }
+
+    // all corners outside the same plane of the frustum
+    bool outside = false;
+    for (int axis = 0; axis < 3 && !outside; axis++)
+      outside = (clip[0][axis] > clip[0].w && clip[1][axis] > clip[1].w &&
+                 clip[2][axis] > clip[2].w) ||
+                (clip[0][axis] < -clip[0].w && clip[1][axis] < -clip[1].w &&
+                 clip[2][axis] < -clip[2].w);
+    if (outside)
+      continue;
+    if (clip[0].z >= -clip[0].w && clip[1].z >= -clip[1].w &&
+        clip[2].z >= -clip[2].w) {
+      addTriangle(chunk, clip, attributes, draws[draw].texture);
+      continue;
+    }
+
+    // cut at the near plane, leaving a triangle or a quad
+    glm::vec4 polygon[4];
+    glm::vec3 polygonAttributes[4];
+    int corners = 0;
+    for (int k = 0; k < 3; k++) {
+      int next = (k + 1) % 3;
+      float distance = clip[k].z + clip[k].w;
+      float nextDistance = clip[next].z + clip[next].w;
+      if (distance >= 0.0f) {
+        polygon[corners] = clip[k];
+        polygonAttributes[corners++] = attributes[k];
+      }
+      if ((distance >= 0.0f) != (nextDistance >= 0.0f)) {
+        float s = distance / (distance - nextDistance);
+        polygon[corners] = glm::mix(clip[k], clip[next], s);
+        polygonAttributes[corners++] =
+            glm::mix(attributes[k], attributes[next], s);
+      }
+    }
+    for (int k = 1; k + 1 < corners; k++) {
+      glm::vec4 fanClip[3] = { polygon[0], polygon[k], polygon[k + 1] };
+      glm::vec3 fanAttributes[3] = { polygonAttributes[0],
+                                     polygonAttributes[k],
+                                     polygonAttributes[k + 1] };
+      addTriangle(chunk, fanClip, fanAttributes, draws[draw].texture);
+    }
+  }
+}
+
+void SoftwareRenderer::addTriangle(size_t chunk, const glm::vec4* clip,
+                                   const glm::vec3* attributes,
+                                   const TextureImage* texture) {
+  glm::vec2 screen[3];
+  float inverseW[3];
+  float depths[3];
+  for (int k = 0; k < 3; k++) {
+    if (clip[k].w <= 0.0f)
+      return;
+    inverseW[k] = 1.0f / clip[k].w;
+    // row 0 is the bottom like the gl framebuffer
+    screen[k] = (glm::vec2(clip[k]) * inverseW[k] * 0.5f + 0.5f) *
+                glm::vec2(width, height);
+    depths[k] = clip[k].z * inverseW[k] * 0.5f + 0.5f;
+  }
+  float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) -
+               (screen[1].y - screen[0].y) * (screen[2].x - screen[0].x);
+  if (std::fabs(area) < 1e-8f)
+    return;
+
+  glm::vec2 lower = glm::min(screen[0], glm::min(screen[1], screen[2]));
+  glm::vec2 upper = glm::max(screen[0], glm::max(screen[1], screen[2]));
+  Setup setup;
+  setup.minX = (int)std::max(std::floor(lower.x), 0.0f);
+  setup.minY = (int)std::max(std::floor(lower.y), 0.0f);
+  setup.maxX = (int)std::min(std::ceil(upper.x), width - 1.0f);
+  setup.maxY = (int)std::min(std::ceil(upper.y), height - 1.0f);
+  if (setup.minX > setup.maxX || setup.minY > setup.maxY)
+    return;
+
+  // dividing by the signed area draws both windings, the half pixel moves
+  // the planes to the pixel centers
+  for (int k = 0; k < 3; k++) {
+    const glm::vec2 &a = screen[(k + 1) % 3];
+    const glm::vec2 &b = screen[(k + 2) % 3];
+    glm::vec3 edge(a.y - b.y, b.x - a.x, a.x * b.y - b.x * a.y);
+    edge /= area;
+    edge.z += 0.5f * (edge.x + edge.y);
+    setup.edges[k] = edge;
+  }
+  setup.depth = glm::vec3(0.0f);
+  setup.inverseW = glm::vec3(0.0f);
+  setup.u = glm::vec3(0.0f);
+  setup.v = glm::vec3(0.0f);
+  setup.occlusion = glm::vec3(0.0f);
+  for (int k = 0; k < 3; k++) {
+    setup.depth += setup.edges[k] * depths[k];
+    setup.inverseW += setup.edges[k] * inverseW[k];
+    setup.u += setup.edges[k] * (attributes[k].x * inverseW[k]);
+    setup.v += setup.edges[k] * (attributes[k].y * inverseW[k]);
+    setup.occlusion += setup.edges[k] * (attributes[k].z * inverseW[k]);
+  }
+  setup.texture = texture;
+
+  std::vector<Setup> &setups = chunkSetups[chunk];
+  unsigned int index = (unsigned int)setups.size();
+  setups.push_back(setup);
+  size_t tileCount = (size_t)tilesX * tilesY;
+  for (int y = setup.minY / TILE_SIZE; y <= setup.maxY / TILE_SIZE; y++)
+    for (int x = setup.minX / TILE_SIZE; x <= setup.maxX / TILE_SIZE; x++)
+      bins[chunk * tileCount + y * tilesX + x].push_back(index);
+}
+
+void SoftwareRenderer::rasterizeTile(unsigned int tile) {
+  int x0 = (tile % tilesX) * TILE_SIZE;
+  int y0 = (tile / tilesX) * TILE_SIZE;
+  int x1 = std::min(x0 + TILE_SIZE, stride) - 1;
+  int y1 = std::min(y0 + TILE_SIZE, height) - 1;
+  for (int y = y0; y <= y1; y++) {
+    size_t row = (size_t)y * stride;
+    std::fill(color.begin() + row + x0, color.begin() + row + x1 + 1,
+              CLEAR_COLOR);
+    std::fill(depth.begin() + row + x0, depth.begin() + row + x1 + 1, 1.0f);
+  }
+
+  size_t tileCount = (size_t)tilesX * tilesY;
+  for (size_t chunk = 0; chunk < chunkSetups.size(); chunk++) {
+    const std::vector<Setup> &setups = chunkSetups[chunk];
+    for (unsigned int index : bins[chunk * tileCount + tile]) {
+      const Setup &setup = setups[index];
+      fillTriangle(setup, std::max(setup.minX, x0), std::max(setup.minY, y0),
+                   std::min(setup.maxX, x1), std::min(setup.maxY, y1));
+    }
+  }
+}
+
+void SoftwareRenderer::fillTriangle(const Setup &setup, int x0, int y0,
+                                    int x1, int y1) {
+#ifdef RASTER_SSE
+  // groups of four start at multiples of four, the tiles and the padded
+  // rows are whole groups so a group never leaves the tile
+  const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+  const __m128 zero = _mm_setzero_ps();
+  __m128 edgeX[3];
+  __m128 edgeY[3];
+  __m128 edgeZ[3];
+  for (int k = 0; k < 3; k++) {
+    edgeX[k] = _mm_set1_ps(setup.edges[k].x);
+    edgeY[k] = _mm_set1_ps(setup.edges[k].y);
+    edgeZ[k] = _mm_set1_ps(setup.edges[k].z);
+  }
+  __m128 depthX = _mm_set1_ps(setup.depth.x);
+  __m128 depthY = _mm_set1_ps(setup.depth.y);
+  __m128 depthZ = _mm_set1_ps(setup.depth.z);
+  for (int y = y0; y <= y1; y++) {
+    size_t row = (size_t)y * stride;
+    __m128 py = _mm_set1_ps((float)y);
+    for (int x = x0 & ~3; x <= x1; x += 4) {
+      __m128 px = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+      __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(-1));
+      for (int k = 0; k < 3; k++) {
+        __m128 edge = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edgeX[k], px),
+                                            _mm_mul_ps(edgeY[k], py)),
+                                 edgeZ[k]);
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(edge, zero));
+      }
+      if (_mm_movemask_ps(mask) == 0)
+        continue;
+      __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(depthX, px),
+                                       _mm_mul_ps(depthY, py)), depthZ);
+      __m128 stored = _mm_loadu_ps(&depth[row + x]);
+      mask = _mm_and_ps(mask, _mm_cmplt_ps(z, stored));
+      int bits = _mm_movemask_ps(mask);
+      if (bits == 0)
+        continue;
+      _mm_storeu_ps(&depth[row + x],
+                    _mm_or_ps(_mm_and_ps(mask, z),
+                              _mm_andnot_ps(mask, stored)));
+      for (; bits != 0; bits &= bits - 1) {
+        int lane = 0;
+        while (!(bits & (1 << lane)))
+          lane++;
+        shadePixel(setup, (float)(x + lane), (float)y, row + x + lane);
+      }
+    }
+  }
+#else
+  for (int y = y0; y <= y1; y++) {
+    size_t row = (size_t)y * stride;
+    for (int x = x0; x <= x1; x++) {
+      float fx = (float)x;
+      float fy = (float)y;
+      if (evaluate(setup.edges[0], fx, fy) < 0.0f ||
+          evaluate(setup.edges[1], fx, fy) < 0.0f ||
+          evaluate(setup.edges[2], fx, fy) < 0.0f)
+        continue;
+      float z = evaluate(setup.depth, fx, fy);
+      if (!(z < depth[row + x]))
+        continue;
+      depth[row + x] = z;
+      shadePixel(setup, fx, fy, row + x);
+    }
+  }
+#endif
+}
+
+void SoftwareRenderer::shadePixel(const Setup &setup, float x, float y,
+                                  size_t index) {
+  float w = 1.0f / evaluate(setup.inverseW, x, y);
+  float occlusion = glm::clamp(evaluate(setup.occlusion, x, y) * w, 0.0f,
+                               1.0f);
+  glm::vec3 rgb(1.0f);
+  if (setup.texture) {
+    float u = evaluate(setup.u, x, y) * w;
+    float v = evaluate(setup.v, x, y) * w;
+    // footprint of the pixel in texels of the base level from the
+    // derivatives of u / w over 1 / w
+    const std::vector<TextureImage::Level> &levels = setup.texture->levels;
+    float texelsX = (float)levels[0].width;
+    float texelsY = (float)levels[0].height;
+    float dudx = (setup.u.x - u * setup.inverseW.x) * w * texelsX;
+    float dvdx = (setup.v.x - v * setup.inverseW.x) * w * texelsY;
+    float dudy = (setup.u.y - u * setup.inverseW.y) * w * texelsX;
+    float dvdy = (setup.v.y - v * setup.inverseW.y) * w * texelsY;
+    float footprint = std::max(dudx * dudx + dvdx * dvdx,
+                               dudy * dudy + dvdy * dvdy);
+    int level = 0;
+    if (footprint > 1.0f)
+      level = std::min((int)(0.5f * std::log2(footprint) + 0.5f),
+                       (int)levels.size() - 1);
+    rgb = sampleLevel(levels[level], u, v);
+  }
+  rgb = glm::clamp(rgb * occlusion, 0.0f, 1.0f) * 255.0f + 0.5f;
+  color[index] = 0xff000000u | ((uint32_t)rgb.b << 16) |
+                 ((uint32_t)rgb.g << 8) | (uint32_t)rgb.r;
+}
+
+void SoftwareRenderer::readPixels(std::vector<unsigned char> &pixels) {
+  pixels.resize((size_t)width * height * 3);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++) {
+      uint32_t value = color[(size_t)y * stride + x];
+      unsigned char* target = &pixels[((size_t)y * width + x) * 3];
+      target[0] = value & 0xff;
+      target[1] = (value >> 8) & 0xff;
+      target[2] = (value >> 16) & 0xff;
+    }
+}
+
+void SoftwareRenderer::report(std::ostream &out) const {
+  JobSystem &jobs = JobSystem::get();
+  unsigned int threads = threadLimit == 0 ? jobs.getThreadCount() :
+                         std::min(threadLimit, jobs.getThreadCount());
+  out << "software: " << triangleCount << " triangles, " << setupCount
+      << " after culling and clipping, " << binnedCount << " in "
+      << tilesX * tilesY << " tiles of " << TILE_SIZE << "x" << TILE_SIZE
+      << ", geometry " << std::fixed << std::setprecision(2) << geometryMs
+      << " ms, raster " << rasterMs << " ms on " << threads << " threads"
+      << std::endl;
+}
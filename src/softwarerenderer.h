@@ -0,0 +1,85 @@
+#ifndef softwarerenderer_h
+#define softwarerenderer_h
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+#include "renderbackend.h"
+#include "textureimage.h"
+
+// draws the model on the cpu without any gl context. the triangles are
+// transformed, clipped and binned into tiles in parallel chunks, then every
+// tile is filled by one thread four pixels at a time. textures are sampled
+// bilinearly from the mip level matching the pixel footprint
+class SoftwareRenderer : public RenderBackend {
+public:
+  const char* getName() const override { return "software"; }
+  void resize(int width, int height) override;
+  void render(Model &model, const RenderView &view) override;
+  void finish() override {}
+  void readPixels(std::vector<unsigned char> &pixels) override;
+  // caps the threads working on a frame, 0 uses all of the job system
+  void setThreadLimit(unsigned int threads) { threadLimit = threads; }
+  void report(std::ostream &out) const;
+private:
+  // clipped triangle in screen space. every value is a plane a*x + b*y + c
+  // over the pixel centers, the edges are the barycentric coordinates and
+  // the attributes are divided by w for perspective correct interpolation
+  struct Setup {
+    glm::vec3 edges[3];
+    glm::vec3 depth;
+    glm::vec3 inverseW;
+    glm::vec3 u;
+    glm::vec3 v;
+    glm::vec3 occlusion;
+    const TextureImage* texture;
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+  };
+  // one mesh placed by one of its nodes
+  struct Draw {
+    const Mesh* mesh;
+    const glm::mat4* transform;
+    const TextureImage* texture;
+    size_t firstVertex;
+    size_t firstTriangle;
+  };
+
+  int width = 0;
+  int height = 0;
+  // rows are padded to whole groups of four pixels
+  int stride = 0;
+  int tilesX = 0;
+  int tilesY = 0;
+  unsigned int threadLimit = 0;
+  std::vector<uint32_t> color;
+  std::vector<float> depth;
+
+  std::vector<Draw> draws;
+  std::vector<glm::vec4> clipPositions;
+  // setups of every chunk of triangles and the ones touching each tile,
+  // tiles walk the chunks in order so the draw order is kept
+  std::vector<std::vector<Setup>> chunkSetups;
+  std::vector<std::vector<unsigned int>> bins;
+
+  size_t triangleCount = 0;
+  size_t setupCount = 0;
+  size_t binnedCount = 0;
+  double geometryMs = 0.0;
+  double rasterMs = 0.0;
+
+  void forEach(size_t count, size_t grain,
+               const std::function<void(size_t, size_t)> &task);
+  void setupChunk(size_t chunk);
+  // attributes hold u, v and occlusion of each corner
+  void addTriangle(size_t chunk, const glm::vec4* clip,
+                   const glm::vec3* attributes, const TextureImage* texture);
+  void rasterizeTile(unsigned int tile);
+  void fillTriangle(const Setup &setup, int x0, int y0, int x1, int y1);
+  void shadePixel(const Setup &setup, float x, float y, size_t index);
+};
+
+#endif
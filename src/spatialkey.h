@@ -0,0 +1,51 @@
+#ifndef spatialkey_h
+#define spatialkey_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <glm/glm.hpp>
+
+// the cell of a point in a cube cut into 2^bits cells along every axis,
+// morton ordered with x in the high bit so the cells of every octree node
+// are contiguous when sorted
+struct MortonGrid {
+  glm::vec3 origin;
+  // cells per unit
+  float scale;
+  int bits;
+
+  uint32_t code(const glm::vec3 &point) const {
+    uint32_t result = 0;
+    const float last = (float)((1 << bits) - 1);
+    glm::vec3 cell = glm::clamp((point - origin) * scale, 0.0f, last);
+    uint32_t x = (uint32_t)cell.x;
+    uint32_t y = (uint32_t)cell.y;
+    uint32_t z = (uint32_t)cell.z;
+    for (int bit = bits - 1; bit >= 0; bit--)
+      result = result << 3 | ((x >> bit) & 1) << 2 | ((y >> bit) & 1) << 1 |
+               ((z >> bit) & 1);
+    return result;
+  }
+};
+
+// mixes the bits of the floats so the high bits spread as well as the low
+// ones, for hash tables and partitions of welded positions. -0 and 0 hash
+// the same
+inline uint64_t hashFloats(const float* values, unsigned int count) {
+  uint64_t hash = 0x9e3779b97f4a7c15ull;
+  for (unsigned int i = 0; i < count; i++) {
+    float value = values[i] == 0.0f ? 0.0f : values[i];
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    hash = (hash ^ bits) * 0xbf58476d1ce4e5b9ull;
+    hash ^= hash >> 31;
+  }
+  return hash;
+}
+
+inline uint64_t hashPosition(const glm::vec3 &position) {
+  return hashFloats(&position[0], 3);
+}
+
+#endif
@@ -0,0 +1,194 @@
+#include "stagingring.h"
+#include "glfeatures.h"
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+// blocks start on cache lines, rows of different writers never share one
+const size_t BLOCK_ALIGNMENT = 64;
+
+}
+
+void StagingRing::init(size_t capacity) {
+  this->capacity = capacity;
+  buffer = GpuBuffer("staging ring");
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id());
+  if (glFeatures.bufferStorage) {
+    // coherent, so the writes are visible to gl without a flush
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                       GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, flags);
+    memory = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+                                              capacity, flags);
+    persistent = memory != nullptr;
+    if (persistent)
+      buffer.setSize(capacity);
+    else {
+      // immutable storage can't be orphaned, the fallback needs a new one
+      buffer = GpuBuffer("staging ring");
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id());
+    }
+  }
+  if (!persistent) {
+    hostMemory.resize(capacity);
+    memory = hostMemory.data();
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  std::lock_guard<std::mutex> lock(mutex);
+  stopped = false;
+}
+
+void StagingRing::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+  }
+  space.notify_all();
+}
+
+void StagingRing::release() {
+  stop();
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const Fence &fence : fences)
+    glDeleteSync(fence.sync);
+  fences.clear();
+  entries.clear();
+  head = 0;
+  if (persistent) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id());
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+  buffer.reset();
+  hostMemory = std::vector<unsigned char>();
+  memory = nullptr;
+  persistent = false;
+}
+
+bool StagingRing::fits(size_t bytes, size_t &offset) const {
+  if (entries.empty()) {
+    offset = 0;
+    return bytes <= capacity;
+  }
+  size_t tail = entries.front().offset;
+  // the live blocks are [tail, head), the end and the start are free
+  if (head > tail) {
+    if (capacity - head >= bytes) {
+      offset = head;
+      return true;
+    }
+    offset = 0;
+    return tail >= bytes;
+  }
+  // the live blocks wrapped, only the gap up to the oldest one is free
+  offset = head;
+  return tail - head >= bytes;
+}
+
+bool StagingRing::reserve(size_t bytes, StagingBlock &block) {
+  size_t size = (bytes + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT *
+                BLOCK_ALIGNMENT;
+  std::unique_lock<std::mutex> lock(mutex);
+  if (size > capacity)
+    return false;
+  size_t offset = 0;
+  if (!stopped && !fits(size, offset)) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    space.wait(lock, [&]() { return stopped || fits(size, offset); });
+    waitMs += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+  }
+  if (stopped)
+    return false;
+  entries.push_back({ offset, size, false, 0 });
+  head = offset + size;
+  block.offset = offset;
+  block.size = bytes;
+  block.data = memory + offset;
+  return true;
+}
+
+void StagingRing::bind(const std::vector<StagingBlock> &blocks,
+                       std::vector<size_t> &offsets) {
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id());
+  offsets.clear();
+  if (persistent) {
+    for (const StagingBlock &block : blocks)
+      offsets.push_back(block.offset);
+    return;
+  }
+  size_t total = 0;
+  for (const StagingBlock &block : blocks) {
+    offsets.push_back(total);
+    total += block.size;
+  }
+  // orphaning hands the buffer of the last frame to the driver, which
+  // keeps it until the gpu read it
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, total, nullptr, GL_STREAM_DRAW);
+  buffer.setSize(total);
+  unsigned char* target = (unsigned char*)glMapBufferRange(
+      GL_PIXEL_UNPACK_BUFFER, 0, total,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  for (size_t i = 0; i < blocks.size(); i++)
+    if (target)
+      std::memcpy(target + offsets[i], blocks[i].data, blocks[i].size);
+    else
+      glBufferSubData(GL_PIXEL_UNPACK_BUFFER, offsets[i], blocks[i].size,
+                      blocks[i].data);
+  if (target)
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+}
+
+void StagingRing::unbind(const std::vector<StagingBlock> &blocks) {
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    // the copies of the fallback are done, its blocks are free right away
+    unsigned long long frame = 0;
+    if (persistent) {
+      frame = nextFrame++;
+      fences.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0),
+                         frame });
+    }
+    for (const StagingBlock &block : blocks)
+      for (Entry &entry : entries)
+        if (entry.offset == block.offset && !entry.released) {
+          entry.released = true;
+          entry.frame = frame;
+          break;
+        }
+  }
+  retire();
+}
+
+void StagingRing::retire() {
+  bool freed = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!fences.empty()) {
+      GLenum state = glClientWaitSync(fences.front().sync,
+                                      GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+      if (state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED)
+        break;
+      completedFrame = fences.front().frame;
+      glDeleteSync(fences.front().sync);
+      fences.pop_front();
+    }
+    while (!entries.empty() && entries.front().released &&
+           entries.front().frame <= completedFrame) {
+      entries.pop_front();
+      freed = true;
+    }
+    if (entries.empty())
+      head = 0;
+  }
+  if (freed)
+    space.notify_all();
+}
+
+double StagingRing::getWaitMs() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return waitMs;
+}
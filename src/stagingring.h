@@ -0,0 +1,83 @@
+#ifndef stagingring_h
+#define stagingring_h
+
+#include <glad/glad.h>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "gpuresource.h"
+
+// bytes of the ring handed to one writer, data stays valid until the
+// block is released and the gpu read it
+struct StagingBlock {
+  size_t offset = 0;
+  size_t size = 0;
+  unsigned char* data = nullptr;
+};
+
+// pixel unpack memory that any thread can write into while gl reads from
+// older blocks. with buffer storage the ring is one persistently mapped
+// buffer and fences tell when a block may be reused, on plain gl 3.3 the
+// ring lives in host memory and every upload is copied into a freshly
+// orphaned buffer
+class StagingRing {
+public:
+  // render thread, the context has to be current
+  void init(size_t capacity);
+  // any thread, wakes the waiting writers and fails every later reserve
+  void stop();
+  // render thread, frees the buffer once no writer touches a block
+  void release();
+  bool isPersistent() const { return persistent; }
+  size_t getCapacity() const { return capacity; }
+
+  // any thread, waits while the ring is full. false once released or for
+  // more bytes than the ring holds
+  bool reserve(size_t bytes, StagingBlock &block);
+  // the rest run on the render thread. binds the unpack buffer and gives
+  // the buffer offset gl reads each block from
+  void bind(const std::vector<StagingBlock> &blocks,
+            std::vector<size_t> &offsets);
+  // after the gl calls reading the blocks, unbinds the buffer. the blocks
+  // are reused once the gpu is past them
+  void unbind(const std::vector<StagingBlock> &blocks);
+  // frees the blocks the gpu is done with and wakes the writers
+  void retire();
+  // milliseconds the writers waited for space
+  double getWaitMs() const;
+private:
+  struct Entry {
+    size_t offset;
+    size_t size;
+    bool released;
+    unsigned long long frame;
+  };
+  struct Fence {
+    GLsync sync;
+    unsigned long long frame;
+  };
+
+  GpuBuffer buffer;
+  bool persistent = false;
+  bool stopped = true;
+  size_t capacity = 0;
+  unsigned char* memory = nullptr;
+  // host memory of the orphaning fallback
+  std::vector<unsigned char> hostMemory;
+
+  mutable std::mutex mutex;
+  std::condition_variable space;
+  // live blocks in the order they were reserved, freed from the front
+  std::deque<Entry> entries;
+  size_t head = 0;
+  std::deque<Fence> fences;
+  unsigned long long nextFrame = 1;
+  unsigned long long completedFrame = 0;
+  double waitMs = 0.0;
+
+  bool fits(size_t bytes, size_t &offset) const;
+};
+
+#endif
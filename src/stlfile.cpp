@@ -0,0 +1,14 @@
+#include "stlfile.h"
+#include <cstdint>
+
+bool openStlFile(const MappedFile &file, StlFile &stl) {
+  uint32_t count = 0;
+  if (!file.isOpen() || file.size() < 84)
+    return false;
+  std::memcpy(&count, file.data() + 80, sizeof(count));
+  if (file.size() != StlFile::record(count))
+    return false;
+  stl.file = &file;
+  stl.triangles = count;
+  return true;
+}
@@ -0,0 +1,33 @@
+#ifndef stlfile_h
+#define stlfile_h
+
+#include <cstddef>
+#include <cstring>
+#include <glm/glm.hpp>
+#include "mappedfile.h"
+
+// a binary stl in a mapped file: an 80 byte header, the triangle count and
+// 50 bytes per triangle with its normal, the three corners and 2 bytes of
+// attributes. the stored normals are often wrong and aren't read
+struct StlFile {
+  const MappedFile* file = nullptr;
+  size_t triangles = 0;
+
+  glm::vec3 corner(size_t triangle, unsigned int c) const {
+    float position[3];
+    std::memcpy(position, file->data() + record(triangle) + 12 + c * 12,
+                sizeof(position));
+    return glm::vec3(position[0], position[1], position[2]);
+  }
+  // lets the pages of the triangles from begin to end go
+  void release(size_t begin, size_t end) const {
+    file->release(record(begin), (end - begin) * 50);
+  }
+  static size_t record(size_t triangle) { return 84 + triangle * 50; }
+};
+
+// binary stl has no other signature than its size, false for ascii files
+// and anything else
+bool openStlFile(const MappedFile &file, StlFile &stl);
+
+#endif
@@ -0,0 +1,340 @@
+#include "texturecache.h"
+#include "contenthash.h"
+#include "jobsystem.h"
+#include <stb_image/stb_image.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char CACHE_MAGIC[8] = { 'o', 'm', 'v', 'b', 'c', '0', '0', '1' };
+const char LEVELS_MAGIC[8] = { 'o', 'm', 'v', 'r', 'g', 'b', '0', '1' };
+
+// a full chain of the largest size a cache entry may hold
+const int MAX_SIZE = 1 << 16;
+const uint32_t MAX_LEVELS = 17;
+
+// levels of a full chain from the size down to 1
+uint32_t levelsBelow(int size) {
+  uint32_t levels = 1;
+  while (size > 1) {
+    size >>= 1;
+    levels++;
+  }
+  return levels;
+}
+
+// the base sets the size of every level below it down to 1x1
+bool validLevel(uint32_t level, uint32_t levelCount, const int32_t size[2],
+                int baseWidth, int baseHeight) {
+  if (level == 0)
+    return size[0] > 0 && size[1] > 0 && size[0] <= MAX_SIZE &&
+           size[1] <= MAX_SIZE &&
+           levelCount <= levelsBelow(std::max(size[0], size[1]));
+  return size[0] == std::max(baseWidth >> level, 1) &&
+         size[1] == std::max(baseHeight >> level, 1);
+}
+
+// bytes from the read position to the end of the file
+uint64_t bytesLeft(std::ifstream &file) {
+  std::streampos position = file.tellg();
+  file.seekg(0, std::ios::end);
+  std::streampos end = file.tellg();
+  file.seekg(position);
+  return position < 0 || end < position ? 0 : (uint64_t)(end - position);
+}
+
+// a file next to the entry that no other process or thread writes, the
+// entry is renamed into place once it is complete
+std::string scratchPath(const std::string &path) {
+#ifdef _WIN32
+  int process = _getpid();
+#else
+  int process = (int)getpid();
+#endif
+  std::ostringstream name;
+  name << path << '.' << process << '.'
+       << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+  return name.str();
+}
+
+// readers see the old entry or the whole new one, never a partial file
+bool replaceEntry(const std::string &scratch, const std::string &path) {
+  if (std::rename(scratch.c_str(), path.c_str()) == 0)
+    return true;
+  // windows doesn't rename over an existing file
+  std::remove(path.c_str());
+  if (std::rename(scratch.c_str(), path.c_str()) == 0)
+    return true;
+  std::remove(scratch.c_str());
+  return false;
+}
+
+void makeDirectory(const std::string &path) {
+#ifdef _WIN32
+  _mkdir(path.c_str());
+#else
+  mkdir(path.c_str(), 0755);
+#endif
+}
+
+}
+
+TextureCache &TextureCache::get() {
+  static TextureCache cache;
+  return cache;
+}
+
+void TextureCache::setDirectory(const std::string &directory) {
+  this->directory = directory;
+  if (!directory.empty())
+    makeDirectory(directory);
+}
+
+bool TextureCache::load(const unsigned char* data, size_t size,
+                        const MipSettings &mips, CompressedImage &image) {
+  int width;
+  int height;
+  int channels;
+  if (!stbi_info_from_memory(data, (int)size, &width, &height, &channels))
+    return false;
+
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  std::string path = entryPath(data, size, mips, ".bc");
+  double psnr = 0.0;
+  bool cached = readEntry(path, image, psnr);
+  size_t texels = 0;
+  bool written = true;
+  if (!cached) {
+    unsigned char* pixels = stbi_load_from_memory(data, (int)size, &width,
+                                                  &height, &channels, 0);
+    if (!pixels)
+      return false;
+    TextureImage decoded = buildTextureImage(pixels, width, height,
+                                             channels, mips);
+    stbi_image_free(pixels);
+    image = compressImage(decoded, chooseBlockFormat(decoded, mips.normalMap));
+    for (const TextureImage::Level &level : decoded.levels)
+      texels += (size_t)level.width * level.height;
+    psnr = computePsnr(decoded, image);
+    written = writeEntry(path, image, psnr);
+  }
+  double ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+
+  // the streaming threads load textures side by side
+  std::lock_guard<std::mutex> lock(mutex);
+  if (cached)
+    readMs += ms;
+  else {
+    encodeMs += ms;
+    encodedTexels += texels;
+    encoded++;
+  }
+  failedWrites += written ? 0 : 1;
+  textures++;
+  // the mip chain adds about a third to the base level
+  uncompressedBytes += (size_t)width * height * channels * 4 / 3;
+  compressedBytes += image.size();
+  psnrSum[image.format] += psnr;
+  psnrCount[image.format]++;
+  return true;
+}
+
+bool TextureCache::readLevels(const unsigned char* data, size_t size,
+                              const MipSettings &mips, TextureImage &image,
+                              int &channels) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  std::ifstream file(entryPath(data, size, mips, ".rgba"), std::ios::binary);
+  char magic[8];
+  uint32_t channelCount = 0;
+  uint32_t levelCount = 0;
+  if (!file.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, LEVELS_MAGIC, sizeof(magic)) != 0 ||
+      !file.read((char*)&channelCount, sizeof(channelCount)) ||
+      channelCount == 0 || channelCount > 4 ||
+      !file.read((char*)&levelCount, sizeof(levelCount)) ||
+      levelCount == 0 || levelCount > MAX_LEVELS)
+    return false;
+  TextureImage entry;
+  entry.levels.resize(levelCount);
+  for (uint32_t i = 0; i < levelCount; i++) {
+    TextureImage::Level &level = entry.levels[i];
+    int32_t size[2];
+    uint64_t bytes = 0;
+    // the sizes are checked against the file before anything is allocated
+    if (!file.read((char*)size, sizeof(size)) ||
+        !file.read((char*)&bytes, sizeof(bytes)) ||
+        !validLevel(i, levelCount, size, entry.levels[0].width,
+                    entry.levels[0].height) ||
+        bytes != (uint64_t)size[0] * size[1] * 4 || bytes > bytesLeft(file))
+      return false;
+    level.width = size[0];
+    level.height = size[1];
+    level.rgba.resize(bytes);
+    if (!file.read((char*)level.rgba.data(), bytes))
+      return false;
+  }
+  image = std::move(entry);
+  channels = (int)channelCount;
+
+  double ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  std::lock_guard<std::mutex> lock(mutex);
+  levelsRead++;
+  readMs += ms;
+  return true;
+}
+
+void TextureCache::storeLevels(const unsigned char* data, size_t size,
+                               const MipSettings &mips,
+                               const TextureImage &image, int channels) {
+  std::string path = entryPath(data, size, mips, ".rgba");
+  std::string scratch = scratchPath(path);
+  std::ofstream file(scratch, std::ios::binary | std::ios::trunc);
+  uint32_t channelCount = (uint32_t)channels;
+  uint32_t levelCount = (uint32_t)image.levels.size();
+  file.write(LEVELS_MAGIC, sizeof(LEVELS_MAGIC));
+  file.write((const char*)&channelCount, sizeof(channelCount));
+  file.write((const char*)&levelCount, sizeof(levelCount));
+  for (const TextureImage::Level &level : image.levels) {
+    int32_t size[2] = { level.width, level.height };
+    uint64_t bytes = level.rgba.size();
+    file.write((const char*)size, sizeof(size));
+    file.write((const char*)&bytes, sizeof(bytes));
+    file.write((const char*)level.rgba.data(), bytes);
+  }
+  file.close();
+  bool written = file && replaceEntry(scratch, path);
+  if (!written)
+    std::remove(scratch.c_str());
+  std::lock_guard<std::mutex> lock(mutex);
+  levelsWritten += written ? 1 : 0;
+  failedWrites += written ? 0 : 1;
+}
+
+std::string TextureCache::entryPath(const unsigned char* data, size_t size,
+                                    const MipSettings &mips,
+                                    const char* extension) const {
+  // the usage picks the format and the filter the levels, both are part
+  // of the key
+  uint32_t usage[3] = { (uint32_t)mips.filter, mips.srgb, mips.normalMap };
+  uint64_t hash = hashBytes(data, size);
+  hash = hashBytes(usage, sizeof(usage), hash);
+  std::ostringstream name;
+  name << directory << '/' << std::hex << std::setw(16) << std::setfill('0')
+       << hash << extension;
+  return name.str();
+}
+
+bool TextureCache::readEntry(const std::string &path, CompressedImage &image,
+                             double &psnr) const {
+  std::ifstream file(path, std::ios::binary);
+  char magic[8];
+  uint32_t format = 0;
+  uint32_t levelCount = 0;
+  if (!file.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 ||
+      !file.read((char*)&format, sizeof(format)) || format > BLOCK_BC5 ||
+      !file.read((char*)&levelCount, sizeof(levelCount)) ||
+      levelCount == 0 || levelCount > MAX_LEVELS ||
+      !file.read((char*)&psnr, sizeof(psnr)))
+    return false;
+  // a damaged or foreign entry is a miss, the texture is encoded again
+  CompressedImage entry;
+  entry.format = (BlockFormat)format;
+  entry.levels.resize(levelCount);
+  for (uint32_t i = 0; i < levelCount; i++) {
+    CompressedImage::Level &level = entry.levels[i];
+    int32_t size[2];
+    uint64_t bytes = 0;
+    if (!file.read((char*)size, sizeof(size)) ||
+        !file.read((char*)&bytes, sizeof(bytes)))
+      return false;
+    if (!validLevel(i, levelCount, size, entry.levels[0].width,
+                    entry.levels[0].height) ||
+        bytes != (uint64_t)((size[0] + 3) / 4) * ((size[1] + 3) / 4) *
+                 blockBytes(entry.format) || bytes > bytesLeft(file))
+      return false;
+    level.width = size[0];
+    level.height = size[1];
+    level.blocks.resize(bytes);
+    if (!file.read((char*)level.blocks.data(), bytes))
+      return false;
+  }
+  image = std::move(entry);
+  return true;
+}
+
+bool TextureCache::writeEntry(const std::string &path,
+                              const CompressedImage &image,
+                              double psnr) const {
+  std::string scratch = scratchPath(path);
+  std::ofstream file(scratch, std::ios::binary | std::ios::trunc);
+  uint32_t format = image.format;
+  uint32_t levelCount = (uint32_t)image.levels.size();
+  file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  file.write((const char*)&format, sizeof(format));
+  file.write((const char*)&levelCount, sizeof(levelCount));
+  file.write((const char*)&psnr, sizeof(psnr));
+  for (const CompressedImage::Level &level : image.levels) {
+    int32_t size[2] = { level.width, level.height };
+    uint64_t bytes = level.blocks.size();
+    file.write((const char*)size, sizeof(size));
+    file.write((const char*)&bytes, sizeof(bytes));
+    file.write((const char*)level.blocks.data(), bytes);
+  }
+  file.close();
+  if (file && replaceEntry(scratch, path))
+    return true;
+  std::remove(scratch.c_str());
+  return false;
+}
+
+void TextureCache::report(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!isEnabled() || textures + levelsRead + levelsWritten == 0)
+    return;
+  const double mb = 1024.0 * 1024.0;
+  out << "texture compression: " << textures << " textures, " << encoded
+      << " encoded";
+  if (encoded > 0)
+    out << " in " << std::fixed << std::setprecision(1) << encodeMs
+        << " ms (" << std::setprecision(2)
+        << encodedTexels / std::max(encodeMs, 1e-3) / 1e3
+        << " million texels per second on "
+        << JobSystem::get().getThreadCount() << " threads)";
+  out << ", " << textures - encoded << " read from " << directory << " in "
+      << std::fixed << std::setprecision(1) << readMs << " ms, "
+      << std::setprecision(2) << compressedBytes / mb << " MB instead of "
+      << uncompressedBytes / mb << " MB";
+  for (unsigned int format = 0; format < 3; format++)
+    if (psnrCount[format] > 0)
+      out << ", " << blockFormatName((BlockFormat)format) << " "
+          << psnrCount[format] << "x at " << std::setprecision(1)
+          << psnrSum[format] / psnrCount[format] << " dB";
+  if (levelsRead + levelsWritten > 0)
+    out << ", " << levelsWritten << " uncompressed mip chains stored and "
+        << levelsRead << " read";
+  if (failedWrites > 0)
+    out << ", " << failedWrites << " not writable";
+  out << std::endl;
+}
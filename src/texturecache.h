@@ -0,0 +1,66 @@
+#ifndef texturecache_h
+#define texturecache_h
+
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include "texturecompression.h"
+
+// block compressed mip chains stored under the hash of the source file,
+// a texture is encoded once and later runs upload the cached blocks. the
+// rgba chains are kept as well where the blocks can't be used
+class TextureCache {
+public:
+  static TextureCache &get();
+
+  // creates the directory, an empty one turns the compression off
+  void setDirectory(const std::string &directory);
+  bool isEnabled() const { return !directory.empty(); }
+  // reads the compressed texture of the encoded file, or decodes, builds
+  // the levels with the settings, encodes and stores it. false when the
+  // file isn't an image, several threads may load at once
+  bool load(const unsigned char* data, size_t size,
+            const MipSettings &mips, CompressedImage &image);
+  // the filtered rgba levels and the channel count of the file, stored by
+  // storeLevels for contexts without the block formats. false when there
+  // is no valid entry
+  bool readLevels(const unsigned char* data, size_t size,
+                  const MipSettings &mips, TextureImage &image,
+                  int &channels);
+  void storeLevels(const unsigned char* data, size_t size,
+                   const MipSettings &mips, const TextureImage &image,
+                   int channels);
+  // encode throughput, quality and the memory saved so far
+  void report(std::ostream &out) const;
+private:
+  TextureCache() {}
+
+  std::string directory;
+  mutable std::mutex mutex;
+  unsigned int textures = 0;
+  unsigned int encoded = 0;
+  unsigned int failedWrites = 0;
+  double encodeMs = 0.0;
+  double readMs = 0.0;
+  size_t encodedTexels = 0;
+  // what the uncompressed upload with its mip chain would take
+  size_t uncompressedBytes = 0;
+  size_t compressedBytes = 0;
+  // averaged per block format, cached textures keep their measured value
+  double psnrSum[3] = {};
+  unsigned int psnrCount[3] = {};
+  unsigned int levelsRead = 0;
+  unsigned int levelsWritten = 0;
+
+  // file in the directory named by the hash of the image and its usage
+  std::string entryPath(const unsigned char* data, size_t size,
+                        const MipSettings &mips, const char* extension) const;
+
+  bool readEntry(const std::string &path, CompressedImage &image,
+                 double &psnr) const;
+  bool writeEntry(const std::string &path, const CompressedImage &image,
+                  double psnr) const;
+};
+
+#endif
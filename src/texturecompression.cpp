@@ -0,0 +1,496 @@
+#include "texturecompression.h"
+#include "jobsystem.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BLOCK_SSE
+#endif
+
+namespace {
+
+// least squares passes over the endpoints after the principal axis guess
+const unsigned int REFINE_PASSES = 2;
+
+// rgb of the 16 texels, kept per channel for four wide loops
+struct ColorBlock {
+  float r[16];
+  float g[16];
+  float b[16];
+};
+
+uint16_t packColor(const glm::vec3 &color) {
+  glm::vec3 clamped = glm::clamp(color, 0.0f, 255.0f);
+  unsigned int r = (unsigned int)(clamped.r * 31.0f / 255.0f + 0.5f);
+  unsigned int g = (unsigned int)(clamped.g * 63.0f / 255.0f + 0.5f);
+  unsigned int b = (unsigned int)(clamped.b * 31.0f / 255.0f + 0.5f);
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+// the high bits are repeated in the low ones like the hardware expands them
+glm::ivec3 unpackColor(uint16_t color) {
+  int r = (color >> 11) & 31;
+  int g = (color >> 5) & 63;
+  int b = color & 31;
+  return glm::ivec3((r << 3) | (r >> 2), (g << 2) | (g >> 4),
+                    (b << 3) | (b >> 2));
+}
+
+// the four colours of a block whose first endpoint is the larger one
+void colorPalette(uint16_t color0, uint16_t color1, glm::ivec3 palette[4]) {
+  palette[0] = unpackColor(color0);
+  palette[1] = unpackColor(color1);
+  palette[2] = (palette[0] * 2 + palette[1]) / 3;
+  palette[3] = (palette[0] + palette[1] * 2) / 3;
+}
+
+// picks the closest palette entry for every texel and returns the summed
+// squared error
+float fitIndices(const ColorBlock &block, const glm::ivec3 palette[4],
+                 uint32_t &indices) {
+  indices = 0;
+  float error = 0.0f;
+#ifdef BLOCK_SSE
+  for (unsigned int i = 0; i < 16; i += 4) {
+    __m128 r = _mm_loadu_ps(block.r + i);
+    __m128 g = _mm_loadu_ps(block.g + i);
+    __m128 b = _mm_loadu_ps(block.b + i);
+    __m128 best = _mm_set1_ps(1e30f);
+    __m128i bestIndex = _mm_setzero_si128();
+    for (int k = 0; k < 4; k++) {
+      __m128 dr = _mm_sub_ps(r, _mm_set1_ps((float)palette[k].r));
+      __m128 dg = _mm_sub_ps(g, _mm_set1_ps((float)palette[k].g));
+      __m128 db = _mm_sub_ps(b, _mm_set1_ps((float)palette[k].b));
+      __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr),
+                                              _mm_mul_ps(dg, dg)),
+                                   _mm_mul_ps(db, db));
+      __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+      best = _mm_min_ps(distance, best);
+      bestIndex = _mm_or_si128(_mm_andnot_si128(closer, bestIndex),
+                               _mm_and_si128(closer, _mm_set1_epi32(k)));
+    }
+    float lanes[4];
+    int32_t lanesIndex[4];
+    _mm_storeu_ps(lanes, best);
+    _mm_storeu_si128((__m128i*)lanesIndex, bestIndex);
+    for (unsigned int k = 0; k < 4; k++) {
+      error += lanes[k];
+      indices |= (uint32_t)lanesIndex[k] << ((i + k) * 2);
+    }
+  }
+#else
+  for (unsigned int i = 0; i < 16; i++) {
+    float best = 1e30f;
+    uint32_t bestIndex = 0;
+    for (uint32_t k = 0; k < 4; k++) {
+      float dr = block.r[i] - palette[k].r;
+      float dg = block.g[i] - palette[k].g;
+      float db = block.b[i] - palette[k].b;
+      float distance = dr * dr + dg * dg + db * db;
+      if (distance < best) {
+        best = distance;
+        bestIndex = k;
+      }
+    }
+    error += best;
+    indices |= bestIndex << (i * 2);
+  }
+#endif
+  return error;
+}
+
+// quantizes the endpoints into the 4 colour mode, the first one has to be
+// the larger value. equal endpoints only need the first index
+float encodeEndpoints(const ColorBlock &block, const glm::vec3 &start,
+                      const glm::vec3 &end, uint16_t &color0,
+                      uint16_t &color1, uint32_t &indices) {
+  color0 = packColor(start);
+  color1 = packColor(end);
+  if (color0 < color1)
+    std::swap(color0, color1);
+  glm::ivec3 palette[4];
+  colorPalette(color0, color1, palette);
+  float error = fitIndices(block, palette, indices);
+  if (color0 == color1)
+    indices = 0;
+  return error;
+}
+
+void writeColorBlock(uint16_t color0, uint16_t color1, uint32_t indices,
+                     unsigned char* out) {
+  out[0] = (unsigned char)(color0 & 0xff);
+  out[1] = (unsigned char)(color0 >> 8);
+  out[2] = (unsigned char)(color1 & 0xff);
+  out[3] = (unsigned char)(color1 >> 8);
+  for (unsigned int i = 0; i < 4; i++)
+    out[4 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+// endpoints on the principal axis of the colours, then refined by least
+// squares for the chosen indices
+void encodeColorBlock(const unsigned char* rgba, unsigned char* out) {
+  ColorBlock block;
+  glm::vec3 mean(0.0f);
+  for (unsigned int i = 0; i < 16; i++) {
+    block.r[i] = rgba[i * 4];
+    block.g[i] = rgba[i * 4 + 1];
+    block.b[i] = rgba[i * 4 + 2];
+    mean += glm::vec3(block.r[i], block.g[i], block.b[i]);
+  }
+  mean /= 16.0f;
+  glm::mat3 covariance(0.0f);
+  for (unsigned int i = 0; i < 16; i++) {
+    glm::vec3 d = glm::vec3(block.r[i], block.g[i], block.b[i]) - mean;
+    covariance += glm::outerProduct(d, d);
+  }
+  // power iteration from the luminance direction
+  glm::vec3 axis(0.299f, 0.587f, 0.114f);
+  for (unsigned int i = 0; i < 8; i++) {
+    axis = covariance * axis;
+    float length = glm::length(axis);
+    if (length < 1e-6f)
+      break;
+    axis /= length;
+  }
+  float low = 0.0f;
+  float high = 0.0f;
+  for (unsigned int i = 0; i < 16; i++) {
+    float t = glm::dot(glm::vec3(block.r[i], block.g[i], block.b[i]) - mean,
+                       axis);
+    low = std::min(low, t);
+    high = std::max(high, t);
+  }
+  // pulling the ends in by a sixteenth keeps the middle colours closer
+  float inset = (high - low) / 16.0f;
+  uint16_t color0;
+  uint16_t color1;
+  uint32_t indices;
+  float error = encodeEndpoints(block, mean + axis * (high - inset),
+                                mean + axis * (low + inset), color0, color1,
+                                indices);
+
+  // position of every index between the endpoints
+  static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+  for (unsigned int pass = 0; pass < REFINE_PASSES && error > 0.0f; pass++) {
+    float aa = 0.0f;
+    float ab = 0.0f;
+    float bb = 0.0f;
+    glm::vec3 ax(0.0f);
+    glm::vec3 bx(0.0f);
+    for (unsigned int i = 0; i < 16; i++) {
+      float t = weights[(indices >> (i * 2)) & 3];
+      glm::vec3 texel(block.r[i], block.g[i], block.b[i]);
+      aa += (1.0f - t) * (1.0f - t);
+      ab += (1.0f - t) * t;
+      bb += t * t;
+      ax += (1.0f - t) * texel;
+      bx += t * texel;
+    }
+    float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) < 1e-6f)
+      break;
+    glm::vec3 start = (bb * ax - ab * bx) / determinant;
+    glm::vec3 end = (aa * bx - ab * ax) / determinant;
+    uint16_t refined0;
+    uint16_t refined1;
+    uint32_t refinedIndices;
+    float refinedError = encodeEndpoints(block, start, end, refined0,
+                                         refined1, refinedIndices);
+    if (refinedError >= error)
+      break;
+    error = refinedError;
+    color0 = refined0;
+    color1 = refined1;
+    indices = refinedIndices;
+  }
+  writeColorBlock(color0, color1, indices, out);
+}
+
+// one channel with eight levels between its extremes, used for the alpha
+// of bc3 and both channels of bc5
+void encodeChannelBlock(const unsigned char* rgba, unsigned int channel,
+                        unsigned char* out) {
+  int high = 0;
+  int low = 255;
+  for (unsigned int i = 0; i < 16; i++) {
+    high = std::max(high, (int)rgba[i * 4 + channel]);
+    low = std::min(low, (int)rgba[i * 4 + channel]);
+  }
+  out[0] = (unsigned char)high;
+  out[1] = (unsigned char)low;
+  uint64_t bits = 0;
+  if (high > low)
+    for (unsigned int i = 0; i < 16; i++) {
+      // steps from the first endpoint, index 1 is the second endpoint
+      // and 2 to 7 lie in between
+      int step = ((high - rgba[i * 4 + channel]) * 7 + (high - low) / 2) /
+                 (high - low);
+      uint64_t index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+      bits |= index << (i * 3);
+    }
+  for (unsigned int i = 0; i < 6; i++)
+    out[2 + i] = (unsigned char)(bits >> (i * 8));
+}
+
+void decodeColorBlock(const unsigned char* in, bool threeColor,
+                      unsigned char* rgba) {
+  uint16_t color0 = (uint16_t)(in[0] | (in[1] << 8));
+  uint16_t color1 = (uint16_t)(in[2] | (in[3] << 8));
+  uint32_t indices = in[4] | (in[5] << 8) | (in[6] << 16) |
+                     ((uint32_t)in[7] << 24);
+  glm::ivec3 palette[4];
+  colorPalette(color0, color1, palette);
+  // bc1 blocks with the smaller endpoint first have three colours and
+  // black, bc3 always uses four
+  bool transparent = false;
+  if (threeColor && color0 <= color1) {
+    palette[2] = (palette[0] + palette[1]) / 2;
+    palette[3] = glm::ivec3(0);
+    transparent = true;
+  }
+  for (unsigned int i = 0; i < 16; i++) {
+    unsigned int index = (indices >> (i * 2)) & 3;
+    rgba[i * 4] = (unsigned char)palette[index].r;
+    rgba[i * 4 + 1] = (unsigned char)palette[index].g;
+    rgba[i * 4 + 2] = (unsigned char)palette[index].b;
+    rgba[i * 4 + 3] = transparent && index == 3 ? 0 : 255;
+  }
+}
+
+void decodeChannelBlock(const unsigned char* in, unsigned int channel,
+                        unsigned char* rgba) {
+  int first = in[0];
+  int second = in[1];
+  int values[8] = { first, second };
+  if (first > second)
+    for (int i = 2; i < 8; i++)
+      values[i] = ((8 - i) * first + (i - 1) * second) / 7;
+  else {
+    for (int i = 2; i < 6; i++)
+      values[i] = ((6 - i) * first + (i - 1) * second) / 5;
+    values[6] = 0;
+    values[7] = 255;
+  }
+  uint64_t bits = 0;
+  for (unsigned int i = 0; i < 6; i++)
+    bits |= (uint64_t)in[2 + i] << (i * 8);
+  for (unsigned int i = 0; i < 16; i++)
+    rgba[i * 4 + channel] = (unsigned char)values[(bits >> (i * 3)) & 7];
+}
+
+void encodeBlock(BlockFormat format, const unsigned char* rgba,
+                 unsigned char* out) {
+  switch (format) {
+  case BLOCK_BC1:
+    encodeColorBlock(rgba, out);
+    break;
+  case BLOCK_BC3:
+    encodeChannelBlock(rgba, 3, out);
+    encodeColorBlock(rgba, out + 8);
+    break;
+  case BLOCK_BC5:
+    encodeChannelBlock(rgba, 0, out);
+    encodeChannelBlock(rgba, 1, out + 8);
+    break;
+  }
+}
+
+void decodeBlock(BlockFormat format, const unsigned char* in,
+                 unsigned char* rgba) {
+  switch (format) {
+  case BLOCK_BC1:
+    decodeColorBlock(in, true, rgba);
+    break;
+  case BLOCK_BC3:
+    decodeColorBlock(in + 8, false, rgba);
+    decodeChannelBlock(in, 3, rgba);
+    break;
+  case BLOCK_BC5:
+    decodeChannelBlock(in, 0, rgba);
+    decodeChannelBlock(in + 8, 1, rgba);
+    for (unsigned int i = 0; i < 16; i++) {
+      rgba[i * 4 + 2] = 0;
+      rgba[i * 4 + 3] = 255;
+    }
+    break;
+  }
+}
+
+int blocksAcross(int size) {
+  return (size + 3) / 4;
+}
+
+}
+
+size_t CompressedImage::size() const {
+  size_t bytes = 0;
+  for (const Level &level : levels)
+    bytes += level.blocks.size();
+  return bytes;
+}
+
+unsigned int blockBytes(BlockFormat format) {
+  return format == BLOCK_BC1 ? 8 : 16;
+}
+
+const char* blockFormatName(BlockFormat format) {
+  switch (format) {
+  case BLOCK_BC1:
+    return "bc1";
+  case BLOCK_BC3:
+    return "bc3";
+  case BLOCK_BC5:
+    return "bc5";
+  }
+  return "unknown";
+}
+
+BlockFormat chooseBlockFormat(const TextureImage &image, bool normalMap) {
+  if (normalMap)
+    return BLOCK_BC5;
+  const std::vector<unsigned char> &rgba = image.levels[0].rgba;
+  for (size_t i = 3; i < rgba.size(); i += 4)
+    if (rgba[i] != 255)
+      return BLOCK_BC3;
+  return BLOCK_BC1;
+}
+
+CompressedImage compressImage(const TextureImage &image, BlockFormat format) {
+  CompressedImage result;
+  result.format = format;
+  // the blocks of every level in one loop, found through the first block
+  // of each level
+  std::vector<size_t> firstBlock;
+  size_t total = 0;
+  for (const TextureImage::Level &level : image.levels) {
+    CompressedImage::Level compressed;
+    compressed.width = level.width;
+    compressed.height = level.height;
+    size_t blocks = (size_t)blocksAcross(level.width) *
+                    blocksAcross(level.height);
+    compressed.blocks.resize(blocks * blockBytes(format));
+    result.levels.push_back(std::move(compressed));
+    firstBlock.push_back(total);
+    total += blocks;
+  }
+
+  JobSystem::get().parallelFor(total, 256, [&](size_t begin, size_t end) {
+    size_t level = std::upper_bound(firstBlock.begin(), firstBlock.end(),
+                                    begin) - firstBlock.begin() - 1;
+    unsigned char texels[64];
+    for (size_t global = begin; global < end; global++) {
+      while (level + 1 < firstBlock.size() && global >= firstBlock[level + 1])
+        level++;
+      const TextureImage::Level &source = image.levels[level];
+      int across = blocksAcross(source.width);
+      size_t block = global - firstBlock[level];
+      int x0 = (int)(block % across) * 4;
+      int y0 = (int)(block / across) * 4;
+      // blocks over the border repeat the last row and column
+      for (int y = 0; y < 4; y++)
+        for (int x = 0; x < 4; x++) {
+          int sx = std::min(x0 + x, source.width - 1);
+          int sy = std::min(y0 + y, source.height - 1);
+          const unsigned char* texel =
+              &source.rgba[((size_t)sy * source.width + sx) * 4];
+          std::copy(texel, texel + 4, texels + (y * 4 + x) * 4);
+        }
+      encodeBlock(format, texels,
+                  &result.levels[level].blocks[block * blockBytes(format)]);
+    }
+  });
+  return result;
+}
+
+std::vector<unsigned char> decompressLevel(const CompressedImage::Level &level,
+                                           BlockFormat format) {
+  std::vector<unsigned char> rgba((size_t)level.width * level.height * 4);
+  int across = blocksAcross(level.width);
+  int down = blocksAcross(level.height);
+  unsigned char texels[64];
+  for (int by = 0; by < down; by++)
+    for (int bx = 0; bx < across; bx++) {
+      decodeBlock(format, &level.blocks[((size_t)by * across + bx) *
+                                        blockBytes(format)], texels);
+      for (int y = 0; y < 4 && by * 4 + y < level.height; y++)
+        for (int x = 0; x < 4 && bx * 4 + x < level.width; x++)
+          std::copy(texels + (y * 4 + x) * 4, texels + (y * 4 + x) * 4 + 4,
+                    &rgba[((size_t)(by * 4 + y) * level.width + bx * 4 + x) *
+                          4]);
+    }
+  return rgba;
+}
+
+double computePsnr(const TextureImage &image,
+                   const CompressedImage &compressed) {
+  unsigned int channels = compressed.format == BLOCK_BC1 ? 3 :
+                          compressed.format == BLOCK_BC3 ? 4 : 2;
+  double squared = 0.0;
+  size_t samples = 0;
+  for (size_t level = 0; level < compressed.levels.size(); level++) {
+    std::vector<unsigned char> decoded =
+        decompressLevel(compressed.levels[level], compressed.format);
+    const std::vector<unsigned char> &source = image.levels[level].rgba;
+    for (size_t i = 0; i < source.size(); i += 4)
+      for (unsigned int c = 0; c < channels; c++) {
+        double d = (double)source[i + c] - decoded[i + c];
+        squared += d * d;
+      }
+    samples += source.size() / 4 * channels;
+  }
+  // identical images have no noise, reported as 100 db
+  if (squared == 0.0 || samples == 0)
+    return 100.0;
+  return 10.0 * std::log10(255.0 * 255.0 * samples / squared);
+}
+
+bool checkBlockCompression(std::ostream &out) {
+  // smooth ramps with a sharp edge, sized so the border blocks are partial
+  const int width = 37;
+  const int height = 21;
+  std::vector<unsigned char> pixels((size_t)width * height * 4);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++) {
+      unsigned char* texel = &pixels[((size_t)y * width + x) * 4];
+      texel[0] = (unsigned char)(x * 255 / (width - 1));
+      texel[1] = (unsigned char)(y * 255 / (height - 1));
+      texel[2] = x < width / 2 ? 40 : 220;
+      texel[3] = (unsigned char)((x + y) * 255 / (width + height - 2));
+    }
+  TextureImage image = buildTextureImage(pixels.data(), width, height, 4);
+  // a solid texel whose colour 565 keeps exactly must come back unchanged
+  const unsigned char solid[4] = { 255, 0, 255, 0 };
+  TextureImage flat = buildTextureImage(solid, 1, 1, 4);
+
+  // lowest psnr each format has to reach on the ramps
+  const double minimum[3] = { 27.0, 28.0, 38.0 };
+  bool passed = true;
+  for (unsigned int format = 0; format < 3; format++) {
+    BlockFormat blockFormat = (BlockFormat)format;
+    CompressedImage compressed = compressImage(image, blockFormat);
+    bool sizes = compressed.levels.size() == image.levels.size();
+    for (size_t level = 0; sizes && level < compressed.levels.size();
+         level++) {
+      const CompressedImage::Level &blocks = compressed.levels[level];
+      sizes = blocks.width == image.levels[level].width &&
+              blocks.height == image.levels[level].height &&
+              blocks.blocks.size() == (size_t)blocksAcross(blocks.width) *
+                  blocksAcross(blocks.height) * blockBytes(blockFormat) &&
+              decompressLevel(blocks, blockFormat).size() ==
+                  image.levels[level].rgba.size();
+    }
+    double psnr = computePsnr(image, compressed);
+    double flatPsnr = computePsnr(flat, compressImage(flat, blockFormat));
+    bool ok = sizes && psnr >= minimum[format] && flatPsnr >= 100.0;
+    out << blockFormatName(blockFormat) << ": " << (ok ? "ok" : "FAILED")
+        << ", " << std::fixed << std::setprecision(1) << psnr
+        << " dB on the ramps, " << flatPsnr << " dB on a solid texel"
+        << (sizes ? "" : ", wrong level sizes") << std::endl;
+    passed = passed && ok;
+  }
+  return passed;
+}
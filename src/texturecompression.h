@@ -0,0 +1,49 @@
+#ifndef texturecompression_h
+#define texturecompression_h
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+#include "textureimage.h"
+
+// 4x4 block formats the encoder writes. bc1 keeps rgb in 8 bytes, bc3 adds
+// an alpha block and bc5 stores two independent channels for normal maps
+enum BlockFormat {
+  BLOCK_BC1,
+  BLOCK_BC3,
+  BLOCK_BC5
+};
+
+// every level of a texture in one block format, rows of blocks from the
+// top like the decoded images
+struct CompressedImage {
+  struct Level {
+    int width;
+    int height;
+    std::vector<unsigned char> blocks;
+  };
+  BlockFormat format = BLOCK_BC1;
+  std::vector<Level> levels;
+
+  size_t size() const;
+};
+
+unsigned int blockBytes(BlockFormat format);
+const char* blockFormatName(BlockFormat format);
+// bc5 for normal maps, bc3 when any texel isn't opaque and bc1 otherwise
+BlockFormat chooseBlockFormat(const TextureImage &image, bool normalMap);
+
+// encodes the blocks of all levels in parallel on the job system
+CompressedImage compressImage(const TextureImage &image, BlockFormat format);
+// rgba8 of one level, bc5 has blue 0 and alpha 255 like the gl decoder
+std::vector<unsigned char> decompressLevel(const CompressedImage::Level &level,
+                                           BlockFormat format);
+// peak signal to noise ratio over all levels and the channels the format
+// keeps, in decibels
+double computePsnr(const TextureImage &image,
+                   const CompressedImage &compressed);
+// encodes and decodes ramps and a solid texel in every format and prints
+// whether the sizes and the quality hold, false when one doesn't
+bool checkBlockCompression(std::ostream &out);
+
+#endif
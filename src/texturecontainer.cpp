@@ -0,0 +1,364 @@
+#include "texturecontainer.h"
+#include "glfeatures.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+const unsigned char DDS_MAGIC[4] = { 'D', 'D', 'S', ' ' };
+const unsigned char KTX2_MAGIC[12] = { 0xab, 'K', 'T', 'X', ' ', '2', '0',
+                                       0xbb, '\r', '\n', 0x1a, '\n' };
+
+const size_t DDS_HEADER_SIZE = 128;
+const size_t DDS_DX10_HEADER_SIZE = 20;
+const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+const uint32_t DDPF_ALPHAPIXELS = 0x1;
+const uint32_t DDPF_FOURCC = 0x4;
+const uint32_t DDPF_RGB = 0x40;
+const uint32_t DDPF_LUMINANCE = 0x20000;
+const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+const uint32_t DDSCAPS2_VOLUME = 0x200000;
+const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+const size_t KTX2_HEADER_SIZE = 80;
+const size_t KTX2_LEVEL_SIZE = 24;
+const uint32_t KTX2_SUPERCOMPRESSION_BASISLZ = 1;
+// larger than any gl implementation allows, keeps the level sizes far from
+// overflowing
+const int MAX_TEXTURE_SIZE = 1 << 16;
+
+uint32_t read32(const unsigned char* data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint64_t read64(const unsigned char* data) {
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint32_t fourCC(const char* code) {
+  return (uint32_t)code[0] | ((uint32_t)code[1] << 8) |
+         ((uint32_t)code[2] << 16) | ((uint32_t)code[3] << 24);
+}
+
+void setCompressed(TextureContainer &container, GLenum internalFormat) {
+  container.internalFormat = internalFormat;
+  container.compressed = true;
+}
+
+void setUncompressed(TextureContainer &container, GLenum internalFormat,
+                     GLenum format) {
+  container.internalFormat = internalFormat;
+  container.compressed = false;
+  container.format = format;
+  container.type = GL_UNSIGNED_BYTE;
+}
+
+// bytes of a 4x4 block, 0 for uncompressed formats
+size_t blockSize(GLenum internalFormat) {
+  switch (internalFormat) {
+  case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_RED_RGTC1:
+    return 8;
+  case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+  case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+  case GL_COMPRESSED_RG_RGTC2:
+  case GL_COMPRESSED_RGBA_BPTC_UNORM_ARB:
+    return 16;
+  }
+  return 0;
+}
+
+size_t pixelSize(GLenum format) {
+  switch (format) {
+  case GL_RED:
+    return 1;
+  case GL_RG:
+    return 2;
+  case GL_RGB:
+  case GL_BGR:
+    return 3;
+  }
+  return 4;
+}
+
+size_t levelSize(const TextureContainer &container, int width, int height) {
+  if (container.compressed)
+    return ((size_t)width + 3) / 4 * (((size_t)height + 3) / 4) *
+           blockSize(container.internalFormat);
+  return (size_t)width * height * pixelSize(container.format);
+}
+
+// both sides positive and at most MAX_TEXTURE_SIZE
+bool validSize(int width, int height) {
+  return width > 0 && height > 0 && width <= MAX_TEXTURE_SIZE &&
+         height <= MAX_TEXTURE_SIZE;
+}
+
+// the viewer shades in the stored values like the png path, so srgb
+// variants are uploaded as their unorm twins
+bool ddsFormat(uint32_t dxgiFormat, TextureContainer &container) {
+  switch (dxgiFormat) {
+  case 28: case 29:
+    setUncompressed(container, GL_RGBA8, GL_RGBA);
+    return true;
+  case 87: case 91:
+    setUncompressed(container, GL_RGBA8, GL_BGRA);
+    return true;
+  case 71: case 72:
+    setCompressed(container, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT);
+    return true;
+  case 74: case 75:
+    setCompressed(container, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT);
+    return true;
+  case 77: case 78:
+    setCompressed(container, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);
+    return true;
+  case 80:
+    setCompressed(container, GL_COMPRESSED_RED_RGTC1);
+    return true;
+  case 83:
+    setCompressed(container, GL_COMPRESSED_RG_RGTC2);
+    return true;
+  case 98: case 99:
+    setCompressed(container, GL_COMPRESSED_RGBA_BPTC_UNORM_ARB);
+    return true;
+  }
+  return false;
+}
+
+bool ktx2Format(uint32_t vkFormat, TextureContainer &container) {
+  switch (vkFormat) {
+  case 9: case 15:
+    setUncompressed(container, GL_R8, GL_RED);
+    return true;
+  case 16: case 22:
+    setUncompressed(container, GL_RG8, GL_RG);
+    return true;
+  case 23: case 29:
+    setUncompressed(container, GL_RGB8, GL_RGB);
+    return true;
+  case 37: case 43:
+    setUncompressed(container, GL_RGBA8, GL_RGBA);
+    return true;
+  case 44: case 50:
+    setUncompressed(container, GL_RGBA8, GL_BGRA);
+    return true;
+  case 131: case 132:
+    setCompressed(container, GL_COMPRESSED_RGB_S3TC_DXT1_EXT);
+    return true;
+  case 133: case 134:
+    setCompressed(container, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT);
+    return true;
+  case 135: case 136:
+    setCompressed(container, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT);
+    return true;
+  case 137: case 138:
+    setCompressed(container, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);
+    return true;
+  case 139:
+    setCompressed(container, GL_COMPRESSED_RED_RGTC1);
+    return true;
+  case 141:
+    setCompressed(container, GL_COMPRESSED_RG_RGTC2);
+    return true;
+  case 145: case 146:
+    setCompressed(container, GL_COMPRESSED_RGBA_BPTC_UNORM_ARB);
+    return true;
+  }
+  return false;
+}
+
+bool readDds(const unsigned char* data, size_t size,
+             TextureContainer &container, std::string &error) {
+  if (size < DDS_HEADER_SIZE || read32(data + 4) != 124) {
+    error = "truncated dds header";
+    return false;
+  }
+  uint32_t flags = read32(data + 8);
+  int height = (int)read32(data + 12);
+  int width = (int)read32(data + 16);
+  uint32_t mipCount = read32(data + 28);
+  uint32_t pixelFlags = read32(data + 80);
+  uint32_t code = read32(data + 84);
+  uint32_t bitCount = read32(data + 88);
+  uint32_t redMask = read32(data + 92);
+  uint32_t caps2 = read32(data + 112);
+  if (caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)) {
+    error = "cube maps and volumes aren't supported";
+    return false;
+  }
+  if (!validSize(width, height)) {
+    error = "invalid dds size";
+    return false;
+  }
+
+  size_t offset = DDS_HEADER_SIZE;
+  bool known = true;
+  if ((pixelFlags & DDPF_FOURCC) && code == fourCC("DX10")) {
+    if (size < DDS_HEADER_SIZE + DDS_DX10_HEADER_SIZE) {
+      error = "truncated dx10 header";
+      return false;
+    }
+    if (read32(data + 132) != DDS_DIMENSION_TEXTURE2D ||
+        read32(data + 140) > 1) {
+      error = "only single 2d textures are supported";
+      return false;
+    }
+    known = ddsFormat(read32(data + 128), container);
+    offset += DDS_DX10_HEADER_SIZE;
+  }
+  else if (pixelFlags & DDPF_FOURCC) {
+    if (code == fourCC("DXT1"))
+      setCompressed(container, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT);
+    else if (code == fourCC("DXT3"))
+      setCompressed(container, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT);
+    else if (code == fourCC("DXT5"))
+      setCompressed(container, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);
+    else if (code == fourCC("ATI1") || code == fourCC("BC4U"))
+      setCompressed(container, GL_COMPRESSED_RED_RGTC1);
+    else if (code == fourCC("ATI2") || code == fourCC("BC5U"))
+      setCompressed(container, GL_COMPRESSED_RG_RGTC2);
+    else
+      known = false;
+  }
+  else if ((pixelFlags & DDPF_RGB) && bitCount == 32)
+    setUncompressed(container, GL_RGBA8,
+                    redMask == 0x00ff0000 ? GL_BGRA : GL_RGBA);
+  else if ((pixelFlags & DDPF_RGB) && bitCount == 24)
+    setUncompressed(container, GL_RGB8,
+                    redMask == 0x00ff0000 ? GL_BGR : GL_RGB);
+  else if ((pixelFlags & DDPF_LUMINANCE) && bitCount == 8 &&
+           !(pixelFlags & DDPF_ALPHAPIXELS))
+    setUncompressed(container, GL_R8, GL_RED);
+  else
+    known = false;
+  if (!known) {
+    error = "unsupported dds pixel format";
+    return false;
+  }
+
+  // the levels follow each other without padding
+  unsigned int levels = (flags & DDSD_MIPMAPCOUNT) && mipCount > 0 ?
+                        mipCount : 1;
+  for (unsigned int level = 0; level < levels; level++) {
+    int levelWidth = std::max(width >> level, 1);
+    int levelHeight = std::max(height >> level, 1);
+    size_t bytes = levelSize(container, levelWidth, levelHeight);
+    if (offset > size || bytes > size - offset) {
+      error = "truncated dds level";
+      return false;
+    }
+    container.levels.push_back({ levelWidth, levelHeight, data + offset,
+                                 bytes });
+    offset += bytes;
+    if (levelWidth == 1 && levelHeight == 1)
+      break;
+  }
+  return true;
+}
+
+bool readKtx2(const unsigned char* data, size_t size,
+              TextureContainer &container, std::string &error) {
+  if (size < KTX2_HEADER_SIZE) {
+    error = "truncated ktx2 header";
+    return false;
+  }
+  uint32_t vkFormat = read32(data + 12);
+  int width = (int)read32(data + 20);
+  int height = (int)read32(data + 24);
+  uint32_t depth = read32(data + 28);
+  uint32_t layers = read32(data + 32);
+  uint32_t faces = read32(data + 36);
+  uint32_t levels = read32(data + 40);
+  uint32_t supercompression = read32(data + 44);
+  if (depth > 0 || layers > 1 || faces != 1) {
+    error = "only single 2d textures are supported";
+    return false;
+  }
+  if (!validSize(width, height)) {
+    error = "invalid ktx2 size";
+    return false;
+  }
+  if (supercompression == KTX2_SUPERCOMPRESSION_BASISLZ || vkFormat == 0) {
+    error = "basis universal textures need a transcoder";
+    return false;
+  }
+  if (supercompression != 0) {
+    error = "supercompressed ktx2 levels aren't supported";
+    return false;
+  }
+  if (!ktx2Format(vkFormat, container)) {
+    error = "unsupported ktx2 vkFormat";
+    return false;
+  }
+
+  // a level count of 0 asks the loader to build the chain
+  container.generateMipmaps = levels == 0 && !container.compressed;
+  levels = std::max(levels, 1u);
+  // the chain ends at 1x1, more levels than that are a broken header
+  uint32_t fullChain = 1;
+  for (int larger = std::max(width, height); larger > 1; larger >>= 1)
+    fullChain++;
+  if (levels > fullChain) {
+    error = "more ktx2 levels than the size allows";
+    return false;
+  }
+  if (KTX2_HEADER_SIZE + (size_t)levels * KTX2_LEVEL_SIZE > size) {
+    error = "truncated ktx2 level index";
+    return false;
+  }
+  for (uint32_t level = 0; level < levels; level++) {
+    const unsigned char* entry = data + KTX2_HEADER_SIZE +
+                                 level * KTX2_LEVEL_SIZE;
+    uint64_t offset = read64(entry);
+    uint64_t bytes = read64(entry + 8);
+    int levelWidth = std::max(width >> level, 1);
+    int levelHeight = std::max(height >> level, 1);
+    if (offset > size || bytes > size - offset ||
+        bytes != levelSize(container, levelWidth, levelHeight)) {
+      error = "truncated ktx2 level";
+      return false;
+    }
+    container.levels.push_back({ levelWidth, levelHeight, data + offset,
+                                 (size_t)bytes });
+    if (levelWidth == 1 && levelHeight == 1)
+      break;
+  }
+  return true;
+}
+
+}
+
+size_t TextureContainer::size() const {
+  size_t bytes = 0;
+  for (const Level &level : levels)
+    bytes += level.size;
+  return bytes;
+}
+
+bool isTextureContainer(const unsigned char* data, size_t size) {
+  return (size >= sizeof(DDS_MAGIC) &&
+          std::memcmp(data, DDS_MAGIC, sizeof(DDS_MAGIC)) == 0) ||
+         (size >= sizeof(KTX2_MAGIC) &&
+          std::memcmp(data, KTX2_MAGIC, sizeof(KTX2_MAGIC)) == 0);
+}
+
+bool readTextureContainer(const unsigned char* data, size_t size,
+                          TextureContainer &container, std::string &error) {
+  container = TextureContainer();
+  error.clear();
+  if (size >= sizeof(DDS_MAGIC) &&
+      std::memcmp(data, DDS_MAGIC, sizeof(DDS_MAGIC)) == 0)
+    return readDds(data, size, container, error);
+  if (size >= sizeof(KTX2_MAGIC) &&
+      std::memcmp(data, KTX2_MAGIC, sizeof(KTX2_MAGIC)) == 0)
+    return readKtx2(data, size, container, error);
+  error = "neither dds nor ktx2";
+  return false;
+}
@@ -0,0 +1,38 @@
+#ifndef texturecontainer_h
+#define texturecontainer_h
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// mip chain of a dds or ktx2 file, the levels point into the file data so
+// they can be uploaded without a copy
+struct TextureContainer {
+  struct Level {
+    int width;
+    int height;
+    const unsigned char* data;
+    size_t size;
+  };
+  // compressed formats are uploaded as they are, the others with the
+  // pixel format and type
+  GLenum internalFormat = 0;
+  bool compressed = false;
+  GLenum format = 0;
+  GLenum type = GL_UNSIGNED_BYTE;
+  // the file holds only the base level and asks for the rest to be built
+  bool generateMipmaps = false;
+  std::vector<Level> levels;
+
+  size_t size() const;
+};
+
+// true for dds and ktx2 files, whether or not they can be read
+bool isTextureContainer(const unsigned char* data, size_t size);
+// reads the headers and points the levels into the data, false with the
+// reason in error
+bool readTextureContainer(const unsigned char* data, size_t size,
+                          TextureContainer &container, std::string &error);
+
+#endif
@@ -0,0 +1,395 @@
+#include "textureimage.h"
+#include "jobsystem.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MIP_SSE
+#endif
+
+namespace {
+
+// the windowed sincs reach three texels of the smaller level either way
+const float SINC_RADIUS = 3.0f;
+const float KAISER_ALPHA = 4.0f;
+// steps of the linear to srgb table, fine enough that the dark end
+// rounds to the right byte
+const int SRGB_STEPS = 16384;
+
+struct ColorTables {
+  float toFloat[256];
+  float toLinear[256];
+  unsigned char toSrgb[SRGB_STEPS];
+};
+
+ColorTables makeColorTables() {
+  ColorTables tables;
+  for (int i = 0; i < 256; i++) {
+    float value = i / 255.0f;
+    tables.toFloat[i] = value;
+    tables.toLinear[i] = value <= 0.04045f ? value / 12.92f :
+                         std::pow((value + 0.055f) / 1.055f, 2.4f);
+  }
+  for (int i = 0; i < SRGB_STEPS; i++) {
+    float value = (float)i / (SRGB_STEPS - 1);
+    float srgb = value <= 0.0031308f ? value * 12.92f :
+                 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    tables.toSrgb[i] = (unsigned char)(srgb * 255.0f + 0.5f);
+  }
+  return tables;
+}
+
+const ColorTables &colorTables() {
+  static const ColorTables tables = makeColorTables();
+  return tables;
+}
+
+float sinc(float x) {
+  if (std::fabs(x) < 1e-5f)
+    return 1.0f;
+  x *= 3.14159265f;
+  return std::sin(x) / x;
+}
+
+// modified bessel function of the first kind, the series converges
+// quickly for the small alphas of the window
+float besselI0(float x) {
+  float sum = 1.0f;
+  float term = 1.0f;
+  float half = x * 0.5f;
+  for (int k = 1; k < 20; k++) {
+    term *= (half / k) * (half / k);
+    sum += term;
+  }
+  return sum;
+}
+
+float filterRadius(MipFilter filter) {
+  return filter == MIP_BOX ? 0.5f : SINC_RADIUS;
+}
+
+// weight of a texel t texels of the smaller level away from the center
+float filterWeight(MipFilter filter, float t) {
+  t = std::fabs(t);
+  switch (filter) {
+  case MIP_BOX:
+    // a texel on the edge of two boxes counts half for each
+    return t < 0.5f ? 1.0f : t == 0.5f ? 0.5f : 0.0f;
+  case MIP_KAISER: {
+    if (t >= SINC_RADIUS)
+      return 0.0f;
+    float edge = t / SINC_RADIUS;
+    return sinc(t) * besselI0(KAISER_ALPHA * std::sqrt(1.0f - edge * edge)) /
+           besselI0(KAISER_ALPHA);
+  }
+  default:
+    return t < SINC_RADIUS ? sinc(t) * sinc(t / SINC_RADIUS) : 0.0f;
+  }
+}
+
+int wrap(int index, int size) {
+  index %= size;
+  return index < 0 ? index + size : index;
+}
+
+// the same number of source texels for every target texel along one
+// axis, first is unwrapped and index already wraps like gl_repeat
+struct Taps {
+  int count;
+  std::vector<int> first;
+  std::vector<int> index;
+  std::vector<float> weights;
+};
+
+Taps buildTaps(int source, int target, MipFilter filter) {
+  Taps taps;
+  float scale = (float)source / target;
+  float radius = filterRadius(filter) * scale;
+  taps.count = (int)std::ceil(radius * 2.0f) + 1;
+  for (int x = 0; x < target; x++) {
+    float center = (x + 0.5f) * scale;
+    int first = (int)std::floor(center - radius);
+    size_t start = taps.weights.size();
+    float sum = 0.0f;
+    for (int k = 0; k < taps.count; k++) {
+      float weight = filterWeight(filter,
+                                  (first + k + 0.5f - center) / scale);
+      taps.index.push_back(wrap(first + k, source));
+      taps.weights.push_back(weight);
+      sum += weight;
+    }
+    for (size_t k = start; k < taps.weights.size(); k++)
+      taps.weights[k] /= sum;
+    taps.first.push_back(first);
+  }
+  // the rounded up count leaves an outer tap without weight everywhere
+  // on exact halvings, it would only cost loads
+  bool leading = true;
+  bool trailing = true;
+  for (int x = 0; x < target; x++) {
+    leading = leading && taps.weights[(size_t)x * taps.count] == 0.0f;
+    trailing = trailing &&
+               taps.weights[(size_t)x * taps.count + taps.count - 1] == 0.0f;
+  }
+  if ((leading || trailing) && taps.count > 1) {
+    int skip = leading ? 1 : 0;
+    int count = taps.count - 1;
+    for (int x = 0; x < target; x++) {
+      for (int k = 0; k < count; k++) {
+        size_t from = (size_t)x * taps.count + k + skip;
+        taps.index[(size_t)x * count + k] = taps.index[from];
+        taps.weights[(size_t)x * count + k] = taps.weights[from];
+      }
+      taps.first[x] += skip;
+    }
+    taps.count = count;
+    taps.index.resize((size_t)target * count);
+    taps.weights.resize((size_t)target * count);
+  }
+  return taps;
+}
+
+void decodeRow(const unsigned char* rgba, int width,
+               const MipSettings &settings, float* target) {
+  const ColorTables &tables = colorTables();
+  const float* color = settings.srgb && !settings.normalMap ?
+                       tables.toLinear : tables.toFloat;
+  for (int x = 0; x < width; x++) {
+    target[x * 4] = color[rgba[x * 4]];
+    target[x * 4 + 1] = color[rgba[x * 4 + 1]];
+    target[x * 4 + 2] = color[rgba[x * 4 + 2]];
+    target[x * 4 + 3] = tables.toFloat[rgba[x * 4 + 3]];
+  }
+}
+
+// one rgba texel is one vector, the taps are summed four channels wide
+void filterRow(const float* row, const Taps &columns, int width,
+               float* target) {
+  for (int x = 0; x < width; x++) {
+    const int* index = &columns.index[(size_t)x * columns.count];
+    const float* weights = &columns.weights[(size_t)x * columns.count];
+#ifdef MIP_SSE
+    __m128 sum = _mm_setzero_ps();
+    for (int k = 0; k < columns.count; k++)
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]),
+                                       _mm_loadu_ps(row + index[k] * 4)));
+    _mm_storeu_ps(target + x * 4, sum);
+#else
+    float sum[4] = {};
+    for (int k = 0; k < columns.count; k++)
+      for (int c = 0; c < 4; c++)
+        sum[c] += weights[k] * row[index[k] * 4 + c];
+    std::copy(sum, sum + 4, target + x * 4);
+#endif
+  }
+}
+
+void accumulateRow(const float* row, float weight, int width, float* sum) {
+  size_t count = (size_t)width * 4;
+#ifdef MIP_SSE
+  __m128 factor = _mm_set1_ps(weight);
+  for (size_t i = 0; i < count; i += 4)
+    _mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i),
+                                      _mm_mul_ps(factor,
+                                                 _mm_loadu_ps(row + i))));
+#else
+  for (size_t i = 0; i < count; i++)
+    sum[i] += weight * row[i];
+#endif
+}
+
+unsigned char quantize(float value) {
+  return (unsigned char)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f +
+                         0.5f);
+}
+
+// the sincs overshoot, every channel is clamped before it is stored
+void encodeRow(const float* row, int width, const MipSettings &settings,
+               unsigned char* rgba) {
+  const ColorTables &tables = colorTables();
+  for (int x = 0; x < width; x++) {
+    const float* texel = row + x * 4;
+    unsigned char* target = rgba + x * 4;
+    if (settings.normalMap) {
+      float normal[3];
+      for (int c = 0; c < 3; c++)
+        normal[c] = std::min(std::max(texel[c], 0.0f), 1.0f) * 2.0f - 1.0f;
+      float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] +
+                               normal[2] * normal[2]);
+      // opposite normals cancel out, the surface is taken as flat
+      if (length < 1e-6f) {
+        normal[0] = normal[1] = 0.0f;
+        normal[2] = length = 1.0f;
+      }
+      for (int c = 0; c < 3; c++)
+        target[c] = quantize(normal[c] / length * 0.5f + 0.5f);
+    }
+    else if (settings.srgb)
+      for (int c = 0; c < 3; c++) {
+        float value = std::min(std::max(texel[c], 0.0f), 1.0f);
+        target[c] = tables.toSrgb[(int)(value * (SRGB_STEPS - 1) + 0.5f)];
+      }
+    else
+      for (int c = 0; c < 3; c++)
+        target[c] = quantize(texel[c]);
+    target[3] = quantize(texel[3]);
+  }
+}
+
+// plain box halvings stay an integer average of 2x2 texels, a side
+// already at one texel repeats it
+void averageLevel(const TextureImage::Level &upper,
+                  TextureImage::Level &level) {
+  size_t grain = std::max<size_t>(4, 32768 / level.width);
+  JobSystem::get().parallelFor(level.height, grain,
+                               [&](size_t begin, size_t end) {
+    for (size_t y = begin; y < end; y++)
+      for (int x = 0; x < level.width; x++) {
+        int x0 = std::min(x * 2, upper.width - 1);
+        int x1 = std::min(x * 2 + 1, upper.width - 1);
+        int y0 = std::min((int)y * 2, upper.height - 1);
+        int y1 = std::min((int)y * 2 + 1, upper.height - 1);
+        for (int c = 0; c < 4; c++) {
+          int sum = upper.rgba[((size_t)y0 * upper.width + x0) * 4 + c] +
+                    upper.rgba[((size_t)y0 * upper.width + x1) * 4 + c] +
+                    upper.rgba[((size_t)y1 * upper.width + x0) * 4 + c] +
+                    upper.rgba[((size_t)y1 * upper.width + x1) * 4 + c];
+          level.rgba[(y * level.width + x) * 4 + c] =
+              (unsigned char)((sum + 2) / 4);
+        }
+      }
+  });
+}
+
+bool halves(int upper, int level) {
+  return upper == level * 2 || upper == 1;
+}
+
+// separable: every chunk of target rows filters the source rows it needs
+// horizontally into its own buffer and sums them vertically, neighbouring
+// chunks repeat the few rows they share instead of waiting for each other
+void filterLevel(const TextureImage::Level &upper, TextureImage::Level &level,
+                 const MipSettings &settings) {
+  Taps columns = buildTaps(upper.width, level.width, settings.filter);
+  Taps rows = buildTaps(upper.height, level.height, settings.filter);
+  size_t grain = std::max<size_t>(4, 32768 / level.width);
+  JobSystem::get().parallelFor(level.height, grain,
+                               [&](size_t begin, size_t end) {
+    int top = rows.first[begin];
+    int bottom = rows.first[end - 1] + rows.count;
+    size_t stride = (size_t)level.width * 4;
+    std::vector<float> decoded((size_t)upper.width * 4);
+    std::vector<float> filtered((size_t)(bottom - top) * stride);
+    for (int v = top; v < bottom; v++) {
+      size_t source = (size_t)wrap(v, upper.height) * upper.width * 4;
+      decodeRow(&upper.rgba[source], upper.width, settings, decoded.data());
+      filterRow(decoded.data(), columns, level.width,
+                &filtered[(size_t)(v - top) * stride]);
+    }
+    std::vector<float> sum(stride);
+    for (size_t y = begin; y < end; y++) {
+      std::fill(sum.begin(), sum.end(), 0.0f);
+      const float* weights = &rows.weights[y * rows.count];
+      for (int k = 0; k < rows.count; k++)
+        if (weights[k] != 0.0f)
+          accumulateRow(&filtered[(size_t)(rows.first[y] + k - top) * stride],
+                        weights[k], level.width, sum.data());
+      encodeRow(sum.data(), level.width, settings, &level.rgba[y * stride]);
+    }
+  });
+}
+
+}
+
+void MipStats::report(std::ostream &out, MipFilter filter) const {
+  if (cpuTextures == 0 && gpuTextures == 0)
+    return;
+  out << "mip chains: ";
+  if (cpuTextures > 0)
+    out << cpuTextures << " textures filtered with "
+        << mipFilterName(filter) << " in " << std::fixed
+        << std::setprecision(1) << cpuMs << " ms (" << std::setprecision(2)
+        << cpuTexels / std::max(cpuMs, 1e-3) / 1e3
+        << " million texels per second on "
+        << JobSystem::get().getThreadCount() << " threads)";
+  if (cpuTextures > 0 && gpuTextures > 0)
+    out << ", ";
+  if (gpuTextures > 0) {
+    out << gpuTextures << " textures with glGenerateMipmap in " << std::fixed
+        << std::setprecision(1) << gpuMs << " ms";
+    if (timed)
+      out << " (" << std::setprecision(2)
+          << gpuTexels / std::max(gpuMs, 1e-3) / 1e3
+          << " million texels per second)";
+    else
+      out << " to queue";
+  }
+  out << std::endl;
+}
+
+bool parseMipFilter(const std::string &name, MipFilter &filter) {
+  if (name == "box")
+    filter = MIP_BOX;
+  else if (name == "kaiser")
+    filter = MIP_KAISER;
+  else if (name == "lanczos")
+    filter = MIP_LANCZOS;
+  else
+    return false;
+  return true;
+}
+
+const char* mipFilterName(MipFilter filter) {
+  switch (filter) {
+  case MIP_BOX:
+    return "box";
+  case MIP_KAISER:
+    return "kaiser";
+  default:
+    return "lanczos";
+  }
+}
+
+TextureImage buildTextureImage(const unsigned char* data, int width,
+                               int height, int channels,
+                               const MipSettings &settings) {
+  TextureImage image;
+  TextureImage::Level base;
+  base.width = width;
+  base.height = height;
+  base.rgba.resize((size_t)width * height * 4);
+  JobSystem::get().parallelFor((size_t)width * height, 65536,
+                               [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      const unsigned char* source = data + i * channels;
+      unsigned char* target = &base.rgba[i * 4];
+      // gray and gray with alpha repeat the first channel like gl swizzles
+      target[0] = source[0];
+      target[1] = channels >= 3 ? source[1] : source[0];
+      target[2] = channels >= 3 ? source[2] : source[0];
+      target[3] = channels == 4 ? source[3] :
+                  channels == 2 ? source[1] : 255;
+    }
+  });
+  image.levels.push_back(std::move(base));
+
+  // every level is filtered from the one above, an odd size rounds down
+  // and the kernel stretches over the remaining texels
+  while (image.levels.back().width > 1 || image.levels.back().height > 1) {
+    const TextureImage::Level &upper = image.levels.back();
+    TextureImage::Level level;
+    level.width = std::max(upper.width / 2, 1);
+    level.height = std::max(upper.height / 2, 1);
+    level.rgba.resize((size_t)level.width * level.height * 4);
+    if (settings.filter == MIP_BOX && !settings.srgb &&
+        !settings.normalMap && halves(upper.width, level.width) &&
+        halves(upper.height, level.height))
+      averageLevel(upper, level);
+    else
+      filterLevel(upper, level, settings);
+    image.levels.push_back(std::move(level));
+  }
+  return image;
+}
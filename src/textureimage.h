@@ -0,0 +1,64 @@
+#ifndef textureimage_h
+#define textureimage_h
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// decoded texture kept in memory for the software renderer and the texture
+// arrays, rgba8 with the whole mip chain
+struct TextureImage {
+  struct Level {
+    int width;
+    int height;
+    std::vector<unsigned char> rgba;
+  };
+  std::vector<Level> levels;
+};
+
+// kernels the levels are filtered with. box averages 2x2 texels, kaiser
+// and lanczos are windowed sincs over three texels of the smaller level
+// that keep more detail
+enum MipFilter {
+  MIP_BOX,
+  MIP_KAISER,
+  MIP_LANCZOS
+};
+
+// how the mip chain of one texture is built
+struct MipSettings {
+  MipFilter filter = MIP_BOX;
+  // colour textures are averaged in linear light and stored as srgb again
+  bool srgb = false;
+  // rgb holds a direction, the filtered vectors are made unit length
+  bool normalMap = false;
+};
+
+// time spent building mip chains on the worker threads and in
+// glGenerateMipmap, for comparing the two
+struct MipStats {
+  unsigned int cpuTextures = 0;
+  size_t cpuTexels = 0;
+  double cpuMs = 0.0;
+  unsigned int gpuTextures = 0;
+  size_t gpuTexels = 0;
+  double gpuMs = 0.0;
+  // glFinish around glGenerateMipmap so its time is measured, only set
+  // for reports since it stalls the upload
+  bool timed = false;
+
+  void report(std::ostream &out, MipFilter filter) const;
+};
+
+// accepts "box", "kaiser" and "lanczos"
+bool parseMipFilter(const std::string &name, MipFilter &filter);
+const char* mipFilterName(MipFilter filter);
+
+// expands 1 to 4 channels to rgba and filters the image down to 1x1, the
+// rows of every level are spread over the job system
+TextureImage buildTextureImage(const unsigned char* data, int width,
+                               int height, int channels,
+                               const MipSettings &settings = MipSettings());
+
+#endif
@@ -0,0 +1,568 @@
+#include "texturestreamer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+
+namespace {
+
+// the decode threads, the filters and encoders inside run on the job
+// system either way
+const unsigned int DECODE_THREADS = 2;
+const size_t RING_BYTES = 64 * 1024 * 1024;
+// the unit of the budget, small enough for a smooth frame and large
+// enough that a big level isn't thousands of calls
+const size_t BAND_BYTES = 1024 * 1024;
+// managed textures start with the levels up to this size, a few
+// kilobytes however large the texture is
+const int INITIAL_SIZE = 128;
+
+// a texture decoded again for its finer levels must come out as before
+bool sameLayout(const TextureContainer &a, const TextureContainer &b) {
+  if (a.levels.size() != b.levels.size() || a.compressed != b.compressed ||
+      a.internalFormat != b.internalFormat || a.format != b.format ||
+      a.type != b.type)
+    return false;
+  for (size_t level = 0; level < a.levels.size(); level++)
+    if (a.levels[level].width != b.levels[level].width ||
+        a.levels[level].height != b.levels[level].height ||
+        a.levels[level].size != b.levels[level].size)
+      return false;
+  return true;
+}
+
+}
+
+TextureStreamer &TextureStreamer::get() {
+  static TextureStreamer streamer;
+  return streamer;
+}
+
+void TextureStreamer::start(size_t frameBudget, bool mipResidency) {
+  if (started)
+    return;
+  this->frameBudget = frameBudget;
+  this->mipResidency = mipResidency;
+  ring.init(RING_BYTES);
+  stopping = false;
+  for (unsigned int i = 0; i < DECODE_THREADS; i++)
+    decoders.emplace_back(&TextureStreamer::decodeLoop, this);
+  started = true;
+}
+
+void TextureStreamer::stop() {
+  if (!started)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    jobs.clear();
+  }
+  wake.notify_all();
+  // writers waiting for space give up
+  ring.stop();
+  for (std::thread &decoder : decoders)
+    decoder.join();
+  decoders.clear();
+  bands.clear();
+  managed.clear();
+  failedUpgrades.clear();
+  ring.release();
+  pending = 0;
+  upgrading = 0;
+  started = false;
+}
+
+void TextureStreamer::request(const std::shared_ptr<GpuTexture> &texture,
+                              const std::string &name, Decoder decode) {
+  Job job;
+  job.texture = texture;
+  job.key = texture.get();
+  job.name = name;
+  job.decode = std::move(decode);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (requested == 0)
+      firstRequest = std::chrono::steady_clock::now();
+    jobs.push_back(std::move(job));
+    requested++;
+    pending++;
+  }
+  wake.notify_one();
+}
+
+void TextureStreamer::requestDetail(const GpuTexture &texture,
+                                    float uvPerPixel) {
+  if (!mipResidency)
+    return;
+  std::shared_ptr<Stream> stream;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = managed.find(&texture);
+    if (found == managed.end())
+      return;
+    stream = found->second;
+  }
+  // the level with about one texel per pixel, the coarser one of the two
+  // trilinear filtering blends
+  const TextureContainer &levels = stream->data.levels;
+  int coarsest = (int)levels.levels.size() - 1;
+  float texels = std::max(levels.levels[0].width, levels.levels[0].height) *
+                 uvPerPixel;
+  int level = texels > 1.0f ? (int)std::floor(std::log2(texels)) : 0;
+  level = std::min(level, coarsest);
+  if (stream->usedFrame != frame) {
+    stream->usedFrame = frame;
+    stream->wantedLevel = level;
+  }
+  else
+    stream->wantedLevel = std::min(stream->wantedLevel, level);
+}
+
+bool TextureStreamer::isBusy() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return pending > 0 || upgrading > 0;
+}
+
+void TextureStreamer::decodeLoop() {
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+      if (stopping)
+        return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    stream(job);
+  }
+}
+
+void TextureStreamer::stream(Job &job) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  // finer levels of a texture that is already in, its pixels are decoded
+  // again and dropped once they are written
+  if (job.stream) {
+    TextureData data;
+    bool decoded = job.stream->decode(data) &&
+                   sameLayout(data.levels, job.stream->data.levels);
+    std::unique_lock<std::mutex> lock(mutex);
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    decodeMs += ms;
+    upgradeDecodeMs += ms;
+    if (!decoded) {
+      failedUpgrades.push_back(job.stream);
+      return;
+    }
+    writeLevels(job.stream, data.levels, job.finest, job.coarsest, lock);
+    return;
+  }
+  std::shared_ptr<Stream> stream = std::make_shared<Stream>();
+  bool decoded = job.decode(stream->data) &&
+                 !stream->data.levels.levels.empty();
+  std::unique_lock<std::mutex> lock(mutex);
+  decodeMs += std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  if (!decoded) {
+    failed++;
+    pending--;
+    return;
+  }
+  stream->texture = job.texture;
+  const TextureContainer &layout = stream->data.levels;
+  int levels = (int)layout.levels.size();
+  stream->splits.resize(levels);
+  stream->bandsLeft.resize(levels);
+  for (int level = 0; level < levels; level++) {
+    const TextureContainer::Level &image = layout.levels[level];
+    Split &split = stream->splits[level];
+    split.unitRows = layout.compressed ? 4 : 1;
+    int units = (image.height + split.unitRows - 1) / split.unitRows;
+    split.unitBytes = image.size / units;
+    split.unitsPerBand = (int)std::max<size_t>(
+        1, BAND_BYTES / std::max<size_t>(split.unitBytes, 1));
+    split.bands = (units + split.unitsPerBand - 1) / split.unitsPerBand;
+    stream->bandsLeft[level] = split.bands;
+  }
+
+  // a chain built by glGenerateMipmap has only its base level to stream
+  stream->managed = mipResidency && levels > 1;
+  int initial = 0;
+  if (stream->managed) {
+    initial = levels - 1;
+    while (initial > 0 &&
+           std::max(layout.levels[initial - 1].width,
+                    layout.levels[initial - 1].height) <= INITIAL_SIZE)
+      initial--;
+  }
+  stream->initialLevel = initial;
+  stream->wantedLevel = initial;
+  stream->baseLevel = levels;
+  stream->queuedLevel = initial;
+  stream->allocatedLevel = levels;
+  if (!writeLevels(stream, stream->data.levels, initial, levels - 1, lock))
+    return;
+  // only the sizes and formats are needed from here on, a managed texture
+  // keeps its decoder for the finer levels instead of their pixels
+  for (TextureContainer::Level &level : stream->data.levels.levels)
+    level.data = nullptr;
+  stream->data.owner.reset();
+  // a texture deleted while it decoded may share its address with a new
+  // one
+  if (stream->managed && !stream->texture.expired()) {
+    stream->decode = std::move(job.decode);
+    managed[job.key] = stream;
+  }
+}
+
+bool TextureStreamer::writeLevels(const std::shared_ptr<Stream> &stream,
+                                  const TextureContainer &source, int finest,
+                                  int coarsest,
+                                  std::unique_lock<std::mutex> &lock) {
+  // the smallest level first, a texture is usable after a few bytes
+  for (int level = coarsest; level >= finest; level--) {
+    const TextureContainer::Level &image = source.levels[level];
+    const Split &split = stream->splits[level];
+    int units = (image.height + split.unitRows - 1) / split.unitRows;
+    for (int unit = 0; unit < units; unit += split.unitsPerBand) {
+      int count = std::min(split.unitsPerBand, units - unit);
+      Band band;
+      band.level = level;
+      band.y = unit * split.unitRows;
+      band.height = std::min(count * split.unitRows, image.height - band.y);
+      size_t bytes = count * split.unitBytes;
+      // the ring may have to wait for the render thread
+      lock.unlock();
+      bool reserved = ring.reserve(bytes, band.block);
+      if (reserved)
+        std::memcpy(band.block.data, image.data + unit * split.unitBytes,
+                    bytes);
+      lock.lock();
+      if (!reserved)
+        return false;
+      band.stream = stream;
+      bands.push_back(std::move(band));
+    }
+  }
+  return true;
+}
+
+size_t TextureStreamer::levelBytes(const Stream &stream, int finest) const {
+  size_t bytes = 0;
+  const TextureContainer &layout = stream.data.levels;
+  for (size_t level = finest; level < layout.levels.size(); level++)
+    bytes += layout.levels[level].size;
+  return bytes;
+}
+
+void TextureStreamer::allocate(Stream &stream, GpuTexture &texture,
+                               int finest) {
+  const TextureContainer &layout = stream.data.levels;
+  int levels = (int)layout.levels.size();
+  glBindTexture(GL_TEXTURE_2D, texture.id());
+  for (int level = finest; level < stream.allocatedLevel; level++) {
+    const TextureContainer::Level &image = layout.levels[level];
+    if (layout.compressed)
+      glCompressedTexImage2D(GL_TEXTURE_2D, level, layout.internalFormat,
+                             image.width, image.height, 0, image.size,
+                             nullptr);
+    else
+      glTexImage2D(GL_TEXTURE_2D, level, layout.internalFormat, image.width,
+                   image.height, 0, layout.format, layout.type, nullptr);
+  }
+  stream.allocatedLevel = std::min(stream.allocatedLevel, finest);
+  if (!stream.allocated) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // sampled from the smallest level until the finer ones are in
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, levels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    stream.allocated = true;
+  }
+  // the mip chain adds about a third to the base level
+  texture.setSize(layout.generateMipmaps ? layout.size() * 4 / 3 :
+                                           levelBytes(stream, finest));
+}
+
+void TextureStreamer::finishBand(const Band &band, bool live) {
+  Stream &stream = *band.stream;
+  stream.bandsLeft[band.level]--;
+  int base = stream.baseLevel;
+  while (base > stream.queuedLevel && stream.bandsLeft[base - 1] == 0)
+    base--;
+  if (base == stream.baseLevel)
+    return;
+  stream.baseLevel = base;
+  if (live)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+  if (base > stream.queuedLevel)
+    return;
+  if (live && stream.data.levels.generateMipmaps) {
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!stream.complete) {
+    stream.complete = true;
+    completed++;
+    pending--;
+    return;
+  }
+  double ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - stream.queuedAt).count();
+  latencyMs += ms;
+  maxLatencyMs = std::max(maxLatencyMs, ms);
+  upgrading--;
+}
+
+void TextureStreamer::update() {
+  if (!started)
+    return;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  ring.retire();
+  std::vector<Band> batch;
+  size_t bytes = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    // at least one band per frame, however small the budget
+    while (!bands.empty() &&
+           (batch.empty() ||
+            bytes + bands.front().block.size <= frameBudget)) {
+      bytes += bands.front().block.size;
+      batch.push_back(std::move(bands.front()));
+      bands.pop_front();
+    }
+  }
+
+  if (!batch.empty()) {
+    // held until the end of the frame, a texture deleted meanwhile skips
+    // its bands. storage is allocated before the unpack buffer is bound,
+    // a null pointer would read from offset 0 of the ring
+    std::vector<std::shared_ptr<GpuTexture>> textures;
+    for (Band &band : batch) {
+      textures.push_back(band.stream->texture.lock());
+      if (textures.back() && !band.stream->allocated)
+        allocate(*band.stream, *textures.back(), band.stream->queuedLevel);
+    }
+    std::vector<StagingBlock> blocks;
+    for (const Band &band : batch)
+      blocks.push_back(band.block);
+    std::vector<size_t> offsets;
+    ring.bind(blocks, offsets);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (!textures[i])
+        continue;
+      const Band &band = batch[i];
+      const TextureContainer &layout = band.stream->data.levels;
+      int width = layout.levels[band.level].width;
+      const void* offset = (const void*)offsets[i];
+      glBindTexture(GL_TEXTURE_2D, textures[i]->id());
+      if (layout.compressed)
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, band.level, 0, band.y,
+                                  width, band.height, layout.internalFormat,
+                                  band.block.size, offset);
+      else
+        glTexSubImage2D(GL_TEXTURE_2D, band.level, 0, band.y, width,
+                        band.height, layout.format, layout.type, offset);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    ring.unbind(blocks);
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (textures[i])
+        glBindTexture(GL_TEXTURE_2D, textures[i]->id());
+      finishBand(batch[i], textures[i] != nullptr);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    std::chrono::steady_clock::time_point end =
+        std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start)
+                    .count();
+    std::lock_guard<std::mutex> lock(mutex);
+    uploadedBytes += bytes;
+    uploadedBands += batch.size();
+    uploadFrames++;
+    uploadMs += ms;
+    maxFrameMs = std::max(maxFrameMs, ms);
+    lastUpload = end;
+  }
+  if (mipResidency)
+    updateResidency();
+  frame++;
+}
+
+void TextureStreamer::updateResidency() {
+  std::vector<std::shared_ptr<Stream>> failures;
+  std::vector<std::shared_ptr<Stream>> streams;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    failures.swap(failedUpgrades);
+    upgrading -= failures.size();
+    upgradeFailures += failures.size();
+    for (auto it = managed.begin(); it != managed.end();)
+      if (it->second->texture.expired())
+        it = managed.erase(it);
+      else
+        streams.push_back((it++)->second);
+  }
+  // a texture that no longer decodes as before keeps the levels it has
+  // and gives back the storage of the upgrade
+  for (const std::shared_ptr<Stream> &stream : failures) {
+    stream->decode = nullptr;
+    evict(*stream, stream->baseLevel);
+  }
+  // the textures drawn longest ago lose their finer levels first
+  std::stable_sort(streams.begin(), streams.end(),
+                   [](const std::shared_ptr<Stream> &a,
+                      const std::shared_ptr<Stream> &b) {
+    return a->usedFrame < b->usedFrame;
+  });
+  // the budget may have been exceeded by anything else
+  makeRoom(streams, 0);
+
+  for (const std::shared_ptr<Stream> &stream : streams) {
+    // one upgrade at a time, to what the last frame asked for
+    if (stream->usedFrame != frame || !stream->complete || !stream->decode ||
+        stream->queuedLevel != stream->baseLevel ||
+        stream->wantedLevel >= stream->baseLevel)
+      continue;
+    int level = stream->wantedLevel;
+    size_t bytes = levelBytes(*stream, level) -
+                   levelBytes(*stream, stream->allocatedLevel);
+    if (!makeRoom(streams, bytes))
+      continue;
+    std::shared_ptr<GpuTexture> texture = stream->texture.lock();
+    if (!texture)
+      continue;
+    allocate(*stream, *texture, level);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    for (int finer = level; finer < stream->baseLevel; finer++)
+      stream->bandsLeft[finer] = stream->splits[finer].bands;
+    stream->queuedLevel = level;
+    stream->queuedAt = std::chrono::steady_clock::now();
+    Job job;
+    job.stream = stream;
+    job.finest = level;
+    job.coarsest = stream->baseLevel - 1;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(std::move(job));
+      upgrading++;
+      upgrades++;
+    }
+    wake.notify_one();
+  }
+}
+
+bool TextureStreamer::makeRoom(
+    const std::vector<std::shared_ptr<Stream>> &streams, size_t bytes) {
+  GpuRegistry &registry = GpuRegistry::get();
+  size_t total = registry.totalBytes();
+  if (total + bytes <= registry.getBudget())
+    return true;
+  // the ones drawn last frame keep what they asked for
+  for (const std::shared_ptr<Stream> &stream : streams) {
+    if (total + bytes <= registry.getBudget())
+      break;
+    int level = stream->usedFrame == frame ? stream->wantedLevel :
+                                             stream->initialLevel;
+    if (stream->complete && stream->queuedLevel == stream->baseLevel &&
+        level > stream->baseLevel)
+      total -= std::min(total, evict(*stream, level));
+  }
+  return total + bytes <= registry.getBudget();
+}
+
+size_t TextureStreamer::evict(Stream &stream, int level) {
+  std::shared_ptr<GpuTexture> texture = stream.texture.lock();
+  if (!texture)
+    return 0;
+  const TextureContainer &layout = stream.data.levels;
+  size_t before = levelBytes(stream, stream.allocatedLevel);
+  glBindTexture(GL_TEXTURE_2D, texture->id());
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+  // an empty level gives its memory back, levels below the base don't
+  // count for completeness
+  for (int finer = stream.allocatedLevel; finer < level; finer++)
+    if (layout.compressed)
+      glCompressedTexImage2D(GL_TEXTURE_2D, finer, layout.internalFormat, 0,
+                             0, 0, 0, nullptr);
+    else
+      glTexImage2D(GL_TEXTURE_2D, finer, layout.internalFormat, 0, 0, 0,
+                   layout.format, layout.type, nullptr);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  stream.baseLevel = level;
+  stream.queuedLevel = level;
+  stream.allocatedLevel = level;
+  size_t after = levelBytes(stream, level);
+  texture->setSize(after);
+  std::lock_guard<std::mutex> lock(mutex);
+  evictions++;
+  evictedBytes += before - after;
+  return before - after;
+}
+
+void TextureStreamer::report(std::ostream &out) const {
+  if (!started)
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  const double mb = 1024.0 * 1024.0;
+  out << "texture streaming: " << completed << " of " << requested
+      << " textures";
+  if (failed > 0)
+    out << ", " << failed << " failed";
+  out << ", " << std::fixed << std::setprecision(2) << uploadedBytes / mb
+      << " MB in " << uploadedBands << " bands over " << uploadFrames
+      << " frames, " << std::setprecision(1) << uploadMs
+      << " ms on the render thread (at most " << maxFrameMs
+      << " ms in a frame, " << uploadedBytes / mb /
+                               std::max(uploadMs / 1e3, 1e-6)
+      << " MB/s), decoded in " << decodeMs << " ms on " << DECODE_THREADS
+      << " threads, " << ring.getWaitMs() << " ms waiting for space in "
+      << (ring.isPersistent() ? "a persistent ring" : "orphaned buffers")
+      << " of " << ring.getCapacity() / mb << " MB";
+  if (requested > 0 && pending == 0 && uploadFrames > 0)
+    out << ", resident " << std::chrono::duration<double, std::milli>(
+               lastUpload - firstRequest).count()
+        << " ms after the first request";
+  out << std::endl;
+  if (!mipResidency)
+    return;
+
+  // resident against what the meshes of the last frame asked for, the
+  // textures not drawn in it only need their first levels
+  size_t resident = 0;
+  size_t wanted = 0;
+  size_t full = 0;
+  for (const auto &entry : managed) {
+    const Stream &stream = *entry.second;
+    if (stream.texture.expired())
+      continue;
+    resident += levelBytes(stream, stream.allocatedLevel);
+    wanted += levelBytes(stream, stream.usedFrame + 1 >= frame ?
+                                 stream.wantedLevel : stream.initialLevel);
+    full += levelBytes(stream, 0);
+  }
+  unsigned int landed = upgrades - upgrading;
+  out << "mip residency: " << managed.size() << " textures, "
+      << std::setprecision(2) << resident / mb << " MB resident for "
+      << wanted / mb << " MB requested (" << full / mb
+      << " MB with every level), " << upgrades << " upgrades decoded again in "
+      << std::setprecision(1) << upgradeDecodeMs << " ms";
+  if (upgradeFailures > 0)
+    out << ", " << upgradeFailures << " failed";
+  if (landed > 0)
+    out << ", resident " << latencyMs / landed
+        << " ms after the request on average and at most " << maxLatencyMs
+        << " ms";
+  out << ", " << evictions << " evictions freeing " << std::setprecision(2)
+      << evictedBytes / mb << " MB" << std::endl;
+}
@@ -0,0 +1,187 @@
+#ifndef texturestreamer_h
+#define texturestreamer_h
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "gpuresource.h"
+#include "stagingring.h"
+#include "texturecontainer.h"
+
+// levels ready for gl and whatever keeps their memory alive, the mapped
+// file, the decoded pixels or the cached blocks
+struct TextureData {
+  TextureContainer levels;
+  std::shared_ptr<void> owner;
+};
+
+// decodes textures on its own threads straight into a staging ring, the
+// render thread hands a budget of bytes per frame to gl. the levels
+// arrive from the smallest up and the base level of the texture follows
+// them, so a texture sharpens while it streams in.
+// with mip residency only the small levels are loaded up front, the
+// finer ones follow the on-screen size the meshes report every frame and
+// are dropped again when the gpu budget runs out. only the sizes of the
+// levels stay in memory, an upgrade decodes the texture again, from the
+// texture cache when it is on
+class TextureStreamer {
+public:
+  typedef std::function<bool(TextureData &)> Decoder;
+
+  static TextureStreamer &get();
+
+  // render thread with a current context, starts the ring and the threads
+  void start(size_t frameBudget, bool mipResidency = false);
+  // render thread before the context goes away, drops unfinished textures
+  void stop();
+  bool isEnabled() const { return started; }
+  // the finer levels wait for requestDetail, textures need a whole chain
+  bool managesMips() const { return started && mipResidency; }
+  // the texture stays empty until its first level arrives
+  void request(const std::shared_ptr<GpuTexture> &texture,
+               const std::string &name, Decoder decode);
+  // render thread while drawing, the texture is seen with this many
+  // texture coordinate units per pixel. the finest level asked for in a
+  // frame is streamed in by the next update
+  void requestDetail(const GpuTexture &texture, float uvPerPixel);
+  // render thread once per frame, recycles the staging memory the gpu is
+  // done with and uploads the written bands up to the budget
+  void update();
+  // textures requested and not completely uploaded yet
+  bool isBusy() const;
+  // upload bandwidth and the time the render thread spent per frame
+  void report(std::ostream &out) const;
+private:
+  TextureStreamer() {}
+
+  // how the rows of a level are cut into bands, whole block rows when
+  // compressed
+  struct Split {
+    int unitRows;
+    size_t unitBytes;
+    int unitsPerBand;
+    unsigned int bands;
+  };
+  // a texture between its decode and its last band, managed textures
+  // keep theirs and their decoder for the finer levels
+  struct Stream {
+    // released by whoever drops the texture, never by a decode thread
+    std::weak_ptr<GpuTexture> texture;
+    // the sizes and formats of the levels, the pixels are dropped once
+    // the first levels are written
+    TextureData data;
+    // managed textures only, null once an upgrade failed to decode
+    Decoder decode;
+    std::vector<Split> splits;
+    std::vector<unsigned int> bandsLeft;
+    bool allocated = false;
+    bool managed = false;
+    // the first levels are in, later levels are upgrades
+    bool complete = false;
+    // finest level with every coarser one uploaded
+    int baseLevel;
+    // finest level whose bands are written or on their way
+    int queuedLevel;
+    // finest level with storage, finer ones are empty
+    int allocatedLevel;
+    // coarsest level kept when the texture isn't drawn
+    int initialLevel;
+    // finest level the frame in usedFrame asked for
+    int wantedLevel;
+    unsigned long long usedFrame = 0;
+    // start of the upgrade to queuedLevel
+    std::chrono::steady_clock::time_point queuedAt;
+  };
+  // rows of one level written into the ring
+  struct Band {
+    std::shared_ptr<Stream> stream;
+    int level;
+    int y;
+    int height;
+    StagingBlock block;
+  };
+  // a texture to decode, or finer levels of a decoded one
+  struct Job {
+    std::weak_ptr<GpuTexture> texture;
+    // the handle requestDetail is called with, only compared
+    const GpuTexture* key = nullptr;
+    std::string name;
+    Decoder decode;
+    std::shared_ptr<Stream> stream;
+    int finest = 0;
+    int coarsest = 0;
+  };
+
+  bool started = false;
+  bool mipResidency = false;
+  size_t frameBudget = 0;
+  StagingRing ring;
+  std::vector<std::thread> decoders;
+
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::deque<Job> jobs;
+  // written bands in the order they are uploaded
+  std::deque<Band> bands;
+  // managed textures by their handle, entries of deleted textures are
+  // dropped by the next update
+  std::unordered_map<const GpuTexture*, std::shared_ptr<Stream>> managed;
+  unsigned long long frame = 1;
+  unsigned int pending = 0;
+  unsigned int upgrading = 0;
+  // upgrades whose decode failed, settled by the next update
+  std::vector<std::shared_ptr<Stream>> failedUpgrades;
+
+  unsigned int requested = 0;
+  unsigned int completed = 0;
+  unsigned int failed = 0;
+  double decodeMs = 0.0;
+  size_t uploadedBytes = 0;
+  unsigned int uploadedBands = 0;
+  unsigned int uploadFrames = 0;
+  double uploadMs = 0.0;
+  double maxFrameMs = 0.0;
+  std::chrono::steady_clock::time_point firstRequest;
+  std::chrono::steady_clock::time_point lastUpload;
+  unsigned int upgrades = 0;
+  unsigned int upgradeFailures = 0;
+  double upgradeDecodeMs = 0.0;
+  unsigned int evictions = 0;
+  size_t evictedBytes = 0;
+  double latencyMs = 0.0;
+  double maxLatencyMs = 0.0;
+
+  void decodeLoop();
+  // runs on a decode thread, decodes a texture and writes its first levels
+  void stream(Job &job);
+  // writes the levels of source from coarsest down to finest band by
+  // band, the lock is held on entry and exit
+  bool writeLevels(const std::shared_ptr<Stream> &stream,
+                   const TextureContainer &source, int finest, int coarsest,
+                   std::unique_lock<std::mutex> &lock);
+  // the rest run on the render thread
+  void allocate(Stream &stream, GpuTexture &texture, int finest);
+  void finishBand(const Band &band, bool live);
+  // queues finer levels for the textures drawn last frame and makes room
+  // for them in the gpu budget
+  void updateResidency();
+  // evicts the levels the textures don't need until bytes more fit into
+  // the budget, the streams are sorted by the frame they were drawn in
+  bool makeRoom(const std::vector<std::shared_ptr<Stream>> &streams,
+                size_t bytes);
+  // drops the levels finer than level, gives the bytes freed
+  size_t evict(Stream &stream, int level);
+  size_t levelBytes(const Stream &stream, int finest) const;
+};
+
+#endif
@@ -2,15 +2,26 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in mat4 aInstance;
+layout (location = 7) in float aOcclusion;
+layout (location = 8) in float aLayer;
 
 out vec2 TexCoord;
+out float Occlusion;
+flat out float Layer;
 
 uniform mat4 model;
+uniform mat4 node;
 uniform mat4 view;
 uniform mat4 projection;
 
+// matches the depth pre-pass exactly
+invariant gl_Position;
+
 void main()
 {
   TexCoord = aTexCoord;
-  gl_Position = projection * view * model * vec4(aPos, 1.0);
+  Occlusion = aOcclusion;
+  Layer = aLayer;
+  gl_Position = projection * view * model * aInstance * node * vec4(aPos, 1.0);
 }
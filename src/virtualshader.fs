@@ -0,0 +1,56 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoord;
+in float Occlusion;
+
+// pages of all virtual textures, each with a border of filtered texels
+uniform sampler2D pageCache;
+// a texel per page of every level: cache slot, resident level and 1 in
+// alpha once any of its levels is resident
+uniform sampler2D indirection;
+uniform vec2 virtualSize;
+uniform int levelCount;
+uniform float lodBias;
+// below 1 for blended materials
+uniform float opacity;
+
+const float PAGE_SIZE = 128.0;
+const float PAGE_BORDER = 4.0;
+const float PAGE_CONTENT = 120.0;
+
+vec2 levelSize(float level)
+{
+  return max(floor(virtualSize / exp2(level)), vec2(1.0));
+}
+
+void main()
+{
+  vec2 uv = fract(TexCoord);
+  vec2 texel = TexCoord * virtualSize;
+  vec2 dx = dFdx(texel);
+  vec2 dy = dFdy(texel);
+  float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + lodBias;
+  int level = clamp(int(floor(lod)), 0, levelCount - 1);
+  vec2 size = levelSize(float(level));
+  vec2 pages = ceil(size / PAGE_CONTENT);
+  ivec2 page = ivec2(min(floor(uv * size / PAGE_CONTENT), pages - 1.0));
+
+  vec4 entry = texelFetch(indirection, page, level);
+  if (entry.a == 0.0) {
+    // nothing arrived yet, not even the coarsest page
+    FragColor = vec4(vec3(0.5) * Occlusion, opacity);
+    return;
+  }
+  ivec3 resident = ivec3(entry.rgb * 255.0 + 0.5);
+  // the page may be a coarser one covering this place
+  size = levelSize(float(resident.z));
+  pages = ceil(size / PAGE_CONTENT);
+  vec2 position = uv * size;
+  vec2 residentPage = min(floor(position / PAGE_CONTENT), pages - 1.0);
+  vec2 inside = position - residentPage * PAGE_CONTENT;
+  vec2 cache = vec2(resident.xy) * PAGE_SIZE + PAGE_BORDER + inside;
+  vec4 color = textureLod(pageCache, cache / vec2(textureSize(pageCache, 0)),
+                          0.0);
+  FragColor = vec4(color.rgb * Occlusion, color.a * opacity);
+}
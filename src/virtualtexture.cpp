@@ -0,0 +1,554 @@
+#include "virtualtexture.h"
+#include "glstate.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+
+// the feedback target is this many times smaller than the view on each
+// axis, a page covers far more pixels than that
+const int FEEDBACK_SCALE = 8;
+// pages copied into the cache per frame, 64 KB each
+const size_t UPLOAD_PAGES = 16;
+// pages requested and not uploaded yet, the staging ring holds them all
+const unsigned int MAX_IN_FLIGHT = 64;
+const size_t RING_BYTES = MAX_IN_FLIGHT * PAGE_BYTES;
+// units above the ones the materials use
+const int CACHE_UNIT = 14;
+const int TABLE_UNIT = 15;
+
+uint64_t feedbackKey(unsigned int id, int level, int x, int y) {
+  return (uint64_t)id << 48 | (uint64_t)level << 40 | (uint64_t)y << 20 |
+         (uint64_t)x;
+}
+
+}
+
+VirtualTextureSystem &VirtualTextureSystem::get() {
+  static VirtualTextureSystem system;
+  return system;
+}
+
+void VirtualTextureSystem::start(size_t cacheBytes) {
+  if (started)
+    return;
+  // slots are addressed with a byte per axis in the tables
+  GLint maxSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  cacheSlots = (int)std::sqrt((double)cacheBytes / PAGE_BYTES);
+  cacheSlots = std::max(2, std::min(cacheSlots,
+                                    std::min(maxSize / PAGE_SIZE, 255)));
+  int size = cacheSlots * PAGE_SIZE;
+  cache = GpuTexture("page cache");
+  glBindTexture(GL_TEXTURE_2D, cache.id());
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, nullptr);
+  // the borders of the pages make bilinear filtering safe, there are no
+  // mips of the cache itself
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  cache.setSize((size_t)size * size * 4);
+  slots.assign(cacheSlots * cacheSlots, Slot());
+  for (Slot &slot : slots) {
+    slot.page.texture = nullptr;
+    slot.used = 0;
+    slot.pinned = false;
+  }
+  ring.init(RING_BYTES);
+  for (GpuBuffer &buffer : readback)
+    buffer = GpuBuffer("page feedback");
+  stopping = false;
+  loader = std::thread(&VirtualTextureSystem::loadLoop, this);
+  started = true;
+}
+
+void VirtualTextureSystem::stop() {
+  if (!started)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    requests.clear();
+  }
+  wake.notify_all();
+  ring.stop();
+  loader.join();
+  loaded.clear();
+  ring.release();
+  slots.clear();
+  textures.clear();
+  cache.reset();
+  feedbackTarget.reset();
+  feedbackColor.reset();
+  feedbackDepth.reset();
+  feedbackWidth = 0;
+  feedbackHeight = 0;
+  for (int i = 0; i < 2; i++) {
+    readback[i].reset();
+    readbackSize[i] = 0;
+    readbackPending[i] = false;
+  }
+  inFlight = 0;
+  started = false;
+}
+
+std::shared_ptr<VirtualTexture> VirtualTextureSystem::open(
+    const std::string &path) {
+  for (const std::shared_ptr<VirtualTexture> &texture : textures)
+    if (texture->path == path)
+      return texture;
+  std::shared_ptr<VirtualTexture> texture =
+      std::make_shared<VirtualTexture>();
+  std::string error;
+  if (!texture->file.open(path, error)) {
+    std::cout << "Couldn't load page file: " << path << " (" << error << ")"
+              << std::endl;
+    return nullptr;
+  }
+  texture->path = path;
+  texture->id = (unsigned int)textures.size() + 1;
+  const PageFile &file = texture->file;
+  int levels = file.getLevelCount();
+
+  // every level of the table needs a texel per page of the same level
+  int width = 1;
+  int height = 1;
+  for (int level = 0; level < levels; level++) {
+    const PageLevel &pages = file.getLevel(level);
+    while (std::max(width >> level, 1) < pages.pagesX)
+      width *= 2;
+    while (std::max(height >> level, 1) < pages.pagesY)
+      height *= 2;
+  }
+  while (std::max(width, height) < (1 << (levels - 1)))
+    width *= 2;
+  texture->tableWidth = width;
+  texture->tableHeight = height;
+  texture->table.resize(levels);
+  texture->dirty.assign(levels, { 0, 0, 0, 0 });
+  texture->indirection = GpuTexture(path + " indirection");
+  glBindTexture(GL_TEXTURE_2D, texture->indirection.id());
+  size_t bytes = 0;
+  for (int level = 0; level < levels; level++) {
+    int levelWidth = std::max(width >> level, 1);
+    int levelHeight = std::max(height >> level, 1);
+    texture->table[level].assign((size_t)levelWidth * levelHeight, 0);
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, levelWidth, levelHeight, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, texture->table[level].data());
+    bytes += (size_t)levelWidth * levelHeight * 4;
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  texture->indirection.setSize(bytes);
+  texture->slots.assign(file.getPageCount(), -1);
+  texture->loading.assign(file.getPageCount(), false);
+  textures.push_back(texture);
+
+  // the coarsest page is loaded right away and stays, it is what a
+  // texture shows before anything else arrived
+  PageKey coarsest = { texture.get(), levels - 1, 0, 0 };
+  texture->loading[texture->pageIndex(levels - 1, 0, 0)] = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    requests.push_back(coarsest);
+    inFlight++;
+    requestedPages++;
+  }
+  wake.notify_one();
+  return texture;
+}
+
+void VirtualTextureSystem::beginFeedback(int width, int height) {
+  width = std::max(width / FEEDBACK_SCALE, 1);
+  height = std::max(height / FEEDBACK_SCALE, 1);
+  if (!feedbackTarget || width != feedbackWidth ||
+      height != feedbackHeight) {
+    feedbackWidth = width;
+    feedbackHeight = height;
+    feedbackTarget = GpuFramebuffer("page feedback");
+    feedbackColor = GpuRenderbuffer("page feedback color");
+    feedbackDepth = GpuRenderbuffer("page feedback depth");
+    glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor.id());
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16UI, width, height);
+    feedbackColor.setSize((size_t)width * height * 8);
+    glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth.id());
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width,
+                          height);
+    feedbackDepth.setSize((size_t)width * height * 4);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackTarget.id());
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, feedbackColor.id());
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, feedbackDepth.id());
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      std::cout << "page feedback framebuffer is incomplete" << std::endl;
+  }
+  // the caller's target is restored by endFeedback
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+  glGetIntegerv(GL_VIEWPORT, savedViewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, feedbackTarget.id());
+  glViewport(0, 0, width, height);
+  const GLuint nothing[4] = { 0, 0, 0, 0 };
+  glClearBufferuiv(GL_COLOR, 0, nothing);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  feedbackActive = true;
+}
+
+void VirtualTextureSystem::endFeedback() {
+  int index = readbackIndex;
+  int pixels = feedbackWidth * feedbackHeight;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback[index].id());
+  if (readbackSize[index] != pixels) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)pixels * 8, nullptr,
+                 GL_STREAM_READ);
+    readback[index].setSize((size_t)pixels * 8);
+    readbackSize[index] = pixels;
+  }
+  // into the buffer, the copy runs while the frame goes on
+  glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER,
+               GL_UNSIGNED_SHORT, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  readbackPending[index] = true;
+  readbackIndex ^= 1;
+  glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+  glViewport(savedViewport[0], savedViewport[1], savedViewport[2],
+             savedViewport[3]);
+  feedbackActive = false;
+}
+
+void VirtualTextureSystem::bind(const VirtualTexture &texture,
+                                Shader &shader) {
+  GlStateCache &state = GlStateCache::get();
+  state.bindTexture(CACHE_UNIT, cache.id());
+  state.bindTexture(TABLE_UNIT, texture.indirection.id());
+  shader.setUniform("pageCache", CACHE_UNIT);
+  shader.setUniform("indirection", TABLE_UNIT);
+  glm::vec2 size = glm::vec2(texture.file.getWidth(),
+                             texture.file.getHeight());
+  shader.setUniform("virtualSize", size);
+  shader.setUniform("levelCount", texture.file.getLevelCount());
+  shader.setUniform("textureId", (int)texture.id);
+  // the smaller target sees the texture that much more minified
+  shader.setUniform("lodBias", feedbackActive ?
+                               -std::log2((float)FEEDBACK_SCALE) : 0.0f);
+}
+
+void VirtualTextureSystem::loadLoop() {
+  for (;;) {
+    PageKey page;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+      if (stopping)
+        return;
+      page = requests.front();
+      requests.pop_front();
+    }
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    Loaded item;
+    item.page = page;
+    // waits while the render thread hasn't uploaded enough pages
+    if (!ring.reserve(PAGE_BYTES, item.block))
+      return;
+    const PageFile &file = page.texture->file;
+    std::memcpy(item.block.data, file.page(page.level, page.x, page.y),
+                PAGE_BYTES);
+    // the copy is in the ring, the mapped page can go again
+    file.release(page.level, page.x, page.y);
+    std::lock_guard<std::mutex> lock(mutex);
+    loadMs += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    loaded.push_back(item);
+  }
+}
+
+void VirtualTextureSystem::update() {
+  if (!started)
+    return;
+  ring.retire();
+  // the feedback of the last frame
+  int last = readbackIndex ^ 1;
+  if (readbackPending[last])
+    readFeedback(last);
+  std::vector<Loaded> batch;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!loaded.empty() && batch.size() < UPLOAD_PAGES) {
+      batch.push_back(loaded.front());
+      loaded.pop_front();
+    }
+  }
+  if (!batch.empty())
+    upload(batch);
+  for (const std::shared_ptr<VirtualTexture> &texture : textures)
+    uploadTables(*texture);
+  frame++;
+}
+
+void VirtualTextureSystem::readFeedback(int index) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  readbackPending[index] = false;
+  std::vector<uint64_t> keys;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback[index].id());
+  const uint16_t* pixels = (const uint16_t*)glMapBufferRange(
+      GL_PIXEL_PACK_BUFFER, 0, (size_t)readbackSize[index] * 8,
+      GL_MAP_READ_BIT);
+  if (pixels) {
+    for (int i = 0; i < readbackSize[index]; i++) {
+      const uint16_t* pixel = pixels + i * 4;
+      if (pixel[3] == 0 || pixel[3] > textures.size())
+        continue;
+      const VirtualTexture &texture = *textures[pixel[3] - 1];
+      int level = pixel[2];
+      if (level >= texture.file.getLevelCount())
+        continue;
+      // the coarser pages under it are the fallback while it loads
+      int x = pixel[0];
+      int y = pixel[1];
+      for (; level < texture.file.getLevelCount(); level++) {
+        keys.push_back(feedbackKey(pixel[3], level, x, y));
+        x >>= 1;
+        y >>= 1;
+      }
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  feedbackFrame = frame;
+  std::lock_guard<std::mutex> lock(mutex);
+  // requests of earlier frames that didn't start are dropped before the
+  // missing pages are collected, the ones still named go back in coarse
+  // first order. the coarsest pages are loaded either way
+  std::deque<PageKey> kept;
+  for (const PageKey &page : requests) {
+    VirtualTexture &texture = *page.texture;
+    if (page.level == texture.file.getLevelCount() - 1)
+      kept.push_back(page);
+    else {
+      texture.loading[texture.pageIndex(page.level, page.x, page.y)] = false;
+      inFlight--;
+      // counted again if the page is still wanted
+      requestedPages--;
+    }
+  }
+  requests.swap(kept);
+  std::vector<PageKey> missing;
+  for (uint64_t key : keys) {
+    VirtualTexture &texture = *textures[(key >> 48) - 1];
+    PageKey page = { &texture, (int)(key >> 40 & 0xff),
+                     (int)(key & 0xfffff), (int)(key >> 20 & 0xfffff) };
+    const PageLevel &pages = texture.file.getLevel(page.level);
+    if (page.x >= pages.pagesX || page.y >= pages.pagesY)
+      continue;
+    size_t index = texture.pageIndex(page.level, page.x, page.y);
+    if (texture.slots[index] >= 0)
+      slots[texture.slots[index]].used = frame;
+    else if (!texture.loading[index])
+      missing.push_back(page);
+  }
+  // slots the view can spare, a view needing more than the cache holds
+  // stays at the coarser levels instead of evicting its own pages
+  unsigned int room = 0;
+  for (const Slot &slot : slots)
+    if (!slot.pinned && (!slot.page.texture || slot.used < feedbackFrame))
+      room++;
+  // coarse first, a texture sharpens a level at a time
+  std::stable_sort(missing.begin(), missing.end(),
+                   [](const PageKey &a, const PageKey &b) {
+    return a.level > b.level;
+  });
+  bool requested = false;
+  for (const PageKey &page : missing) {
+    if (inFlight >= std::min(MAX_IN_FLIGHT, room))
+      break;
+    page.texture->loading[page.texture->pageIndex(page.level, page.x,
+                                                  page.y)] = true;
+    requests.push_back(page);
+    inFlight++;
+    requestedPages++;
+    requested = true;
+  }
+  settled = !requested;
+  feedbackFrames++;
+  feedbackMs += std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  wake.notify_all();
+}
+
+void VirtualTextureSystem::upload(const std::vector<Loaded> &batch) {
+  std::vector<StagingBlock> blocks;
+  for (const Loaded &item : batch)
+    blocks.push_back(item.block);
+  std::vector<size_t> offsets;
+  ring.bind(blocks, offsets);
+  glBindTexture(GL_TEXTURE_2D, cache.id());
+  size_t uploaded = 0;
+  size_t evicted = 0;
+  size_t dropped = 0;
+  for (size_t i = 0; i < batch.size(); i++) {
+    const PageKey &page = batch[i].page;
+    VirtualTexture &texture = *page.texture;
+    texture.loading[texture.pageIndex(page.level, page.x, page.y)] = false;
+    // the slot used longest ago, pages the last feedback named stay
+    int slot = -1;
+    for (int candidate = 0; candidate < (int)slots.size(); candidate++) {
+      const Slot &entry = slots[candidate];
+      if (entry.pinned ||
+          (entry.page.texture && entry.used >= feedbackFrame))
+        continue;
+      if (slot < 0 || entry.used < slots[slot].used)
+        slot = candidate;
+    }
+    if (slot < 0) {
+      dropped++;
+      continue;
+    }
+    Slot &target = slots[slot];
+    if (target.page.texture) {
+      setPage(target.page, -1);
+      evicted++;
+    }
+    target.page = page;
+    target.used = frame;
+    target.pinned = page.level == texture.file.getLevelCount() - 1;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, slot % cacheSlots * PAGE_SIZE,
+                    slot / cacheSlots * PAGE_SIZE, PAGE_SIZE, PAGE_SIZE,
+                    GL_RGBA, GL_UNSIGNED_BYTE, (const void*)offsets[i]);
+    setPage(page, slot);
+    uploaded++;
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  ring.unbind(blocks);
+  std::lock_guard<std::mutex> lock(mutex);
+  inFlight -= (unsigned int)batch.size();
+  loadedPages += uploaded;
+  evictedPages += evicted;
+  droppedPages += dropped;
+}
+
+void VirtualTextureSystem::setPage(const PageKey &page, int slot) {
+  VirtualTexture &texture = *page.texture;
+  int levels = texture.file.getLevelCount();
+  texture.slots[texture.pageIndex(page.level, page.x, page.y)] = slot;
+  uint32_t value = 0;
+  if (slot >= 0)
+    value = (uint32_t)(slot % cacheSlots) |
+            (uint32_t)(slot / cacheSlots) << 8 |
+            (uint32_t)page.level << 16 | 255u << 24;
+  else if (page.level + 1 < levels) {
+    int width = std::max(texture.tableWidth >> (page.level + 1), 1);
+    value = texture.table[page.level + 1][(size_t)(page.y >> 1) * width +
+                                          (page.x >> 1)];
+  }
+  // the page and the finer pages under it, those resident themselves
+  // keep their entries
+  for (int level = page.level; level >= 0; level--) {
+    int shift = page.level - level;
+    const PageLevel &pages = texture.file.getLevel(level);
+    int x0 = page.x << shift;
+    int y0 = page.y << shift;
+    int x1 = std::min((page.x + 1) << shift, pages.pagesX);
+    int y1 = std::min((page.y + 1) << shift, pages.pagesY);
+    int width = std::max(texture.tableWidth >> level, 1);
+    bool changed = false;
+    for (int y = y0; y < y1; y++)
+      for (int x = x0; x < x1; x++) {
+        uint32_t &entry = texture.table[level][(size_t)y * width + x];
+        int shown = entry >> 24 ? (int)(entry >> 16 & 0xff) : levels;
+        if (slot >= 0 ? shown >= page.level : shown == page.level) {
+          entry = value;
+          changed = true;
+        }
+      }
+    if (!changed)
+      continue;
+    VirtualTexture::Dirty &dirty = texture.dirty[level];
+    if (dirty.x0 >= dirty.x1)
+      dirty = { x0, y0, x1, y1 };
+    else
+      dirty = { std::min(dirty.x0, x0), std::min(dirty.y0, y0),
+                std::max(dirty.x1, x1), std::max(dirty.y1, y1) };
+  }
+}
+
+void VirtualTextureSystem::uploadTables(VirtualTexture &texture) {
+  bool bound = false;
+  for (size_t level = 0; level < texture.table.size(); level++) {
+    VirtualTexture::Dirty &dirty = texture.dirty[level];
+    if (dirty.x0 >= dirty.x1)
+      continue;
+    if (!bound) {
+      glBindTexture(GL_TEXTURE_2D, texture.indirection.id());
+      bound = true;
+    }
+    int width = std::max(texture.tableWidth >> level, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+    glTexSubImage2D(GL_TEXTURE_2D, level, dirty.x0, dirty.y0,
+                    dirty.x1 - dirty.x0, dirty.y1 - dirty.y0, GL_RGBA,
+                    GL_UNSIGNED_BYTE,
+                    &texture.table[level][(size_t)dirty.y0 * width +
+                                          dirty.x0]);
+    dirty = { 0, 0, 0, 0 };
+  }
+  if (bound) {
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+}
+
+bool VirtualTextureSystem::isBusy() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  // one more frame to read the feedback back, unless the last one had
+  // everything in the cache already
+  return inFlight > 0 ||
+         (!settled && (readbackPending[0] || readbackPending[1]));
+}
+
+void VirtualTextureSystem::report(std::ostream &out) const {
+  if (!started)
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  const double mb = 1024.0 * 1024.0;
+  size_t texels = 0;
+  size_t tableBytes = 0;
+  for (const std::shared_ptr<VirtualTexture> &texture : textures) {
+    texels += (size_t)texture->file.getWidth() * texture->file.getHeight();
+    tableBytes += texture->table.empty() ? 0 :
+                  (size_t)texture->tableWidth * texture->tableHeight * 16 /
+                  3;
+  }
+  size_t cacheBytes = slots.size() * PAGE_BYTES;
+  size_t resident = 0;
+  for (const Slot &slot : slots)
+    resident += slot.page.texture ? 1 : 0;
+  out << "virtual textures: " << textures.size() << " page files of "
+      << std::fixed << std::setprecision(1) << texels * 4 / mb
+      << " MB, cache of " << cacheSlots << "x" << cacheSlots << " pages ("
+      << cacheBytes / mb << " MB, " << resident << " resident), "
+      << requestedPages << " pages requested, " << loadedPages
+      << " loaded in " << loadMs << " ms on the loader thread, "
+      << evictedPages << " evicted";
+  if (droppedPages > 0)
+    out << ", " << droppedPages << " dropped with the cache full";
+  out << ", " << feedbackFrames << " feedback frames of " << feedbackWidth
+      << "x" << feedbackHeight << " in " << feedbackMs
+      << " ms. gpu memory " << (cacheBytes + tableBytes) / mb
+      << " MB and " << RING_BYTES / mb << " MB of staging however large "
+      << "the textures are" << std::endl;
+}
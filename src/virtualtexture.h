@@ -0,0 +1,161 @@
+#ifndef virtualtexture_h
+#define virtualtexture_h
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gpuresource.h"
+#include "pagefile.h"
+#include "shader.h"
+#include "stagingring.h"
+
+// a page file drawn through the shared page cache. the indirection table
+// has a texel for every page of every level, it names the cache slot and
+// the level of the page or of the closest coarser one that is resident
+struct VirtualTexture {
+  PageFile file;
+  std::string path;
+  // written into the feedback, 1 and up
+  unsigned int id;
+  GpuTexture indirection;
+  // rgba8 texels of each table level: slot x and y, resident level and
+  // 255 once anything is resident
+  std::vector<std::vector<uint32_t>> table;
+  // the table levels are powers of two large enough for the pages
+  int tableWidth;
+  int tableHeight;
+  // cache slot of every page in file order, -1 while not resident
+  std::vector<int> slots;
+  std::vector<bool> loading;
+  // changed texels of each table level, empty when x0 >= x1
+  struct Dirty {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+  };
+  std::vector<Dirty> dirty;
+
+  size_t pageIndex(int level, int x, int y) const {
+    const PageLevel &pages = file.getLevel(level);
+    return pages.firstPage + (size_t)y * pages.pagesX + x;
+  }
+};
+
+// textures larger than memory: a fixed cache texture of pages, loaded
+// from the mapped page files by a thread while a low resolution feedback
+// pass names the pages the view needs. the memory used doesn't depend on
+// the size of the textures
+class VirtualTextureSystem {
+public:
+  static VirtualTextureSystem &get();
+
+  // render thread with a current context, the cache holds about cacheBytes
+  // of pages
+  void start(size_t cacheBytes);
+  // render thread before the context goes away
+  void stop();
+  bool isEnabled() const { return started; }
+  // shared by every mesh using the page file, null if it can't be read
+  std::shared_ptr<VirtualTexture> open(const std::string &path);
+
+  // the meshes drawn between begin and end write the pages they need at a
+  // fraction of the view size into an integer target
+  void beginFeedback(int width, int height);
+  // starts reading the target back, a later update takes it over
+  void endFeedback();
+  // binds the cache and the table of a texture and sets the uniforms of
+  // the colour or the feedback program
+  void bind(const VirtualTexture &texture, Shader &shader);
+  // render thread once per frame: takes over the feedback, queues the
+  // missing pages coarse first, copies the loaded ones into the cache and
+  // updates the indirection tables
+  void update();
+  // pages requested and not in the cache yet
+  bool isBusy() const;
+  void report(std::ostream &out) const;
+private:
+  VirtualTextureSystem() {}
+
+  // a page of a texture
+  struct PageKey {
+    VirtualTexture* texture;
+    int level;
+    int x;
+    int y;
+  };
+  // a cache slot and the page in it
+  struct Slot {
+    PageKey page;
+    unsigned long long used;
+    // the coarsest level of each texture never leaves the cache
+    bool pinned;
+  };
+  // a page copied into the staging ring by the loader
+  struct Loaded {
+    PageKey page;
+    StagingBlock block;
+  };
+
+  bool started = false;
+  std::vector<std::shared_ptr<VirtualTexture>> textures;
+  GpuTexture cache;
+  int cacheSlots = 0;
+  std::vector<Slot> slots;
+  StagingRing ring;
+  unsigned long long frame = 1;
+  // frame of the last feedback read back, the pages it named stay
+  unsigned long long feedbackFrame = 0;
+
+  GpuFramebuffer feedbackTarget;
+  GpuRenderbuffer feedbackColor;
+  GpuRenderbuffer feedbackDepth;
+  int feedbackWidth = 0;
+  int feedbackHeight = 0;
+  // read back in turns, the buffer of the last frame is mapped
+  GpuBuffer readback[2];
+  int readbackSize[2] = { 0, 0 };
+  bool readbackPending[2] = { false, false };
+  int readbackIndex = 0;
+  bool feedbackActive = false;
+  // the last feedback read back found every page it named in the cache
+  bool settled = false;
+  int savedFramebuffer = 0;
+  int savedViewport[4] = { 0, 0, 0, 0 };
+
+  std::thread loader;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::deque<PageKey> requests;
+  std::deque<Loaded> loaded;
+  // pages queued, being copied or waiting for the upload
+  unsigned int inFlight = 0;
+
+  unsigned int feedbackFrames = 0;
+  double feedbackMs = 0.0;
+  size_t requestedPages = 0;
+  size_t loadedPages = 0;
+  size_t evictedPages = 0;
+  size_t droppedPages = 0;
+  double loadMs = 0.0;
+
+  void loadLoop();
+  // the pages named by the feedback and their coarser ancestors
+  void readFeedback(int index);
+  void upload(const std::vector<Loaded> &batch);
+  // points the table of the page and the finer pages under it that fell
+  // back to coarser ones at the slot, or at the parent with slot -1
+  void setPage(const PageKey &page, int slot);
+  void uploadTables(VirtualTexture &texture);
+};
+
+#endif